@@ -116,6 +116,9 @@ bool Application::initialize()
     config_->writeConfig();
   }
   
+  library_->set_cache_path(saveLocation("partcache/").toLocal8Bit().data());
+  library_->set_memory_budget(256 * 1024 * 1024);
+  
   params_ = new ldraw_renderer::parameters();
   params_->set_shading(true);
   params_->set_shader(false);
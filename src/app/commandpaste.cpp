@@ -62,6 +62,7 @@ CommandPaste::AffectedRowInfo CommandPaste::affectedRows() const
 
 void CommandPaste::redo()
 {
+  ldraw::model_multipart::batch b(model_->parent());
   int o = offset_;
   
   QList<ldraw::element_base *> list = list_.elements();
@@ -83,6 +84,7 @@ void CommandPaste::redo()
 
 void CommandPaste::undo()
 {
+  ldraw::model_multipart::batch b(model_->parent());
   int o = offset_;
   
   for (int i = 0; i < list_.length(); ++i)
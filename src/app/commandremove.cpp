@@ -57,12 +57,16 @@ CommandRemove::AffectedRowInfo CommandRemove::affectedRows() const
 
 void CommandRemove::redo()
 {
+  ldraw::model_multipart::batch b(model_->parent());
+  
   for (QList<int>::Iterator it = itemsToRemove_.begin(); it != itemsToRemove_.end(); ++it)
     model_->delete_element(*it);
 }
 
 void CommandRemove::undo()
 {
+  ldraw::model_multipart::batch b(model_->parent());
+  
   for (QMap<int, std::string>::Iterator it = objects_.begin(); it != objects_.end(); ++it) {
     ldraw::element_base *elem = ldraw::reader::parse_line(*it, model_);
     model_->insert_element(elem, it.key());
@@ -63,6 +63,8 @@ bool CommandTransform::needUpdateDimension() const
 
 void CommandTransform::redo()
 {
+  ldraw::model_multipart::batch b(model_->parent());
+  
   for (QSet<int>::ConstIterator it = selection_.constBegin(); it != selection_.constEnd(); ++it) {
     if (model_->elements()[*it]->get_type() == ldraw::type_ref) {
       ldraw::element_ref *r = CAST_AS_REF(model_->elements()[*it]);
@@ -110,15 +112,20 @@ void CommandTransform::redo()
       }
       
       r->set_matrix(cmat);
+      model_->element_changed(r);
     }
   }
 }
 
 void CommandTransform::undo()
 {
+  ldraw::model_multipart::batch b(model_->parent());
+  
   for (QSet<int>::ConstIterator it = selection_.constBegin(); it != selection_.constEnd(); ++it) {
-    if (model_->elements()[*it]->get_type() == ldraw::type_ref)
+    if (model_->elements()[*it]->get_type() == ldraw::type_ref) {
       CAST_AS_REF(model_->elements()[*it])->set_matrix(oldmatrices_[*it]);
+      model_->element_changed(model_->elements()[*it]);
+    }
   }
 }
 
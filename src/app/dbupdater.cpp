@@ -61,6 +61,9 @@ DBUpdater::DBUpdater(const std::string &path, bool forceRescan, QObject *parent)
   status_ = true;
   
   library_->set_unlink_policy(ldraw::part_library::parts);
+  // Keep primitives shared between parts around, but not all of them
+  library_->set_memory_budget(64 * 1024 * 1024);
+  library_->set_cache_path(saveLocation("partcache/").toLocal8Bit().data());
   ldraw::color::init();
   reader_ = new ldraw::reader(library_->ldrawpath(ldraw::part_library::ldraw_parts_path));
   
@@ -180,7 +183,7 @@ int DBUpdater::start()
   QDir dir(library_->ldrawpath(ldraw::part_library::ldraw_parts_path).c_str());
   QString path = saveLocation("partimgs/");
   
-  const std::map<std::string, std::string> &partlist = library_->part_list();
+  const ldraw::part_library::file_list &partlist = library_->part_list();
   int totalSize = partlist.size();
 
   if (forceRescan_) {
@@ -195,7 +198,7 @@ int DBUpdater::start()
 
   int i = 0;
   bool intransaction = false;
-  for (std::map<std::string, std::string>::const_iterator it = partlist.begin(); it != partlist.end(); ++it, ++i) {
+  for (ldraw::part_library::file_list::const_iterator it = partlist.begin(); it != partlist.end(); ++it, ++i) {
     // Omit subparts
     std::string fn = ldraw::utils::translate_string((*it).second);
     if (fn[0] == 's' && fn[1] == DIRECTORY_SEPARATOR[0])
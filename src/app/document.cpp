@@ -39,7 +39,7 @@ Document::Document(const QString &name, const QString &desc, const QString &auth
   modelBase_->main_model()->set_name(std::string(name.toLocal8Bit().data()));
   modelBase_->main_model()->set_author(std::string(author.toLocal8Bit().data()));
   modelBase_->main_model()->set_desc(std::string(desc.toLocal8Bit().data()));
-  modelBase_->main_model()->update_custom_data<ldraw::metrics>();
+  modelBase_->main_model()->init_custom_data<ldraw::metrics>()->track();
   modelBase_->main_model()->init_custom_data<UndoStackExtension>(this);
   
   setActiveModel(modelBase_->main_model());
@@ -66,7 +66,12 @@ Document::Document(const QString &path, QObject *parent)
   ldraw::model *mainModel = modelBase_->main_model();
   ldraw::utils::validate_bowtie_quads(mainModel);
   
-  mainModel->update_custom_data<ldraw::metrics>();
+  // Referenced submodels first, so that each box is computed once
+  std::vector<const ldraw::model *> order = modelBase_->dependency_order();
+  for (std::vector<const ldraw::model *>::const_reverse_iterator it = order.rbegin(); it != order.rend(); ++it)
+    const_cast<ldraw::model *>(*it)->init_custom_data<ldraw::metrics>()->track();
+  if (!mainModel->custom_data<ldraw::metrics>())
+    mainModel->init_custom_data<ldraw::metrics>()->track();
   
   mainModel->init_custom_data<UndoStackExtension>(this);
   for (ldraw::model_multipart::submodel_iterator it = contents()->submodel_list().begin(); it != contents()->submodel_list().end(); ++it)
@@ -105,7 +110,9 @@ QByteArray Document::save(bool forceMultipart) const
   else
     writer.write(modelBase_);
   
-  return QByteArray(stream.str().c_str());
+  const std::string &data = stream.str();
+  
+  return QByteArray(data.data(), data.size());
 }
 
 bool Document::setActiveModel(ldraw::model *m)
@@ -148,7 +155,7 @@ ldraw::model* Document::newSubmodel(const std::string &name, const std::string &
   if (!modelBase_->insert_submodel(m))
     return 0L;
   
-  m->init_custom_data<ldraw::metrics>();
+  m->init_custom_data<ldraw::metrics>()->track();
   m->update_custom_data<PixmapExtension>(Application::self()->pixmapRenderer());
   UndoStackExtension *ext = m->init_custom_data<UndoStackExtension>(this);
   emit undoStackAdded(ext);
@@ -219,8 +226,9 @@ void Document::recalibrateScreenDimension()
     
     // If current model has actual content
     if (count) {
-      // Update bounding box
-      activeModel_->update_custom_data<ldraw::metrics>();
+      // The bounding box is kept current once tracked
+      if (!activeModel_->custom_data<ldraw::metrics>())
+        activeModel_->init_custom_data<ldraw::metrics>()->track();
       const ldraw::metrics *metrics = activeModel_->custom_data<ldraw::metrics>();
       const ldraw::vector &min = metrics->min_();
       const ldraw::vector &max = metrics->max_();
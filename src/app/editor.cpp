@@ -589,7 +589,10 @@ void Editor::indexChanged(int index)
   for (int i = s; i <= e; ++i) {
     const CommandBase *cmd = dynamic_cast<const CommandBase *>(activeStack_->command(i - 1));
     if (cmd->needUpdateDimension()) {
-      const_cast<CommandBase *>(cmd)->model()->update_custom_data<ldraw::metrics>();
+      // Tracked bounding boxes follow the edits by themselves
+      ldraw::model *m = const_cast<CommandBase *>(cmd)->model();
+      if (!m->custom_data<ldraw::metrics>())
+        m->init_custom_data<ldraw::metrics>()->track();
       break;
     }
   }
@@ -8,10 +8,13 @@
 #include <QString>
 
 #include <libldr/color.h>
+#include <libldr/elements.h>
 #include <libldr/math.h>
 #include <libldr/metrics.h>
 #include <libldr/model.h>
+#include <libldr/traits.h>
 #include <libldr/utils.h>
+#include <libldr/visitor.h>
 
 #include "povrayrenderparameters.h"
 
@@ -112,82 +115,234 @@ void POVRayExporter::fillColors()
   fillColorsRecursive(model_, colorList);
 }
 
+// Declares the colors of the faces and references dispatched to it, and
+// those used in the referenced models
+class POVRayExporter::ColorCollector : public ldraw::element_visitor<ColorCollector>
+{
+ public:
+  ColorCollector(POVRayExporter *e, std::set<int> &cset) : exporter_(e), cset_(cset) {}
+  
+  void visit_ref(const ldraw::element_ref *elem) {
+    if (!elem->get_model())
+      return;
+    
+    exporter_->fillColorsRecursive(elem->get_model(), cset_);
+    exporter_->fillColor(elem->get_color().get_id(), cset_);
+  }
+  
+  void visit_triangle(const ldraw::element_triangle *elem) { exporter_->fillColor(elem->get_color().get_id(), cset_); }
+  void visit_quadrilateral(const ldraw::element_quadrilateral *elem) { exporter_->fillColor(elem->get_color().get_id(), cset_); }
+  
+ private:
+  POVRayExporter *exporter_;
+  std::set<int> &cset_;
+};
+
 void POVRayExporter::fillColorsRecursive(const ldraw::model *m, std::set<int> &cset)
 {
-  int i = 0;
+  // At least, color '0' must be exported.
+  if (!m->elements().empty())
+    fillColor(0, cset);
+  
+  ColorCollector(this, cset).visit_elements(m);
+}
+
+void POVRayExporter::fillColor(int c, std::set<int> &cset)
+{
+  if (cset.find(c) != cset.end())
+    return;
+  
+  ldraw::color ce(c);
+  ldraw::material_type material = ce.get_entity()->material;
+  const unsigned char *rgba = ce.get_entity()->rgba;
+  float ambient;
+  float diffuse;
+  float reflection;
+  int phong_size;
+  
+  switch (material) {
+    case ldraw::material_transparent:
+      ambient = 0.3f;
+      diffuse = 0.6f;
+      reflection = 0.25f;
+      phong_size = 60;
+      break;
+    case ldraw::material_metallic:
+      ambient = 0.25f;
+      diffuse = 0.6f;
+      reflection = 0.6f;
+      phong_size = 75;
+      break;
+    default:
+      ambient = 0.17f;
+      diffuse = 0.4f;
+      reflection = 0.025f;
+      phong_size = 20;
+  }
+  
+  cset.insert(c);
+  
+  stream_ << "#declare Color" << c << " = material {\n";
+  stream_ << "\ttexture {\n";
+  stream_ << "\t\tpigment { " << (material != ldraw::material_transparent ? "rgb" : "rgbf") << " <" << (float)rgba[0]/255.0f << ", " << (float)rgba[1]/255.0f << ", " << (float)rgba[2]/255.0f;
+  if (material == ldraw::material_transparent)
+    stream_ << ", " << (float)rgba[3]/255.0f;
+  stream_ << "> }\n";
+  stream_ << "\t\tfinish { ambient " << ambient << " diffuse " << diffuse << " reflection " << reflection << " ";
+  if (material != ldraw::material_metallic)
+    stream_ << "phong 0.3 phong_size " << phong_size << " ";
+  else
+    stream_ << "brilliance 5 metallic specular 0.7 roughness 1/100 ";
+  if (material == ldraw::material_transparent)
+    stream_ << "refraction 1 ior 1.5 ";
+  stream_ << "}\n";
+  if (material == ldraw::material_normal)
+    stream_ << "\t\tnormal { bumps 0.05 scale 0.02 }\n";
+  stream_ << "\t}\n}\n\n";
+}
+
+// Counts the objects a model is written as: a mesh for each run of faces of
+// one color, and an object for each reference to a model written. Writes
+// the referenced models first.
+class POVRayExporter::ObjectCounter : public ldraw::element_visitor<ObjectCounter>
+{
+ public:
+  ObjectCounter(POVRayExporter *e, const ldraw::model_multipart *main, std::set<const ldraw::model *> &cset, std::set<const ldraw::model *> &blacklist)
+      : count(0), exporter_(e), main_(main), cset_(cset), blacklist_(blacklist), cf_(-1), pext_(false) {}
   
-  for (ldraw::model::const_iterator it = m->elements().begin(); it != m->elements().end(); ++i) {
-    int c;
+  void visit_ref(const ldraw::element_ref *elem) {
+    pext_ = true;
+    
+    if (!elem->get_model())
+      return;
     
-    if (i == 0) // At least, color '0' must be exported.
-      c = 0;
-    else if ((*it)->get_type() == ldraw::type_ref && CAST_AS_REF(*it)->get_model()) {
-      c = CAST_AS_REF(*it)->get_color().get_id();
-      fillColorsRecursive(CAST_AS_REF(*it)->get_model(), cset);
-    } else if ((*it)->get_type() == ldraw::type_triangle)
-			c = CAST_AS_TRIANGLE(*it)->get_color().get_id();
-    else if ((*it)->get_type() == ldraw::type_quadrilateral)
-      c = CAST_AS_QUADRILATERAL(*it)->get_color().get_id();
-    else {
-      if (i > 0)
-        ++it;
-      continue;
+    // Duplicate check
+    if (cset_.find(elem->get_model()) == cset_.end())
+      exporter_->fillPartsRecursive(main_, elem->get_model(), cset_, blacklist_);
+    
+    if (blacklist_.find(elem->get_model()) == blacklist_.end())
+      ++count;
+  }
+  
+  void visit_triangle(const ldraw::element_triangle *elem) { face(elem->get_color().get_id()); }
+  void visit_quadrilateral(const ldraw::element_quadrilateral *elem) { face(elem->get_color().get_id()); }
+  
+  int count;
+  
+ private:
+  void face(int cc) {
+    if (cf_ != cc) {
+      ++count;
+      cf_ = cc;
+    } else if (pext_) {
+      ++count;
+      pext_ = false;
     }
+  }
+  
+  POVRayExporter *exporter_;
+  const ldraw::model_multipart *main_;
+  std::set<const ldraw::model *> &cset_;
+  std::set<const ldraw::model *> &blacklist_;
+  int cf_;
+  bool pext_;
+};
+
+// Writes the faces of a model as meshes and its references as objects
+class POVRayExporter::ObjectWriter : public ldraw::element_visitor<ObjectWriter>
+{
+ public:
+  ObjectWriter(POVRayExporter *e, const ldraw::model_multipart *main, const ldraw::model *m, const std::set<const ldraw::model *> &blacklist)
+      : exporter_(e), main_(main), model_(m), blacklist_(blacklist), meshFlag_(false), colorFlag_(-1) {}
+  
+  // Process triangles and quadrilaterals.
+  void visit_triangle(const ldraw::element_triangle *elem) {
+    beginMesh(elem->get_color().get_id());
     
-    if (cset.find(c) == cset.end()) {
-      ldraw::color ce(c);
-      ldraw::material_type material = ce.get_entity()->material;
-      const unsigned char *rgba = ce.get_entity()->rgba;
-      float ambient;
-      float diffuse;
-      float reflection;
-      int phong_size;
-      
-      switch (material) {
-        case ldraw::material_transparent:
-          ambient = 0.3f;
-          diffuse = 0.6f;
-          reflection = 0.25f;
-          phong_size = 60;
-          break;
-        case ldraw::material_metallic:
-          ambient = 0.25f;
-          diffuse = 0.6f;
-          reflection = 0.6f;
-          phong_size = 75;
-          break;
-        default:
-          ambient = 0.17f;
-          diffuse = 0.4f;
-          reflection = 0.025f;
-          phong_size = 20;
-      }
+    exporter_->stream_ << "\t\ttriangle { " << exporter_->serialize(elem->pos1()) << ", " << exporter_->serialize(elem->pos2()) << ", " << exporter_->serialize(elem->pos3()) << " }\n";
+  }
+  
+  void visit_quadrilateral(const ldraw::element_quadrilateral *elem) {
+    beginMesh(elem->get_color().get_id());
+    
+    exporter_->stream_ << "\t\ttriangle { " << exporter_->serialize(elem->pos1()) << ", " << exporter_->serialize(elem->pos2()) << ", " << exporter_->serialize(elem->pos3()) << " }\n";
+    exporter_->stream_ << "\t\ttriangle { " << exporter_->serialize(elem->pos3()) << ", " << exporter_->serialize(elem->pos4()) << ", " << exporter_->serialize(elem->pos1()) << " }\n";
+  }
+  
+  void visit_ref(const ldraw::element_ref *elem) {
+    ldraw::matrix om = elem->get_matrix();
+    if (ldraw::utils::is_singular_matrix(om))
+      return;
+    
+    if (!elem->get_model() || blacklist_.find(elem->get_model()) != blacklist_.end())
+      return;
+    
+    endMesh();
+    
+    if (elem->parent()->parent() == main_ && !model_->is_submodel_of(main_)) {
+      // Seam width
+      ldraw::metrics metrics(elem->get_model());
+      metrics.update();
+      float distance = ldraw::vector::distance(metrics.min_(), metrics.max_());
+      float scale = (distance - exporter_->params_->seamWidth()) / distance;
       
-      cset.insert(c);
+      ldraw::matrix sm;
+      sm.value(0, 0) = scale;
+      sm.value(1, 1) = scale;
+      sm.value(2, 2) = scale;
       
-      stream_ << "#declare Color" << c << " = material {\n";
-      stream_ << "\ttexture {\n";
-      stream_ << "\t\tpigment { " << (material != ldraw::material_transparent ? "rgb" : "rgbf") << " <" << (float)rgba[0]/255.0f << ", " << (float)rgba[1]/255.0f << ", " << (float)rgba[2]/255.0f;
-      if (material == ldraw::material_transparent)
-        stream_ << ", " << (float)rgba[3]/255.0f;
-      stream_ << "> }\n";
-      stream_ << "\t\tfinish { ambient " << ambient << " diffuse " << diffuse << " reflection " << reflection << " ";
-      if (material != ldraw::material_metallic)
-        stream_ << "phong 0.3 phong_size " << phong_size << " ";
-      else
-        stream_ << "brilliance 5 metallic specular 0.7 roughness 1/100 ";
-      if (material == ldraw::material_transparent)
-        stream_ << "refraction 1 ior 1.5 ";
-      stream_ << "}\n";
-      if (material == ldraw::material_normal)
-        stream_ << "\t\tnormal { bumps 0.05 scale 0.02 }\n";
-      stream_ << "\t}\n}\n\n";
+      ldraw::vector v = om.get_translation_vector();
+      om = om * sm;
+      om.set_translation_vector(v);
     }
     
-    if (i > 0)
-      ++it;
+    exporter_->stream_ << "\tobject { " << exporter_->convertNameFormat(elem->get_model()->name()) << " matrix " << exporter_->serialize(om.transpose());
+    
+    if (exporter_->colorAmbiguityTest(elem->get_model()) && elem->get_color().get_id() != 16 && elem->get_color().get_id() != 24)
+      exporter_->stream_ << " material { Color" << elem->get_color().get_id() << " } ";
+    exporter_->stream_ << "}\n";
   }
-}
+  
+  // Terminates the last mesh
+  void finish() { endMesh(); }
+  
+ private:
+  void beginMesh(int c) {
+    if (colorFlag_ == -1)
+      colorFlag_ = c;
+    
+    // If current " mesh { ... } " block has been finished and one another block is about to start,
+    // Terminate the previous one and create new.
+    if (colorFlag_ != c && meshFlag_) {
+      endMesh();
+      colorFlag_ = c;
+    }
+    
+    // new block
+    if (!meshFlag_) {
+      exporter_->stream_ << "\tmesh {\n";
+      meshFlag_ = true;
+    }
+  }
+  
+  void endMesh() {
+    if (!meshFlag_)
+      return;
+    
+    if (colorFlag_ != 16 && colorFlag_ != 24)
+      exporter_->stream_ << "\t\tmaterial { Color" << colorFlag_ << " }\n";
+    
+    exporter_->stream_ << "\t}\n";
+    meshFlag_ = false;
+  }
+  
+  POVRayExporter *exporter_;
+  const ldraw::model_multipart *main_;
+  const ldraw::model *model_;
+  const std::set<const ldraw::model *> &blacklist_;
+  bool meshFlag_;
+  int colorFlag_;
+};
 
 void POVRayExporter::fillParts()
 {
@@ -201,7 +356,6 @@ void POVRayExporter::fillParts()
 
 void POVRayExporter::fillPartsRecursive(const ldraw::model_multipart *main, const ldraw::model *m, std::set<const ldraw::model *> &cset, std::set<const ldraw::model *> &blacklist)
 {
-  bool foundFlag;
   QString modelName = convertNameFormat(m->name());
   
   // Skip this if current part is in the blacklist
@@ -212,40 +366,9 @@ void POVRayExporter::fillPartsRecursive(const ldraw::model_multipart *main, cons
   // and a group of meshes must have one identical color.
   // If an object has only one (or less) object, it must be defined as an 'object'
   // 'union' if else.
-  int count = 0;
-  int cf = -1;
-  bool pext = false;
-  for (ldraw::model::const_iterator it = m->elements().begin(); it != m->elements().end(); ++it) {
-    if ((*it)->get_type() == ldraw::type_ref) {
-      pext = true;
-      const ldraw::element_ref *elem = CAST_AS_CONST_REF(*it);
-      
-      if (!elem->get_model())
-        continue;
-      
-      // Duplicate check
-      foundFlag = false;
-      
-      if (cset.find(elem->get_model()) != cset.end())
-        foundFlag = true;
-      
-      if (!foundFlag)
-        fillPartsRecursive(main, elem->get_model(), cset, blacklist);
-      
-      if (blacklist.find(elem->get_model()) == blacklist.end())
-        ++count;
-    } else if ((*it)->get_type() == ldraw::type_triangle || (*it)->get_type() == ldraw::type_quadrilateral) {
-      int cc = (*it)->get_type() == ldraw::type_triangle ? CAST_AS_TRIANGLE(*it)->get_color().get_id() : CAST_AS_QUADRILATERAL(*it)->get_color().get_id();
-      
-      if (cf != cc) {
-        ++count;
-        cf = cc;
-      } else if (pext) {
-        ++count;
-        pext = false;
-      }
-    }
-  }
+  ObjectCounter counter(this, main, cset, blacklist);
+  counter.visit_elements(m);
+  int count = counter.count;
   if (!count) {
     blacklist.insert(m);
     return; 
@@ -260,90 +383,9 @@ void POVRayExporter::fillPartsRecursive(const ldraw::model_multipart *main, cons
     stream_ << ((count == 1) ? "object" : "union") << " {\n";
     
     // Serialize data
-    bool meshFlag = false;
-    int colorFlag = -1;
-    for (ldraw::model::const_iterator it = m->elements().begin(); it != m->elements().end(); ++it) {
-      // Process triangles and quadrilaterals.
-      if ((*it)->get_type() == ldraw::type_triangle || (*it)->get_type() == ldraw::type_quadrilateral) {
-        int c = (*it)->get_type() == ldraw::type_triangle ? CAST_AS_TRIANGLE(*it)->get_color().get_id() : CAST_AS_QUADRILATERAL(*it)->get_color().get_id();
-        if (colorFlag == -1) {
-          colorFlag = c;
-        }
-	
-        // If current " mesh { ... } " block has been finished and one another block is about to start,
-        // Terminate the previous one and create new.
-        if (colorFlag != c && meshFlag) {
-          if (colorFlag != 16 && colorFlag != 24)
-            stream_ << "\t\tmaterial { Color" << colorFlag << " }\n";
-          stream_ << "\t}\n";
-          meshFlag = false;
-          colorFlag = c;
-        }
-	
-        // new block
-        if (!meshFlag) {
-          stream_ << "\tmesh {\n";
-          meshFlag = true;
-        }
-	
-        // Serialize!
-        if ((*it)->get_type() == ldraw::type_triangle) {
-          ldraw::element_triangle *elem = CAST_AS_TRIANGLE(*it);
-          stream_ << "\t\ttriangle { " << serialize(elem->pos1()) << ", " << serialize(elem->pos2()) << ", " << serialize(elem->pos3()) << " }\n";
-        } else {
-          ldraw::element_quadrilateral *elem = CAST_AS_QUADRILATERAL(*it);
-          stream_ << "\t\ttriangle { " << serialize(elem->pos1()) << ", " << serialize(elem->pos2()) << ", " << serialize(elem->pos3()) << " }\n";
-          stream_ << "\t\ttriangle { " << serialize(elem->pos3()) << ", " << serialize(elem->pos4()) << ", " << serialize(elem->pos1()) << " }\n";
-        }
-      } else if ((*it)->get_type() == ldraw::type_ref) {
-        ldraw::element_ref *elem = CAST_AS_REF(*it);
-        
-        ldraw::matrix om = elem->get_matrix();
-        if (ldraw::utils::is_singular_matrix(om))
-          continue;
-        
-        if (!elem->get_model() || blacklist.find(elem->get_model()) != blacklist.end())
-          continue;
-	
-        if (meshFlag) {
-          if (colorFlag != 16 && colorFlag != 24)
-            stream_ << "\t\tmaterial { Color" << colorFlag << " }\n";
-          
-          stream_ << "\t}\n";
-          meshFlag = false;
-        }
-        
-        if (elem->parent()->parent() == main && !m->is_submodel_of(main)) {
-          // Seam width
-          ldraw::metrics metrics(elem->get_model());
-          metrics.update();
-          float distance = ldraw::vector::distance(metrics.min_(), metrics.max_());
-          float scale = (distance - params_->seamWidth()) / distance;
-          
-          ldraw::matrix sm;
-          sm.value(0, 0) = scale;
-          sm.value(1, 1) = scale;
-          sm.value(2, 2) = scale;
-          
-          ldraw::vector v = om.get_translation_vector();
-          om = om * sm;
-          om.set_translation_vector(v);
-        }
-	
-        stream_ << "\tobject { " << convertNameFormat(elem->get_model()->name()) << " matrix " << serialize(om.transpose());
-	
-        if (colorAmbiguityTest(elem->get_model()) && elem->get_color().get_id() != 16 && elem->get_color().get_id() != 24)
-          stream_ << " material { Color" << elem->get_color().get_id() << " } ";
-        stream_ << "}\n";
-      }
-    }
-    
-    if (meshFlag) {
-      if (colorFlag != 16 && colorFlag != 24)
-        stream_ << "\t\tmaterial { Color" << colorFlag << " }\n";
-      
-      stream_ << "\t}\n";
-    }
+    ObjectWriter writer(this, main, m, blacklist);
+    writer.visit_elements(m);
+    writer.finish();
     stream_ << "}\n\n";
   }
 }
@@ -569,6 +611,10 @@ void POVRayExporter::substitute8Dash8Sphe()
 
 bool POVRayExporter::colorAmbiguityTest(const ldraw::model *m)
 {
+  const ldraw::traits *traits = m->custom_data<ldraw::traits>();
+  if (traits)
+    return traits->is(ldraw::traits::color_ambiguous);
+  
   for (ldraw::model::const_iterator it = m->elements().begin(); it != m->elements().end(); ++it) {
     if ((*it)->capabilities() & ldraw::capability_color) {
       ldraw::element_colored_base *elem = dynamic_cast<ldraw::element_colored_base *>(*it);
@@ -34,8 +34,15 @@ class POVRayExporter : public QObject
  private:
   QString convertNameFormat(const std::string &s);
   
+  // Element visitors (libldr/visitor.h) walking a model for fillColors()
+  // and fillParts()
+  class ColorCollector;
+  class ObjectCounter;
+  class ObjectWriter;
+  
   void fillHeader();
   void fillColors();
+  void fillColor(int c, std::set<int> &cset);
   void fillColorsRecursive(const ldraw::model *m, std::set<int> &cset);
   void fillParts();
   void fillPartsRecursive(const ldraw::model_multipart *main, const ldraw::model *m, std::set<const ldraw::model *> &cset, std::set<const ldraw::model *> &bl);
@@ -7,7 +7,6 @@
 
 #include <libldr/elements.h>
 #include <libldr/metrics.h>
-#include <libldr/utils.h>
 
 #include <QAction>
 #include <QActionGroup>
@@ -1330,7 +1329,7 @@ void RenderWidget::dropEvent(QDropEvent *event)
   ldraw::model *sm = (*activeDocument_)->contents()->
       find_submodel(refobj.filename().toLocal8Bit().data());
   if (sm) {
-    if (ldraw::utils::cyclic_reference_test(
+    if ((*activeDocument_)->contents()->creates_cycle(
             (*activeDocument_)->getActiveModel(), sm)) {
       QMessageBox::critical(this, tr("Error"), tr("Cannot include this part into the current model."));
       
@@ -1,6 +1,11 @@
 // Konstruktor - An interactive LDraw modeler for KDE
 // Copyright (c)2006-2011 Park "segfault" J. K. <mastermind@planetmono.org>
 
+#include <algorithm>
+
+#include <libldr/metrics.h>
+#include <libldr/model.h>
+
 #include "renderwidget.h"
 #include "visibilityextension.h"
 
@@ -64,6 +69,36 @@ bool Selection::hasSelection() const
 
 ldraw::vector Selection::calculateCenter() const
 {
+  const ldraw::metrics *tracked = model_ ? model_->custom_data<ldraw::metrics>() : 0L;
+  
+  // Union of the element boxes the model already keeps
+  if (tracked && tracked->is_tracking() && tsset_ && !inverted_) {
+    ldraw::vector min, max, emin, emax;
+    bool first = true;
+    
+    for (QSet<int>::ConstIterator it = tsset_->constBegin(); it != tsset_->constEnd(); ++it) {
+      if (*it >= (int)model_->elements().size() || (visibility_ && visibility_->find(*it)))
+        continue;
+      if (!tracked->element_bounds(model_->elements()[*it], emin, emax))
+        continue;
+      
+      if (first) {
+        min = emin;
+        max = emax;
+        first = false;
+      } else {
+        for (int i = 0; i < 3; ++i) {
+          min[i] = std::min(min[i], emin[i]);
+          max[i] = std::max(max[i], emax[i]);
+        }
+      }
+    }
+    
+    if (!first)
+      return (min + max) * 0.5f;
+  }
+  
+  // Nothing selected has a tracked box; measure the selection instead
   ldraw::metrics m(model_);
 
   m.update(this);
@@ -0,0 +1,155 @@
+/* libLDR: Portable and easy-to-use LDraw format abstraction & I/O reference library *
+ * To obtain more information about LDraw, visit http://www.ldraw.org.               *
+ * Distributed in terms of the GNU Lesser General Public License v3                  *
+ *                                                                                   *
+ * Author: (c)2006-2013 Park "segfault" J. K. <mastermind_at_planetmono_dot_org>     */
+
+#include <deque>
+#include <mutex>
+#include <vector>
+
+#include "utils.h"
+
+#include "atom.h"
+
+namespace ldraw
+{
+
+namespace
+{
+
+struct entry
+{
+  std::string name;
+  std::size_t hash;
+};
+
+// Open addressing over indices into entries; slots hold index + 1, 0 is
+// empty. Entries live in a deque so that name() references stay valid.
+struct table
+{
+  table() : slots(1024, 0) {}
+
+  std::mutex mutex;
+  std::deque<entry> entries;
+  std::vector<unsigned int> slots;
+};
+
+table& get_table()
+{
+  static table t;
+
+  return t;
+}
+
+std::size_t fold_hash(const char *name, std::size_t length)
+{
+  std::size_t h = 2166136261u;
+
+  for (std::size_t i = 0; i < length; ++i) {
+    h ^= (unsigned char) utils::translate((unsigned char) name[i]);
+    h *= 16777619u;
+  }
+
+  return h;
+}
+
+bool fold_equal(const std::string &folded, const char *name, std::size_t length)
+{
+  if (folded.length() != length)
+    return false;
+
+  for (std::size_t i = 0; i < length; ++i) {
+    if (folded[i] != (char) utils::translate((unsigned char) name[i]))
+      return false;
+  }
+
+  return true;
+}
+
+atom make_atom(unsigned int index, const std::string &folded)
+{
+  return (index + 1) << 1 | (folded.find("stu") != std::string::npos ? 1 : 0);
+}
+
+void grow(table &t)
+{
+  std::vector<unsigned int> slots(t.slots.size() * 2, 0);
+  std::size_t mask = slots.size() - 1;
+
+  for (std::size_t i = 0; i < t.entries.size(); ++i) {
+    std::size_t s = t.entries[i].hash & mask;
+    while (slots[s])
+      s = (s + 1) & mask;
+    slots[s] = i + 1;
+  }
+
+  t.slots.swap(slots);
+}
+
+}
+
+atom atom_table::intern(const std::string &name)
+{
+  return intern(name.data(), name.length());
+}
+
+atom atom_table::intern(const char *name, std::size_t length)
+{
+  if (!length)
+    return null_atom;
+
+  table &t = get_table();
+  std::size_t h = fold_hash(name, length);
+
+  std::lock_guard<std::mutex> lock(t.mutex);
+
+  std::size_t mask = t.slots.size() - 1;
+  std::size_t s = h & mask;
+
+  while (t.slots[s]) {
+    const entry &e = t.entries[t.slots[s] - 1];
+    if (e.hash == h && fold_equal(e.name, name, length))
+      return make_atom(t.slots[s] - 1, e.name);
+    s = (s + 1) & mask;
+  }
+
+  entry e;
+  e.name.assign(name, length);
+  for (std::string::iterator it = e.name.begin(); it != e.name.end(); ++it)
+    *it = (char) utils::translate((unsigned char) *it);
+  e.hash = h;
+
+  unsigned int index = t.entries.size();
+  t.entries.push_back(e);
+  t.slots[s] = index + 1;
+
+  // Keep the load factor under one half
+  if (t.entries.size() * 2 > t.slots.size())
+    grow(t);
+
+  return make_atom(index, t.entries.back().name);
+}
+
+const std::string& atom_table::name(atom a)
+{
+  static const std::string empty;
+
+  if (a == null_atom)
+    return empty;
+
+  table &t = get_table();
+  std::lock_guard<std::mutex> lock(t.mutex);
+
+  return t.entries[(a >> 1) - 1].name;
+}
+
+std::size_t atom_table::size()
+{
+  table &t = get_table();
+  std::lock_guard<std::mutex> lock(t.mutex);
+
+  return t.entries.size();
+}
+
+}
@@ -0,0 +1,45 @@
+/* libLDR: Portable and easy-to-use LDraw format abstraction & I/O reference library *
+ * To obtain more information about LDraw, visit http://www.ldraw.org.               *
+ * Distributed in terms of the GNU Lesser General Public License v3                  *
+ *                                                                                   *
+ * Author: (c)2006-2013 Park "segfault" J. K. <mastermind_at_planetmono_dot_org>     */
+
+#ifndef _LIBLDR_ATOM_H_
+#define _LIBLDR_ATOM_H_
+
+#include <cstddef>
+#include <string>
+
+#include "common.h"
+
+namespace ldraw
+{
+
+// Interned file name. Names that are equal after utils::translate_string()
+// (lowercase, '\' -> '/') map to the same atom, so file and submodel names
+// can be compared and hashed as integers. The empty name is null_atom.
+typedef unsigned int atom;
+
+const atom null_atom = 0;
+
+// Process-wide table of atoms. Atoms are never freed; interning is safe
+// from any thread.
+class LIBLDR_EXPORT atom_table
+{
+ public:
+  static atom intern(const std::string &name);
+  static atom intern(const char *name, std::size_t length);
+
+  // Folded name of an atom
+  static const std::string& name(atom a);
+
+  // Whether the name contains "stu" (see utils::is_stud()). Kept in the
+  // atom itself, so this does not touch the table.
+  static bool is_stud(atom a) { return a & 1; }
+
+  static std::size_t size();
+};
+
+}
+
+#endif
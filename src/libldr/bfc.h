@@ -72,7 +72,8 @@ class LIBLDR_EXPORT element_bfc : public element_base
 	command get_command() const;
 	void set_command(command cmd);
 
-	virtual type get_type() const { return type_bfc; }
+	static const type tag = type_bfc;
+	virtual type get_type() const { return tag; }
 	virtual int line_type() const { return 0; }
 
 	element_bfc& operator= (const element_bfc &rhs);
@@ -0,0 +1,617 @@
+/* libLDR: Portable and easy-to-use LDraw format abstraction & I/O reference library *
+ * To obtain more information about LDraw, visit http://www.ldraw.org.               *
+ * Distributed in terms of the GNU Lesser General Public License v3                  *
+ *                                                                                   *
+ * Author: (c)2006-2013 Park "segfault" J. K. <mastermind_at_planetmono_dot_org>     */
+
+#include <algorithm>
+#include <cmath>
+
+#include "elements.h"
+#include "metrics.h"
+#include "model.h"
+
+#include "bvh.h"
+
+namespace ldraw
+{
+
+template <class Box> static void merge(const Box &a, const Box &b, Box &out)
+{
+  for (int i = 0; i < 3; ++i) {
+    out.min[i] = std::min(a.min[i], b.min[i]);
+    out.max[i] = std::max(a.max[i], b.max[i]);
+  }
+}
+
+// Half the surface area, the cost of a node in the insertion heuristic
+template <class Box> static float area(const Box &b)
+{
+  float dx = b.max[0] - b.min[0], dy = b.max[1] - b.min[1], dz = b.max[2] - b.min[2];
+
+  return dx*dy + dy*dz + dz*dx;
+}
+
+template <class Box> static bool contains(const Box &outer, const Box &inner)
+{
+  for (int i = 0; i < 3; ++i) {
+    if (inner.min[i] < outer.min[i] || inner.max[i] > outer.max[i])
+      return false;
+  }
+
+  return true;
+}
+
+template <class Box> static bool overlaps(const Box &a, const Box &b)
+{
+  for (int i = 0; i < 3; ++i) {
+    if (a.max[i] < b.min[i] || a.min[i] > b.max[i])
+      return false;
+  }
+
+  return true;
+}
+
+bvh::bvh(model *m, void *arg)
+    : extension(m, arg), m_root(-1), m_numbered(false)
+{
+}
+
+void bvh::update()
+{
+  std::vector<std::pair<box, const element_base *> > leaves;
+  box b;
+
+  clear();
+
+  for (model::const_iterator it = m_model->elements().begin(); it != m_model->elements().end(); ++it) {
+    if (element_box(*it, b))
+      leaves.push_back(std::make_pair(b, *it));
+  }
+
+  if (!leaves.empty()) {
+    m_root = build(leaves, 0, leaves.size());
+    m_nodes[m_root].parent = -1;
+  }
+}
+
+int bvh::height() const
+{
+  return m_root == -1 ? 0 : m_nodes[m_root].height + 1;
+}
+
+bool bvh::bounds(const element_base *e, vector &min, vector &max) const
+{
+  std::unordered_map<const element_base *, int>::const_iterator it = m_leaves.find(e);
+
+  if (it == m_leaves.end())
+    return false;
+
+  const box &b = m_nodes[(*it).second].bounds;
+  min = vector(b.min[0], b.min[1], b.min[2]);
+  max = vector(b.max[0], b.max[1], b.max[2]);
+
+  return true;
+}
+
+int bvh::index(const element_base *e)
+{
+  std::unordered_map<const element_base *, int>::const_iterator it = m_leaves.find(e);
+
+  if (it == m_leaves.end())
+    return -1;
+
+  if (!m_numbered)
+    renumber();
+
+  return m_nodes[(*it).second].index;
+}
+
+void bvh::query_box(const vector &min, const vector &max, std::vector<const element_base *> &result) const
+{
+  if (m_root == -1)
+    return;
+
+  box q = { { min.x(), min.y(), min.z() }, { max.x(), max.y(), max.z() } };
+  std::vector<int> stack(1, m_root);
+
+  while (!stack.empty()) {
+    const node &n = m_nodes[stack.back()];
+    stack.pop_back();
+
+    if (!overlaps(n.bounds, q))
+      continue;
+
+    if (n.element) {
+      result.push_back(n.element);
+    } else {
+      stack.push_back(n.child[0]);
+      stack.push_back(n.child[1]);
+    }
+  }
+}
+
+void bvh::query_frustum(const plane *planes, int count, std::vector<const element_base *> &result) const
+{
+  if (m_root == -1)
+    return;
+
+  std::vector<int> stack(1, m_root);
+
+  while (!stack.empty()) {
+    const node &n = m_nodes[stack.back()];
+    stack.pop_back();
+
+    // Outside if even the corner furthest along a plane's normal is
+    bool outside = false;
+    for (int i = 0; i < count && !outside; ++i) {
+      const vector &nv = planes[i].normal;
+      float d = planes[i].distance;
+
+      for (int j = 0; j < 3; ++j)
+        d += nv[j] * (nv[j] >= 0.0f ? n.bounds.max[j] : n.bounds.min[j]);
+
+      outside = d < 0.0f;
+    }
+
+    if (outside)
+      continue;
+
+    if (n.element) {
+      result.push_back(n.element);
+    } else {
+      stack.push_back(n.child[0]);
+      stack.push_back(n.child[1]);
+    }
+  }
+}
+
+void bvh::query_ray(const vector &origin, const vector &direction, std::vector<hit> &result) const
+{
+  if (m_root == -1)
+    return;
+
+  std::size_t first = result.size();
+  std::vector<int> stack(1, m_root);
+
+  while (!stack.empty()) {
+    const node &n = m_nodes[stack.back()];
+    stack.pop_back();
+
+    // Slab test, clipped to the part of the ray ahead of the origin
+    float tmin = 0.0f, tmax = HUGE_VALF;
+    bool miss = false;
+    for (int i = 0; i < 3 && !miss; ++i) {
+      if (direction[i] == 0.0f) {
+        miss = origin[i] < n.bounds.min[i] || origin[i] > n.bounds.max[i];
+        continue;
+      }
+
+      float t1 = (n.bounds.min[i] - origin[i]) / direction[i];
+      float t2 = (n.bounds.max[i] - origin[i]) / direction[i];
+      if (t1 > t2)
+        std::swap(t1, t2);
+
+      tmin = std::max(tmin, t1);
+      tmax = std::min(tmax, t2);
+      miss = tmin > tmax;
+    }
+
+    if (miss)
+      continue;
+
+    if (n.element) {
+      result.push_back(hit(tmin, n.element));
+    } else {
+      stack.push_back(n.child[0]);
+      stack.push_back(n.child[1]);
+    }
+  }
+
+  std::sort(result.begin() + first, result.end());
+}
+
+void bvh::element_inserted(const element_base *e)
+{
+  m_numbered = false;
+  element_changed(e);
+}
+
+void bvh::element_removed(const element_base *e)
+{
+  std::unordered_map<const element_base *, int>::iterator it = m_leaves.find(e);
+
+  // Those after it move up, whether it was a leaf or not
+  m_numbered = false;
+
+  if (it == m_leaves.end())
+    return;
+
+  remove_leaf((*it).second);
+  release((*it).second);
+  m_leaves.erase(it);
+}
+
+void bvh::element_changed(const element_base *e)
+{
+  box b;
+
+  if (!element_box(e, b)) {
+    element_removed(e);
+    return;
+  }
+
+  std::unordered_map<const element_base *, int>::iterator it = m_leaves.find(e);
+
+  if (it == m_leaves.end()) {
+    int leaf = allocate();
+    m_nodes[leaf].bounds = b;
+    m_nodes[leaf].element = e;
+    m_leaves[e] = leaf;
+    insert_leaf(leaf);
+    m_numbered = false;
+    return;
+  }
+
+  int leaf = (*it).second, parent = m_nodes[leaf].parent;
+
+  if (parent == -1 || contains(m_nodes[parent].bounds, b)) {
+    // Still where it belongs; the ancestors may only shrink
+    m_nodes[leaf].bounds = b;
+    refit(parent);
+  } else {
+    remove_leaf(leaf);
+    m_nodes[leaf].bounds = b;
+    insert_leaf(leaf);
+  }
+}
+
+void bvh::elements_cleared()
+{
+  clear();
+}
+
+std::size_t bvh::memory_usage() const
+{
+  return m_nodes.capacity() * sizeof(node) + m_free.capacity() * sizeof(int) +
+      m_leaves.bucket_count() * sizeof(void *) + m_leaves.size() * (sizeof(std::pair<const element_base *, int>) + 2 * sizeof(void *));
+}
+
+bool bvh::element_box(const element_base *e, box &b)
+{
+  float points[24];
+  int count;
+
+  switch (e->get_type()) {
+    case type_line: {
+      const element_line *l = element_cast<element_line>(e);
+      std::copy(l->pos1().get_pointer(), l->pos1().get_pointer() + 3, points);
+      std::copy(l->pos2().get_pointer(), l->pos2().get_pointer() + 3, points + 3);
+      count = 2;
+      break;
+    }
+    case type_triangle: {
+      const element_triangle *l = element_cast<element_triangle>(e);
+      std::copy(l->pos1().get_pointer(), l->pos1().get_pointer() + 3, points);
+      std::copy(l->pos2().get_pointer(), l->pos2().get_pointer() + 3, points + 3);
+      std::copy(l->pos3().get_pointer(), l->pos3().get_pointer() + 3, points + 6);
+      count = 3;
+      break;
+    }
+    case type_quadrilateral: {
+      const element_quadrilateral *l = element_cast<element_quadrilateral>(e);
+      std::copy(l->pos1().get_pointer(), l->pos1().get_pointer() + 3, points);
+      std::copy(l->pos2().get_pointer(), l->pos2().get_pointer() + 3, points + 3);
+      std::copy(l->pos3().get_pointer(), l->pos3().get_pointer() + 3, points + 6);
+      std::copy(l->pos4().get_pointer(), l->pos4().get_pointer() + 3, points + 9);
+      count = 4;
+      break;
+    }
+    case type_condline: {
+      const element_condline *l = element_cast<element_condline>(e);
+      std::copy(l->pos1().get_pointer(), l->pos1().get_pointer() + 3, points);
+      std::copy(l->pos2().get_pointer(), l->pos2().get_pointer() + 3, points + 3);
+      count = 2;
+      break;
+    }
+    case type_ref: {
+      const element_ref *r = element_cast<element_ref>(e);
+      model *m = r->get_model();
+
+      if (!m)
+        return false;
+
+      // All eight corners, as the matrix may rotate the box
+      const metrics *mm = m->shared_custom_data<metrics>();
+      const vector &min = mm->min_();
+      const vector &max = mm->max_();
+      for (int i = 0; i < 8; ++i) {
+        points[i * 3] = i & 1 ? max.x() : min.x();
+        points[i * 3 + 1] = i & 2 ? max.y() : min.y();
+        points[i * 3 + 2] = i & 4 ? max.z() : min.z();
+      }
+
+      r->get_matrix().transform(points, points, 8);
+      count = 8;
+      break;
+    }
+    default:
+      return false;
+  }
+
+  for (int j = 0; j < 3; ++j)
+    b.min[j] = b.max[j] = points[j];
+  for (int i = 1; i < count; ++i) {
+    for (int j = 0; j < 3; ++j) {
+      b.min[j] = std::min(b.min[j], points[i * 3 + j]);
+      b.max[j] = std::max(b.max[j], points[i * 3 + j]);
+    }
+  }
+
+  return true;
+}
+
+int bvh::allocate()
+{
+  int n;
+
+  if (!m_free.empty()) {
+    n = m_free.back();
+    m_free.pop_back();
+  } else {
+    n = m_nodes.size();
+    m_nodes.push_back(node());
+  }
+
+  m_nodes[n].parent = -1;
+  m_nodes[n].child[0] = m_nodes[n].child[1] = -1;
+  m_nodes[n].element = 0L;
+  m_nodes[n].index = -1;
+  m_nodes[n].height = 0;
+
+  return n;
+}
+
+void bvh::release(int n)
+{
+  m_nodes[n].element = 0L;
+  m_free.push_back(n);
+}
+
+// Top-down build, splitting the longest axis of the centers at the median
+int bvh::build(std::vector<std::pair<box, const element_base *> > &leaves, int first, int last)
+{
+  if (last - first == 1) {
+    int n = allocate();
+    m_nodes[n].bounds = leaves[first].first;
+    m_nodes[n].element = leaves[first].second;
+    m_leaves[leaves[first].second] = n;
+
+    return n;
+  }
+
+  box centers;
+  for (int j = 0; j < 3; ++j)
+    centers.min[j] = centers.max[j] = leaves[first].first.min[j] + leaves[first].first.max[j];
+  for (int i = first + 1; i < last; ++i) {
+    for (int j = 0; j < 3; ++j) {
+      float c = leaves[i].first.min[j] + leaves[i].first.max[j];
+      centers.min[j] = std::min(centers.min[j], c);
+      centers.max[j] = std::max(centers.max[j], c);
+    }
+  }
+
+  int axis = 0;
+  for (int j = 1; j < 3; ++j) {
+    if (centers.max[j] - centers.min[j] > centers.max[axis] - centers.min[axis])
+      axis = j;
+  }
+
+  int mid = first + (last - first) / 2;
+  std::nth_element(leaves.begin() + first, leaves.begin() + mid, leaves.begin() + last,
+                   [axis](const std::pair<box, const element_base *> &a, const std::pair<box, const element_base *> &b) {
+                     return a.first.min[axis] + a.first.max[axis] < b.first.min[axis] + b.first.max[axis];
+                   });
+
+  int left = build(leaves, first, mid);
+  int right = build(leaves, mid, last);
+  int n = allocate();
+
+  m_nodes[n].child[0] = left;
+  m_nodes[n].child[1] = right;
+  m_nodes[left].parent = m_nodes[right].parent = n;
+  m_nodes[n].height = 1 + std::max(m_nodes[left].height, m_nodes[right].height);
+  merge(m_nodes[left].bounds, m_nodes[right].bounds, m_nodes[n].bounds);
+
+  return n;
+}
+
+// Finds the sibling whose enlargement costs least, the way Box2D's dynamic
+// tree does, and pairs the leaf with it under a new node
+void bvh::insert_leaf(int leaf)
+{
+  if (m_root == -1) {
+    m_root = leaf;
+    m_nodes[leaf].parent = -1;
+    return;
+  }
+
+  const box b = m_nodes[leaf].bounds;
+  int sibling = m_root;
+
+  while (!m_nodes[sibling].element) {
+    const node &n = m_nodes[sibling];
+    box combined;
+    merge(n.bounds, b, combined);
+
+    float cost = 2.0f * area(combined);
+    float inheritance = 2.0f * (area(combined) - area(n.bounds));
+    float child_cost[2];
+
+    for (int i = 0; i < 2; ++i) {
+      const node &c = m_nodes[n.child[i]];
+      merge(c.bounds, b, combined);
+      child_cost[i] = area(combined) + inheritance;
+      if (!c.element)
+        child_cost[i] -= area(c.bounds);
+    }
+
+    if (cost < child_cost[0] && cost < child_cost[1])
+      break;
+
+    sibling = n.child[child_cost[1] < child_cost[0] ? 1 : 0];
+  }
+
+  int old_parent = m_nodes[sibling].parent;
+  int parent = allocate();
+
+  m_nodes[parent].parent = old_parent;
+  m_nodes[parent].child[0] = sibling;
+  m_nodes[parent].child[1] = leaf;
+  merge(m_nodes[sibling].bounds, b, m_nodes[parent].bounds);
+  m_nodes[sibling].parent = m_nodes[leaf].parent = parent;
+
+  if (old_parent == -1)
+    m_root = parent;
+  else
+    m_nodes[old_parent].child[m_nodes[old_parent].child[0] == sibling ? 0 : 1] = parent;
+
+  rebalance(parent);
+}
+
+void bvh::remove_leaf(int leaf)
+{
+  if (leaf == m_root) {
+    m_root = -1;
+    return;
+  }
+
+  int parent = m_nodes[leaf].parent;
+  int grandparent = m_nodes[parent].parent;
+  int sibling = m_nodes[parent].child[m_nodes[parent].child[0] == leaf ? 1 : 0];
+
+  m_nodes[sibling].parent = grandparent;
+  if (grandparent == -1) {
+    m_root = sibling;
+  } else {
+    m_nodes[grandparent].child[m_nodes[grandparent].child[0] == parent ? 0 : 1] = sibling;
+    rebalance(grandparent);
+  }
+
+  release(parent);
+  m_nodes[leaf].parent = -1;
+}
+
+// Rotates the taller grandchild of n up when one child of n is more than a
+// level taller than the other, as Box2D's dynamic tree does; returns the
+// node that is in n's place afterwards
+int bvh::balance(int n)
+{
+  if (m_nodes[n].element || m_nodes[n].height < 2)
+    return n;
+
+  int difference = m_nodes[m_nodes[n].child[1]].height - m_nodes[m_nodes[n].child[0]].height;
+
+  if (difference > 1)
+    return rotate(n, 1);
+  else if (difference < -1)
+    return rotate(n, 0);
+
+  return n;
+}
+
+// Moves child side of n up into n's place. Of its children, the taller
+// stays with it and the other takes its place under n.
+int bvh::rotate(int n, int side)
+{
+  int up = m_nodes[n].child[side];
+  int other = m_nodes[n].child[1 - side];
+  int first = m_nodes[up].child[0], second = m_nodes[up].child[1];
+  int keep = m_nodes[first].height > m_nodes[second].height ? first : second;
+  int move = keep == first ? second : first;
+  int parent = m_nodes[n].parent;
+
+  m_nodes[up].parent = parent;
+  if (parent == -1)
+    m_root = up;
+  else
+    m_nodes[parent].child[m_nodes[parent].child[0] == n ? 0 : 1] = up;
+
+  m_nodes[up].child[0] = n;
+  m_nodes[up].child[1] = keep;
+  m_nodes[n].parent = up;
+
+  m_nodes[n].child[side] = move;
+  m_nodes[move].parent = n;
+
+  merge(m_nodes[other].bounds, m_nodes[move].bounds, m_nodes[n].bounds);
+  m_nodes[n].height = 1 + std::max(m_nodes[other].height, m_nodes[move].height);
+  merge(m_nodes[n].bounds, m_nodes[keep].bounds, m_nodes[up].bounds);
+  m_nodes[up].height = 1 + std::max(m_nodes[n].height, m_nodes[keep].height);
+
+  return up;
+}
+
+// Balances the nodes from n up to the root and recomputes their boxes and
+// heights, after a leaf was inserted or removed below n
+void bvh::rebalance(int n)
+{
+  while (n != -1) {
+    n = balance(n);
+
+    node &nd = m_nodes[n];
+    const node &left = m_nodes[nd.child[0]], &right = m_nodes[nd.child[1]];
+    nd.height = 1 + std::max(left.height, right.height);
+    merge(left.bounds, right.bounds, nd.bounds);
+
+    n = nd.parent;
+  }
+}
+
+// Recomputes the boxes from n up, until one does not change. The heights
+// stay as they are, as no node moved.
+void bvh::refit(int n)
+{
+  while (n != -1) {
+    node &nd = m_nodes[n];
+    box b;
+    merge(m_nodes[nd.child[0]].bounds, m_nodes[nd.child[1]].bounds, b);
+
+    bool same = true;
+    for (int i = 0; i < 3; ++i) {
+      if (b.min[i] != nd.bounds.min[i] || b.max[i] != nd.bounds.max[i])
+        same = false;
+    }
+
+    if (same)
+      return;
+
+    nd.bounds = b;
+    n = nd.parent;
+  }
+}
+
+void bvh::renumber()
+{
+  const std::vector<element_base *> &elements = m_model->elements();
+
+  for (std::size_t i = 0; i < elements.size(); ++i) {
+    std::unordered_map<const element_base *, int>::const_iterator it = m_leaves.find(elements[i]);
+
+    if (it != m_leaves.end())
+      m_nodes[(*it).second].index = (int) i;
+  }
+
+  m_numbered = true;
+}
+
+void bvh::clear()
+{
+  m_nodes.clear();
+  m_free.clear();
+  m_leaves.clear();
+  m_root = -1;
+  m_numbered = false;
+}
+
+}
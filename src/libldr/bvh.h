@@ -0,0 +1,119 @@
+/* libLDR: Portable and easy-to-use LDraw format abstraction & I/O reference library *
+ * To obtain more information about LDraw, visit http://www.ldraw.org.               *
+ * Distributed in terms of the GNU Lesser General Public License v3                  *
+ *                                                                                   *
+ * Author: (c)2006-2013 Park "segfault" J. K. <mastermind_at_planetmono_dot_org>     */
+
+#ifndef _LIBLDR_BVH_H_
+#define _LIBLDR_BVH_H_
+
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "extension.h"
+#include "math.h"
+
+namespace ldraw
+{
+
+class element_base;
+class model;
+
+// Bounding volume hierarchy over the elements of a model.
+//
+// Every element with an extent is a leaf, boxed in the model's coordinates;
+// a reference gets the box of its model's metrics, transformed. update()
+// builds a balanced tree from scratch. Afterwards the tree follows the edits
+// of the model: an element moved within the box of its parent node is only
+// refitted, otherwise it is taken out and inserted again where it enlarges
+// the tree least. Rotations on the way up from an inserted or removed leaf
+// keep the tree balanced.
+class LIBLDR_EXPORT bvh : public extension
+{
+ public:
+  // A half-space; a point p is inside if dot(normal, p) + distance >= 0
+  struct plane
+  {
+    vector normal;
+    float distance;
+  };
+
+  typedef std::pair<float, const element_base *> hit;
+
+  bvh(model *m, void *arg = 0L);
+  virtual ~bvh() {}
+
+  static const std::string identifier() { return "bvh"; }
+
+  void update();
+
+  int size() const { return (int) m_leaves.size(); }
+  int height() const;
+
+  // Box of an element of the model; false if it is not in the tree
+  bool bounds(const element_base *e, vector &min, vector &max) const;
+
+  // Position of an element in the model, for the results of the queries;
+  // -1 if it is not in the tree. The leaves are numbered again on the first
+  // call after an element was inserted or removed.
+  int index(const element_base *e);
+
+  // Elements whose boxes overlap the box between min and max
+  void query_box(const vector &min, const vector &max, std::vector<const element_base *> &result) const;
+
+  // Elements whose boxes are not entirely outside any of the planes
+  void query_frustum(const plane *planes, int count, std::vector<const element_base *> &result) const;
+
+  // Elements whose boxes the ray from origin along direction hits, with the
+  // distance (in units of direction) where it enters them, nearest first
+  void query_ray(const vector &origin, const vector &direction, std::vector<hit> &result) const;
+
+  virtual void element_inserted(const element_base *e);
+  virtual void element_removed(const element_base *e);
+  virtual void element_changed(const element_base *e);
+  virtual void elements_cleared();
+
+  virtual std::size_t memory_usage() const;
+
+ private:
+  struct box
+  {
+    float min[3];
+    float max[3];
+  };
+
+  struct node
+  {
+    box bounds;
+    int parent;
+    int child[2];
+    const element_base *element;
+    int index;
+    int height; // 0 for a leaf
+  };
+
+  static bool element_box(const element_base *e, box &b);
+
+  int allocate();
+  void release(int n);
+  int build(std::vector<std::pair<box, const element_base *> > &leaves, int first, int last);
+  void insert_leaf(int leaf);
+  void remove_leaf(int leaf);
+  int balance(int n);
+  int rotate(int n, int side);
+  void rebalance(int n);
+  void refit(int n);
+  void renumber();
+  void clear();
+
+  std::vector<node> m_nodes;
+  std::vector<int> m_free;
+  std::unordered_map<const element_base *, int> m_leaves;
+  int m_root;
+  bool m_numbered;
+};
+
+}
+
+#endif
@@ -4,6 +4,7 @@
  *                                                                                   *
  * Author: (c)2006-2008 Park "segfault" J. K. <mastermind_at_planetmono_dot_org>     */
 
+#include <atomic>
 #include <iostream>
 #include <sstream>
 #include <map>
@@ -14,8 +15,7 @@ namespace ldraw {
 
 typedef std::map<int, const color_entity *> color_map_type;
 
-const color_map_type color::color_map = color_map_type();
-bool color::m_initialized = false;
+std::atomic<bool> color::m_initialized(false);
 
 // Predefined color table
 const material_traits_speckle color::material_chart_speckle[] = {
@@ -168,14 +168,23 @@ const color_entity color::color_chart[] = {
 
 const int color::color_chart_count = sizeof(color_chart) / sizeof(color_entity);
 
-void color::init()
+static color_map_type build_color_map()
 {
-  color_map_type &m = *const_cast<color_map_type *>(&color_map);
+  color_map_type m;
   
-  for (int i = 0; i < color_chart_count; ++i)
-    m[color_chart[i].id] = &color_chart[i];
+  for (int i = 0; i < color::color_chart_count; ++i)
+    m[color::color_chart[i].id] = &color::color_chart[i];
   
-  m_initialized = true;
+  return m;
+}
+
+// Built during static initialization, after color_chart above, and never
+// modified afterwards; lookups need no locking.
+const color_map_type color::color_map = build_color_map();
+
+void color::init()
+{
+  m_initialized.store(true, std::memory_order_release);
 }
 
 color::~color()
@@ -187,7 +196,7 @@ color::~color()
 // Map color-id to appropriate color value
 void color::link()
 {
-  if (!m_initialized)
+  if (!m_initialized.load(std::memory_order_acquire))
     throw exception(__func__, exception::user_error, "Color table is not initialized! run color::init() first.");
   
   m_custom_color = false;
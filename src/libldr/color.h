@@ -7,6 +7,7 @@
 #ifndef _LIBLDR_COLOR_H_
 #define _LIBLDR_COLOR_H_
 
+#include <atomic>
 #include <map>
 #include <string>
 
@@ -65,6 +66,8 @@ class LIBLDR_EXPORT color
   static const int color_chart_count;
   static const std::map<int, const color_entity *> color_map;
   
+  // Enables color lookups. The table itself is immutable, so this may be
+  // called any number of times, from any thread.
   static void init();
   
   color() : m_valid(true), m_id(0) { link(); }
@@ -85,7 +88,7 @@ class LIBLDR_EXPORT color
   const color_entity* get_entity() const { return m_entity; }
   
  private:
-  static bool m_initialized;
+  static std::atomic<bool> m_initialized;
   
   void link();
   
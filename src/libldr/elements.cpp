@@ -27,6 +27,11 @@ element_ref::element_ref(element_ref &rhs)
 
 element_ref::~element_ref()
 {
+	// Only the submodel graph is told; the model is done with the element
+	if (m_model && m_parent && m_parent->parent())
+		m_parent->parent()->update_reference(this, m_model, 0L);
+	m_parent = 0L;
+
 	if(m_linkpoint)
 		m_linkpoint->unlink_element(this);
 }
@@ -34,6 +39,7 @@ element_ref::~element_ref()
 void element_ref::set_filename(const std::string &s)
 {
 	m_filename = s;
+	m_atom = atom_table::intern(s);
 	
 	link();
 }
@@ -46,7 +52,7 @@ void element_ref::link()
 	if (m_linkpoint)
 		m_linkpoint->unlink_element(this);
 
-	m_model = 0L;
+	set_model(0L);
 
 	model_multipart *mp = 0L;
 	if (m_parent)
@@ -56,9 +62,28 @@ void element_ref::link()
 		m_linkpoint->link_element(this);
 }
 
+void element_ref::set_model(model *m)
+{
+	if (m == m_model)
+		return;
+
+	// Keeps the submodel graph of the containing document current
+	if (m_parent && m_parent->parent())
+		m_parent->parent()->update_reference(this, m_model, m);
+
+	m_model = m;
+
+	// The bounding box and other per-element state of the parent depend on
+	// the referenced model; a batch tells the parent once, at its end
+	if (m_parent && m_parent->parent() && m_parent->parent()->is_batching())
+		m_parent->parent()->m_relinked.insert(m_parent);
+	else if (m_parent)
+		m_parent->element_changed(this);
+}
+
 void element_ref::operator= (element_ref &rhs)
 {
-	m_model = 0L;
+	set_model(0L);
 	m_color = rhs.get_color();
 	m_matrix = rhs.get_matrix();
 	m_parent = 0L;
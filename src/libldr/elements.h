@@ -7,8 +7,10 @@
 #ifndef _LIBLDR_ELEMENTS_H_
 #define _LIBLDR_ELEMENTS_H_
 
+#include <cassert>
 #include <string>
 
+#include "atom.h"
 #include "common.h"
 #include "color.h"
 #include "math.h"
@@ -36,6 +38,7 @@ namespace ldraw
 
 class model;
 class model_multipart;
+class part_cache;
 class part_library;
 class reader;
 
@@ -65,11 +68,26 @@ public:
   element_base() {}
   virtual ~element_base() {}
   
+  // Every element class also exposes its type as a static 'tag'
   virtual type get_type() const = 0;
   virtual  int line_type() const = 0;
   virtual unsigned int capabilities() const { return 0; }
 };
 
+// Downcasts an element whose type has already been checked with
+// get_type(). Unlike the CAST_AS_* macros this is a plain static_cast.
+template <class T> inline T* element_cast(element_base *e)
+{
+  assert(!e || e->get_type() == T::tag);
+  return static_cast<T *>(e);
+}
+
+template <class T> inline const T* element_cast(const element_base *e)
+{
+  assert(!e || e->get_type() == T::tag);
+  return static_cast<const T *>(e);
+}
+
 // Colored element
 class LIBLDR_EXPORT element_colored_base : public element_base
 {
@@ -97,7 +115,8 @@ public:
   const std::string& get_comment() const { return m_str; }
   void set_comment(const std::string &s) { m_str = s;}
   
-  type get_type() const { return type_comment; }
+  static const type tag = type_comment;
+  type get_type() const { return tag; }
   int line_type() const { return 0; }
   
   void operator= (const element_comment &rhs) { m_str = rhs.get_comment(); }
@@ -119,7 +138,8 @@ public:
   state& get_state() { return m_state; }
   const state& get_state() const { return m_state; }
   
-  type get_type() const { return type_state; }
+  static const type tag = type_state;
+  type get_type() const { return tag; }
   int line_type() const { return 0; }
   
   void operator= (const element_state &rhs) { m_state = rhs.get_state(); }
@@ -139,7 +159,8 @@ public:
   const std::string& get_string() const { return m_str; }
   void set_string(const std::string &s) { m_str = s; }
   
-  type get_type() const { return type_print; }
+  static const type tag = type_print;
+  type get_type() const { return tag; }
   int line_type() const { return 0; }
   
   void operator= (const element_print &rhs) { m_str = rhs.get_string(); }
@@ -158,6 +179,7 @@ public:
   
   const matrix& get_matrix() const { return m_matrix; }
   const std::string& filename() const { return m_filename; }
+  atom filename_atom() const { return m_atom; }
   model* get_model() const { return m_model; }
   model* parent() const { return m_parent; }
   part_library* linkpoint() { return m_linkpoint; }
@@ -166,7 +188,8 @@ public:
   void set_filename(const std::string &s);
   void link();
   
-  type get_type() const { return type_ref; }
+  static const type tag = type_ref;
+  type get_type() const { return tag; }
   int line_type() const { return 1; }
   
   void operator= (element_ref &rhs);
@@ -174,15 +197,17 @@ public:
 private:
   friend class model;
   friend class model_multipart;
+  friend class part_cache;
   friend class part_library;
   friend class reader;
   
-  void set_model(model *m) { m_model = m; }
+  void set_model(model *m);
   void set_parent(model *p) { m_parent = p; }
   void resolve(part_library *l) { m_linkpoint = l; }
   
   matrix m_matrix;
   std::string m_filename;
+  atom m_atom;
   model *m_model;
   model *m_parent;
   part_library *m_linkpoint;
@@ -203,7 +228,8 @@ public:
   vector& pos2() { return m_pos2; }
   const vector& pos2() const { return m_pos2; }
   
-  type get_type() const { return type_line; }
+  static const type tag = type_line;
+  type get_type() const { return tag; }
   int line_type() const { return 2; }
   
   void operator= (const element_line &rhs);
@@ -230,7 +256,8 @@ public:
   vector& pos3() { return m_pos3; }
   const vector& pos3() const { return m_pos3; }
   
-  type get_type() const { return type_triangle; }
+  static const type tag = type_triangle;
+  type get_type() const { return tag; }
   int line_type() const { return 3; }
   
   void operator= (const element_triangle &rhs);
@@ -258,7 +285,8 @@ public:
   vector& pos4() { return m_pos4; }
   const vector& pos4() const { return m_pos4; }
   
-  type get_type() const { return type_quadrilateral; }
+  static const type tag = type_quadrilateral;
+  type get_type() const { return tag; }
   int line_type() const { return 4; }
   
   void operator= (const element_quadrilateral &rhs);
@@ -286,7 +314,8 @@ public:
   vector& pos4() { return m_pos4; }
   const vector& pos4() const { return m_pos4; }
   
-  type get_type() const { return type_condline; }
+  static const type tag = type_condline;
+  type get_type() const { return tag; }
   int line_type() const { return 5; }
   
   void operator= (const element_condline &rhs);
@@ -7,11 +7,14 @@
 #ifndef _LIBLDR_EXTENSION_H_
 #define _LIBLDR_EXTENSION_H_
 
+#include <cstddef>
+
 #include "common.h"
 
 namespace ldraw
 {
 
+class element_base;
 class model;
 
 class LIBLDR_EXPORT extension
@@ -23,6 +26,16 @@ class LIBLDR_EXPORT extension
 	void set_data(void *arg) { m_arg = arg; }
 
 	virtual void update() {}
+
+	// Edits of the model, for extensions that keep per-element state. The
+	// element is still part of the model when it is being removed.
+	virtual void element_inserted(const element_base *) {}
+	virtual void element_removed(const element_base *) {}
+	virtual void element_changed(const element_base *) {}
+	virtual void elements_cleared() {}
+
+	// Heap memory held by the extension, for library accounting
+	virtual std::size_t memory_usage() const { return 0; }
 	
   protected:
   	model *m_model;
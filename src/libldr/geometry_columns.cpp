@@ -0,0 +1,157 @@
+/* libLDR: Portable and easy-to-use LDraw format abstraction & I/O reference library *
+ * To obtain more information about LDraw, visit http://www.ldraw.org.               *
+ * Distributed in terms of the GNU Lesser General Public License v3                  *
+ *                                                                                   *
+ * Author: (c)2006-2013 Park "segfault" J. K. <mastermind_at_planetmono_dot_org>     */
+
+#include "elements.h"
+#include "model.h"
+
+#include "geometry_columns.h"
+
+namespace ldraw
+{
+
+namespace
+{
+
+void append(geometry_columns::column &c, const element_colored_base *e, unsigned int index, const vector *v, int count)
+{
+	for (int i = 0; i < count; ++i) {
+		c.positions.push_back(v[i].x());
+		c.positions.push_back(v[i].y());
+		c.positions.push_back(v[i].z());
+	}
+
+	c.colors.push_back(e->get_color().get_id());
+	c.elements.push_back(index);
+}
+
+}
+
+geometry_columns::geometry_columns(model *m, void *arg)
+	: extension(m, arg)
+{
+}
+
+int geometry_columns::vertices(column_type t)
+{
+	switch (t) {
+		case lines:
+			return 2;
+		case triangles:
+			return 3;
+		case quads:
+		case condlines:
+			return 4;
+		default:
+			return 0;
+	}
+}
+
+void geometry_columns::update()
+{
+	int count[4] = { 0, 0, 0, 0 };
+
+	for (model::const_iterator it = m_model->elements().begin(); it != m_model->elements().end(); ++it) {
+		switch ((*it)->get_type()) {
+			case type_line:
+				++count[lines];
+				break;
+			case type_triangle:
+				++count[triangles];
+				break;
+			case type_quadrilateral:
+				++count[quads];
+				break;
+			case type_condline:
+				++count[condlines];
+				break;
+			default:
+				break;
+		}
+	}
+
+	for (int i = 0; i < 4; ++i) {
+		column &c = m_columns[i];
+
+		c.positions.clear();
+		c.colors.clear();
+		c.elements.clear();
+
+		c.positions.reserve(count[i] * vertices((column_type) i) * 3);
+		c.colors.reserve(count[i]);
+		c.elements.reserve(count[i]);
+	}
+
+	m_order.clear();
+	m_order.reserve(m_model->elements().size());
+	m_refs.clear();
+
+	unsigned int index = 0;
+	for (model::const_iterator it = m_model->elements().begin(); it != m_model->elements().end(); ++it, ++index) {
+		entry e;
+		e.type = other;
+		e.row = index;
+
+		switch ((*it)->get_type()) {
+			case type_line: {
+				const element_line *l = element_cast<element_line>(*it);
+				const vector v[] = { l->pos1(), l->pos2() };
+				e.type = lines;
+				e.row = m_columns[lines].rows();
+				append(m_columns[lines], l, index, v, 2);
+				break;
+			}
+			case type_triangle: {
+				const element_triangle *l = element_cast<element_triangle>(*it);
+				const vector v[] = { l->pos1(), l->pos2(), l->pos3() };
+				e.type = triangles;
+				e.row = m_columns[triangles].rows();
+				append(m_columns[triangles], l, index, v, 3);
+				break;
+			}
+			case type_quadrilateral: {
+				const element_quadrilateral *l = element_cast<element_quadrilateral>(*it);
+				const vector v[] = { l->pos1(), l->pos2(), l->pos3(), l->pos4() };
+				e.type = quads;
+				e.row = m_columns[quads].rows();
+				append(m_columns[quads], l, index, v, 4);
+				break;
+			}
+			case type_condline: {
+				const element_condline *l = element_cast<element_condline>(*it);
+				const vector v[] = { l->pos1(), l->pos2(), l->pos3(), l->pos4() };
+				e.type = condlines;
+				e.row = m_columns[condlines].rows();
+				append(m_columns[condlines], l, index, v, 4);
+				break;
+			}
+			case type_ref:
+				m_refs.push_back(index);
+				break;
+			default:
+				break;
+		}
+
+		m_order.push_back(e);
+	}
+}
+
+std::size_t geometry_columns::memory_usage() const
+{
+	std::size_t size = sizeof(*this);
+
+	for (int i = 0; i < 4; ++i) {
+		size += m_columns[i].positions.capacity() * sizeof(float);
+		size += m_columns[i].colors.capacity() * sizeof(unsigned int);
+		size += m_columns[i].elements.capacity() * sizeof(unsigned int);
+	}
+
+	size += m_order.capacity() * sizeof(entry);
+	size += m_refs.capacity() * sizeof(unsigned int);
+
+	return size;
+}
+
+}
@@ -0,0 +1,69 @@
+/* libLDR: Portable and easy-to-use LDraw format abstraction & I/O reference library *
+ * To obtain more information about LDraw, visit http://www.ldraw.org.               *
+ * Distributed in terms of the GNU Lesser General Public License v3                  *
+ *                                                                                   *
+ * Author: (c)2006-2013 Park "segfault" J. K. <mastermind_at_planetmono_dot_org>     */
+
+#ifndef _LIBLDR_GEOMETRY_COLUMNS_H_
+#define _LIBLDR_GEOMETRY_COLUMNS_H_
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "extension.h"
+
+namespace ldraw
+{
+
+// Structure-of-arrays copy of a model's geometry, meant for parts and
+// primitives that are read far more often than they are edited. Each
+// primitive type gets a column of packed xyz positions and color ids, and
+// order() records where every element of the model went so that the
+// original element sequence can be rebuilt (see writer::write_columns()).
+// Like other extensions it is not kept in sync automatically; call
+// update() after editing the model.
+class LIBLDR_EXPORT geometry_columns : public extension
+{
+  public:
+	enum column_type { lines, triangles, quads, condlines, other };
+
+	struct column
+	{
+		std::vector<float> positions;        // vertices() * 3 floats per row
+		std::vector<unsigned int> colors;    // color id per row
+		std::vector<unsigned int> elements;  // element index per row
+
+		std::size_t rows() const { return colors.size(); }
+	};
+
+	struct entry
+	{
+		unsigned char type;  // column_type
+		unsigned int row;    // row in the column, or element index for 'other'
+	};
+
+	geometry_columns(model *m, void *arg = 0L);
+	virtual ~geometry_columns() {}
+
+	static const std::string identifier() { return "geometry_columns"; }
+	static int vertices(column_type t);
+
+	void update();
+
+	const model* source() const { return m_model; }
+	const column& get(column_type t) const { return m_columns[t]; }
+	const std::vector<entry>& order() const { return m_order; }
+	const std::vector<unsigned int>& refs() const { return m_refs; }
+
+	std::size_t memory_usage() const;
+
+  private:
+	column m_columns[4];
+	std::vector<entry> m_order;
+	std::vector<unsigned int> m_refs;   // element indices of references
+};
+
+}
+
+#endif
@@ -0,0 +1,156 @@
+/* libLDR: Portable and easy-to-use LDraw format abstraction & I/O reference library *
+ * To obtain more information about LDraw, visit http://www.ldraw.org.               *
+ * Distributed in terms of the GNU Lesser General Public License v3                  *
+ *                                                                                   *
+ * Author: (c)2006-2013 Park "segfault" J. K. <mastermind_at_planetmono_dot_org>     */
+
+#ifdef WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "mapped_file.h"
+
+namespace ldraw
+{
+
+mapped_file::mapped_file()
+    : m_open(false), m_data(0L), m_size(0)
+{
+#ifdef WIN32
+  m_file = 0L;
+  m_mapping = 0L;
+#endif
+}
+
+mapped_file::mapped_file(const std::string &path)
+    : m_open(false), m_data(0L), m_size(0)
+{
+#ifdef WIN32
+  m_file = 0L;
+  m_mapping = 0L;
+#endif
+
+  open(path);
+}
+
+mapped_file::~mapped_file()
+{
+  close();
+}
+
+#ifdef WIN32
+
+bool mapped_file::open(const std::string &path)
+{
+  close();
+
+  HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, 0L, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0L);
+  if (file == INVALID_HANDLE_VALUE)
+    return false;
+
+  LARGE_INTEGER size;
+  if (!GetFileSizeEx(file, &size)) {
+    CloseHandle(file);
+    return false;
+  }
+
+  m_file = file;
+  m_size = (std::size_t) size.QuadPart;
+  m_open = true;
+
+  // Zero-length files cannot be mapped
+  if (m_size == 0)
+    return true;
+
+  HANDLE mapping = CreateFileMappingA(file, 0L, PAGE_READONLY, 0, 0, 0L);
+  if (!mapping) {
+    close();
+    return false;
+  }
+  m_mapping = mapping;
+
+  m_data = (const char *) MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+  if (!m_data) {
+    close();
+    return false;
+  }
+
+  return true;
+}
+
+void mapped_file::close()
+{
+  if (m_data)
+    UnmapViewOfFile(m_data);
+  if (m_mapping)
+    CloseHandle((HANDLE) m_mapping);
+  if (m_file)
+    CloseHandle((HANDLE) m_file);
+
+  m_file = 0L;
+  m_mapping = 0L;
+  m_data = 0L;
+  m_size = 0;
+  m_open = false;
+}
+
+#else
+
+bool mapped_file::open(const std::string &path)
+{
+  close();
+
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0)
+    return false;
+
+  struct stat st;
+  if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode)) {
+    ::close(fd);
+    return false;
+  }
+
+  m_size = (std::size_t) st.st_size;
+  m_open = true;
+
+  // Zero-length files cannot be mapped
+  if (m_size > 0) {
+    void *p = mmap(0L, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (p == MAP_FAILED) {
+      ::close(fd);
+      m_size = 0;
+      m_open = false;
+      return false;
+    }
+
+#ifdef MADV_SEQUENTIAL
+    madvise(p, m_size, MADV_SEQUENTIAL);
+#endif
+
+    m_data = (const char *) p;
+  }
+
+  // The mapping stays valid after the descriptor is closed
+  ::close(fd);
+
+  return true;
+}
+
+void mapped_file::close()
+{
+  if (m_data)
+    munmap((void *) m_data, m_size);
+
+  m_data = 0L;
+  m_size = 0;
+  m_open = false;
+}
+
+#endif
+
+}
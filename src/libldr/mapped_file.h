@@ -0,0 +1,49 @@
+/* libLDR: Portable and easy-to-use LDraw format abstraction & I/O reference library *
+ * To obtain more information about LDraw, visit http://www.ldraw.org.               *
+ * Distributed in terms of the GNU Lesser General Public License v3                  *
+ *                                                                                   *
+ * Author: (c)2006-2013 Park "segfault" J. K. <mastermind_at_planetmono_dot_org>     */
+
+#ifndef _LIBLDR_MAPPED_FILE_H_
+#define _LIBLDR_MAPPED_FILE_H_
+
+#include <cstddef>
+#include <string>
+
+#include "common.h"
+
+namespace ldraw
+{
+
+// Read-only view of a whole file. Uses mmap() (or a file mapping on win32)
+// so that the contents can be tokenized in place without copying.
+class LIBLDR_EXPORT mapped_file
+{
+ public:
+  mapped_file();
+  explicit mapped_file(const std::string &path);
+  ~mapped_file();
+
+  bool open(const std::string &path);
+  void close();
+
+  bool is_open() const { return m_open; }
+  const char* data() const { return m_data; }
+  std::size_t size() const { return m_size; }
+
+ private:
+  mapped_file(const mapped_file &);
+  mapped_file& operator=(const mapped_file &);
+
+  bool m_open;
+  const char *m_data;
+  std::size_t m_size;
+#ifdef WIN32
+  void *m_file;
+  void *m_mapping;
+#endif
+};
+
+}
+
+#endif
@@ -8,6 +8,12 @@
 
 #include "math.h"
 
+// SSE is part of every x86-64 target; other targets use the scalar code
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define LDR_MATH_SSE
+#include <xmmintrin.h>
+#endif
+
 namespace ldraw
 {
 
@@ -28,9 +34,9 @@ vector vector::normalize() const
 
 float vector::distance(const vector &a, const vector &b)
 {
-  return std::sqrt(std::pow(a.x() - b.x(), 2.0f) +
-                   std::pow(a.y() - b.y(), 2.0f) +
-                   std::pow(a.z() - b.z(), 2.0f));
+  float dx = a.x() - b.x(), dy = a.y() - b.y(), dz = a.z() - b.z();
+  
+  return std::sqrt(dx*dx + dy*dy + dz*dz);
 }
 
 float vector::get_angle(const vector &a, const vector &b)
@@ -140,13 +146,33 @@ matrix matrix::operator* (const matrix &m) const
 {
   matrix n;
   
-  for (int i = 0; i < 4; i++) {
+  // The last row of a product of affine matrices is (0, 0, 0, 1) as well,
+  // which the identity n starts with
+  int rows = is_affine() && m.is_affine() ? 3 : 4;
+  
+#ifdef LDR_MATH_SSE
+  __m128 b0 = _mm_loadu_ps(m.m_matrix[0]);
+  __m128 b1 = _mm_loadu_ps(m.m_matrix[1]);
+  __m128 b2 = _mm_loadu_ps(m.m_matrix[2]);
+  __m128 b3 = _mm_loadu_ps(m.m_matrix[3]);
+  
+  // Row i of the product is the rows of m weighted by row i of this
+  for (int i = 0; i < rows; i++) {
+    __m128 r = _mm_mul_ps(_mm_set1_ps(m_matrix[i][0]), b0);
+    r = _mm_add_ps(r, _mm_mul_ps(_mm_set1_ps(m_matrix[i][1]), b1));
+    r = _mm_add_ps(r, _mm_mul_ps(_mm_set1_ps(m_matrix[i][2]), b2));
+    r = _mm_add_ps(r, _mm_mul_ps(_mm_set1_ps(m_matrix[i][3]), b3));
+    _mm_storeu_ps(n.m_matrix[i], r);
+  }
+#else
+  for (int i = 0; i < rows; i++) {
     for (int j = 0; j < 4; j++) {
       n.value(i, j) = 0.0f;
       for (int k = 0; k < 4; k++)
         n.value(i, j) += value(i, k) * m.value(k, j);
     }
   }
+#endif
   
   return n;
 }
@@ -154,11 +180,59 @@ matrix matrix::operator* (const matrix &m) const
 // Linear transform
 vector matrix::operator* (const vector &v) const
 {
+#ifdef LDR_MATH_SSE
+  __m128 c0 = _mm_loadu_ps(m_matrix[0]);
+  __m128 c1 = _mm_loadu_ps(m_matrix[1]);
+  __m128 c2 = _mm_loadu_ps(m_matrix[2]);
+  __m128 c3 = _mm_loadu_ps(m_matrix[3]);
+  _MM_TRANSPOSE4_PS(c0, c1, c2, c3);
+  
+  __m128 r = _mm_mul_ps(c0, _mm_set1_ps(v.x()));
+  r = _mm_add_ps(r, _mm_mul_ps(c1, _mm_set1_ps(v.y())));
+  r = _mm_add_ps(r, _mm_mul_ps(c2, _mm_set1_ps(v.z())));
+  r = _mm_add_ps(r, _mm_mul_ps(c3, _mm_set1_ps(v.w())));
+  
+  float out[4];
+  _mm_storeu_ps(out, r);
+  
+  return vector(out[0], out[1], out[2]);
+#else
   return vector(
       value(0, 0)*v.x() + value(0, 1)*v.y() + value(0, 2)*v.z() + value(0, 3)*v.w(),
       value(1, 0)*v.x() + value(1, 1)*v.y() + value(1, 2)*v.z() + value(1, 3)*v.w(),
       value(2, 0)*v.x() + value(2, 1)*v.y() + value(2, 2)*v.z() + value(2, 3)*v.w()
                 );
+#endif
+}
+
+void matrix::transform(const float *in, float *out, std::size_t count) const
+{
+#ifdef LDR_MATH_SSE
+  // Columns of the upper three rows; the fourth lane is not stored
+  __m128 c0 = _mm_loadu_ps(m_matrix[0]);
+  __m128 c1 = _mm_loadu_ps(m_matrix[1]);
+  __m128 c2 = _mm_loadu_ps(m_matrix[2]);
+  __m128 c3 = _mm_loadu_ps(m_matrix[3]);
+  _MM_TRANSPOSE4_PS(c0, c1, c2, c3);
+  
+  for (std::size_t i = 0; i < count; ++i, in += 3, out += 3) {
+    __m128 r = _mm_mul_ps(c0, _mm_set1_ps(in[0]));
+    r = _mm_add_ps(r, _mm_mul_ps(c1, _mm_set1_ps(in[1])));
+    r = _mm_add_ps(r, _mm_mul_ps(c2, _mm_set1_ps(in[2])));
+    r = _mm_add_ps(r, c3);
+    
+    _mm_storel_pi((__m64 *) out, r);
+    _mm_store_ss(out + 2, _mm_movehl_ps(r, r));
+  }
+#else
+  for (std::size_t i = 0; i < count; ++i, in += 3, out += 3) {
+    float x = in[0], y = in[1], z = in[2];
+    
+    out[0] = value(0, 0)*x + value(0, 1)*y + value(0, 2)*z + value(0, 3);
+    out[1] = value(1, 0)*x + value(1, 1)*y + value(1, 2)*z + value(1, 3);
+    out[2] = value(2, 0)*x + value(2, 1)*y + value(2, 2)*z + value(2, 3);
+  }
+#endif
 }
 
 // Scalar multiplication
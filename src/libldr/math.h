@@ -7,6 +7,7 @@
 #ifndef _LIBLDR_MATH_H_
 #define _LIBLDR_MATH_H_
 
+#include <cstddef>
 #include <cstring>
 #include <string>
 
@@ -22,7 +23,7 @@ namespace ldraw
 class LIBLDR_EXPORT vector
 {
  public:
-  vector() { m_array[0] = 0.0f, m_array[1] = 0.0f, m_array[2] = 0.0f; }
+  vector() { m_array[0] = 0.0f, m_array[1] = 0.0f, m_array[2] = 0.0f; m_array[3] = 1.0f; }
   vector(float x, float y, float z, float w = 1.0f) { m_array[0] = x, m_array[1] = y, m_array[2] = z; m_array[3] = w; }
   vector(const vector &p) { m_array[0] = p.x(), m_array[1] = p.y(), m_array[2] = p.z(), m_array[3] = p.w(); }
   ~vector() {}
@@ -79,6 +80,14 @@ class LIBLDR_EXPORT matrix
   matrix operator~ () const; // Inversion
   matrix transpose() const;
   
+  // Transforms count packed xyz points (w = 1) from in to out, which may be
+  // the same array. Same results as operator* on each point, but the matrix
+  // is set up only once.
+  void transform(const float *in, float *out, std::size_t count) const;
+  
+  // Whether the last row is (0, 0, 0, 1), as for every LDraw transformation
+  bool is_affine() const { return m_matrix[3][0] == 0.0f && m_matrix[3][1] == 0.0f && m_matrix[3][2] == 0.0f && m_matrix[3][3] == 1.0f; }
+  
   vector get_translation_vector() const;
   void set_translation_vector(const vector &v);
   
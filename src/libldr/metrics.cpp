@@ -8,17 +8,80 @@
 #include "filter.h"
 #include "model.h"
 #include "utils.h"
+#include "visitor.h"
 
 #include "metrics.h"
 
 namespace ldraw
 {
 
+class metrics::walker : public element_visitor<metrics::walker>
+{
+ public:
+  walker(metrics *m, std::stack<matrix> *modelview_matrix, const filter *filter, bool orthogonal, int depth)
+      : m_metrics(m), m_modelview_matrix(modelview_matrix), m_filter(filter), m_orthogonal(orthogonal), m_depth(depth) {}
+  
+  void visit_line(const element_line *l)
+  {
+    test(l->pos1());
+    test(l->pos2());
+  }
+  
+  void visit_triangle(const element_triangle *l)
+  {
+    test(l->pos1());
+    test(l->pos2());
+    test(l->pos3());
+  }
+  
+  void visit_quadrilateral(const element_quadrilateral *l)
+  {
+    test(l->pos1());
+    test(l->pos2());
+    test(l->pos3());
+    test(l->pos4());
+  }
+  
+  void visit_ref(const element_ref *l)
+  {
+    if (!l->get_model())
+      return;
+    
+    m_modelview_matrix->push(m_modelview_matrix->top() * l->get_matrix());
+    
+    if (utils::is_stud(l)) {
+      // niche optimization: assume a stud as a line.
+      test(vector(0.0f, 0.0f, 0.0f));
+      test(vector(0.0f, -4.0f, 0.0f));
+    } else {
+      model *m = l->get_model();
+      
+      if (m_orthogonal && utils::is_orthogonal(m_modelview_matrix->top()))
+        m_metrics->dimension_test(m_modelview_matrix->top(), *m->shared_custom_data<metrics>());
+      else
+        m_metrics->do_recursive(m, m_modelview_matrix, m_filter, false, m_depth + 1);
+    }
+    
+    m_modelview_matrix->pop();
+  }
+  
+ private:
+  void test(const vector &v) { m_metrics->dimension_test(m_modelview_matrix->top() * v); }
+  
+  metrics *m_metrics;
+  std::stack<matrix> *m_modelview_matrix;
+  const filter *m_filter;
+  bool m_orthogonal;
+  int m_depth;
+};
+
 metrics::metrics(model *m, void *arg)
     : extension(m, arg)
 {
   m_null = true;
   m_started = false;
+  m_tracking = false;
+  m_dirty = false;
 }
 
 metrics::metrics(const vector &min, const vector &max)
@@ -26,6 +89,8 @@ metrics::metrics(const vector &min, const vector &max)
 {
   m_null = false;
   m_started = false;
+  m_tracking = false;
+  m_dirty = false;
   
   m_min = min;
   m_max = max;
@@ -34,8 +99,11 @@ metrics::metrics(const vector &min, const vector &max)
 metrics& metrics::operator=(const metrics &rhs)
 {
   m_null = rhs.m_null;
-  m_min = rhs.m_min;
-  m_max = rhs.m_max;
+  m_min = rhs.min_();
+  m_max = rhs.max_();
+  m_tracking = false;
+  m_dirty = false;
+  m_bounds.clear();
   
   return *this;
 }
@@ -47,9 +115,15 @@ void metrics::update()
 
 void metrics::update(const filter *filter)
 {
+  if (m_tracking && !filter) {
+    track();
+    return;
+  }
+  
   std::stack<matrix> modelview_matrix;
   
   m_started = true;
+  m_dirty = false;
   
   // set dimension as arbitrary initial value
   m_min = vector(0.0f, 0.0f, 0.0f);
@@ -62,58 +136,223 @@ void metrics::update(const filter *filter)
   do_recursive(m_model, &modelview_matrix, filter);
 }
 
-void metrics::do_recursive(const model *m, std::stack<matrix> *modelview_matrix, const filter *filter, bool orthogonal, int depth)
+void metrics::track()
 {
-  int idx = 0;
+  m_tracking = true;
+  m_bounds.clear();
   
-  for (model::const_iterator it = m->elements().begin(); it != m->elements().end(); ++it) {
-    if (filter && !filter->query(m, idx, depth)) {
-      ++idx;
-      continue;
+  for (model::const_iterator it = m_model->elements().begin(); it != m_model->elements().end(); ++it)
+    insert_bounds(*it);
+  
+  rebuild();
+}
+
+bool metrics::element_bounds(const element_base *e, vector &min, vector &max) const
+{
+  if (m_tracking) {
+    bounds_map::const_iterator it = m_bounds.find(e);
+    if (it == m_bounds.end())
+      return false;
+    
+    min = (*it).second.min;
+    max = (*it).second.max;
+    
+    return true;
+  }
+  
+  return compute_bounds(e, min, max);
+}
+
+bool metrics::compute_bounds(const element_base *e, vector &min, vector &max) const
+{
+  metrics single(m_model);
+  std::stack<matrix> modelview_matrix;
+  
+  single.m_started = true;
+  modelview_matrix.push(matrix());
+  walker(&single, &modelview_matrix, 0L, true, 0).dispatch(e);
+  
+  // Nothing was tested
+  if (single.m_started)
+    return false;
+  
+  min = single.m_min;
+  max = single.m_max;
+  
+  return true;
+}
+
+void metrics::element_inserted(const element_base *e)
+{
+  if (!m_tracking)
+    invalidate();
+  else if (insert_bounds(e))
+    propagate();
+}
+
+void metrics::element_removed(const element_base *e)
+{
+  if (!m_tracking)
+    invalidate();
+  else if (remove_bounds(e))
+    propagate();
+}
+
+void metrics::element_changed(const element_base *e)
+{
+  if (!m_tracking) {
+    invalidate();
+  } else {
+    bool removed = remove_bounds(e);
+    bool inserted = insert_bounds(e);
+    
+    if (removed || inserted)
+      propagate();
+  }
+}
+
+void metrics::elements_cleared()
+{
+  m_bounds.clear();
+  m_min = vector(0.0f, 0.0f, 0.0f);
+  m_max = vector(0.0f, 0.0f, 0.0f);
+  m_dirty = false;
+  
+  // The elements were removed without a word each
+  propagate();
+}
+
+std::size_t metrics::memory_usage() const
+{
+  return m_bounds.bucket_count() * sizeof(void *) + m_bounds.size() * (sizeof(bounds_map::value_type) + 2 * sizeof(void *));
+}
+
+// Adds the box of e; true if the model's box grew
+bool metrics::insert_bounds(const element_base *e)
+{
+  bounds b;
+  
+  if (!compute_bounds(e, b.min, b.max))
+    return false;
+  
+  m_bounds[e] = b;
+  
+  if (m_dirty)
+    return true;
+  
+  if (m_bounds.size() == 1) {
+    m_min = b.min;
+    m_max = b.max;
+    return true;
+  }
+  
+  bool grown = false;
+  for (int i = 0; i < 3; ++i) {
+    if (b.min[i] < m_min[i]) {
+      m_min[i] = b.min[i];
+      grown = true;
+    }
+    if (b.max[i] > m_max[i]) {
+      m_max[i] = b.max[i];
+      grown = true;
     }
+  }
+  
+  return grown;
+}
+
+// Drops the box of e; true if it was on the boundary of the model's box,
+// which is then rebuilt on the next access
+bool metrics::remove_bounds(const element_base *e)
+{
+  bounds_map::iterator it = m_bounds.find(e);
+  
+  if (it == m_bounds.end())
+    return false;
+  
+  const bounds &b = (*it).second;
+  bool boundary = false;
+  for (int i = 0; i < 3; ++i) {
+    if (b.min[i] <= m_min[i] || b.max[i] >= m_max[i])
+      boundary = true;
+  }
+  
+  m_bounds.erase(it);
+  
+  if (boundary)
+    m_dirty = true;
+  
+  return boundary;
+}
+
+void metrics::invalidate()
+{
+  if (!m_dirty) {
+    m_dirty = true;
+    propagate();
+  }
+}
+
+void metrics::propagate()
+{
+  model_multipart *mp = m_model->parent();
+  
+  if (!mp)
+    return;
+  
+  // Once for the whole batch
+  if (mp->is_batching()) {
+    mp->m_resized.insert(m_model);
+    return;
+  }
+  
+  // Through the model, so that its other extensions see the new box too
+  const std::unordered_set<element_ref *> &refs = mp->referrers(m_model);
+  for (std::unordered_set<element_ref *>::const_iterator it = refs.begin(); it != refs.end(); ++it) {
+    if ((*it)->parent())
+      (*it)->parent()->element_changed(*it);
+  }
+}
+
+void metrics::rebuild() const
+{
+  if (!m_tracking) {
+    const_cast<metrics *>(this)->update();
+    return;
+  }
+  
+  m_dirty = false;
+  m_min = vector(0.0f, 0.0f, 0.0f);
+  m_max = vector(0.0f, 0.0f, 0.0f);
+  
+  bool first = true;
+  for (bounds_map::const_iterator it = m_bounds.begin(); it != m_bounds.end(); ++it) {
+    const bounds &b = (*it).second;
     
-    type elemtype = (*it)->get_type();
+    if (first) {
+      m_min = b.min;
+      m_max = b.max;
+      first = false;
+      continue;
+    }
     
-    if (elemtype == type_line) {
-      element_line *l = CAST_AS_LINE(*it);
-      dimension_test(modelview_matrix->top() * l->pos1());
-      dimension_test(modelview_matrix->top() * l->pos2());
-    } else if (elemtype == type_triangle) {
-      element_triangle *l = CAST_AS_TRIANGLE(*it);
-      dimension_test(modelview_matrix->top() * l->pos1());
-      dimension_test(modelview_matrix->top() * l->pos2());
-      dimension_test(modelview_matrix->top() * l->pos3());
-    } else if (elemtype == type_quadrilateral) {
-      element_quadrilateral *l = CAST_AS_QUADRILATERAL(*it);
-      dimension_test(modelview_matrix->top() * l->pos1());
-      dimension_test(modelview_matrix->top() * l->pos2());
-      dimension_test(modelview_matrix->top() * l->pos3());
-      dimension_test(modelview_matrix->top() * l->pos4());
-    } else if (elemtype == type_ref) {
-      element_ref *l = CAST_AS_REF(*it);
-      if (l->get_model()) {
-        modelview_matrix->push(modelview_matrix->top() * l->get_matrix());
-	
-        if (utils::is_stud(l)) {
-          // niche optimization: assume a stud as a line.
-          dimension_test(modelview_matrix->top() * vector(0.0f, 0.0f, 0.0f));
-          dimension_test(modelview_matrix->top() * vector(0.0f, -4.0f, 0.0f));
-        } else {
-          model *m = l->get_model();
-          
-          if (orthogonal && utils::is_orthogonal(modelview_matrix->top())) {
-            if (!m->custom_data<metrics>())
-              m->update_custom_data<metrics>();
-            
-            dimension_test(modelview_matrix->top(), *m->custom_data<metrics>());
-          } else {
-            do_recursive(m, modelview_matrix, filter, false, depth + 1);
-          }
-        }
-        
-        modelview_matrix->pop();
-      }
+    for (int i = 0; i < 3; ++i) {
+      if (b.min[i] < m_min[i])
+        m_min[i] = b.min[i];
+      if (b.max[i] > m_max[i])
+        m_max[i] = b.max[i];
     }
+  }
+}
+
+void metrics::do_recursive(const model *m, std::stack<matrix> *modelview_matrix, const filter *filter, bool orthogonal, int depth)
+{
+  walker w(this, modelview_matrix, filter, orthogonal, depth);
+  int idx = 0;
+  
+  for (model::const_iterator it = m->elements().begin(); it != m->elements().end(); ++it) {
+    if (!filter || filter->query(m, idx, depth))
+      w.dispatch(*it);
     
     ++idx;
   }
@@ -8,6 +8,7 @@
 #define _LIBLDR_METRICS_H_
 
 #include <stack>
+#include <unordered_map>
 
 #include "extension.h"
 #include "math.h"
@@ -15,9 +16,21 @@
 namespace ldraw
 {
 
+class element_base;
 class filter;
 class model;
 
+// Bounding box of a model.
+//
+// By default the box is computed by update(), and an edit of the model only
+// marks it stale, to be recomputed on the next access. A tracked box (see
+// track()) keeps the box of every element and is maintained on each edit
+// instead: inserting or moving an element extends the box at once, and only
+// removing an element on its boundary leaves a rebuild from the remaining
+// element boxes to the next access. Changes are passed on to the models
+// referencing this one, as changes of the referencing elements; within a
+// batch of the document (see model_multipart::begin_batch()), once at its
+// end.
 class LIBLDR_EXPORT metrics : public extension
 {
   public:
@@ -32,21 +45,56 @@ class LIBLDR_EXPORT metrics : public extension
     void update();
     void update(const filter *filter);
 
+    // Computes the box and keeps it current from then on
+    void track();
+    bool is_tracking() const { return m_tracking; }
+
+    // Box of a single element of the model; false if it has no extent
+    bool element_bounds(const element_base *e, vector &min, vector &max) const;
+
     bool is_null() const { return m_null; }
-    const vector& min_() const { return m_min; }
-    const vector& max_() const { return m_max; }
+    const vector& min_() const { if (m_dirty) rebuild(); return m_min; }
+    const vector& max_() const { if (m_dirty) rebuild(); return m_max; }
+
+    virtual void element_inserted(const element_base *e);
+    virtual void element_removed(const element_base *e);
+    virtual void element_changed(const element_base *e);
+    virtual void elements_cleared();
+
+    virtual std::size_t memory_usage() const;
 
   private:
+    struct bounds
+    {
+      vector min;
+      vector max;
+    };
+
+    typedef std::unordered_map<const element_base *, bounds> bounds_map;
+
+    // Tests the vertices of the elements dispatched to it (visitor.h)
+    class walker;
+
     void do_recursive(const model *m, std::stack<matrix> *modelview_matrix,
         const filter *filter = 0L, bool orthogonal = true, int depth = 0);
     void dimension_test(const vector &vec);
     void dimension_test(const matrix &transformation, const metrics &m);
+
+    bool compute_bounds(const element_base *e, vector &min, vector &max) const;
+    bool insert_bounds(const element_base *e);
+    bool remove_bounds(const element_base *e);
+    void invalidate();
+    void propagate();
+    void rebuild() const;
 	
   protected:
     bool m_null;
-    vector m_min;
-    vector m_max;
+    mutable vector m_min;
+    mutable vector m_max;
     bool m_started;
+    bool m_tracking;
+    mutable bool m_dirty;
+    bounds_map m_bounds;
 };
 
 };
@@ -6,15 +6,87 @@
 
 #include <algorithm>
 
+#include "bfc.h"
 #include "model.h"
 #include "reader.h"
-#include "utils.h"
 
 namespace ldraw
 {
 
+namespace
+{
+
+// Heap bytes behind a string; none when it fits in the string itself
+std::size_t string_usage(const std::string &s)
+{
+  const char *p = s.data();
+  
+  if (p >= (const char *) &s && p < (const char *) (&s + 1))
+    return 0;
+  
+  return s.capacity() + 1;
+}
+
+// Size of a map node holding value_type T, assuming a red-black tree
+template <class T> std::size_t map_node_usage()
+{
+  return sizeof(T) + 3 * sizeof(void *) + sizeof(int);
+}
+
+std::size_t element_size(const element_base *e)
+{
+  switch (e->get_type()) {
+    case type_comment:
+      return sizeof(element_comment);
+    case type_state:
+      return sizeof(element_state);
+    case type_print:
+      return sizeof(element_print);
+    case type_ref:
+      return sizeof(element_ref);
+    case type_line:
+      return sizeof(element_line);
+    case type_triangle:
+      return sizeof(element_triangle);
+    case type_quadrilateral:
+      return sizeof(element_quadrilateral);
+    case type_condline:
+      return sizeof(element_condline);
+    case type_bfc:
+      return sizeof(element_bfc);
+    default:
+      return 0;
+  }
+}
+
+// An extension model::shared_custom_data() is building
+struct building
+{
+  const model *owner;
+  std::string identifier;
+  extension *data;
+};
+
+std::vector<building> s_building;
+
+std::size_t element_payload(const element_base *e)
+{
+  switch (e->get_type()) {
+    case type_comment:
+      return string_usage(element_cast<element_comment>(e)->get_comment());
+    case type_print:
+      return string_usage(element_cast<element_print>(e)->get_string());
+    case type_ref:
+      return string_usage(element_cast<element_ref>(e)->filename());
+    default:
+      return 0;
+  }
+}
+
+}
+
 model::model(const std::string &desc, const std::string &name, const std::string &author, model_multipart *parent)
-    : m_desc(desc), m_name(name), m_author(author), m_null(false), m_parent(parent), m_model_type(general)
+    : m_desc(desc), m_name(name), m_atom(atom_table::intern(name)), m_author(author), m_null(false), m_parent(parent), m_data(0L), m_model_type(general)
 {
 }
 
@@ -22,8 +94,34 @@ model::~model()
 {
   clear();
   
-  for (std::map<std::string, extension *>::iterator it = m_data.begin(); it != m_data.end(); ++it)
-    delete (*it).second;
+  extension_entry *e = m_data.load();
+  while (e) {
+    extension_entry *next = e->next.load();
+    delete e->data;
+    delete e;
+    e = next;
+  }
+}
+
+std::size_t model::memory_usage() const
+{
+  std::size_t size = sizeof(model);
+  
+  size += string_usage(m_desc) + string_usage(m_name) + string_usage(m_author);
+  size += m_elements.capacity() * sizeof(element_base *);
+  
+  for (const_iterator it = m_elements.begin(); it != m_elements.end(); ++it) {
+    size += element_size(*it);
+    size += element_payload(*it);
+  }
+  
+  for (std::multimap<std::string, std::string>::const_iterator it = m_headers.begin(); it != m_headers.end(); ++it)
+    size += map_node_usage<std::pair<const std::string, std::string> >() + string_usage((*it).first) + string_usage((*it).second);
+  
+  for (const extension_entry *e = m_data.load(); e; e = e->next.load())
+    size += sizeof(extension_entry) + string_usage(e->identifier) + e->data->memory_usage();
+  
+  return size;
 }
 
 bool model::is_submodel_of(const model_multipart *m) const
@@ -82,6 +180,9 @@ void model::insert_element(element_base *e, int pos)
     m_elements.push_back(e);
   else
     m_elements.insert(m_elements.begin() + pos, e);
+  
+  for (extension_entry *it = m_data.load(); it; it = it->next.load())
+    it->data->element_inserted(e);
 }
 
 bool model::delete_element(int pos)
@@ -92,12 +193,114 @@ bool model::delete_element(int pos)
   if (pos == -1)
     pos = m_elements.size() - 1;
   
-  delete m_elements[pos];
+  for (extension_entry *it = m_data.load(); it; it = it->next.load())
+    it->data->element_removed(m_elements[pos]);
+  
+  destroy_element(m_elements[pos]);
   m_elements.erase(m_elements.begin() + pos);
   
   return true;
 }
 
+void* model::allocate_element(type t)
+{
+  slab *s = m_parent ? m_parent->element_slab(t) : 0L;
+  
+  return s ? s->allocate() : 0L;
+}
+
+// Elements in a slab of the parent go back to it, the rest were new'ed
+void model::destroy_element(element_base *e)
+{
+  slab *s = m_parent ? m_parent->element_slab(e->get_type()) : 0L;
+  
+  if (s && s->owns(e)) {
+    e->~element_base();
+    s->free(e);
+  } else {
+    delete e;
+  }
+}
+
+void model::element_changed(const element_base *e)
+{
+  for (extension_entry *it = m_data.load(); it; it = it->next.load())
+    it->data->element_changed(e);
+}
+
+extension* model::find_extension(const std::string &identifier) const
+{
+  for (const extension_entry *e = m_data.load(std::memory_order_acquire); e; e = e->next.load(std::memory_order_acquire)) {
+    if (e->identifier == identifier)
+      return e->data;
+  }
+  
+  return 0L;
+}
+
+// Replaces the extension of that name, or links a new entry in at the end
+void model::set_extension(const std::string &identifier, extension *ext)
+{
+  std::atomic<extension_entry *> *link = &m_data;
+  
+  for (extension_entry *e; (e = link->load(std::memory_order_acquire)); link = &e->next) {
+    if (e->identifier == identifier) {
+      delete e->data;
+      e->data = ext;
+      return;
+    }
+  }
+  
+  extension_entry *e = new extension_entry;
+  e->identifier = identifier;
+  e->data = ext;
+  e->next.store(0L, std::memory_order_relaxed);
+  link->store(e, std::memory_order_release);
+}
+
+void model::remove_extension(const std::string &identifier)
+{
+  std::atomic<extension_entry *> *link = &m_data;
+  
+  for (extension_entry *e; (e = link->load()); link = &e->next) {
+    if (e->identifier == identifier) {
+      link->store(e->next.load());
+      delete e->data;
+      delete e;
+      return;
+    }
+  }
+}
+
+std::recursive_mutex& model::extension_mutex()
+{
+  static std::recursive_mutex mutex;
+  
+  return mutex;
+}
+
+extension* model::building_extension(const std::string &identifier) const
+{
+  for (std::vector<building>::const_iterator it = s_building.begin(); it != s_building.end(); ++it) {
+    if ((*it).owner == this && (*it).identifier == identifier)
+      return (*it).data;
+  }
+  
+  return 0L;
+}
+
+// Pushes e, or pops the last extension built when e is null
+void model::set_building_extension(const std::string &identifier, extension *e)
+{
+  if (!e) {
+    s_building.pop_back();
+    return;
+  }
+  
+  building b = { this, identifier, e };
+  s_building.push_back(b);
+}
+
 void model::set_header(const std::string &key, const std::string &value)
 {
   m_headers.insert(make_pair(key, value));
@@ -114,9 +317,17 @@ void model::clear()
   set_desc("");
   set_author("");
   
-  for (model::iterator it = m_elements.begin(); it != m_elements.end(); ++it)
-    delete (*it);
-  m_elements.clear();
+  // The extensions hear of it once, not per element
+  if (!m_elements.empty()) {
+    model_multipart::batch b(m_parent);
+    
+    for (model::iterator it = m_elements.begin(); it != m_elements.end(); ++it)
+      destroy_element(*it);
+    m_elements.clear();
+    
+    for (extension_entry *it = m_data.load(); it; it = it->next.load())
+      it->data->elements_cleared();
+  }
   
   m_null = true;
 }
@@ -135,12 +346,41 @@ void model::clear()
     push_back(*it);
 }*/
 
+model_multipart::model_multipart()
+    : m_line_slab(sizeof(element_line)), m_triangle_slab(sizeof(element_triangle)),
+      m_quadrilateral_slab(sizeof(element_quadrilateral)), m_condline_slab(sizeof(element_condline)),
+      m_ref_slab(sizeof(element_ref)), m_batch(0)
+{
+  m_main_model.set_parent(this);
+  m_graph.insert_node(&m_main_model);
+}
+
+std::size_t model_multipart::memory_usage() const
+{
+  std::size_t size = sizeof(model_multipart) - sizeof(model) + m_main_model.memory_usage();
+  
+  for (submodel_const_iterator it = m_submodel_list.begin(); it != m_submodel_list.end(); ++it) {
+    size += map_node_usage<std::pair<const std::string, model *> >() + string_usage((*it).first);
+    size += (*it).second->memory_usage();
+  }
+  
+  // hash nodes plus one bucket pointer each
+  size += m_submodel_index.size() * (sizeof(std::pair<const atom, model *>) + 2 * sizeof(void *));
+  size += m_submodel_index.bucket_count() * sizeof(void *);
+  
+  for (std::unordered_map<atom, model_multipart*>::const_iterator it = m_external_model_list.begin(); it != m_external_model_list.end(); ++it)
+    size += sizeof(std::pair<const atom, model_multipart *>) + 2 * sizeof(void *) + (*it).second->memory_usage();
+  size += m_external_model_list.bucket_count() * sizeof(void *);
+  
+  return size;
+}
+
 bool model_multipart::contains(const model *m) const
 {
-  std::string lowercase = utils::translate_string(m->name());
+  atom a = m->name_atom();
   
-  if (m_submodel_list.find(lowercase) == m_submodel_list.end())
-    if (m_external_model_list.find(lowercase) == m_external_model_list.end())
+  if (m_submodel_index.find(a) == m_submodel_index.end())
+    if (m_external_model_list.find(a) == m_external_model_list.end())
       return false;
   
   return true;
@@ -148,6 +388,8 @@ bool model_multipart::contains(const model *m) const
 
 void model_multipart::link_submodels()
 {
+  batch b(this);
+  
   link_submodel(&m_main_model);
   
   for (submodel_iterator it = m_submodel_list.begin(); it != m_submodel_list.end(); ++it)
@@ -164,8 +406,6 @@ void model_multipart::link_submodel(model *m)
 
 bool model_multipart::link_submodel_element(element_ref *r)
 {
-  std::string fn = utils::translate_string(r->filename());
-  
   model_multipart *p = 0L;
   
   if (r->parent())
@@ -174,13 +414,13 @@ bool model_multipart::link_submodel_element(element_ref *r)
   if (p != this)
     return false;
   
-  model *m = find_submodel(fn);
+  model *m = find_submodel(r->filename_atom());
   if (m) {
     r->set_model(m);
     return true;
   }
   
-  model_multipart *ext = find_external_model(r->filename());
+  model_multipart *ext = find_external_model(r->filename_atom());
   if (!ext)
     ext = load_external_model(reader(), r->filename());
   
@@ -194,10 +434,24 @@ bool model_multipart::link_submodel_element(element_ref *r)
 
 model* model_multipart::find_submodel(const std::string &name)
 {
-  std::string lowercase = utils::translate_string(name);
-  std::map<std::string, model*>::iterator it = m_submodel_list.find(lowercase);
+  return find_submodel(atom_table::intern(name));
+}
+
+model* model_multipart::find_submodel(atom name)
+{
+  std::unordered_map<atom, model*>::iterator it = m_submodel_index.find(name);
+
+  if(it == m_submodel_index.end())
+    return 0L;
+  else
+    return (*it).second;
+}
+
+const model* model_multipart::find_submodel(atom name) const
+{
+  std::unordered_map<atom, model*>::const_iterator it = m_submodel_index.find(name);
 
-  if(it == m_submodel_list.end())
+  if(it == m_submodel_index.end())
     return 0L;
   else
     return (*it).second;
@@ -210,32 +464,50 @@ bool model_multipart::insert_submodel(model *m)
 
 bool model_multipart::insert_submodel(model *m, const std::string &key)
 {
-  std::string fn = utils::translate_string(key);
+  atom a = atom_table::intern(key);
   
   // Search for duplicate
-  if(m_submodel_list.find(fn) != m_submodel_list.end())
+  if(m_submodel_index.find(a) != m_submodel_index.end())
     return false;
 
-  m_submodel_list[fn] = m;
+  m_submodel_list[atom_table::name(a)] = m;
+  m_submodel_index[a] = m;
+  
+  // References to other submodels may have been linked already
+  m_graph.insert_node(m);
+  for (model::const_iterator it = m->elements().begin(); it != m->elements().end(); ++it) {
+    if ((*it)->get_type() == type_ref && element_cast<element_ref>(*it)->get_model())
+      update_reference(element_cast<element_ref>(*it), 0L, element_cast<element_ref>(*it)->get_model());
+  }
   
   return true;
 }
 
 bool model_multipart::remove_submodel(const std::string &name)
 {
-  std::string lowercase = utils::translate_string(name);
-  std::map<std::string, model*>::iterator it = m_submodel_list.find(lowercase);
+  atom a = atom_table::intern(name);
+  std::unordered_map<atom, model*>::iterator it = m_submodel_index.find(a);
   
-  if (it == m_submodel_list.end())
+  if (it == m_submodel_index.end())
     return false;
   
   model *m = (*it).second;
   
-  if (utils::affected_models(this, m).size() > 0)
+  if (m_graph.is_referenced(m))
     return false;
   
+  for (model::const_iterator it = m->elements().begin(); it != m->elements().end(); ++it) {
+    if ((*it)->get_type() == type_ref && element_cast<element_ref>(*it)->get_model())
+      update_reference(element_cast<element_ref>(*it), element_cast<element_ref>(*it)->get_model(), 0L);
+  }
+  
+  m_graph.remove_node(m);
+  m_referrers.erase(m);
   delete m;
-  m_submodel_list.erase(it);
+  m_relinked.erase(m);
+  m_resized.erase(m);
+  m_submodel_index.erase(it);
+  m_submodel_list.erase(atom_table::name(a));
   
   return true;
 }
@@ -253,32 +525,106 @@ bool model_multipart::rename_submodel(const std::string &name, const std::string
     return false;
   
   // rename
-  m_submodel_list.erase(utils::translate_string(name));
-  m_submodel_list[utils::translate_string(newname)] = m;
+  atom a = atom_table::intern(name), na = atom_table::intern(newname);
   
-  // search the main model
-  for (int i = 0; i < m_main_model.size(); ++i) {
-    if (m_main_model[i]->get_type() == type_ref && CAST_AS_REF(m_main_model[i])->get_model() == m)
-      CAST_AS_REF(m_main_model[i])->set_filename(newname);
-  }
+  m_submodel_list.erase(atom_table::name(a));
+  m_submodel_index.erase(a);
+  m_submodel_list[atom_table::name(na)] = m;
+  m_submodel_index[na] = m;
   
-  // search entire submodels
-  for (std::map<std::string, model *>::iterator it = m_submodel_list.begin(); it != m_submodel_list.end(); ++it) {
-    model *tm = (*it).second;
-    for (int i = 0; i < (*it).second->size(); ++i) {
-      if (tm->at(i)->get_type() == type_ref && CAST_AS_REF(tm->at(i))->get_model() == m)
-        CAST_AS_REF(tm->at(i))->set_filename(newname);
-    }
-  }
+  // Relinking takes the references out of the index and puts them back
+  const std::unordered_set<element_ref *> &refs = referrers(m);
+  std::vector<element_ref *> targets(refs.begin(), refs.end());
+  
+  for (std::vector<element_ref *>::iterator it = targets.begin(); it != targets.end(); ++it)
+    (*it)->set_filename(newname);
   
   m->set_name(newname);
   
   return true;
 }
 
-model_multipart* model_multipart::find_external_model(const std::string &name)
+const std::unordered_set<element_ref *>& model_multipart::referrers(const model *m) const
+{
+  static const std::unordered_set<element_ref *> none;
+  
+  std::unordered_map<const model *, std::unordered_set<element_ref *> >::const_iterator it = m_referrers.find(m);
+  if (it == m_referrers.end())
+    return none;
+  
+  return (*it).second;
+}
+
+std::list<model *> model_multipart::referencing_models(const model *m) const
+{
+  std::list<model *> result;
+  std::unordered_set<const model *> seen;
+  std::vector<const model *> queue(1, m);
+  
+  seen.insert(m);
+  
+  while (!queue.empty()) {
+    const std::unordered_set<element_ref *> &refs = referrers(queue.back());
+    queue.pop_back();
+    
+    for (std::unordered_set<element_ref *>::const_iterator it = refs.begin(); it != refs.end(); ++it) {
+      model *p = (*it)->parent();
+      
+      if (seen.insert(p).second) {
+        result.push_back(p);
+        queue.push_back(p);
+      }
+    }
+  }
+  
+  return result;
+}
+
+void model_multipart::update_reference(element_ref *r, model *old_target, model *new_target)
+{
+  model *from = r->parent();
+  
+  if (!m_graph.contains(from))
+    return;
+  
+  if (old_target && m_graph.contains(old_target)) {
+    m_graph.remove_edge(from, old_target);
+    
+    std::unordered_map<const model *, std::unordered_set<element_ref *> >::iterator it = m_referrers.find(old_target);
+    if (it != m_referrers.end()) {
+      (*it).second.erase(r);
+      if ((*it).second.empty())
+        m_referrers.erase(it);
+    }
+  }
+  
+  if (new_target && m_graph.contains(new_target)) {
+    m_graph.insert_edge(from, new_target);
+    m_referrers[new_target].insert(r);
+  }
+}
+
+slab* model_multipart::element_slab(type t)
+{
+  switch (t) {
+    case type_line:
+      return &m_line_slab;
+    case type_triangle:
+      return &m_triangle_slab;
+    case type_quadrilateral:
+      return &m_quadrilateral_slab;
+    case type_condline:
+      return &m_condline_slab;
+    case type_ref:
+      return &m_ref_slab;
+    default:
+      return 0L;
+  }
+}
+
+model_multipart* model_multipart::find_external_model(atom name)
 {
-  std::map<std::string, model_multipart*>::iterator it = m_external_model_list.find(utils::translate_string(name));
+  std::unordered_map<atom, model_multipart*>::iterator it = m_external_model_list.find(name);
   
   if (it == m_external_model_list.end())
     return 0L;
@@ -296,16 +642,18 @@ model_multipart* model_multipart::load_external_model(const reader &r, const std
     return 0L;
   }
   
-  remove_external_model(name);
+  atom a = atom_table::intern(name);
+  
+  remove_external_model(a);
   
-  m_external_model_list[utils::translate_string(name)] = m;
+  m_external_model_list[a] = m;
   
   return m;
 }
 
-bool model_multipart::remove_external_model(const std::string &name)
+bool model_multipart::remove_external_model(atom name)
 {
-  std::map<std::string, model_multipart*>::iterator it = m_external_model_list.find(utils::translate_string(name));
+  std::unordered_map<atom, model_multipart*>::iterator it = m_external_model_list.find(name);
   
   if (it != m_external_model_list.end()) {
     delete (*it).second;
@@ -317,20 +665,76 @@ bool model_multipart::remove_external_model(const std::string &name)
   return false;
 }
 
+void model_multipart::begin_batch()
+{
+  ++m_batch;
+}
+
+void model_multipart::end_batch()
+{
+  if (m_batch > 1) {
+    --m_batch;
+    return;
+  }
+  
+  // Telling one model may change the box of another; that is noted as well
+  // and handled in the next round
+  while (!m_relinked.empty() || !m_resized.empty()) {
+    std::unordered_set<model *> relinked, resized;
+    
+    relinked.swap(m_relinked);
+    for (std::unordered_set<model *>::iterator it = relinked.begin(); it != relinked.end(); ++it) {
+      for (model::const_iterator eit = (*it)->elements().begin(); eit != (*it)->elements().end(); ++eit) {
+        if ((*eit)->get_type() == type_ref)
+          (*it)->element_changed(*eit);
+      }
+    }
+    
+    resized.swap(m_resized);
+    for (std::unordered_set<model *>::iterator it = resized.begin(); it != resized.end(); ++it) {
+      const std::unordered_set<element_ref *> &refs = referrers(*it);
+      for (std::unordered_set<element_ref *>::const_iterator rit = refs.begin(); rit != refs.end(); ++rit) {
+        if ((*rit)->parent())
+          (*rit)->parent()->element_changed(*rit);
+      }
+    }
+  }
+  
+  m_batch = 0;
+}
+
 void model_multipart::clear()
 {
+  // Freeing the models unlinks their references; nothing to track
+  m_graph.clear();
+  m_referrers.clear();
+  
   for (model_multipart::submodel_iterator it = m_submodel_list.begin(); it != m_submodel_list.end(); ++it) {
     (*it).second->clear();
     delete (*it).second;
   }
   
-  for (std::map<std::string, model_multipart*>::iterator it = m_external_model_list.begin(); it != m_external_model_list.end(); ++it) {
+  for (std::unordered_map<atom, model_multipart*>::iterator it = m_external_model_list.begin(); it != m_external_model_list.end(); ++it) {
     delete (*it).second;
   }
   
   m_submodel_list.clear();
+  m_submodel_index.clear();
   m_external_model_list.clear();
   m_main_model.clear();
+  
+  // Every element has been destroyed; the slabs go in one piece
+  m_line_slab.release();
+  m_triangle_slab.release();
+  m_quadrilateral_slab.release();
+  m_condline_slab.release();
+  m_ref_slab.release();
+  
+  // The models an open batch noted are gone
+  m_relinked.clear();
+  m_resized.clear();
+  
+  m_graph.insert_node(&m_main_model);
 }
 
 }
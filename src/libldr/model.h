@@ -9,22 +9,30 @@
 
 #include <string>
 
+#include <atomic>
 #include <list>
 #include <map>
+#include <mutex>
+#include <new>
 #include <set>
 #include <stack>
+#include <unordered_map>
+#include <unordered_set>
 #include <utility>
 #include <vector>
 
 #include "common.h"
 #include "elements.h"
 #include "extension.h"
+#include "slab.h"
+#include "submodel_graph.h"
 
 namespace ldraw
 {
 
 class extension;
 class model_multipart;
+class part_cache;
 class part_library;
 class reader;
 
@@ -37,7 +45,7 @@ class LIBLDR_EXPORT model
   typedef std::vector<element_base*>::const_reverse_iterator reverse_iterator;
   
   explicit model(model_multipart *parent = 0L)
-      : m_null(true), m_parent(parent), m_model_type(general) {}
+      : m_atom(null_atom), m_null(true), m_parent(parent), m_data(0L), m_model_type(general) {}
   model(const std::string &desc, const std::string &name, const std::string &author, model_multipart *parent = 0L);
   ~model();
   
@@ -48,6 +56,7 @@ class LIBLDR_EXPORT model
   model_type modeltype() const { return m_model_type; }
   const std::string& desc() const { return m_desc; }
   const std::string& name() const { return m_name; }
+  atom name_atom() const { return m_atom; }
   const std::string& author() const { return m_author; }
   std::list<std::string> header(const std::string &key) const;
   const std::multimap<std::string, std::string> headers() const { return m_headers; }
@@ -63,35 +72,49 @@ class LIBLDR_EXPORT model
   void insert_element(element_base *e, int pos = -1);
   bool delete_element(int pos = -1);
   
+  // Constructs an element for this model, to be added with
+  // insert_element(). Lines, triangles, quadrilaterals, conditional lines
+  // and references come from the slabs of the parent, anything else and
+  // the elements of a model without a parent from the heap. The model
+  // frees it either way; it must not move to a model of another parent.
+  template <class T, class... Args> T* new_element(Args&&... args)
+  {
+    void *p = allocate_element(T::tag);
+    
+    if (p)
+      return new (p) T(std::forward<Args>(args)...);
+    
+    return new T(std::forward<Args>(args)...);
+  }
+  
+  // Tells the extensions that e, an element of this model, was modified in
+  // place (e.g. a new matrix or position)
+  void element_changed(const element_base *e);
+  
   void set_modeltype(model_type t) { m_model_type = t; }
   void set_desc(const std::string &desc) { m_desc = desc; }
-  void set_name(const std::string &name) { m_name = name; }
+  void set_name(const std::string &name) { m_name = name; m_atom = atom_table::intern(name); }
   void set_author(const std::string &author) { m_author = author; }
   void set_header(const std::string &key, const std::string &value);
   void remove_header(const std::string &key);
   
+  // Bytes held by the model: itself, its elements, headers and extensions
+  std::size_t memory_usage() const;
+  
   template <class T> T* init_custom_data(void *data = 0L, bool preserve = false)
   {
-    if (custom_data<T>()) {
-      if (preserve)
-        return 0L;
-      delete m_data[T::identifier()];
-    }
+    if (custom_data<T>() && preserve)
+      return 0L;
     
     T *ndata = new T(this, data);
-    m_data[T::identifier()] = ndata;
+    set_extension(T::identifier(), ndata);
     
     return ndata;
   }
   
   template <class T> T* custom_data() const
   {
-    std::map<std::string, extension *>::const_iterator it = m_data.find(T::identifier());
-    
-    if (it == m_data.end())
-      return 0L;
-    
-    return dynamic_cast<T *>((*it).second);
+    return dynamic_cast<T *>(find_extension(T::identifier()));
   }
   
   template <class T> const T* const_custom_data() const
@@ -113,21 +136,50 @@ class LIBLDR_EXPORT model
       
     }
     
-    if (!custom_data<T>())
-      init_custom_data<T>(data, preserve);
+    extension *e = find_extension(T::identifier());
+    
+    if (!e)
+      e = init_custom_data<T>(data, preserve);
     else
-      m_data[T::identifier()]->set_data(data);
+      e->set_data(data);
+    
+    e->update();
+  }
+  
+  // The extension T, created and brought up to date first if there is
+  // none. Unlike the functions above, this may be called by several
+  // threads at once on the parts and primitives of a shared part_library:
+  // extensions are created one at a time, and other threads only find an
+  // extension once it is complete.
+  template <class T> T* shared_custom_data(void *data = 0L)
+  {
+    T *ext = custom_data<T>();
     
-    m_data[T::identifier()]->update();
+    if (ext)
+      return ext;
+    
+    // Recursive, as an extension may need those of the referenced models
+    std::lock_guard<std::recursive_mutex> lock(extension_mutex());
+    
+    if ((ext = custom_data<T>()))
+      return ext;
+    
+    // A reference cycle leads back to the extension being built
+    if ((ext = dynamic_cast<T *>(building_extension(T::identifier()))))
+      return ext;
+    
+    ext = new T(this, data);
+    set_building_extension(T::identifier(), ext);
+    ext->update();
+    set_building_extension(T::identifier(), 0L);
+    set_extension(T::identifier(), ext);
+    
+    return ext;
   }
   
   template <class T> void delete_custom_data()
   {
-    std::map<std::string, extension *>::iterator it = m_data.find(T::identifier());
-    if (it != m_data.end()) {
-      delete (*it).second;
-      m_data.erase(it);
-    }
+    remove_extension(T::identifier());
   }		
   
   void clear();
@@ -136,13 +188,35 @@ class LIBLDR_EXPORT model
   typedef std::vector<element_base*>::iterator iterator;
   
   friend class model_multipart;
+  friend class part_cache;
   friend class part_library;
   friend class reader;
   
+  // Extensions in the order they were attached. Readers walk the list
+  // without a lock; an entry is complete before it is linked in.
+  struct extension_entry
+  {
+    std::string identifier;
+    extension *data;
+    std::atomic<extension_entry *> next;
+  };
+  
   void set_parent(model_multipart *parent) { m_parent = parent; }
   
+  void* allocate_element(type t);
+  void destroy_element(element_base *e);
+  
+  extension* find_extension(const std::string &identifier) const;
+  void set_extension(const std::string &identifier, extension *e);
+  void remove_extension(const std::string &identifier);
+  static std::recursive_mutex& extension_mutex();
+  // Extensions shared_custom_data() is building, under extension_mutex()
+  extension* building_extension(const std::string &identifier) const;
+  void set_building_extension(const std::string &identifier, extension *e);
+  
   std::string m_desc;
   std::string m_name;
+  atom m_atom;
   std::string m_author;
   
   std::vector<element_base*> m_elements;
@@ -152,7 +226,7 @@ class LIBLDR_EXPORT model
   bool m_null;
   model_multipart *m_parent;
   
-  std::map<std::string, extension *> m_data;
+  std::atomic<extension_entry *> m_data;
   
   model_type m_model_type;
 };
@@ -165,14 +239,19 @@ class LIBLDR_EXPORT model_multipart
   typedef std::map<std::string, model*>::const_iterator submodel_const_iterator;
   typedef std::map<std::string, model*>::reverse_iterator submodel_reverse_iterator;
   
-  model_multipart() { m_main_model.set_parent(this); }
+  model_multipart();
   ~model_multipart() { clear(); }
   
   int count() const { return m_submodel_list.size(); }
   
+  // Bytes held by the main model, the submodels and external models
+  std::size_t memory_usage() const;
+  
   model* main_model() { return &m_main_model; }
   const model* main_model() const { return &m_main_model; }
   
+  // Keyed by folded name. Add, remove and rename submodels only through
+  // the functions below, which keep the atom index in sync.
   std::map<std::string, model*>& submodel_list() { return m_submodel_list; }
   const std::map<std::string, model*>& submodel_list() const { return m_submodel_list; }
   
@@ -183,25 +262,80 @@ class LIBLDR_EXPORT model_multipart
   bool link_submodel_element(element_ref *r);
   
   model* find_submodel(const std::string &name);
+  model* find_submodel(atom name);
+  const model* find_submodel(atom name) const;
   bool insert_submodel(model *m);
   bool insert_submodel(model *m, const std::string &key);
   bool remove_submodel(const std::string &name);
   bool remove_submodel(model *m);
   bool rename_submodel(const std::string &name, const std::string &newname);
   
+  // References between the main model and the submodels, kept up to date
+  // as references are linked and unlinked (see submodel_graph).
+  bool is_cyclic() const { return m_graph.is_cyclic(); }
+  // Whether a reference from m to insert would close a cycle
+  bool creates_cycle(const model *m, const model *insert) const { return m_graph.reaches(insert, m); }
+  // The main model and the submodels, each ahead of the ones it
+  // references. Empty if there is a cycle.
+  std::vector<const model *> dependency_order() const { return m_graph.order(); }
+  
+  // Elements of the main model and the submodels that reference m
+  const std::unordered_set<element_ref *>& referrers(const model *m) const;
+  // Models referencing m directly or through other submodels
+  std::list<model *> referencing_models(const model *m) const;
+  
+  // Within a batch, references relinked and models whose box changed are
+  // only noted; the models concerned are told once, as the outermost
+  // batch ends. Linking and clearing run in one.
+  void begin_batch();
+  void end_batch();
+  bool is_batching() const { return m_batch > 0; }
+  
+  // Holds a batch of m, if any, for its lifetime
+  class batch
+  {
+   public:
+    batch(model_multipart *m) : m_model(m) { if (m_model) m_model->begin_batch(); }
+    ~batch() { if (m_model) m_model->end_batch(); }
+    
+   private:
+    model_multipart *m_model;
+  };
+  
   void clear();
   
   //void operator=(const model_multipart &rhs);
   
  private:
-  model_multipart* find_external_model(const std::string &name);
+  friend class element_ref;
+  friend class metrics;
+  friend class model;
+  
+  // The slab model::new_element() takes elements of type t from, if any
+  slab* element_slab(type t);
+  
+  void update_reference(element_ref *r, model *old_target, model *new_target);
+  model_multipart* find_external_model(atom name);
   model_multipart* load_external_model(const reader &r, const std::string &name);
-  bool remove_external_model(const std::string &name);
+  bool remove_external_model(atom name);
   
  private:
+  // Ahead of the models, so that they outlive their elements
+  slab m_line_slab;
+  slab m_triangle_slab;
+  slab m_quadrilateral_slab;
+  slab m_condline_slab;
+  slab m_ref_slab;
+  
   model m_main_model;
   std::map<std::string, model*> m_submodel_list;
-  std::map<std::string, model_multipart*> m_external_model_list;
+  std::unordered_map<atom, model*> m_submodel_index;
+  std::unordered_map<atom, model_multipart*> m_external_model_list;
+  mutable submodel_graph m_graph;
+  std::unordered_map<const model *, std::unordered_set<element_ref *> > m_referrers;
+  int m_batch;
+  std::unordered_set<model *> m_relinked;  // models with references relinked
+  std::unordered_set<model *> m_resized;   // models whose box changed
 };
 
 }
@@ -0,0 +1,482 @@
+/* libLDR: Portable and easy-to-use LDraw format abstraction & I/O reference library *
+ * To obtain more information about LDraw, visit http://www.ldraw.org.               *
+ * Distributed in terms of the GNU Lesser General Public License v3                  *
+ *                                                                                   *
+ * Author: (c)2006-2013 Park "segfault" J. K. <mastermind_at_planetmono_dot_org>     */
+
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#ifdef WIN32
+#include <process.h>
+#define getpid _getpid
+#else
+#include <unistd.h>
+#endif
+
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <sstream>
+
+#include "bfc.h"
+#include "elements.h"
+#include "mapped_file.h"
+#include "model.h"
+
+#include "part_cache.h"
+
+namespace ldraw
+{
+
+/* .ldbin layout. All values are in host byte order; the byte order marker
+ * rejects files built on a different architecture.
+ *
+ *   char[6]  "LDBIN\0"
+ *   u16      format version
+ *   u32      byte order marker
+ *   u64      source size
+ *   i64      source modification time, seconds
+ *   i64      source modification time, nanoseconds within the second
+ *   str      source path
+ *   u32      number of models (main model first)
+ *   model    ...
+ *   u32      end marker
+ *
+ * model:     str key, str name, str desc, str author, u8 model type,
+ *            u8 bfc flag, u8 certification, u8 winding,
+ *            u32 header count, (str key, str value)...,
+ *            u32 element count, element...
+ * element:   u8 type, followed by
+ *            comment/print: str
+ *            state/bfc: u8
+ *            ref: i32 color, f32[12] (a..i, x, y, z), str filename
+ *            line/triangle/quadrilateral/condline: i32 color, f32[3n]
+ * str:       u32 length, bytes */
+
+namespace
+{
+
+const char cache_magic[6] = { 'L', 'D', 'B', 'I', 'N', '\0' };
+const unsigned short cache_version = 2;
+const unsigned int cache_byte_order = 0x01020304;
+const unsigned int cache_end = 0x4c444245;
+
+class encoder
+{
+ public:
+  template <typename T> void put(T v) { m_buf.append((const char *) &v, sizeof(T)); }
+  void put_string(const std::string &s) { put<unsigned int>(s.length()); m_buf.append(s); }
+  void put_vector(const vector &v) { put<float>(v.x()); put<float>(v.y()); put<float>(v.z()); }
+
+  void put_model(const std::string &key, const model *m);
+
+  const std::string& buffer() const { return m_buf; }
+
+ private:
+  std::string m_buf;
+};
+
+void encoder::put_model(const std::string &key, const model *m)
+{
+  put_string(key);
+  put_string(m->name());
+  put_string(m->desc());
+  put_string(m->author());
+  put<unsigned char>(m->modeltype());
+
+  const bfc_certification *cert = m->custom_data<bfc_certification>();
+  put<unsigned char>(cert ? 1 : 0);
+  put<unsigned char>(cert ? cert->certification() : 0);
+  put<unsigned char>(cert ? cert->orientation() : 0);
+
+  const std::multimap<std::string, std::string> headers = m->headers();
+  put<unsigned int>(headers.size());
+  for (std::multimap<std::string, std::string>::const_iterator it = headers.begin(); it != headers.end(); ++it) {
+    put_string((*it).first);
+    put_string((*it).second);
+  }
+
+  put<unsigned int>(m->elements().size());
+  for (model::const_iterator it = m->elements().begin(); it != m->elements().end(); ++it) {
+    type t = (*it)->get_type();
+    put<unsigned char>(t);
+
+    switch (t) {
+      case type_comment:
+        put_string(static_cast<const element_comment *>(*it)->get_comment());
+        break;
+      case type_print:
+        put_string(static_cast<const element_print *>(*it)->get_string());
+        break;
+      case type_state:
+        put<unsigned char>(static_cast<const element_state *>(*it)->get_state());
+        break;
+      case type_bfc:
+        put<unsigned char>(static_cast<const element_bfc *>(*it)->get_command());
+        break;
+      case type_ref: {
+        const element_ref *e = static_cast<const element_ref *>(*it);
+        const matrix &mt = e->get_matrix();
+        put<int>(e->get_color().get_id());
+        for (int i = 0; i < 3; ++i)
+          for (int j = 0; j < 3; ++j)
+            put<float>(mt.value(i, j));
+        for (int i = 0; i < 3; ++i)
+          put<float>(mt.value(i, 3));
+        put_string(e->filename());
+        break;
+      }
+      case type_line: {
+        const element_line *e = static_cast<const element_line *>(*it);
+        put<int>(e->get_color().get_id());
+        put_vector(e->pos1());
+        put_vector(e->pos2());
+        break;
+      }
+      case type_triangle: {
+        const element_triangle *e = static_cast<const element_triangle *>(*it);
+        put<int>(e->get_color().get_id());
+        put_vector(e->pos1());
+        put_vector(e->pos2());
+        put_vector(e->pos3());
+        break;
+      }
+      case type_quadrilateral: {
+        const element_quadrilateral *e = static_cast<const element_quadrilateral *>(*it);
+        put<int>(e->get_color().get_id());
+        put_vector(e->pos1());
+        put_vector(e->pos2());
+        put_vector(e->pos3());
+        put_vector(e->pos4());
+        break;
+      }
+      case type_condline: {
+        const element_condline *e = static_cast<const element_condline *>(*it);
+        put<int>(e->get_color().get_id());
+        put_vector(e->pos1());
+        put_vector(e->pos2());
+        put_vector(e->pos3());
+        put_vector(e->pos4());
+        break;
+      }
+    }
+  }
+}
+
+// Reads from a mapped cache file. Any out-of-bounds read or unknown value
+// clears the good flag; callers check it and throw the result away.
+class decoder
+{
+ public:
+  decoder(const char *data, std::size_t size) : m_pos(data), m_end(data + size), m_good(true) {}
+
+  bool good() const { return m_good; }
+
+  template <typename T> T get()
+  {
+    T v = T();
+    if (!m_good || (std::size_t) (m_end - m_pos) < sizeof(T)) {
+      m_good = false;
+      return v;
+    }
+
+    std::memcpy(&v, m_pos, sizeof(T));
+    m_pos += sizeof(T);
+    return v;
+  }
+
+  std::string get_string()
+  {
+    unsigned int len = get<unsigned int>();
+    if (!m_good || (std::size_t) (m_end - m_pos) < len) {
+      m_good = false;
+      return std::string();
+    }
+
+    std::string s(m_pos, len);
+    m_pos += len;
+    return s;
+  }
+
+  vector get_vector()
+  {
+    float x = get<float>();
+    float y = get<float>();
+    float z = get<float>();
+    return vector(x, y, z);
+  }
+
+  bool get_magic()
+  {
+    if ((std::size_t) (m_end - m_pos) < sizeof(cache_magic) || std::memcmp(m_pos, cache_magic, sizeof(cache_magic)) != 0)
+      return false;
+
+    m_pos += sizeof(cache_magic);
+    return true;
+  }
+
+  void get_model(model *m, std::string *key, std::vector<element_base *> *elements);
+  element_base* get_element(model *m);
+
+ private:
+  const char *m_pos;
+  const char *m_end;
+  bool m_good;
+};
+
+void decoder::get_model(model *m, std::string *key, std::vector<element_base *> *elements)
+{
+  *key = get_string();
+  m->set_name(get_string());
+  m->set_desc(get_string());
+  m->set_author(get_string());
+
+  unsigned char modeltype = get<unsigned char>();
+  if (modeltype > model::general)
+    m_good = false;
+  m->set_modeltype((model::model_type) modeltype);
+
+  unsigned char has_cert = get<unsigned char>();
+  unsigned char cert = get<unsigned char>();
+  unsigned char winding = get<unsigned char>();
+  if (has_cert) {
+    bfc_certification *c = m->init_custom_data<bfc_certification>();
+    c->set_certification((bfc_certification::cert_status) cert);
+    c->set_orientation((bfc_certification::winding) winding);
+  }
+
+  unsigned int headers = get<unsigned int>();
+  for (unsigned int i = 0; i < headers && m_good; ++i) {
+    std::string k = get_string();
+    std::string v = get_string();
+    m->set_header(k, v);
+  }
+
+  unsigned int count = get<unsigned int>();
+  elements->clear();
+  for (unsigned int i = 0; i < count && m_good; ++i) {
+    element_base *e = get_element(m);
+    if (e)
+      elements->push_back(e);
+  }
+}
+
+element_base* decoder::get_element(model *m)
+{
+  unsigned char t = get<unsigned char>();
+  if (!m_good)
+    return 0L;
+
+  switch (t) {
+    case type_comment:
+      return m->new_element<element_comment>(get_string());
+    case type_print:
+      return m->new_element<element_print>(get_string());
+    case type_state:
+      return m->new_element<element_state>((element_state::state) get<unsigned char>());
+    case type_bfc:
+      return m->new_element<element_bfc>((element_bfc::command) get<unsigned char>());
+    case type_ref: {
+      int col = get<int>();
+      float v[12];
+      for (int i = 0; i < 12; ++i)
+        v[i] = get<float>();
+      std::string fn = get_string();
+      if (!m_good)
+        return 0L;
+      return m->new_element<element_ref>(color(col), matrix(v[0], v[1], v[2], v[3], v[4], v[5], v[6], v[7], v[8], v[9], v[10], v[11]), fn);
+    }
+    case type_line: {
+      int col = get<int>();
+      vector p1 = get_vector();
+      vector p2 = get_vector();
+      return m->new_element<element_line>(color(col), p1, p2);
+    }
+    case type_triangle: {
+      int col = get<int>();
+      vector p1 = get_vector();
+      vector p2 = get_vector();
+      vector p3 = get_vector();
+      return m->new_element<element_triangle>(color(col), p1, p2, p3);
+    }
+    case type_quadrilateral: {
+      int col = get<int>();
+      vector p1 = get_vector();
+      vector p2 = get_vector();
+      vector p3 = get_vector();
+      vector p4 = get_vector();
+      return m->new_element<element_quadrilateral>(color(col), p1, p2, p3, p4);
+    }
+    case type_condline: {
+      int col = get<int>();
+      vector p1 = get_vector();
+      vector p2 = get_vector();
+      vector p3 = get_vector();
+      vector p4 = get_vector();
+      return m->new_element<element_condline>(color(col), p1, p2, p3, p4);
+    }
+    default:
+      m_good = false;
+      return 0L;
+  }
+}
+
+}
+
+// Unlike model::insert_element() this does not try to resolve references;
+// submodels are linked at the end of load() and everything else by the
+// part library.
+void part_cache::attach(model *m, const std::vector<element_base *> &elements)
+{
+  m->m_elements.reserve(elements.size());
+
+  for (std::vector<element_base *>::const_iterator it = elements.begin(); it != elements.end(); ++it) {
+    if ((*it)->get_type() == type_ref)
+      static_cast<element_ref *>(*it)->set_parent(m);
+    m->m_elements.push_back(*it);
+  }
+}
+
+std::string part_cache::filename(const std::string &source) const
+{
+  // FNV-1a; collisions only cost a rebuild since the path is stored too
+  unsigned long long h = 14695981039346656037ULL;
+  for (std::string::const_iterator it = source.begin(); it != source.end(); ++it) {
+    h ^= (unsigned char) *it;
+    h *= 1099511628211ULL;
+  }
+
+  char buf[32];
+  std::sprintf(buf, "%016llx.ldbin", h);
+
+  return m_path + DIRECTORY_SEPARATOR + buf;
+}
+
+bool part_cache::source_stamp(const std::string &source, stamp *s)
+{
+  struct stat st;
+  if (stat(source.c_str(), &st) != 0)
+    return false;
+
+  s->size = (unsigned long long) st.st_size;
+  s->mtime = (long long) st.st_mtime;
+#if defined(__APPLE__)
+  s->mtime_nsec = (long long) st.st_mtimespec.tv_nsec;
+#elif defined(WIN32)
+  s->mtime_nsec = 0;
+#else
+  s->mtime_nsec = (long long) st.st_mtim.tv_nsec;
+#endif
+
+  return true;
+}
+
+model_multipart* part_cache::load(const std::string &source) const
+{
+  if (!is_enabled())
+    return 0L;
+
+  stamp s;
+  if (!source_stamp(source, &s))
+    return 0L;
+
+  mapped_file file;
+  if (!file.open(filename(source)) || !file.data())
+    return 0L;
+
+  decoder d(file.data(), file.size());
+  if (!d.get_magic() || d.get<unsigned short>() != cache_version || d.get<unsigned int>() != cache_byte_order)
+    return 0L;
+
+  if (d.get<unsigned long long>() != s.size || d.get<long long>() != s.mtime || d.get<long long>() != s.mtime_nsec ||
+      d.get_string() != source || !d.good())
+    return 0L;
+
+  unsigned int count = d.get<unsigned int>();
+  if (!d.good() || count == 0)
+    return 0L;
+
+  model_multipart *m = new model_multipart();
+  std::vector<element_base *> elements;
+  std::string key;
+
+  d.get_model(m->main_model(), &key, &elements);
+  attach(m->main_model(), elements);
+  for (unsigned int i = 1; i < count && d.good(); ++i) {
+    model *sm = new model(m);
+    d.get_model(sm, &key, &elements);
+    attach(sm, elements);
+    if (!m->insert_submodel(sm, key))
+      delete sm;
+  }
+
+  if (!d.good() || d.get<unsigned int>() != cache_end || !d.good()) {
+    delete m;
+    return 0L;
+  }
+
+  if (count > 1)
+    m->link_submodels();
+
+  return m;
+}
+
+bool part_cache::store(const std::string &source, const model_multipart *m, const stamp &s) const
+{
+  if (!is_enabled())
+    return false;
+
+  // Where mtime has a resolution of one second, a file that is still being
+  // written to could change again within the same second unnoticed, as
+  // for the part library's manifest.
+  if (s.mtime >= (long long) std::time(0L) - 1)
+    return false;
+
+  encoder b;
+  b.put<unsigned short>(cache_version);
+  b.put<unsigned int>(cache_byte_order);
+  b.put<unsigned long long>(s.size);
+  b.put<long long>(s.mtime);
+  b.put<long long>(s.mtime_nsec);
+  b.put_string(source);
+  b.put<unsigned int>(1 + m->submodel_list().size());
+  b.put_model(std::string(), m->main_model());
+  for (model_multipart::submodel_const_iterator it = m->submodel_list().begin(); it != m->submodel_list().end(); ++it)
+    b.put_model((*it).first, (*it).second);
+  b.put<unsigned int>(cache_end);
+
+  // Write to a private file first so that readers never see a partial
+  // entry. Threads of one process storing the same file need distinct ones.
+  static std::atomic<unsigned int> sequence(0);
+  std::string target = filename(source);
+  std::ostringstream tmpname;
+  tmpname << target << "." << getpid() << "." << sequence++ << ".tmp";
+
+  std::ofstream out(tmpname.str().c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+  if (!out)
+    return false;
+
+  out.write(cache_magic, sizeof(cache_magic));
+  out.write(b.buffer().data(), b.buffer().length());
+  out.close();
+
+  if (!out) {
+    std::remove(tmpname.str().c_str());
+    return false;
+  }
+
+#ifdef WIN32
+  std::remove(target.c_str());
+#endif
+  if (std::rename(tmpname.str().c_str(), target.c_str()) != 0) {
+    std::remove(tmpname.str().c_str());
+    return false;
+  }
+
+  return true;
+}
+
+}
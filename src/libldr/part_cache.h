@@ -0,0 +1,65 @@
+/* libLDR: Portable and easy-to-use LDraw format abstraction & I/O reference library *
+ * To obtain more information about LDraw, visit http://www.ldraw.org.               *
+ * Distributed in terms of the GNU Lesser General Public License v3                  *
+ *                                                                                   *
+ * Author: (c)2006-2013 Park "segfault" J. K. <mastermind_at_planetmono_dot_org>     */
+
+#ifndef _LIBLDR_PART_CACHE_H_
+#define _LIBLDR_PART_CACHE_H_
+
+#include <string>
+#include <vector>
+
+#include "common.h"
+
+namespace ldraw
+{
+
+class element_base;
+class model;
+class model_multipart;
+
+// On-disk cache of parsed library files in a compact binary format (.ldbin).
+// Every source file gets its own cache file, named after a hash of its path
+// and stamped with the path, size and modification time it was built from.
+// Cache files are mapped into memory and decoded without any text parsing.
+class LIBLDR_EXPORT part_cache
+{
+ public:
+  part_cache() {}
+  explicit part_cache(const std::string &path) : m_path(path) {}
+
+  bool is_enabled() const { return !m_path.empty(); }
+  const std::string& path() const { return m_path; }
+  void set_path(const std::string &path) { m_path = path; }
+
+  // Size and modification time of a source file, with nanoseconds where
+  // the platform has them
+  struct stamp
+  {
+    unsigned long long size;
+    long long mtime;
+    long long mtime_nsec;
+  };
+
+  static bool source_stamp(const std::string &source, stamp *s);
+
+  std::string filename(const std::string &source) const;
+
+  // Returns 0L if there is no entry for source or if it is out of date.
+  model_multipart* load(const std::string &source) const;
+
+  // Stores m, parsed from source after its stamp s was taken, so that an
+  // edit during the parse leaves the entry out of date. Nothing is stored
+  // for a source modified within the last second.
+  bool store(const std::string &source, const model_multipart *m, const stamp &s) const;
+
+ private:
+  static void attach(model *m, const std::vector<element_base *> &elements);
+
+  std::string m_path;
+};
+
+}
+
+#endif
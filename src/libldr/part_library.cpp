@@ -4,14 +4,33 @@
  *                                                                                   *
  * Author: (c)2006-2008 Park "segfault" J. K. <mastermind_at_planetmono_dot_org>     */
 
+#include <sys/stat.h>
 #include <sys/types.h>
 
+#ifdef WIN32
+#include <process.h>
+#define getpid _getpid
+#else
+#include <unistd.h>
+#endif
+
 #include <algorithm>
+#include <condition_variable>
+#include <cstdio>
 #include <cstdlib>
+#include <ctime>
+#include <deque>
+#include <fstream>
 #include <iostream>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <unordered_set>
+#include <vector>
 
 #include "model.h"
 #include "reader.h"
+#include "traits.h"
 #include "utils.h"
 
 #include "part_library.h"
@@ -41,25 +60,35 @@ static const std::string predefined_path[] = {
 };
 #endif
 
-item_refcount::item_refcount()
-{
-  first = 0L, second = 0;
-}
+static const char manifest_magic[] = "LDMANIFEST 1";
 
 item_refcount::item_refcount(model_multipart *m)
+    : m_model(0L), m_refcount(0), m_size(0), m_idle(false)
 {
   set_model(m);
 }
 
+void item_refcount::set_model(model_multipart *m)
+{
+  m_model = m;
+  m_refcount = 0;
+  m_size = m ? m->memory_usage() : 0;
+}
+
 item_refcount::~item_refcount()
 {
-  if(first)
-    delete first;
+  if(m_model)
+    delete m_model;
 }
 
 part_library::part_library()
 {
   m_unlink_policy = parts | primitives;
+  m_loader_threads = 0;
+  m_budget = 0;
+  m_memory_usage = m_idle_memory_usage = 0;
+  m_lookups = m_misses = m_evictions = 0;
+  m_destroying = false;
   
   char *tmp = getenv("LDRAWDIR");
   
@@ -83,6 +112,11 @@ part_library::part_library()
 part_library::part_library(const std::string &path)
 {
   m_unlink_policy = parts | primitives;
+  m_loader_threads = 0;
+  m_budget = 0;
+  m_memory_usage = m_idle_memory_usage = 0;
+  m_lookups = m_misses = m_evictions = 0;
+  m_destroying = false;
   
   if(!read_fs(path))
     throw exception(__func__, exception::fatal, "Couldn't find LDraw part library.");
@@ -90,12 +124,177 @@ part_library::part_library(const std::string &path)
 
 part_library::~part_library()
 {
-  // FIXME Apparently not working.
+  // Pool models reference each other; freeing one unlinks its references
+  // from models that may already be gone, so unlink_element() leaves the
+  // pool alone from here on.
+  m_destroying = true;
   
-#if 0
-  for (std::map<std::string, item_refcount*>::iterator it = m_data.begin(); it != m_data.end(); ++it)
-    delete (*it).second;
-#endif
+  for (int i = 0; i < shard_count; ++i) {
+    std::unordered_map<atom, item_refcount*> &items = m_shards[i].items;
+    for (std::unordered_map<atom, item_refcount*>::iterator it = items.begin(); it != items.end(); ++it)
+      delete (*it).second;
+  }
+}
+
+int part_library::size() const
+{
+  int count = 0;
+  
+  for (int i = 0; i < shard_count; ++i) {
+    std::lock_guard<std::mutex> lock(m_shards[i].mutex);
+    count += m_shards[i].items.size();
+  }
+  
+  return count;
+}
+
+void part_library::set_memory_budget(std::size_t bytes)
+{
+  m_budget = bytes;
+  
+  if (!bytes)
+    return;
+  
+  // Models the unlink policy kept around become evictable
+  for (int i = 0; i < shard_count; ++i) {
+    shard &s = m_shards[i];
+    std::lock_guard<std::mutex> lock(s.mutex);
+    
+    for (std::unordered_map<atom, item_refcount*>::iterator it = s.items.begin(); it != s.items.end(); ++it) {
+      if (!(*it).second->refcount() && !(*it).second->m_idle)
+        retire((*it).first, (*it).second);
+    }
+  }
+  
+  evict();
+}
+
+part_library::statistics part_library::stats() const
+{
+  statistics s;
+  
+  s.hits = m_lookups - m_misses;
+  s.misses = m_misses;
+  s.evictions = m_evictions;
+  s.memory_usage = m_memory_usage;
+  s.idle_memory_usage = m_idle_memory_usage;
+  
+  return s;
+}
+
+void part_library::reset_stats()
+{
+  m_lookups = m_misses = m_evictions = 0;
+}
+
+bool part_library::contains(atom name) const
+{
+  shard &s = shard_of(name);
+  std::lock_guard<std::mutex> lock(s.mutex);
+  
+  return s.items.find(name) != s.items.end();
+}
+
+// Takes a reference to a pooled model, 0 if it is not loaded
+item_refcount* part_library::acquire(atom name)
+{
+  shard &s = shard_of(name);
+  std::lock_guard<std::mutex> lock(s.mutex);
+  
+  std::unordered_map<atom, item_refcount*>::iterator it = s.items.find(name);
+  if (it == s.items.end())
+    return 0L;
+  
+  item_refcount *item = (*it).second;
+  
+  if (item->m_idle) {
+    std::lock_guard<std::mutex> lru_lock(m_lru_mutex);
+    
+    m_lru.erase(item->m_lru);
+    item->m_idle = false;
+    m_idle_memory_usage -= item->memory_usage();
+  }
+  
+  item->acquire();
+  ++m_lookups;
+  
+  return item;
+}
+
+// Adds a freshly loaded model to the pool, without references. Returns 0
+// if the name is taken already; the caller keeps the model then.
+item_refcount* part_library::publish(atom name, model_multipart *m)
+{
+  item_refcount *item = new item_refcount(m);
+  
+  {
+    shard &s = shard_of(name);
+    std::lock_guard<std::mutex> lock(s.mutex);
+    
+    if (s.items.insert(std::make_pair(name, item)).second) {
+      m_memory_usage += item->memory_usage();
+      ++m_misses;
+      return item;
+    }
+  }
+  
+  item->set_model(0L);
+  delete item;
+  
+  return 0L;
+}
+
+// Puts an unreferenced model at the front of the LRU list. Caller must
+// hold the lock of its shard.
+void part_library::retire(atom name, item_refcount *item)
+{
+  std::lock_guard<std::mutex> lock(m_lru_mutex);
+  
+  m_lru.push_front(name);
+  item->m_lru = m_lru.begin();
+  item->m_idle = true;
+  m_idle_memory_usage += item->memory_usage();
+}
+
+void part_library::evict()
+{
+  for (;;) {
+    atom name;
+    
+    {
+      std::lock_guard<std::mutex> lock(m_lru_mutex);
+      
+      if (m_memory_usage <= m_budget || m_lru.empty())
+        return;
+      name = m_lru.back();
+    }
+    
+    // Shard first, as everywhere else. The model may have been taken
+    // again in between, in which case the next round sees another one.
+    shard &s = shard_of(name);
+    item_refcount *item = 0L;
+    
+    {
+      std::lock_guard<std::mutex> lock(s.mutex);
+      
+      std::unordered_map<atom, item_refcount*>::iterator it = s.items.find(name);
+      if (it != s.items.end() && (*it).second->m_idle) {
+        std::lock_guard<std::mutex> lru_lock(m_lru_mutex);
+        
+        item = (*it).second;
+        m_lru.erase(item->m_lru);
+        item->m_idle = false;
+        s.items.erase(it);
+        m_memory_usage -= item->memory_usage();
+        m_idle_memory_usage -= item->memory_usage();
+        ++m_evictions;
+      }
+    }
+    
+    // Freeing a model releases the models it references, which may retire
+    // and evict them in turn.
+    delete item;
+  }
 }
 
 std::string part_library::ldrawpath(path_type path_type) const
@@ -119,18 +318,385 @@ std::string part_library::ldrawpath(const std::string &filename, path_type path_
 
 bool part_library::find(const std::string &name) const
 {
-  std::string lowercase = utils::translate_string(name);
-  
-  if (m_partlist.find(lowercase) != m_partlist.end())
-    return true;
-  else if (m_primlist.find(lowercase) != m_primlist.end())
-    return true;
+  index();
   
-  return false;
+  return m_files.find(atom_table::intern(name)) != m_files.end();
 }	
 
+void part_library::index() const
+{
+  std::call_once(m_indexed, [this]() {
+      if (!load_manifest()) {
+        scan_fs();
+        store_manifest();
+      }
+      
+      build_file_index();
+    });
+}
+
+// Hashes both lists by atom for find() and resolve(); a primitive shadows
+// a part of the same name
+void part_library::build_file_index() const
+{
+  m_files.clear();
+  m_files.reserve(m_primlist.size() + m_partlist.size());
+  
+  const file_list *lists[] = { &m_primlist, &m_partlist };
+  for (int i = 0; i < 2; ++i) {
+    for (file_list::const_iterator it = lists[i]->begin(); it != lists[i]->end(); ++it) {
+      file_entry e = { &(*it).second, i == 0 };
+      m_files.insert(std::make_pair(atom_table::intern((*it).first), e));
+    }
+  }
+}
+
+// Modification times of the directories read by scan_fs(), -1 for missing
+// ones. Adding, removing or renaming a file changes them.
+std::vector<std::pair<std::string, long long> > part_library::directory_stamps() const
+{
+  const std::string dirs[] = {
+    ldrawpath(ldraw_primitives_path),
+    ldrawpath(ldraw_primitives_path) + DIRECTORY_SEPARATOR + "48",
+    ldrawpath(ldraw_parts_path),
+    ldrawpath(ldraw_parts_path) + DIRECTORY_SEPARATOR + "s",
+    ldrawpath(ldraw_parts_path) + DIRECTORY_SEPARATOR + "S"
+  };
+  
+  std::vector<std::pair<std::string, long long> > stamps;
+  
+  for (int i = 0; i < 5; ++i) {
+    struct stat st;
+    
+    if (stat(dirs[i].c_str(), &st) == 0)
+      stamps.push_back(std::make_pair(dirs[i], (long long) st.st_mtime));
+    else
+      stamps.push_back(std::make_pair(dirs[i], -1LL));
+  }
+  
+  return stamps;
+}
+
+std::string part_library::manifest_filename() const
+{
+  return m_cache.path() + DIRECTORY_SEPARATOR + "library.manifest";
+}
+
+/* Manifest layout (text, one item per line):
+ *   LDMANIFEST <version>
+ *   <number of directories>, then per directory: <mtime> <path>
+ *   <number of primitives>, then their file names
+ *   <number of parts>, then their file names
+ */
+bool part_library::load_manifest() const
+{
+  if (!m_cache.is_enabled())
+    return false;
+  
+  std::ifstream in(manifest_filename().c_str());
+  if (!in)
+    return false;
+  
+  std::string line;
+  if (!getline(in, line) || line != manifest_magic)
+    return false;
+  
+  std::vector<std::pair<std::string, long long> > stamps = directory_stamps();
+  size_t count;
+  
+  if (!(in >> count) || count != stamps.size())
+    return false;
+  
+  for (size_t i = 0; i < count; ++i) {
+    long long mtime;
+    
+    if (!(in >> mtime) || in.get() != ' ' || !getline(in, line))
+      return false;
+    if (line != stamps[i].first || mtime != stamps[i].second)
+      return false;
+  }
+  
+  file_list *lists[] = { &m_primlist, &m_partlist };
+  bool complete = true;
+  
+  for (int i = 0; i < 2 && complete; ++i) {
+    if (!(in >> count))
+      break;
+    in.ignore(1);
+    
+    // Written in name order, so every insertion goes at the end
+    for (size_t j = 0; j < count && getline(in, line); ++j)
+      lists[i]->insert(lists[i]->end(), file_list::value_type(utils::translate_string(line), line));
+    
+    complete = lists[i]->size() == count;
+  }
+  
+  if (!in || !complete) {
+    m_primlist.clear();
+    m_partlist.clear();
+    return false;
+  }
+  
+  return true;
+}
+
+void part_library::store_manifest() const
+{
+  if (!m_cache.is_enabled())
+    return;
+  
+  std::vector<std::pair<std::string, long long> > stamps = directory_stamps();
+  
+  // mtime has a resolution of one second; a directory that is still being
+  // written to could change again within the same second unnoticed.
+  long long now = (long long) std::time(0L);
+  for (size_t i = 0; i < stamps.size(); ++i) {
+    if (stamps[i].second >= now - 1)
+      return;
+  }
+  
+  std::ostringstream out;
+  out << manifest_magic << std::endl << stamps.size() << std::endl;
+  for (size_t i = 0; i < stamps.size(); ++i)
+    out << stamps[i].second << " " << stamps[i].first << std::endl;
+  
+  const file_list *lists[] = { &m_primlist, &m_partlist };
+  for (int i = 0; i < 2; ++i) {
+    out << lists[i]->size() << std::endl;
+    for (file_list::const_iterator it = lists[i]->begin(); it != lists[i]->end(); ++it)
+      out << (*it).second << std::endl;
+  }
+  
+  // Same write-then-rename as the part cache
+  std::string target = manifest_filename();
+  std::ostringstream tmpname;
+  tmpname << target << "." << getpid() << ".tmp";
+  
+  std::ofstream file(tmpname.str().c_str(), std::ios::out | std::ios::trunc);
+  file << out.str();
+  file.close();
+  
+  if (!file) {
+    std::remove(tmpname.str().c_str());
+    return;
+  }
+  
+#ifdef WIN32
+  std::remove(target.c_str());
+#endif
+  if (std::rename(tmpname.str().c_str(), target.c_str()) != 0)
+    std::remove(tmpname.str().c_str());
+}
+
+std::string part_library::resolve(atom name, bool *primitive) const
+{
+  index();
+  
+  std::unordered_map<atom, file_entry>::const_iterator it = m_files.find(name);
+  if (it == m_files.end())
+    return std::string();
+  
+  *primitive = (*it).second.primitive;
+  return ldrawpath(*(*it).second.filename, *primitive ? ldraw_primitives_path : ldraw_parts_path);
+}
+
+model_multipart* part_library::load_file(const std::string &path) const
+{
+  model_multipart *m = m_cache.load(path);
+  if (!m) {
+    // Stamped before parsing, so an edit in between is not cached
+    part_cache::stamp s;
+    bool stamped = m_cache.is_enabled() && part_cache::source_stamp(path, &s);
+    
+    reader nil;
+    m = nil.load_from_file(path);
+    if (stamped)
+      m_cache.store(path, m, s);
+  }
+  
+  return m;
+}
+
+// Walks the part/primitive reference graph breadth-first and parses every
+// file not yet in the pool on a set of worker threads. Each finished model
+// has its own references queued in turn; the models enter the pool only
+// once all of them are read (see preload()).
+class part_library::loader
+{
+ public:
+  loader(part_library *library) : m_library(library), m_busy(0) {}
+  
+  bool is_empty() const { return m_queue.empty(); }
+  const std::vector<std::pair<atom, model_multipart *> >& loaded() const { return m_loaded; }
+  
+  void enqueue(const model_multipart *m);
+  void run(int threads);
+  
+ private:
+  struct job
+  {
+    atom key;
+    std::string path;
+    bool primitive;
+  };
+  
+  void enqueue(const model *m);
+  void work();
+  
+  part_library *m_library;
+  std::mutex m_mutex;
+  std::condition_variable m_cond;
+  std::deque<job> m_queue;
+  std::unordered_set<atom> m_seen;
+  std::vector<std::pair<atom, model_multipart *> > m_loaded;
+  int m_busy;
+};
+
+// Caller must hold m_mutex once workers are running.
+void part_library::loader::enqueue(const model_multipart *m)
+{
+  enqueue(m->main_model());
+  
+  for (model_multipart::submodel_const_iterator it = m->submodel_list().begin(); it != m->submodel_list().end(); ++it)
+    enqueue((*it).second);
+}
+
+void part_library::loader::enqueue(const model *m)
+{
+  for (model::const_iterator it = m->elements().begin(); it != m->elements().end(); ++it) {
+    if ((*it)->get_type() != type_ref)
+      continue;
+    
+    const element_ref *r = CAST_AS_CONST_REF(*it);
+    if (r->get_model())
+      continue;
+    
+    atom fn = r->filename_atom();
+    
+    // submodels are resolved by model_multipart
+    if (m->parent() && m->parent()->find_submodel(fn))
+      continue;
+    
+    if (m_seen.find(fn) != m_seen.end())
+      continue;
+    m_seen.insert(fn);
+    
+    if (m_library->contains(fn))
+      continue;
+    
+    job j;
+    j.key = fn;
+    j.path = m_library->resolve(fn, &j.primitive);
+    
+    // unknown files are reported later by link_element()
+    if (!j.path.empty())
+      m_queue.push_back(j);
+  }
+}
+
+void part_library::loader::run(int threads)
+{
+  if (threads <= 1) {
+    work();
+    return;
+  }
+  
+  std::vector<std::thread> pool;
+  for (int i = 0; i < threads; ++i)
+    pool.push_back(std::thread(&loader::work, this));
+  
+  for (std::vector<std::thread>::iterator it = pool.begin(); it != pool.end(); ++it)
+    (*it).join();
+}
+
+void part_library::loader::work()
+{
+  std::unique_lock<std::mutex> lock(m_mutex);
+  
+  for (;;) {
+    while (m_queue.empty() && m_busy > 0)
+      m_cond.wait(lock);
+    
+    if (m_queue.empty())
+      break;
+    
+    job j = m_queue.front();
+    m_queue.pop_front();
+    ++m_busy;
+    
+    lock.unlock();
+    
+    // Failures are left to link_element(), which reports them as before.
+    model_multipart *n;
+    try {
+      n = m_library->load_file(j.path);
+      n->main_model()->set_modeltype(j.primitive ? model::primitive : model::part);
+    } catch (const exception &) {
+      n = 0L;
+    }
+    
+    lock.lock();
+    
+    if (n) {
+      m_loaded.push_back(std::make_pair(j.key, n));
+      enqueue(n);
+    }
+    
+    --m_busy;
+    m_cond.notify_all();
+  }
+}
+
+void part_library::preload(model_multipart *m)
+{
+  loader l(this);
+  
+  l.enqueue(m);
+  if (l.is_empty())
+    return;
+  
+  int threads = m_loader_threads;
+  if (threads <= 0)
+    threads = std::max(1, (int) std::thread::hardware_concurrency());
+  
+  l.run(threads);
+  
+  std::lock_guard<std::recursive_mutex> lock(m_link_mutex);
+  
+  // Another thread may have loaded some of the same files meanwhile; the
+  // copy that made it into the pool first wins.
+  std::vector<model_multipart *> published;
+  for (std::vector<std::pair<atom, model_multipart *> >::const_iterator it = l.loaded().begin(); it != l.loaded().end(); ++it) {
+    if (publish((*it).first, (*it).second))
+      published.push_back((*it).second);
+    else
+      delete (*it).second;
+  }
+  
+  // Every dependency is in the pool now, so this only takes references.
+  for (std::vector<model_multipart *>::const_iterator it = published.begin(); it != published.end(); ++it)
+    link_multipart(*it);
+  
+  // Fully linked, the traits are final; some were computed already
+  // through the models referencing them
+  for (std::vector<model_multipart *>::const_iterator it = published.begin(); it != published.end(); ++it) {
+    if (!(*it)->main_model()->custom_data<traits>())
+      (*it)->main_model()->update_custom_data<traits>();
+  }
+}
+
 void part_library::link(model_multipart *m)
 {
+  preload(m);
+  
+  std::lock_guard<std::recursive_mutex> lock(m_link_mutex);
+  link_multipart(m);
+}
+
+void part_library::link_multipart(model_multipart *m)
+{
+  model_multipart::batch b(m);
+  
   link_model(m->main_model());
   
   std::map<std::string, model*> &list = m->submodel_list();
@@ -140,15 +706,15 @@ void part_library::link(model_multipart *m)
 
 bool part_library::link_element(element_ref *r)
 {
-  reader nil;
-  
   if (r->get_model())
     return true;
   
   if (r->linkpoint())
     r->linkpoint()->unlink_element(r);
   
-  std::string fn = utils::translate_string(r->filename());
+  std::lock_guard<std::recursive_mutex> lock(m_link_mutex);
+  
+  atom fn = r->filename_atom();
   
   // 1. find the submodel if multipart
   if (r->parent() && r->parent()->parent())
@@ -156,36 +722,25 @@ bool part_library::link_element(element_ref *r)
       return true;
   
   // 2. find the model pool.
-  std::map<std::string, item_refcount*>::iterator it1 = m_data.find(fn);
-  if (it1 != m_data.end()) {
-    (*it1).second->acquire();
-    r->set_model((*it1).second->model()->main_model());
+  item_refcount *item = acquire(fn);
+  if (item) {
+    r->set_model(item->model()->main_model());
     r->resolve(this);
     return true;
   }
   
-  // 3. find the primitive list
-  std::map<std::string, std::string>::iterator it2 = m_primlist.find(fn);
-  if (it2 != m_primlist.end()) {
-    model_multipart *n = nil.load_from_file(m_ldrawpath + DIRECTORY_SEPARATOR + m_primdir + DIRECTORY_SEPARATOR + (*it2).second);
+  // 3. find the primitive list, then the parts list
+  bool primitive;
+  std::string path = resolve(fn, &primitive);
+  if (!path.empty()) {
+    model_multipart *n = load_file(path);
     link(n);
     r->set_model(n->main_model());
-    n->main_model()->set_modeltype(model::primitive);
-    m_data[(*it2).first] = new item_refcount(n);
-    m_data[(*it2).first]->acquire();
-    r->resolve(this);
-    return true;
-  }
-  
-  // 4. find the parts list
-  std::map<std::string, std::string>::iterator it3 = m_partlist.find(fn);
-  if (it3 != m_partlist.end()) {
-    model_multipart *n = nil.load_from_file(m_ldrawpath + DIRECTORY_SEPARATOR + m_partsdir + DIRECTORY_SEPARATOR + (*it3).second);
-    link(n);
-    r->set_model(n->main_model());
-    n->main_model()->set_modeltype(model::part);
-    m_data[(*it3).first] = new item_refcount(n);
-    m_data[(*it3).first]->acquire();
+    n->main_model()->set_modeltype(primitive ? model::primitive : model::part);
+    n->main_model()->update_custom_data<traits>();
+    // Publishing happens under m_link_mutex only, so the name is free
+    publish(fn, n);
+    acquire(fn);
     r->resolve(this);
     return true;
   }
@@ -220,25 +775,48 @@ void part_library::unlink_element(element_ref *r)
   if (r->linkpoint() != this)
     return;
   
-  std::string fn = utils::translate_string(r->filename());
+  if (m_destroying) {
+    r->set_model(0L);
+    r->resolve(0L);
+    return;
+  }
+  
+  atom fn = r->filename_atom();
   
   if (r->get_model() && (r->get_model()->modeltype() == model::submodel || r->get_model()->modeltype() == model::external_file))
     return;
   
-  std::map<std::string, item_refcount*>::iterator it = m_data.find(fn);
-  if (r->get_model() && it != m_data.end()) {
-    (*it).second->release();
-    if (!(*it).second->refcount()) {
-      if (((*it).second->model()->main_model()->modeltype() == model::part && m_unlink_policy & parts) ||
-          ((*it).second->model()->main_model()->modeltype() == model::primitive && m_unlink_policy & primitives)) {
-        delete (*it).second;
-        m_data.erase(it);
+  item_refcount *dead = 0L;
+  
+  if (r->get_model()) {
+    shard &s = shard_of(fn);
+    std::lock_guard<std::mutex> lock(s.mutex);
+    
+    std::unordered_map<atom, item_refcount*>::iterator it = s.items.find(fn);
+    if (it != s.items.end()) {
+      item_refcount *item = (*it).second;
+      
+      if (!item->release()) {
+        if (m_budget) {
+          retire(fn, item);
+        } else if ((item->model()->main_model()->modeltype() == model::part && m_unlink_policy & parts) ||
+                   (item->model()->main_model()->modeltype() == model::primitive && m_unlink_policy & primitives)) {
+          s.items.erase(it);
+          m_memory_usage -= item->memory_usage();
+          dead = item;
+        }
       }
     }
   }
   
   r->set_model(0L);
   r->resolve(0L);
+  
+  // Outside the lock: freeing a model unlinks the models it references
+  delete dead;
+  
+  if (m_budget)
+    evict();
 }
 
 void part_library::link_model(model *m)
@@ -247,7 +825,8 @@ void part_library::link_model(model *m)
     if (m->at(i)->get_type() == type_ref) {
       element_ref *r = CAST_AS_REF(m->at(i));
       if (link_element(r)) {
-        if(r->get_model())
+        // Library models are fully linked before they enter the pool
+        if (r->get_model() && r->get_model()->modeltype() != model::part && r->get_model()->modeltype() != model::primitive)
           link_model(r->get_model());
       }
     }
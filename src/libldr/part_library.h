@@ -7,12 +7,20 @@
 #ifndef _LIBLDR_PART_LIBRARY_H_
 #define _LIBLDR_PART_LIBRARY_H_
 
+#include <cstddef>
+#include <atomic>
+#include <list>
 #include <map>
+#include <mutex>
 #include <set>
 #include <string>
+#include <unordered_map>
 #include <utility>
+#include <vector>
 
+#include "atom.h"
 #include "common.h"
+#include "part_cache.h"
 
 namespace ldraw
 {
@@ -21,34 +29,74 @@ class element_ref;
 class model;
 class model_multipart;
 
-class item_refcount : public std::pair<model_multipart *, int>
+class item_refcount
 {
  public:
-  item_refcount();
-  item_refcount(model_multipart *m);
+  item_refcount(model_multipart *m = 0L);
   ~item_refcount();
   
-  void set_model(model_multipart *m) { first = m, second = 0; }
+  void set_model(model_multipart *m);
   
-  void acquire() { ++second; }
-  void release() { --second; }
-  int refcount() const { return second; }
+  // Return the new count
+  int acquire() { return ++m_refcount; }
+  int release() { return --m_refcount; }
+  int refcount() const { return m_refcount; }
   
-  model_multipart* model() { return first; }
+  model_multipart* model() { return m_model; }
+  
+  // model_multipart::memory_usage() at the time the model was set
+  std::size_t memory_usage() const { return m_size; }
+  
+ private:
+  friend class part_library;
+  
+  model_multipart *m_model;
+  std::atomic<int> m_refcount;
+  std::size_t m_size;
+  bool m_idle;                     // unreferenced, in the library's LRU list
+  std::list<atom>::iterator m_lru;
 };
 
+// Thread safety: one part_library may be shared by any number of threads,
+// each linking and unlinking its own documents. Parsing runs concurrently;
+// linking is serialized, so a model is fully linked before any other
+// thread can reach it through the pool. Pool lookups lock one of a number
+// of shards only, and unlinking and eviction never wait for a link in
+// progress. Pool models are shared and never edited. Their traits, and
+// their columns when enabled, are attached while they are loaded; any
+// other extension on them has to be created through
+// model::shared_custom_data(), as the renderers, picking and the bounding
+// volume code do. Extensions are then read concurrently, so one brought up
+// to date again in place (a vertex buffer after its renderer's parameters
+// changed) must not be in use by another thread meanwhile. Configuration
+// setters are meant to be called before the library is shared.
 class LIBLDR_EXPORT part_library
 {
  public:
   enum path_type { ldraw_path, ldraw_parts_path, ldraw_primitives_path };
   enum unlink_policy { parts = 0x1, primitives = 0x2 };
   
+  struct statistics
+  {
+    unsigned long hits;            // references to models already loaded
+    unsigned long misses;          // models that had to be loaded
+    unsigned long evictions;       // unreferenced models freed for the budget
+    std::size_t memory_usage;      // bytes held by loaded models
+    std::size_t idle_memory_usage; // of which by unreferenced ones
+  };
+  
+  // Folded name -> file name relative to parts/ or p/, in name order
+  typedef std::map<std::string, std::string> file_list;
+  
   part_library();
   part_library(const std::string &path);
   ~part_library();
   
-  const std::map<std::string, std::string>& part_list() const { return m_partlist; }
-  const std::map<std::string, std::string>& prim_list() const { return m_primlist; }
+  // The part and primitive lists are built on first use, from the
+  // manifest in the cache directory if the library directories have not
+  // changed since it was written, or by scanning them otherwise.
+  const file_list& part_list() const { index(); return m_partlist; }
+  const file_list& prim_list() const { index(); return m_primlist; }
   
   int get_unlink_policy() const { return m_unlink_policy; }
   void set_unlink_policy(int u) { m_unlink_policy = u; }
@@ -57,24 +105,99 @@ class LIBLDR_EXPORT part_library
   std::string ldrawpath(const std::string &filename, path_type path_type = ldraw_parts_path) const;
   
   bool find(const std::string &name) const;
-  int size() const { return m_data.size(); }
+  int size() const;
+  
+  // Upper bound in bytes on memory held by loaded parts and primitives.
+  // With a budget, models that are no longer referenced are kept
+  // regardless of the unlink policy and freed least recently used first
+  // once the total exceeds it. 0 (default) frees them as the unlink
+  // policy says.
+  std::size_t memory_budget() const { return m_budget.load(); }
+  void set_memory_budget(std::size_t bytes);
+  
+  statistics stats() const;
+  void reset_stats();
   
+  // Number of worker threads used to load parts in link(). 0 picks one
+  // thread per core, 1 loads everything on the calling thread.
+  int get_loader_threads() const { return m_loader_threads; }
+  void set_loader_threads(int n) { m_loader_threads = n; }
+  
+  // Directory of the binary part cache. Parts and primitives are loaded
+  // from there when up to date and written back after parsing otherwise.
+  // The library manifest is kept there as well. Empty (default) disables
+  // the cache.
+  const std::string& cache_path() const { return m_cache.path(); }
+  void set_cache_path(const std::string &path) { m_cache.set_path(path); }
+  
+  // Every part and primitive linked carries its traits (see traits.h)
   void link(model_multipart *m);
   bool link_element(element_ref *r);
   void unlink(model_multipart *m);
   void unlink_element(element_ref *r);
   
  private:
+  class loader;
+  
+  enum { shard_count = 16 };
+  
+  struct shard
+  {
+    std::mutex mutex;
+    std::unordered_map<atom, item_refcount*> items;
+  };
+  
+  shard& shard_of(atom name) const { return m_shards[(name >> 1) % shard_count]; }
+  
+  // Entry of the part or primitive list a name resolves to
+  struct file_entry
+  {
+    const std::string *filename;
+    bool primitive;
+  };
+  
   bool read_fs(const std::string &path);
+  bool scan_fs() const;
+  void index() const;
+  void build_file_index() const;
+  std::vector<std::pair<std::string, long long> > directory_stamps() const;
+  std::string manifest_filename() const;
+  bool load_manifest() const;
+  void store_manifest() const;
+  std::string resolve(atom name, bool *primitive) const;
+  model_multipart* load_file(const std::string &path) const;
+  void preload(model_multipart *m);
+  void link_multipart(model_multipart *m);
   void link_model(model *m);
+  bool contains(atom name) const;
+  item_refcount* acquire(atom name);
+  item_refcount* publish(atom name, model_multipart *m);
+  void retire(atom name, item_refcount *item);
+  void evict();
   
-  std::map<std::string, std::string> m_partlist;
-  std::map<std::string, std::string> m_primlist;
-  std::map<std::string, item_refcount*> m_data;
+  mutable file_list m_partlist;
+  mutable file_list m_primlist;
+  mutable std::unordered_map<atom, file_entry> m_files; // both lists, by name
+  mutable std::once_flag m_indexed;
+  mutable shard m_shards[shard_count];
+  std::recursive_mutex m_link_mutex;
   std::string m_ldrawpath;
   std::string m_partsdir;
   std::string m_primdir;
   int m_unlink_policy;
+  int m_loader_threads;
+  part_cache m_cache;
+  
+  // Lock order: shard, then m_lru_mutex
+  std::mutex m_lru_mutex;
+  std::list<atom> m_lru;           // unreferenced models, most recent first
+  std::atomic<std::size_t> m_budget;
+  std::atomic<std::size_t> m_memory_usage;
+  std::atomic<std::size_t> m_idle_memory_usage;
+  std::atomic<unsigned long> m_lookups;
+  std::atomic<unsigned long> m_misses;
+  std::atomic<unsigned long> m_evictions;
+  bool m_destroying;
 };
 
 }
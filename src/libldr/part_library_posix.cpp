@@ -48,8 +48,17 @@ bool part_library::read_fs(const std::string &path)
   m_primdir = pdir;
   m_partsdir = partsdir;
   
+  return true;
+}
+
+bool part_library::scan_fs() const
+{
+  DIR *de;
+  struct dirent *ep;
+  std::string dn1, dn2;
+  
   // 2. look into p/ directory
-  if ((de = opendir((m_ldrawpath + DIRECTORY_SEPARATOR + pdir).c_str())) == 0L) {
+  if ((de = opendir((m_ldrawpath + DIRECTORY_SEPARATOR + m_primdir).c_str())) == 0L) {
     std::cerr << "[libLDR] Couldn't open p/." << std::endl;
     return false;
   }
@@ -63,7 +72,7 @@ bool part_library::read_fs(const std::string &path)
   closedir(de);
   
   // 3. look into p/48 directory
-  if ((de = opendir((m_ldrawpath + DIRECTORY_SEPARATOR + pdir + DIRECTORY_SEPARATOR + "48").c_str())) == 0L)
+  if ((de = opendir((m_ldrawpath + DIRECTORY_SEPARATOR + m_primdir + DIRECTORY_SEPARATOR + "48").c_str())) == 0L)
     std::cerr << "[libLDR] Couldn't open p/48/." << std::endl;
   else {
     while((ep = readdir(de))) {
@@ -31,7 +31,6 @@ int dirsep(int c)
 bool part_library::read_fs(const std::string &path)
 {
   // TODO recursive subdirectory handling
-  std::string dn1, dn2;
   
   // 1. find subdirectories  
   m_ldrawpath = path;
@@ -46,7 +45,13 @@ bool part_library::read_fs(const std::string &path)
     std::cerr << "[libLDR] No p/ or parts/ found." << std::endl;
     return false;
   }
+  
+  return true;
+}
 
+bool part_library::scan_fs() const
+{
+  std::string dn1, dn2;
   WIN32_FIND_DATA ffd;
   HANDLE hFind = INVALID_HANDLE_VALUE;
 
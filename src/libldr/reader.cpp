@@ -6,293 +6,576 @@
 
 #include <fstream>
 #include <iostream>
-#include <sstream>
 
 #include <algorithm>
-#include <set>
+#include <cctype>
+#include <cfloat>
+#include <climits>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
 
 #include "bfc.h"
 #include "elements.h"
+#include "mapped_file.h"
 #include "model.h"
-#include "utils.h"
 
 #include "reader.h"
 
 namespace ldraw
 {
 
-reader::reader()
+namespace
 {
-}
 
-reader::reader(const std::string &basepath)
+// Non-owning view of a range in the input buffer.
+struct slice
 {
-  m_basepath = basepath;
+  slice(const char *b, const char *e) : begin(b), end(e) {}
   
-  if (!basepath.empty() && *(m_basepath.rbegin()) != '/')
-    m_basepath += "/";
+  std::size_t length() const { return end - begin; }
+  bool empty() const { return begin == end; }
+  std::string str() const { return std::string(begin, end); }
+  
+  const char *begin;
+  const char *end;
+};
+
+inline bool is_blank(char c)
+{
+  return c == ' ' || c == '\t';
 }
 
-model_multipart* reader::load_from_file(const std::string &name) const
+// Same rules as utils::trim_string()
+slice trim(const slice &s)
 {
-  std::ifstream file;
+  const char *b = s.begin;
+  const char *e = s.end;
   
-  file.open((m_basepath + name).c_str(), std::ios::in);
-  if (!file.is_open())
-    throw exception(__func__, exception::user_error, std::string("Could not open file for reading: ") + name);
+  while (b != e && is_blank(*b))
+    ++b;
+  while (e != b && (is_blank(*(e - 1)) || *(e - 1) == '\r' || *(e - 1) == '\n'))
+    --e;
   
-  model_multipart *model = load_from_stream(file, name);
+  return slice(b, e);
+}
+
+// Case-insensitive prefix test. prefix must be lowercase.
+bool starts_with(const slice &s, const char *prefix)
+{
+  const char *p = s.begin;
   
-  file.close();
+  for (; *prefix; ++prefix, ++p) {
+    if (p == s.end || std::tolower((unsigned char) *p) != *prefix)
+      return false;
+  }
   
-  return model;
+  return true;
 }
 
-model_multipart* reader::load_from_stream(std::istream &stream, std::string name)
+// Case-insensitive comparison. s must be lowercase.
+bool equals(const slice &sl, const char *s)
+{
+  return sl.length() == std::strlen(s) && starts_with(sl, s);
+}
+
+const char* skip_blank(const char *p, const char *end)
 {
-  model_multipart *nm = new model_multipart;
+  while (p != end && is_blank(*p))
+    ++p;
   
-  // Search for submodel names
-  std::set<std::string> m_submodel_names;
-  std::string line;
-  while (!stream.eof()) {
-    getline(stream, line);
-    line = utils::trim_string(line);
-    if (line.length() > 7 && line.substr(0, 6) == "0 FILE") {
-      std::string filename = utils::translate_string(line.substr(7, line.length() - 7));
-      m_submodel_names.insert(filename);
-    }
-  }
+  return p;
+}
 
-  std::string keyname;
+inline bool is_digit(char c)
+{
+  return c >= '0' && c <= '9';
+}
+
+// Values past the range of int saturate
+bool parse_int(const char *&p, const char *end, int &out)
+{
+  const char *s = p = skip_blank(p, end);
+  bool neg = false;
   
-  // Rewind the stream to the beginning
-  stream.clear();
-  stream.seekg(0, std::ios::beg);
+  if (p != end && (*p == '-' || *p == '+'))
+    neg = *(p++) == '-';
   
-  bool tmp = parse_stream(nm->main_model(), stream, true, &keyname);
-  if (nm->main_model()->name().empty()) {
-    std::string nfp;
-    size_t o = name.find_last_of("/");
-    if (o == std::string::npos)
-      nfp = name;
-    else
-      nfp = name.substr(o + 1, name.length() - o);
-    
-    nm->main_model()->set_name(nfp);
+  if (p == end || !is_digit(*p)) {
+    p = s;
+    return false;
   }
-  if (!tmp)
-    return nm;
   
-  bool loop = true;
-  while (loop) {
-    std::string fn;
-    model *m = new model;
-    
-    m->set_parent(nm);
-    m->set_modeltype(model::submodel);
-    loop = parse_stream(m, stream, true, &fn);
-    m->set_name(keyname);
-    
-    nm->insert_submodel(m, keyname);
-
-    keyname = fn;
+  long long v = 0;
+  while (p != end && is_digit(*p)) {
+    if (v <= INT_MAX)
+      v = v * 10 + (*p - '0');
+    ++p;
   }
   
-  nm->link_submodels();
+  if (neg)
+    out = v > -(long long) INT_MIN ? INT_MIN : (int) -v;
+  else
+    out = v > INT_MAX ? INT_MAX : (int) v;
   
-  if (utils::cyclic_reference_test(nm->main_model()))
-    throw exception(__func__, exception::fatal, "Cyclic reference detected. This model file may be corrupted.");
-  for (model_multipart::submodel_const_iterator it = nm->submodel_list().begin(); it != nm->submodel_list().end(); ++it) {
-    if (utils::cyclic_reference_test((*it).second))
-      throw exception(__func__, exception::fatal, "Cyclic reference detected. This model file may be corrupted.");
+  return true;
+}
+
+// Hands the digits between begin and end to strtof(), which rounds
+// correctly. The decimal point is folded into the exponent, so the
+// locale's idea of it does not matter.
+float convert_digits(const char *begin, const char *end, int exponent)
+{
+  std::string t;
+  bool fraction = false;
+  
+  t.reserve(end - begin + 8);
+  for (const char *p = begin; p != end; ++p) {
+    if (*p == '.')
+      fraction = true;
+    else {
+      t += *p;
+      if (fraction)
+        --exponent;
+    }
   }
   
-  return nm;
+  char e[16];
+  std::sprintf(e, "e%d", exponent);
+  t += e;
+  
+  return std::strtof(t.c_str(), 0L);
 }
 
-bool reader::parse_stream(model *m, std::istream &stream, bool multipart, std::string *keyname)
+// Decimal float parser, rounding as strtof() does. A mantissa of up to
+// 2^53 with a power of ten up to 10^22 gives an exact quotient in double
+// that is rounded once; rounding it again to float is still correct unless
+// it landed exactly halfway between two floats. Everything else, which no
+// LDraw file carries in practice, goes to strtof().
+bool parse_float(const char *&p, const char *end, float &out)
 {
-  std::string line;
-  int lines = 0;
-  int zerocnt = 0;
-  bool founddesc = false;
-  bool foundheader;
-  
-  while(!stream.eof()) {
-    getline(stream, line);
-    line = utils::trim_string(line);
-    long llen = line.length();
-    ++lines;
-    if (llen == 0)
-      continue;
-    // Returns true when more subpart(s) available. returns false otherwise.
-    if (multipart && llen > 7 && line.substr(0, 6) == "0 FILE") {
-      if (keyname)
-        *keyname = line.substr(7, llen - 7);
-      if (lines != 1) {
-        stream.seekg((long)stream.tellg() - llen - 1);
-        return true;
+  static const double pow10[] = {
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+  };
+  
+  const char *s = p = skip_blank(p, end);
+  bool neg = false;
+  bool any = false;
+  bool dropped = false;
+  unsigned long long mantissa = 0;
+  int exponent = 0, written = 0;
+  
+  if (p != end && (*p == '-' || *p == '+'))
+    neg = *(p++) == '-';
+  
+  const char *digits = p;
+  
+  for (; p != end && is_digit(*p); ++p) {
+    any = true;
+    if (mantissa < 100000000000000000ULL)
+      mantissa = mantissa * 10 + (*p - '0');
+    else {
+      dropped = dropped || *p != '0';
+      ++exponent;
+    }
+  }
+  
+  if (p != end && *p == '.') {
+    for (++p; p != end && is_digit(*p); ++p) {
+      any = true;
+      if (mantissa < 100000000000000000ULL) {
+        mantissa = mantissa * 10 + (*p - '0');
+        --exponent;
+      } else {
+        dropped = dropped || *p != '0';
       }
     }
+  }
+  
+  if (!any) {
+    p = s;
+    return false;
+  }
+  
+  const char *digits_end = p;
+  
+  if (p != end && (*p == 'e' || *p == 'E')) {
+    const char *q = p + 1;
+    bool eneg = false;
     
-    foundheader = false;
+    if (q != end && (*q == '-' || *q == '+'))
+      eneg = *(q++) == '-';
     
-    if (line[0] == '0') {
-      // parse line type 0
-      foundheader = true;
-      ++zerocnt;
-      
-      std::string cont = utils::trim_string(line.substr(1, line.length()-1));
-      std::string contlc = utils::translate_string(cont);
-      
-      // Parse header data
-      if (contlc.length() > 4 && contlc.substr(0, 4) == "file"); // Skip
-      else if (contlc.length() > 6 && contlc.substr(0, 5) == "name:") { // Filename
-        m->set_name(cont.substr(6, cont.length() - 6));
-      } else if (contlc.length() > 5 && contlc.substr(0, 4) == "name") { // Filename without ':'
-        m->set_name(cont.substr(5, cont.length() - 5));
-      } else if (contlc.length() > 8 && contlc.substr(0, 7) == "author:") { // Author
-        m->set_author(cont.substr(8, cont.length() - 8));
-      } else if (contlc.length() > 7 && contlc.substr(0, 6) == "author") { // Author without ':'
-        m->set_author(cont.substr(7, cont.length() - 7));
-      } else if (zerocnt < 3 && !founddesc) { // Partname
-        m->set_desc(cont);
-        founddesc = true;
-      } else {
-        foundheader = false;
+    if (q != end && is_digit(*q)) {
+      int e = 0;
+      while (q != end && is_digit(*q)) {
+        if (e < 10000)
+          e = e * 10 + (*q - '0');
+        ++q;
       }
+      
+      written = eneg ? -e : e;
+      p = q;
     }
+  }
+  
+  exponent += written;
+  
+  float f;
+  bool exact = false;
+  
+  if (!dropped && mantissa <= (1ULL << 53) && exponent >= -22 && exponent <= 22) {
+    double v = (double) mantissa;
     
-    if (!foundheader) {
-      element_base *el = parse_line(line, m);
-      if (el)
-        m->insert_element(el);
+    if (exponent < 0)
+      v /= pow10[-exponent];
+    else
+      v *= pow10[exponent];
+    
+    if (v <= FLT_MAX) {
+      f = (float) v;
+      exact = (double) f == v;
+      
+      if (!exact) {
+        float other = std::nextafter(f, (double) f < v ? FLT_MAX : 0.0f);
+        exact = ((double) f + (double) other) * 0.5 != v;
+      }
     }
   }
   
-  return false;
+  if (!exact)
+    f = convert_digits(digits, digits_end, written);
+  
+  out = neg ? -f : f;
+  
+  return true;
 }
 
-element_base* reader::parse_line(const std::string &command, model *m)
+void parse_floats(const char *&p, const char *end, float *out, int count)
+{
+  for (int i = 0; i < count; ++i) {
+    if (!parse_float(p, end, out[i]))
+      out[i] = 0.0f;
+  }
+}
+
+// Element made by m (see model::new_element()), or on the heap without one
+template <class T, class... Args> T* make_element(model *m, Args&&... args)
+{
+  if (m)
+    return m->new_element<T>(std::forward<Args>(args)...);
+  
+  return new T(std::forward<Args>(args)...);
+}
+
+// Parses line types 1-5 directly from the buffer, for m if given.
+element_base* parse_geometry(const slice &line, model *m)
+{
+  const char *p = line.begin + 1;
+  const char *end = line.end;
+  int col = 0;
+  float v[12];
+  
+  parse_int(p, end, col);
+  
+  switch (*line.begin) {
+    case '1':
+      parse_floats(p, end, v, 12);
+      return make_element<element_ref>(m, color(col), matrix(v[3], v[4], v[5], v[6], v[7], v[8], v[9], v[10], v[11], v[0], v[1], v[2]),
+                                       trim(slice(p, end)).str());
+    case '2':
+      parse_floats(p, end, v, 6);
+      return make_element<element_line>(m, color(col), vector(v[0], v[1], v[2]), vector(v[3], v[4], v[5]));
+    case '3':
+      parse_floats(p, end, v, 9);
+      return make_element<element_triangle>(m, color(col), vector(v[0], v[1], v[2]), vector(v[3], v[4], v[5]), vector(v[6], v[7], v[8]));
+    case '4':
+      parse_floats(p, end, v, 12);
+      return make_element<element_quadrilateral>(m, color(col), vector(v[0], v[1], v[2]), vector(v[3], v[4], v[5]), vector(v[6], v[7], v[8]), vector(v[9], v[10], v[11]));
+    case '5':
+      parse_floats(p, end, v, 12);
+      return make_element<element_condline>(m, color(col), vector(v[0], v[1], v[2]), vector(v[3], v[4], v[5]), vector(v[6], v[7], v[8]), vector(v[9], v[10], v[11]));
+    default:
+      return 0L;
+  }
+}
+
+// Parses the content of a type 0 line, after the "0". Header lines are
+// stored in m and give no element.
+element_base* parse_meta(const slice &cont, model *m)
 {
-  std::string line = utils::trim_string(command);
+  std::size_t len = cont.length();
+  
+  if (len == 0)
+    return 0L;
   
-  if (line.length() == 0)
-    return 0;
-  if (line[0] == '0') {
-    // parse line type 0
+  if (*cont.begin == '!') {
+    // header data
+    const char *space = (const char *) std::memchr(cont.begin, ' ', len);
+    if (m && space)
+      m->set_header(slice(cont.begin + 1, space).str(), slice(space + 1, cont.end).str());
+  } else if (equals(cont, "step")) {
+    return new element_state(element_state::state_step);
+  } else if (equals(cont, "pause")) {
+    return new element_state(element_state::state_pause);
+  } else if (equals(cont, "clear")) {
+    return new element_state(element_state::state_clear);
+  } else if (equals(cont, "save")) {
+    return new element_state(element_state::state_save);
+  } else if (len > 6 && (starts_with(cont, "print") || starts_with(cont, "write"))) {
+    return new element_print(slice(cont.begin + 6, cont.end).str());
+  } else if (len > 3 && starts_with(cont, "bfc")) {
+    // Handle BFC statements
+    slice subs(std::min(cont.begin + 4, cont.end), cont.end);
+    int cert = -1, winding = -1;
     
-    std::string cont = utils::trim_string(line.substr(1, line.length()-1));
-    std::string contlc = utils::translate_string(cont);
-    if (cont.length() == 0)
-      return 0;
+    if (equals(subs, "ccw"))
+      return new element_bfc(element_bfc::ccw);
+    else if (equals(subs, "cw"))
+      return new element_bfc(element_bfc::cw);
+    else if (equals(subs, "clip"))
+      return new element_bfc(element_bfc::clip);
+    else if (equals(subs, "clip cw") || equals(subs, "cw clip"))
+      return new element_bfc(element_bfc::clip_cw);
+    else if (equals(subs, "clip ccw") || equals(subs, "ccw clip"))
+      return new element_bfc(element_bfc::clip_ccw);
+    else if (equals(subs, "noclip"))
+      return new element_bfc(element_bfc::noclip);
+    else if (equals(subs, "invertnext"))
+      return new element_bfc(element_bfc::invertnext);
+    else if (equals(subs, "certify") || equals(subs, "certify ccw"))
+      cert = bfc_certification::certified, winding = bfc_certification::ccw;
+    else if (equals(subs, "certify cw"))
+      cert = bfc_certification::certified, winding = bfc_certification::cw;
+    else if (equals(subs, "nocertify"))
+      cert = bfc_certification::uncertified;
     
-    if (cont[0] == '!') {
-      // header data
-      size_t pos = cont.find_first_of(" ");
-      if (m && pos != std::string::npos)
-        m->set_header(cont.substr(1, pos - 1), cont.substr(pos + 1));
-    } else if (contlc == "step") {
-      return new element_state(element_state::state_step);
-    } else if (contlc == "pause") {
-      return new element_state(element_state::state_pause);
-    } else if (contlc == "clear") {
-      return new element_state(element_state::state_clear);
-    } else if (contlc == "save") {
-      return new element_state(element_state::state_save);
-    } else if (contlc.length() > 6 && (contlc.substr(0, 5) == "print" || contlc.substr(0, 5) == "write")) {
-      return new element_print(cont.substr(6, line.length()-6));
-    } else if (contlc.length() > 3 && contlc.substr(0, 3) == "bfc") {
-      // Handle BFC statements
-      std::string subs = contlc.substr(4, line.length() - 4);
-      int cert = -1, winding = -1;
-      
-      if (subs == "ccw")
-        return new element_bfc(element_bfc::ccw);
-      else if (subs == "cw")
-        return new element_bfc(element_bfc::cw);
-      else if (subs == "clip")
-        return new element_bfc(element_bfc::clip);
-      else if (subs == "clip cw" || subs == "cw clip")
-        return new element_bfc(element_bfc::clip_cw);
-      else if (subs == "clip ccw" || subs == "ccw clip")
-        return new element_bfc(element_bfc::clip_ccw);
-      else if (subs == "noclip")
-        return new element_bfc(element_bfc::noclip);
-      else if (subs == "invertnext")
-        return new element_bfc(element_bfc::invertnext);
-      else if (subs == "certify" || subs == "certify ccw")
-        cert = bfc_certification::certified, winding = bfc_certification::ccw;
-      else if (subs == "certify cw")
-        cert = bfc_certification::certified, winding = bfc_certification::cw;
-      
-      else if (subs == "nocertify")
-        cert = bfc_certification::uncertified;
-      
-      if (m && cert != -1) {
-        bfc_certification *c = m->init_custom_data<bfc_certification>();
-        c->set_certification((bfc_certification::cert_status)cert);
-        if (winding != -1)
-          c->set_orientation((bfc_certification::winding)winding);
-      }
+    if (m && cert != -1) {
+      bfc_certification *c = m->init_custom_data<bfc_certification>();
+      c->set_certification((bfc_certification::cert_status)cert);
+      if (winding != -1)
+        c->set_orientation((bfc_certification::winding)winding);
+    }
+  } else {
+    return new element_comment(cont.str());
+  }
+  
+  return 0L;
+}
+
+bool is_file_line(const slice &line)
+{
+  return line.length() > 7 && std::memcmp(line.begin, "0 FILE", 6) == 0;
+}
+
+// Builds a model_multipart from lines fed in order. Submodels are split
+// as their "0 FILE" lines arrive, so every byte of input is seen once.
+class multipart_builder
+{
+ public:
+  multipart_builder()
+      : m_result(new model_multipart), m_multipart(false)
+  {
+    m_current = m_result->main_model();
+    reset_state();
+  }
+  
+  void feed(const slice &raw);
+  model_multipart* finish(const std::string &name);
+  
+ private:
+  void reset_state() { m_lines = 0, m_zerocnt = 0, m_founddesc = false; }
+  void parse_header_or_element(const slice &line);
+  void close_submodel();
+  
+  model_multipart *m_result;
+  model *m_current;
+  std::string m_keyname;
+  bool m_multipart;
+  
+  // Per-model header parsing state
+  int m_lines;
+  int m_zerocnt;
+  bool m_founddesc;
+};
+
+void multipart_builder::feed(const slice &raw)
+{
+  slice line = trim(raw);
+  
+  if (line.empty())
+    return;
+  
+  // Every "0 FILE" except the first line of a model starts a new submodel
+  if (is_file_line(line)) {
+    if (m_lines > 0) {
+      close_submodel();
       
-      return 0L;
-    } else if (contlc.length() > 0) {
-      return new element_comment(cont);
+      m_current = new model(m_result);
+      m_current->set_modeltype(model::submodel);
+      reset_state();
+      m_multipart = true;
     }
-  } else if (line[0] == '1') {
-    // File reference
-    std::istringstream s(line.substr(2, line.length()-2));
-    int col;
-    float x, y, z, a, b, c, d, e, f, g, h, i;
-    char fnbuf[255];
-    
-    s >> col >> x >> y >> z >> a >> b >> c >> d >> e >> f >> g >> h >> i;
-    s.getline(fnbuf, 255);
-    
-    std::string fn = utils::trim_string(std::string(fnbuf));
-    
-    return new element_ref(color(col), matrix(a, b, c, d, e, f, g, h, i, x, y, z), fn);
-  } else if (line[0] == '2') {
-    // Line
-    std::istringstream s(line.substr(2, line.length()-2));
-    int col;
-    float x1, y1, z1, x2, y2, z2;
     
-    s >> col >> x1 >> y1 >> z1 >> x2 >> y2 >> z2;
-    
-    return new element_line(color(col), vector(x1, y1, z1), vector(x2, y2, z2));
-  } else if (line[0] == '3') {
-    // Triangle
-    std::istringstream s(line.substr(2, line.length()-2));
-    int col;
-    float x1, y1, z1, x2, y2, z2, x3, y3, z3;
-    
-    s >> col >> x1 >> y1 >> z1 >> x2 >> y2 >> z2 >> x3 >> y3 >> z3;
-    
-    return new element_triangle(color(col), vector(x1, y1, z1), vector(x2, y2, z2), vector(x3, y3, z3));
-  } else if (line[0] == '4') {
-    // Quadrilateral
-    std::istringstream s(line.substr(2, line.length()-2));
-    int col;
-    float x1, y1, z1, x2, y2, z2, x3, y3, z3, x4, y4, z4;
+    m_keyname = slice(line.begin + 7, line.end).str();
+  }
+  
+  ++m_lines;
+  parse_header_or_element(line);
+}
+
+void multipart_builder::parse_header_or_element(const slice &line)
+{
+  model *m = m_current;
+  
+  if (*line.begin == '0') {
+    ++m_zerocnt;
     
-    s >> col >> x1 >> y1 >> z1 >> x2 >> y2 >> z2 >> x3 >> y3 >> z3 >> x4 >> y4 >> z4;
+    slice cont = trim(slice(line.begin + 1, line.end));
+    std::size_t len = cont.length();
     
-    return new element_quadrilateral(color(col), vector(x1, y1, z1), vector(x2, y2, z2), vector(x3, y3, z3), vector(x4, y4, z4));
-  } else if (line[0] == '5') {
-    // Conditional line
-    std::istringstream s(line.substr(2, line.length()-2));
-    int col;
-    float x1, y1, z1, x2, y2, z2, x3, y3, z3, x4, y4, z4;
+    if (len > 4 && starts_with(cont, "file"))
+      return;
+    else if (len > 6 && starts_with(cont, "name:"))
+      m->set_name(slice(cont.begin + 6, cont.end).str());
+    else if (len > 5 && starts_with(cont, "name"))
+      m->set_name(slice(cont.begin + 5, cont.end).str());
+    else if (len > 8 && starts_with(cont, "author:"))
+      m->set_author(slice(cont.begin + 8, cont.end).str());
+    else if (len > 7 && starts_with(cont, "author"))
+      m->set_author(slice(cont.begin + 7, cont.end).str());
+    else if (m_zerocnt < 3 && !m_founddesc) {
+      m->set_desc(cont.str());
+      m_founddesc = true;
+    } else {
+      element_base *el = parse_meta(cont, m);
+      if (el)
+        m->insert_element(el);
+    }
     
-    s >> col >> x1 >> y1 >> z1 >> x2 >> y2 >> z2 >> x3 >> y3 >> z3 >> x4 >> y4 >> z4;
+    return;
+  }
+  
+  element_base *el = parse_geometry(line, m);
+  if (el)
+    m->insert_element(el);
+}
+
+void multipart_builder::close_submodel()
+{
+  if (m_current == m_result->main_model())
+    return;
+  
+  m_current->set_name(m_keyname);
+  m_result->insert_submodel(m_current, m_keyname);
+}
+
+model_multipart* multipart_builder::finish(const std::string &name)
+{
+  close_submodel();
+  
+  model_multipart *nm = m_result;
+  
+  if (nm->main_model()->name().empty()) {
+    size_t o = name.find_last_of("/");
+    if (o == std::string::npos)
+      nm->main_model()->set_name(name);
+    else
+      nm->main_model()->set_name(name.substr(o + 1, name.length() - o));
+  }
+  
+  if (!m_multipart)
+    return nm;
+  
+  nm->link_submodels();
+  
+  if (nm->is_cyclic())
+    throw exception("load_from_stream", exception::fatal, "Cyclic reference detected. This model file may be corrupted.");
+  
+  return nm;
+}
+
+}
+
+reader::reader()
+    : m_memory_mapped(true)
+{
+}
+
+reader::reader(const std::string &basepath)
+    : m_memory_mapped(true)
+{
+  m_basepath = basepath;
+  
+  if (!basepath.empty() && *(m_basepath.rbegin()) != '/')
+    m_basepath += "/";
+}
+
+model_multipart* reader::load_from_file(const std::string &name) const
+{
+  // Pipes and other special files can't be mapped; read them as a stream.
+  if (m_memory_mapped) {
+    mapped_file mapped(m_basepath + name);
+    if (mapped.is_open())
+      return load_from_buffer(mapped.data(), mapped.size(), name);
+  }
+  
+  std::ifstream file;
+  
+  file.open((m_basepath + name).c_str(), std::ios::in);
+  if (!file.is_open())
+    throw exception(__func__, exception::user_error, std::string("Could not open file for reading: ") + name);
+  
+  model_multipart *model = load_from_stream(file, name);
+  
+  file.close();
+  
+  return model;
+}
+
+// Single pass; works on non-seekable streams such as pipes and std::cin.
+model_multipart* reader::load_from_stream(std::istream &stream, std::string name)
+{
+  multipart_builder builder;
+  std::string line;
+  
+  while (getline(stream, line))
+    builder.feed(slice(line.data(), line.data() + line.length()));
+  
+  return builder.finish(name);
+}
+
+model_multipart* reader::load_from_buffer(const char *data, std::size_t length, std::string name)
+{
+  multipart_builder builder;
+  const char *p = data;
+  const char *end = data + length;
+  
+  while (p != end) {
+    const char *eol = (const char *) std::memchr(p, '\n', end - p);
+    if (!eol)
+      eol = end;
     
-    return new element_condline(color(col), vector(x1, y1, z1), vector(x2, y2, z2), vector(x3, y3, z3), vector(x4, y4, z4));
+    builder.feed(slice(p, eol));
+    p = eol == end ? end : eol + 1;
   }
   
-  return 0L;
+  return builder.finish(name);
+}
+
+element_base* reader::parse_line(const std::string &command, model *m)
+{
+  slice line = trim(slice(command.data(), command.data() + command.length()));
+  
+  if (line.empty())
+    return 0L;
+  if (*line.begin == '0')
+    return parse_meta(trim(slice(line.begin + 1, line.end)), m);
+  
+  // Callers may insert it anywhere, so it is not made by m
+  return parse_geometry(line, 0L);
 }
 
 }
@@ -7,6 +7,7 @@
 #ifndef _LIBLDR_READER_H_
 #define _LIBLDR_READER_H_
 
+#include <cstddef>
 #include <string>
 
 #include "common.h"
@@ -26,15 +27,20 @@ class LIBLDR_EXPORT reader
 	
 	model_multipart* load_from_file(const std::string &name) const;
 	static model_multipart* load_from_stream(std::istream &stream, std::string name = "");
+	static model_multipart* load_from_buffer(const char *data, std::size_t length, std::string name = "");
 	static element_base* parse_line(const std::string &command, model *m = 0L);
 	
 	const std::string& basepath() const { return m_basepath; }
 	void set_basepath(const std::string &path) { m_basepath = path; }
 	
-  private:
-	static bool parse_stream(model *m, std::istream &stream, bool multipart, std::string *keyname = 0L);
+	// When enabled (default), load_from_file() maps the file into memory
+	// and tokenizes it in place instead of going through std::ifstream.
+	bool is_memory_mapped() const { return m_memory_mapped; }
+	void set_memory_mapped(bool b) { m_memory_mapped = b; }
 	
+  private:
 	std::string m_basepath;
+	bool m_memory_mapped;
 };
 
 }
@@ -0,0 +1,120 @@
+/* libLDR: Portable and easy-to-use LDraw format abstraction & I/O reference library *
+ * To obtain more information about LDraw, visit http://www.ldraw.org.               *
+ * Distributed in terms of the GNU Lesser General Public License v3                  *
+ *                                                                                   *
+ * Author: (c)2006-2013 Park "segfault" J. K. <mastermind_at_planetmono_dot_org>     */
+
+#include <algorithm>
+#include <cstdlib>
+#include <new>
+
+#include "slab.h"
+
+namespace ldraw
+{
+
+namespace
+{
+
+// Primitives hold a handful of elements of each type, so the first chunk
+// is small; later ones double up to the last size.
+const std::size_t first_chunk_count = 8;
+const std::size_t max_chunk_count = 512;
+// Enough for every element type and for the free list link
+const std::size_t alignment = sizeof(void *) > sizeof(double) ? sizeof(void *) : sizeof(double);
+
+}
+
+slab::slab(std::size_t size)
+    : m_size((std::max(size, sizeof(void *)) + alignment - 1) & ~(alignment - 1)),
+      m_current(0L), m_end(0L), m_free(0L), m_next_count(first_chunk_count), m_reserved(0), m_hint(0)
+{
+}
+
+slab::~slab()
+{
+  release();
+}
+
+void* slab::allocate()
+{
+  if (m_free) {
+    void *r = m_free;
+    m_free = *(void **) r;
+    return r;
+  }
+
+  if (m_current == m_end) {
+    std::size_t bytes = m_size * m_next_count;
+    char *p = (char *) std::malloc(bytes);
+    if (!p)
+      throw std::bad_alloc();
+
+    chunk c;
+    c.begin = p;
+    c.end = p + bytes;
+
+    // Chunks mostly come at rising addresses, so this rarely moves any
+    std::vector<chunk>::iterator it = m_chunks.end();
+    while (it != m_chunks.begin() && p < (*(it - 1)).begin)
+      --it;
+    m_chunks.insert(it, c);
+
+    m_current = p;
+    m_end = p + bytes;
+    m_reserved += bytes;
+    if (m_next_count < max_chunk_count)
+      m_next_count *= 2;
+  }
+
+  void *r = m_current;
+  m_current += m_size;
+
+  return r;
+}
+
+void slab::free(void *p)
+{
+  *(void **) p = m_free;
+  m_free = p;
+}
+
+void slab::release()
+{
+  for (std::vector<chunk>::iterator it = m_chunks.begin(); it != m_chunks.end(); ++it)
+    std::free((*it).begin);
+
+  m_chunks.clear();
+  m_current = m_end = 0L;
+  m_free = 0L;
+  m_next_count = first_chunk_count;
+  m_reserved = 0;
+  m_hint = 0;
+}
+
+bool slab::owns(const void *p) const
+{
+  const char *c = (const char *) p;
+
+  // Slots are mostly freed in the order they were handed out, so the
+  // chunk of the last one found is tried first
+  if (m_hint < m_chunks.size() && c >= m_chunks[m_hint].begin && c < m_chunks[m_hint].end)
+    return true;
+
+  // Last chunk starting at or below p
+  std::vector<chunk>::const_iterator it =
+      std::upper_bound(m_chunks.begin(), m_chunks.end(), c, [](const char *addr, const chunk &ch) { return addr < ch.begin; });
+
+  if (it == m_chunks.begin())
+    return false;
+  --it;
+
+  if (c >= (*it).end)
+    return false;
+
+  m_hint = it - m_chunks.begin();
+
+  return true;
+}
+
+}
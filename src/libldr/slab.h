@@ -0,0 +1,60 @@
+/* libLDR: Portable and easy-to-use LDraw format abstraction & I/O reference library *
+ * To obtain more information about LDraw, visit http://www.ldraw.org.               *
+ * Distributed in terms of the GNU Lesser General Public License v3                  *
+ *                                                                                   *
+ * Author: (c)2006-2013 Park "segfault" J. K. <mastermind_at_planetmono_dot_org>     */
+
+#ifndef _LIBLDR_SLAB_H_
+#define _LIBLDR_SLAB_H_
+
+#include <cstddef>
+#include <vector>
+
+#include "common.h"
+
+namespace ldraw
+{
+
+// Allocator for objects of a single size. Slots are carved out of chunks
+// of growing length; a slot given back with free() is reused by the next
+// allocate(), and release() returns all the chunks at once. Objects have
+// to be destroyed by their owner before their slot is freed or released.
+// Not thread-safe.
+class LIBLDR_EXPORT slab
+{
+ public:
+  explicit slab(std::size_t size);
+  ~slab();
+
+  void* allocate();
+  void free(void *p);
+  void release();
+
+  bool owns(const void *p) const;
+
+  // Total size of the chunks held by the slab
+  std::size_t reserved() const { return m_reserved; }
+
+ private:
+  slab(const slab &);
+  slab& operator=(const slab &);
+
+  struct chunk
+  {
+    char *begin;
+    char *end;
+  };
+
+  std::vector<chunk> m_chunks; // sorted by address
+  std::size_t m_size;
+  char *m_current;
+  char *m_end;
+  void *m_free;                // freed slots, each holding the next
+  std::size_t m_next_count;
+  std::size_t m_reserved;
+  mutable std::size_t m_hint;  // chunk owns() found last
+};
+
+}
+
+#endif
@@ -0,0 +1,280 @@
+/* libLDR: Portable and easy-to-use LDraw format abstraction & I/O reference library *
+ * To obtain more information about LDraw, visit http://www.ldraw.org.               *
+ * Distributed in terms of the GNU Lesser General Public License v3                  *
+ *                                                                                   *
+ * Author: (c)2006-2013 Park "segfault" J. K. <mastermind_at_planetmono_dot_org>     */
+
+#include <algorithm>
+#include <climits>
+
+#include "submodel_graph.h"
+
+namespace ldraw
+{
+
+submodel_graph::submodel_graph()
+    : m_next_rank(0), m_state(acyclic), m_mark(0)
+{
+}
+
+void submodel_graph::clear()
+{
+  m_nodes.clear();
+  m_next_rank = 0;
+  m_state = acyclic;
+}
+
+void submodel_graph::insert_node(const model *m)
+{
+  if (contains(m))
+    return;
+  
+  // Without edges, ranking it last is always valid
+  node &n = m_nodes[m];
+  n.rank = m_next_rank++;
+  n.mark = 0;
+}
+
+void submodel_graph::remove_node(const model *m)
+{
+  node_list::iterator it = m_nodes.find(m);
+  if (it == m_nodes.end())
+    return;
+  
+  node &n = (*it).second;
+  bool connected = !n.out.empty() || !n.in.empty();
+  
+  for (edge_list::iterator eit = n.out.begin(); eit != n.out.end(); ++eit)
+    m_nodes[(*eit).first].in.erase(m);
+  for (edge_list::iterator eit = n.in.begin(); eit != n.in.end(); ++eit)
+    m_nodes[(*eit).first].out.erase(m);
+  
+  m_nodes.erase(it);
+  
+  if (m_state == cyclic && connected)
+    m_state = unknown;
+}
+
+void submodel_graph::insert_edge(const model *from, const model *to)
+{
+  node_list::iterator f = m_nodes.find(from), t = m_nodes.find(to);
+  if (f == m_nodes.end() || t == m_nodes.end())
+    return;
+  
+  ++(*t).second.in[from];
+  if ((*f).second.out[to]++)
+    return;
+  
+  if (m_state != acyclic)
+    return;
+  
+  if (from == to) {
+    m_state = cyclic;
+    return;
+  }
+  
+  int lower = (*t).second.rank, upper = (*f).second.rank;
+  if (lower > upper)
+    return;
+  
+  // Only the nodes reachable from 'to' and ranked below 'from', and those
+  // reaching 'from' and ranked above 'to', are out of order now.
+  std::vector<const model *> forward, backward;
+  
+  ++m_mark;
+  if (search_forward(to, upper, from, forward)) {
+    m_state = cyclic;
+    return;
+  }
+  
+  ++m_mark;
+  search_backward(from, lower, backward);
+  
+  // Hand their ranks out again, in the same order within each set but
+  // with the nodes leading to 'from' first
+  std::vector<std::pair<int, const model *> > back_ranked, forward_ranked;
+  std::vector<int> ranks;
+  
+  for (std::vector<const model *>::const_iterator it = backward.begin(); it != backward.end(); ++it)
+    back_ranked.push_back(std::make_pair(m_nodes[*it].rank, *it));
+  for (std::vector<const model *>::const_iterator it = forward.begin(); it != forward.end(); ++it)
+    forward_ranked.push_back(std::make_pair(m_nodes[*it].rank, *it));
+  
+  std::sort(back_ranked.begin(), back_ranked.end());
+  std::sort(forward_ranked.begin(), forward_ranked.end());
+  back_ranked.insert(back_ranked.end(), forward_ranked.begin(), forward_ranked.end());
+  
+  for (std::vector<std::pair<int, const model *> >::const_iterator it = back_ranked.begin(); it != back_ranked.end(); ++it)
+    ranks.push_back((*it).first);
+  std::sort(ranks.begin(), ranks.end());
+  
+  for (size_t i = 0; i < back_ranked.size(); ++i)
+    m_nodes[back_ranked[i].second].rank = ranks[i];
+}
+
+void submodel_graph::remove_edge(const model *from, const model *to)
+{
+  node_list::iterator f = m_nodes.find(from), t = m_nodes.find(to);
+  if (f == m_nodes.end() || t == m_nodes.end())
+    return;
+  
+  edge_list::iterator out = (*f).second.out.find(to);
+  if (out == (*f).second.out.end())
+    return;
+  
+  edge_list::iterator in = (*t).second.in.find(from);
+  if (--(*in).second == 0)
+    (*t).second.in.erase(in);
+  
+  if (--(*out).second == 0) {
+    (*f).second.out.erase(out);
+    
+    // The ranks stay valid; a cycle may be gone, though
+    if (m_state == cyclic)
+      m_state = unknown;
+  }
+}
+
+bool submodel_graph::is_referenced(const model *m) const
+{
+  node_list::const_iterator it = m_nodes.find(m);
+  
+  return it != m_nodes.end() && !(*it).second.in.empty();
+}
+
+bool submodel_graph::is_cyclic()
+{
+  validate();
+  
+  return m_state == cyclic;
+}
+
+bool submodel_graph::reaches(const model *from, const model *m)
+{
+  node_list::iterator f = m_nodes.find(from), t = m_nodes.find(m);
+  if (f == m_nodes.end() || t == m_nodes.end())
+    return false;
+  
+  if (from == m)
+    return true;
+  
+  validate();
+  
+  int limit = INT_MAX;
+  if (m_state == acyclic) {
+    if ((*f).second.rank > (*t).second.rank)
+      return false;
+    limit = (*t).second.rank;
+  }
+  
+  std::vector<const model *> visited;
+  ++m_mark;
+  
+  return search_forward(from, limit, m, visited);
+}
+
+std::vector<const model *> submodel_graph::order()
+{
+  std::vector<std::pair<int, const model *> > ranked;
+  std::vector<const model *> result;
+  
+  if (is_cyclic())
+    return result;
+  
+  ranked.reserve(m_nodes.size());
+  for (node_list::const_iterator it = m_nodes.begin(); it != m_nodes.end(); ++it)
+    ranked.push_back(std::make_pair((*it).second.rank, (*it).first));
+  std::sort(ranked.begin(), ranked.end());
+  
+  result.reserve(ranked.size());
+  for (std::vector<std::pair<int, const model *> >::const_iterator it = ranked.begin(); it != ranked.end(); ++it)
+    result.push_back((*it).second);
+  
+  return result;
+}
+
+// Reranks everything from scratch (Kahn's algorithm) after a cycle may
+// have been broken.
+void submodel_graph::validate()
+{
+  if (m_state != unknown)
+    return;
+  
+  std::unordered_map<const model *, int> degree;
+  std::vector<const model *> ready;
+  int rank = 0;
+  
+  for (node_list::const_iterator it = m_nodes.begin(); it != m_nodes.end(); ++it) {
+    degree[(*it).first] = (*it).second.in.size();
+    if ((*it).second.in.empty())
+      ready.push_back((*it).first);
+  }
+  
+  while (!ready.empty()) {
+    node &n = m_nodes[ready.back()];
+    ready.pop_back();
+    
+    n.rank = rank++;
+    for (edge_list::const_iterator it = n.out.begin(); it != n.out.end(); ++it) {
+      if (--degree[(*it).first] == 0)
+        ready.push_back((*it).first);
+    }
+  }
+  
+  if (rank == (int) m_nodes.size()) {
+    m_state = acyclic;
+    m_next_rank = rank;
+  } else {
+    m_state = cyclic;
+  }
+}
+
+// Depth first over outgoing edges, into nodes ranked below limit. Returns
+// true as soon as target is seen.
+bool submodel_graph::search_forward(const model *m, int limit, const model *target, std::vector<const model *> &visited)
+{
+  std::vector<const model *> stack(1, m);
+  m_nodes[m].mark = m_mark;
+  
+  while (!stack.empty()) {
+    node &n = m_nodes[stack.back()];
+    visited.push_back(stack.back());
+    stack.pop_back();
+    
+    for (edge_list::const_iterator it = n.out.begin(); it != n.out.end(); ++it) {
+      if ((*it).first == target)
+        return true;
+      
+      node &next = m_nodes[(*it).first];
+      if (next.mark != m_mark && next.rank < limit) {
+        next.mark = m_mark;
+        stack.push_back((*it).first);
+      }
+    }
+  }
+  
+  return false;
+}
+
+// Depth first over incoming edges, into nodes ranked above limit
+void submodel_graph::search_backward(const model *m, int limit, std::vector<const model *> &visited)
+{
+  std::vector<const model *> stack(1, m);
+  m_nodes[m].mark = m_mark;
+  
+  while (!stack.empty()) {
+    node &n = m_nodes[stack.back()];
+    visited.push_back(stack.back());
+    stack.pop_back();
+    
+    for (edge_list::const_iterator it = n.in.begin(); it != n.in.end(); ++it) {
+      node &prev = m_nodes[(*it).first];
+      if (prev.mark != m_mark && prev.rank > limit) {
+        prev.mark = m_mark;
+        stack.push_back((*it).first);
+      }
+    }
+  }
+}
+
+}
@@ -0,0 +1,82 @@
+/* libLDR: Portable and easy-to-use LDraw format abstraction & I/O reference library *
+ * To obtain more information about LDraw, visit http://www.ldraw.org.               *
+ * Distributed in terms of the GNU Lesser General Public License v3                  *
+ *                                                                                   *
+ * Author: (c)2006-2013 Park "segfault" J. K. <mastermind_at_planetmono_dot_org>     */
+
+#ifndef _LIBLDR_SUBMODEL_GRAPH_H_
+#define _LIBLDR_SUBMODEL_GRAPH_H_
+
+#include <unordered_map>
+#include <vector>
+
+#include "common.h"
+
+namespace ldraw
+{
+
+class model;
+
+// Reference graph between the models of a model_multipart. An edge from a
+// to b stands for the references from a to b; they are counted, so that
+// the edge goes away with the last one.
+//
+// While the graph is acyclic every node carries a rank such that edges
+// always point to a higher rank. Inserting an edge that already agrees
+// with the ranks costs nothing; otherwise only the nodes ranked between
+// its ends are visited and reranked (Pearce & Kelly's dynamic topological
+// sort). Removing an edge keeps the ranks valid. Once a cycle is found the
+// state is kept until an edge is removed, and recomputed on the next query.
+class LIBLDR_EXPORT submodel_graph
+{
+ public:
+  submodel_graph();
+
+  void clear();
+
+  void insert_node(const model *m);
+  void remove_node(const model *m);
+  bool contains(const model *m) const { return m_nodes.find(m) != m_nodes.end(); }
+
+  void insert_edge(const model *from, const model *to);
+  void remove_edge(const model *from, const model *to);
+
+  // Whether any model references m
+  bool is_referenced(const model *m) const;
+
+  bool is_cyclic();
+
+  // Whether m can be reached from 'from' following references
+  bool reaches(const model *from, const model *m);
+
+  // Every model ahead of the models it references; empty if cyclic
+  std::vector<const model *> order();
+
+ private:
+  enum state { acyclic, cyclic, unknown };
+
+  typedef std::unordered_map<const model *, int> edge_list;
+
+  struct node
+  {
+    int rank;
+    unsigned int mark;
+    edge_list out;
+    edge_list in;
+  };
+
+  typedef std::unordered_map<const model *, node> node_list;
+
+  void validate();
+  bool search_forward(const model *m, int limit, const model *target, std::vector<const model *> &visited);
+  void search_backward(const model *m, int limit, std::vector<const model *> &visited);
+
+  node_list m_nodes;
+  int m_next_rank;
+  state m_state;
+  unsigned int m_mark;
+};
+
+}
+
+#endif
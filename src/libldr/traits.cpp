@@ -0,0 +1,103 @@
+/* libLDR: Portable and easy-to-use LDraw format abstraction & I/O reference library *
+ * To obtain more information about LDraw, visit http://www.ldraw.org.               *
+ * Distributed in terms of the GNU Lesser General Public License v3                  *
+ *                                                                                   *
+ * Author: (c)2006-2013 Park "segfault" J. K. <mastermind_at_planetmono_dot_org>     */
+
+#include "elements.h"
+#include "model.h"
+#include "utils.h"
+
+#include "traits.h"
+
+namespace ldraw
+{
+
+static bool is_inherited(const color &c)
+{
+  return c.get_id() == 16 || c.get_id() == 24;
+}
+
+traits::traits(model *m, void *arg)
+    : extension(m, arg), m_flags(0), m_bfc(bfc_certification::unknown), m_studs(0)
+{
+  for (int i = 0; i < 4; ++i)
+    m_count[i] = m_total[i] = m_stud_total[i] = 0;
+}
+
+void traits::update()
+{
+  m_flags = 0;
+  m_studs = 0;
+  for (int i = 0; i < 4; ++i)
+    m_count[i] = m_total[i] = m_stud_total[i] = 0;
+  
+  if (utils::is_stud(m_model))
+    m_flags |= stud;
+  
+  const bfc_certification *cert = m_model->custom_data<bfc_certification>();
+  m_bfc = cert ? cert->certification() : bfc_certification::unknown;
+  
+  for (model::const_iterator it = m_model->elements().begin(); it != m_model->elements().end(); ++it) {
+    const element_base *e = *it;
+    int p;
+    
+    switch (e->get_type()) {
+      case type_line:
+        p = lines;
+        break;
+      case type_triangle:
+        p = triangles;
+        break;
+      case type_quadrilateral:
+        p = quads;
+        break;
+      case type_condline:
+        p = condlines;
+        break;
+      case type_ref: {
+        const element_ref *r = element_cast<element_ref>(e);
+        model *rm = r->get_model();
+        if (!rm)
+          continue;
+        
+        // A model referencing itself finds the traits being computed,
+        // still empty, which ends the recursion
+        if (!rm->custom_data<traits>())
+          rm->update_custom_data<traits>();
+        const traits *rt = rm->custom_data<traits>();
+        
+        if (rt->is(stud)) {
+          ++m_studs;
+          for (int i = 0; i < 4; ++i)
+            m_stud_total[i] += rt->m_total[i] + rt->m_stud_total[i];
+        } else {
+          m_studs += rt->m_studs;
+          for (int i = 0; i < 4; ++i) {
+            m_total[i] += rt->m_total[i];
+            m_stud_total[i] += rt->m_stud_total[i];
+          }
+        }
+        
+        if (rt->is(renderable))
+          m_flags |= renderable;
+        
+        // Studs may be drawn as substitutes in the edge color
+        if (is_inherited(r->get_color()) && (rt->is(color_ambiguous) || rt->is(stud)))
+          m_flags |= color_ambiguous;
+        continue;
+      }
+      default:
+        continue;
+    }
+    
+    ++m_count[p];
+    ++m_total[p];
+    m_flags |= renderable;
+    
+    if (is_inherited(static_cast<const element_colored_base *>(e)->get_color()))
+      m_flags |= own_color_ambiguous | color_ambiguous;
+  }
+}
+
+}
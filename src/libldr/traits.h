@@ -0,0 +1,69 @@
+/* libLDR: Portable and easy-to-use LDraw format abstraction & I/O reference library *
+ * To obtain more information about LDraw, visit http://www.ldraw.org.               *
+ * Distributed in terms of the GNU Lesser General Public License v3                  *
+ *                                                                                   *
+ * Author: (c)2006-2013 Park "segfault" J. K. <mastermind_at_planetmono_dot_org>     */
+
+#ifndef _LIBLDR_TRAITS_H_
+#define _LIBLDR_TRAITS_H_
+
+#include <cstddef>
+#include <string>
+
+#include "bfc.h"
+#include "extension.h"
+
+namespace ldraw
+{
+
+// Properties of a model that renderers and exporters would otherwise work
+// out again on every traversal. update() computes them from the elements
+// and the traits of the referenced models, which it attaches where they
+// are missing. The part library does so for every part and primitive it
+// links; those never change afterwards. Like geometry_columns it is not
+// kept in sync with edits of the model.
+class LIBLDR_EXPORT traits : public extension
+{
+ public:
+  enum flag
+  {
+    stud = 0x1,                // the name contains "stu" (see utils::is_stud())
+    own_color_ambiguous = 0x2, // a line, triangle, quad or condline of its own is in color 16 or 24
+    color_ambiguous = 0x4,     // looks different depending on the color it is referenced in
+    renderable = 0x8           // has geometry, itself or through references
+  };
+  
+  enum primitive { lines, triangles, quads, condlines };
+  
+  traits(model *m, void *arg = 0L);
+  virtual ~traits() {}
+  
+  static const std::string identifier() { return "traits"; }
+  
+  void update();
+  
+  bool is(flag f) const { return (m_flags & f) != 0; }
+  int flags() const { return m_flags; }
+  bfc_certification::cert_status bfc() const { return m_bfc; }
+  
+  // Primitives of the model itself
+  std::size_t count(primitive p) const { return m_count[p]; }
+  // Primitives of the model and every model it references, except those
+  // below references to studs
+  std::size_t total(primitive p) const { return m_total[p]; }
+  // Primitives below references to studs, and the number of those
+  std::size_t stud_total(primitive p) const { return m_stud_total[p]; }
+  std::size_t studs() const { return m_studs; }
+  
+ private:
+  int m_flags;
+  bfc_certification::cert_status m_bfc;
+  std::size_t m_count[4];
+  std::size_t m_total[4];
+  std::size_t m_stud_total[4];
+  std::size_t m_studs;
+};
+
+}
+
+#endif
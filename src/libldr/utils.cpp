@@ -7,7 +7,7 @@
 #include <algorithm>
 #include <cctype>
 #include <cmath>
-#include <set>
+#include <unordered_set>
 
 #include "elements.h"
 #include "math.h"
@@ -22,9 +22,9 @@ namespace ldraw
 namespace utils
 {
 
-bool _cyclic_reference_test(std::set<std::string> &sets, const model *m, const model *insert = 0L)
+bool _cyclic_reference_test(std::unordered_set<atom> &sets, const model *m, const model *insert = 0L)
 {
-	std::string mname = translate_string(m->name());
+	atom mname = m->name_atom();
 
 	if (sets.find(mname) != sets.end())
 		return true;
@@ -54,62 +54,29 @@ bool _cyclic_reference_test(std::set<std::string> &sets, const model *m, const m
 
 bool cyclic_reference_test(const model *m)
 {
-	std::set<std::string> names;
+	std::unordered_set<atom> names;
 
 	return _cyclic_reference_test(names, m);
 }
 
 bool cyclic_reference_test(const model *m, const model *insert)
 {
-	std::set<std::string> names;
+	std::unordered_set<atom> names;
 
 	return _cyclic_reference_test(names, m, insert);
 }
 
-bool _affected_model(const model *target, const model *m)
-{
-	for (model::const_iterator it = m->elements().begin(); it != m->elements().end(); ++it) {
-		if ((*it)->get_type() == ldraw::type_ref) {
-			const element_ref *r = CAST_AS_CONST_REF(*it);
-
-			if (!r->get_model())
-				continue;
-
-			const model *cm = r->get_model();
-
-			if (cm == target)
-				return true;
-			else if (cm->modeltype() == model::submodel && m->parent() == target->parent()) {
-				if (_affected_model(target, cm))
-					return true;
-			}
-		}
-	}
-
-	return false;
-}
-
 std::list<model *> affected_models(model_multipart *base, ldraw::model *m)
 {
-	std::list<ldraw::model *> set;
-
 	if (base->main_model() != m && !m->is_submodel_of(base))
-		return set;
+		return std::list<model *>();
 	
-	if (_affected_model(m, base->main_model()))
-		set.push_back(base->main_model());
-
-	for (std::map<std::string, model *>::const_iterator it = base->submodel_list().begin(); it != base->submodel_list().end(); ++it) {
-		if (_affected_model(m, (*it).second))
-			set.push_back((*it).second);
-	}
-
-	return set;
+	return base->referencing_models(m);
 }
 
 bool name_duplicate_test(const std::string &name, const model_multipart *model)
 {
-	return model->submodel_list().find(name) != model->submodel_list().end();
+	return model->find_submodel(atom_table::intern(name)) != 0L;
 }
 
 bool name_duplicate_test(const std::string &name, const part_library &library)
@@ -199,12 +166,12 @@ std::string trim_string(const std::string &str)
 
 bool is_stud(const model *model)
 {
-	return translate_string(model->name()).find("stu") != std::string::npos;
+	return atom_table::is_stud(model->name_atom());
 }
 
 bool is_stud(const element_ref *ref)
 {
-	return translate_string(ref->filename()).find("stu") != std::string::npos;
+	return atom_table::is_stud(ref->filename_atom());
 }
 
 // Determinant.
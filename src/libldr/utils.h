@@ -41,6 +41,7 @@ LIBLDR_EXPORT void validate_bowtie_quad(element_quadrilateral &quad);
 LIBLDR_EXPORT void validate_bowtie_quads(model *model);
 
 // String handling
+LIBLDR_EXPORT int translate(int c);
 LIBLDR_EXPORT std::string translate_string(const std::string &str);
 LIBLDR_EXPORT std::string trim_string(const std::string &str);
 
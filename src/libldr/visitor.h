@@ -0,0 +1,83 @@
+/* libLDR: Portable and easy-to-use LDraw format abstraction & I/O reference library *
+ * To obtain more information about LDraw, visit http://www.ldraw.org.               *
+ * Distributed in terms of the GNU Lesser General Public License v3                  *
+ *                                                                                   *
+ * Author: (c)2006-2013 Park "segfault" J. K. <mastermind_at_planetmono_dot_org>     */
+
+#ifndef _LIBLDR_VISITOR_H_
+#define _LIBLDR_VISITOR_H_
+
+#include "bfc.h"
+#include "elements.h"
+#include "model.h"
+
+namespace ldraw
+{
+
+// Statically dispatched element visitor. Derive as
+//
+//   class my_visitor : public ldraw::element_visitor<my_visitor> { ... };
+//
+// and define the visit_*() handlers needed; the others do nothing.
+// dispatch() branches once on the element's type tag and calls the handler
+// with a static_cast, so handlers can be inlined into the loop.
+template <class Derived>
+class element_visitor
+{
+ public:
+  void visit_comment(const element_comment *) {}
+  void visit_state(const element_state *) {}
+  void visit_print(const element_print *) {}
+  void visit_ref(const element_ref *) {}
+  void visit_line(const element_line *) {}
+  void visit_triangle(const element_triangle *) {}
+  void visit_quadrilateral(const element_quadrilateral *) {}
+  void visit_condline(const element_condline *) {}
+  void visit_bfc(const element_bfc *) {}
+
+  void dispatch(const element_base *e)
+  {
+    Derived *d = static_cast<Derived *>(this);
+
+    switch (e->get_type()) {
+      case type_comment:
+        d->visit_comment(static_cast<const element_comment *>(e));
+        break;
+      case type_state:
+        d->visit_state(static_cast<const element_state *>(e));
+        break;
+      case type_print:
+        d->visit_print(static_cast<const element_print *>(e));
+        break;
+      case type_ref:
+        d->visit_ref(static_cast<const element_ref *>(e));
+        break;
+      case type_line:
+        d->visit_line(static_cast<const element_line *>(e));
+        break;
+      case type_triangle:
+        d->visit_triangle(static_cast<const element_triangle *>(e));
+        break;
+      case type_quadrilateral:
+        d->visit_quadrilateral(static_cast<const element_quadrilateral *>(e));
+        break;
+      case type_condline:
+        d->visit_condline(static_cast<const element_condline *>(e));
+        break;
+      case type_bfc:
+        d->visit_bfc(static_cast<const element_bfc *>(e));
+        break;
+    }
+  }
+
+  // Visits the elements of m in order (not the referenced models)
+  void visit_elements(const model *m)
+  {
+    for (model::const_iterator it = m->elements().begin(); it != m->elements().end(); ++it)
+      dispatch(*it);
+  }
+};
+
+}
+
+#endif
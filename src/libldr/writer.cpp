@@ -4,11 +4,26 @@
  *                                                                                   *
  * Author: (c)2006-2008 Park "segfault" J. K. <mastermind_at_planetmono_dot_org>     */
 
+#ifdef WIN32
+#include <io.h>
+#define write_fd _write
+#else
+#include <unistd.h>
+#define write_fd ::write
+#endif
+
+#include <cerrno>
+#include <cfloat>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <fstream>
 #include <ios>
 
 #include "bfc.h"
 #include "elements.h"
+#include "geometry_columns.h"
 #include "model.h"
 
 #include "writer.h"
@@ -16,233 +31,489 @@
 namespace ldraw
 {
 
+// Buffered output is handed over once it grows past this
+static const std::size_t flush_threshold = 64 * 1024;
+
 writer::writer(const std::string &filename)
-	: m_filestream(new std::ofstream), m_stream(*m_filestream)
+	: m_filestream(new std::ofstream), m_stream(m_filestream), m_fd(-1), m_depth(0)
 {
 	m_filestream->open(filename.c_str(), std::ios::out);
-	if (!m_filestream->is_open())
+	if (!m_filestream->is_open()) {
+		delete m_filestream;
 		throw exception(__func__, exception::user_error, std::string("Could not open file for writing: ") + filename);
+	}
+
+	m_buffer.reserve(flush_threshold + 1024);
 }
 
 writer::writer(std::ostream &stream)
-	: m_stream(stream)
+	: m_filestream(0L), m_stream(&stream), m_fd(-1), m_depth(0)
 {
-	m_filestream = 0L;
+	m_buffer.reserve(flush_threshold + 1024);
+}
+
+writer::writer(int fd)
+	: m_filestream(0L), m_stream(0L), m_fd(fd), m_depth(0)
+{
+	m_buffer.reserve(flush_threshold + 1024);
 }
 
 writer::~writer()
 {
+	try {
+		flush();
+	} catch (const exception &) {
+	}
+
 	if (m_filestream) {
 		m_filestream->close();
 		delete m_filestream;
 	}
 }
 
+void writer::flush()
+{
+	if (m_buffer.empty())
+		return;
+
+	if (m_stream) {
+		m_stream->write(m_buffer.data(), m_buffer.size());
+		m_buffer.clear();
+		return;
+	}
+
+	const char *p = m_buffer.data();
+	std::size_t left = m_buffer.size();
+
+	while (left) {
+		int n = write_fd(m_fd, p, left);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0) {
+			m_buffer.clear();
+			throw exception(__func__, exception::user_error, std::string("Could not write: ") + std::strerror(errno));
+		}
+
+		p += n;
+		left -= n;
+	}
+
+	m_buffer.clear();
+}
+
+void writer::put(const char *s)
+{
+	m_buffer.append(s);
+}
+
+void writer::put_uint(unsigned long v)
+{
+	char buf[24];
+	char *p = buf + sizeof(buf);
+
+	do {
+		*--p = '0' + v % 10;
+		v /= 10;
+	} while (v);
+
+	m_buffer.append(p, buf + sizeof(buf) - p);
+}
+
+void writer::put_float(float v)
+{
+	char buf[24];
+
+	m_buffer.append(buf, format_float(v, buf));
+}
+
+void writer::end_line()
+{
+	m_buffer.push_back('\n');
+
+	if (m_buffer.size() >= flush_threshold)
+		flush();
+}
+
+// Whether n / 10^k reads back as a, as strtof() and the reader round it.
+// The quotient is exact in double up to a single rounding; only a result
+// exactly halfway between two floats has to be settled by strtof(), fed
+// without a decimal point so that the locale does not matter.
+static bool reads_back(unsigned long long n, int k, double scale, float a)
+{
+	double q = n / scale;
+	float f = (float) q;
+
+	if ((double) f != q) {
+		float other = std::nextafter(f, (double) f < q ? FLT_MAX : 0.0f);
+
+		if (((double) f + (double) other) * 0.5 == q) {
+			char buf[32];
+			std::snprintf(buf, sizeof(buf), "%llue-%d", n, k);
+			return std::strtof(buf, 0L) == a;
+		}
+	}
+
+	return f == a;
+}
+
+int writer::format_float(float v, char *out)
+{
+	static const double pow10[] = {
+		1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7,
+		1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15
+	};
+
+	float a = std::fabs(v);
+
+	// The fewest decimals whose nearest value reads back as v
+	for (int k = 0; k < 16 && a < 1e9f; ++k) {
+		double scaled = (double) a * pow10[k];
+		if (scaled >= 9e15)
+			break;
+
+		unsigned long long n = (unsigned long long) (scaled + 0.5);
+		if (!reads_back(n, k, pow10[k], a))
+			continue;
+
+		char digits[24];
+		int len = 0;
+		do {
+			digits[len++] = '0' + n % 10;
+			n /= 10;
+		} while (n);
+
+		char *p = out;
+		if (v < 0.0f)
+			*p++ = '-';
+
+		for (int i = len - 1; i >= k; --i)
+			*p++ = digits[i];
+		if (len <= k)
+			*p++ = '0';
+
+		if (k) {
+			*p++ = '.';
+			for (int i = k - 1; i >= 0; --i)
+				*p++ = i < len ? digits[i] : '0';
+		}
+
+		return p - out;
+	}
+
+	// Large, tiny and non-finite values
+	for (int precision = 6; precision < 9; ++precision) {
+		int len = std::snprintf(out, 24, "%.*g", precision, v);
+		if (std::strtof(out, 0L) == v)
+			return len;
+	}
+
+	return std::snprintf(out, 24, "%.9g", v);
+}
+
 void writer::write(const model *model)
 {
-	m_stream << "0 " << model->desc() << std::endl;
-	if (!model->name().empty())
-		m_stream << "0 Name: " << model->name() << std::endl;
-	if (!model->author().empty())
-		m_stream << "0 Author: " << model->author() << std::endl << std::endl;
+	scope s(this);
+
+	put("0 ");
+	put(model->desc());
+	end_line();
+	if (!model->name().empty()) {
+		put("0 Name: ");
+		put(model->name());
+		end_line();
+	}
+	if (!model->author().empty()) {
+		put("0 Author: ");
+		put(model->author());
+		end_line();
+		end_line();
+	}
 
 	if (model->custom_data<bfc_certification>()) {
 		bfc_certification *c = model->custom_data<bfc_certification>();
 		if (c->certification() == bfc_certification::certified) {
-			m_stream << "0 BFC";
+			put("0 BFC");
 			
 			if (c->orientation() == bfc_certification::cw)
-				m_stream << " CW";
+				put(" CW");
 
-			m_stream << std::endl << std::endl;;
+			end_line();
+			end_line();
 		} else if (c->certification() == bfc_certification::uncertified) {
-			m_stream << "0 BFC NOCERTIFY" << std::endl << std::endl;
+			put("0 BFC NOCERTIFY");
+			end_line();
+			end_line();
 		}
 	}
 	
 	const std::multimap<std::string, std::string> &headers = model->headers();
-	for (std::multimap<std::string, std::string>::const_iterator it = headers.begin(); it != headers.end(); ++it)
-		m_stream << "0 !" << (*it).first << " " << (*it).second << std::endl;
-	m_stream << std::endl;
+	for (std::multimap<std::string, std::string>::const_iterator it = headers.begin(); it != headers.end(); ++it) {
+		put("0 !");
+		put((*it).first);
+		put(' ');
+		put((*it).second);
+		end_line();
+	}
+	end_line();
 	
 	for (model::const_iterator it = model->elements().begin(); it != model->elements().end(); ++it)
 		write(*it);
+
+	s.done();
 }
 	
 void writer::write(const model_multipart *mpmodel)
 {
-	m_stream << "0 FILE " << mpmodel->main_model()->name() << std::endl;
+	scope s(this);
+
+	put("0 FILE ");
+	put(mpmodel->main_model()->name());
+	end_line();
 
 	write(mpmodel->main_model());
 
 	for (std::map<std::string, model *>::const_iterator it = mpmodel->submodel_list().begin(); it != mpmodel->submodel_list().end(); ++it) {
-		m_stream << std::endl << "0 FILE " << (*it).second->name() << std::endl;
+		end_line();
+		put("0 FILE ");
+		put((*it).second->name());
+		end_line();
 		write((*it).second);
 	}
+
+	s.done();
 }
 
 void writer::write(const element_base *elem)
 {
+	scope s(this);
+
 	switch (elem->get_type()) {
 		case type_comment:
-			serialize_comment(CAST_AS_CONST_COMMENT(elem));
+			serialize_comment(element_cast<element_comment>(elem));
 			break;
 		case type_state:
-			serialize_state(CAST_AS_CONST_STATE(elem));
+			serialize_state(element_cast<element_state>(elem));
 			break;
 		case type_print:
-			serialize_print(CAST_AS_CONST_PRINT(elem));
+			serialize_print(element_cast<element_print>(elem));
 			break;
 		case type_ref:
-			serialize_ref(CAST_AS_CONST_REF(elem));
+			serialize_ref(element_cast<element_ref>(elem));
 			break;
 		case type_line:
-			serialize_line(CAST_AS_CONST_LINE(elem));
+			serialize_line(element_cast<element_line>(elem));
 			break;
 		case type_triangle:
-			serialize_triangle(CAST_AS_CONST_TRIANGLE(elem));
+			serialize_triangle(element_cast<element_triangle>(elem));
 			break;
 		case type_quadrilateral:
-			serialize_quadrilateral(CAST_AS_CONST_QUADRILATERAL(elem));
+			serialize_quadrilateral(element_cast<element_quadrilateral>(elem));
 			break;
 		case type_condline:
-			serialize_condline(CAST_AS_CONST_CONDLINE(elem));
+			serialize_condline(element_cast<element_condline>(elem));
 			break;
 		case type_bfc:
-			serialize_bfc(CAST_AS_CONST_BFC(elem));
+			serialize_bfc(element_cast<element_bfc>(elem));
 			break;
 		default:
 			break;
 	}
+
+	s.done();
+}
+
+void writer::write_columns(const geometry_columns *columns)
+{
+	static const char codes[] = { '2', '3', '4', '5' };
+
+	const std::vector<element_base *> &elements = columns->source()->elements();
+	const std::vector<geometry_columns::entry> &order = columns->order();
+
+	scope s(this);
+
+	for (std::vector<geometry_columns::entry>::const_iterator it = order.begin(); it != order.end(); ++it) {
+		if ((*it).type == geometry_columns::other) {
+			write(elements[(*it).row]);
+			continue;
+		}
+
+		geometry_columns::column_type t = (geometry_columns::column_type) (*it).type;
+		const geometry_columns::column &c = columns->get(t);
+		int n = geometry_columns::vertices(t);
+		const float *p = &c.positions[(*it).row * n * 3];
+
+		put(codes[t]);
+		put(' ');
+		put_uint(c.colors[(*it).row]);
+		for (int i = 0; i < n; ++i, p += 3) {
+			put(' ');
+			put_float(p[0]);
+			put(' ');
+			put_float(p[1]);
+			put(' ');
+			put_float(p[2]);
+		}
+		end_line();
+	}
+
+	s.done();
 }
 
 void writer::serialize_comment(const element_comment *e)
 {
-	m_stream << "0 " << e->get_comment() << std::endl;
+	put("0 ");
+	put(e->get_comment());
+	end_line();
 }
 
 void writer::serialize_state(const element_state *e)
 {
-	m_stream << "0 ";
+	put("0 ");
 
 	switch (e->get_state()) {
 		case element_state::state_step:
-			m_stream << "STEP";
+			put("STEP");
 			break;
 		case element_state::state_pause:
-			m_stream << "PAUSE";
+			put("PAUSE");
 			break;
 		case element_state::state_clear:
-			m_stream << "CLEAR";
+			put("CLEAR");
 			break;
 		case element_state::state_save:
-			m_stream << "SAVE";
+			put("SAVE");
 			break;
 	}
 
-	m_stream << std::endl;
+	end_line();
 }
 
 void writer::serialize_print(const element_print *e)
 {
-	m_stream << "0 PRINT " << e->get_string() << std::endl;
+	put("0 PRINT ");
+	put(e->get_string());
+	end_line();
 }
 
 void writer::serialize_ref(const element_ref *e)
 {
-	m_stream << "1 " << e->get_color().get_id() << " ";
+	put("1 ");
+	put_uint(e->get_color().get_id());
+	put(' ');
 	serialize_matrix(e->get_matrix());
-	m_stream << " " << e->filename() << std::endl;
+	put(' ');
+	put(e->filename());
+	end_line();
 }
 
 void writer::serialize_line(const element_line *e)
 {
-	m_stream << "2 " << e->get_color().get_id() << " ";
+	put("2 ");
+	put_uint(e->get_color().get_id());
+	put(' ');
 	serialize_vector(e->pos1());
-	m_stream << " ";
+	put(' ');
 	serialize_vector(e->pos2());
-	m_stream << std::endl;
+	end_line();
 }
 
 void writer::serialize_triangle(const element_triangle *e)
 {
-	m_stream << "3 " << e->get_color().get_id() << " ";
+	put("3 ");
+	put_uint(e->get_color().get_id());
+	put(' ');
 	serialize_vector(e->pos1());
-	m_stream << " ";
+	put(' ');
 	serialize_vector(e->pos2());
-	m_stream << " ";
+	put(' ');
 	serialize_vector(e->pos3());
-	m_stream << std::endl;
+	end_line();
 }
 	
 void writer::serialize_quadrilateral(const element_quadrilateral *e)
 {
-	m_stream << "4 " << e->get_color().get_id() << " ";
+	put("4 ");
+	put_uint(e->get_color().get_id());
+	put(' ');
 	serialize_vector(e->pos1());
-	m_stream << " ";
+	put(' ');
 	serialize_vector(e->pos2());
-	m_stream << " ";
+	put(' ');
 	serialize_vector(e->pos3());
-	m_stream << " ";
+	put(' ');
 	serialize_vector(e->pos4());
-	m_stream << std::endl;
+	end_line();
 }
 
 void writer::serialize_condline(const element_condline *e)
 {
-	m_stream << "5 " << e->get_color().get_id() << " ";
+	put("5 ");
+	put_uint(e->get_color().get_id());
+	put(' ');
 	serialize_vector(e->pos1());
-	m_stream << " ";
+	put(' ');
 	serialize_vector(e->pos2());
-	m_stream << " ";
+	put(' ');
 	serialize_vector(e->pos3());
-	m_stream << " ";
+	put(' ');
 	serialize_vector(e->pos4());
-	m_stream << std::endl;
+	end_line();
 }
 
 void writer::serialize_bfc(const element_bfc *e)
 {
-	m_stream << "0 BFC ";
+	put("0 BFC ");
 	
 	switch (e->get_command()) {
 		case element_bfc::cw:
-			m_stream << "CW";
+			put("CW");
 			break;
 		case element_bfc::ccw:
-			m_stream << "CCW";
+			put("CCW");
 			break;
 		case element_bfc::clip:
-			m_stream << "CLIP";
+			put("CLIP");
 			break;
 		case element_bfc::clip_cw:
-			m_stream << "CLIP CW";
+			put("CLIP CW");
 			break;
 		case element_bfc::clip_ccw:
-			m_stream << "CLIP CCW";
+			put("CLIP CCW");
 			break;
 		case element_bfc::noclip:
-			m_stream << "NOCLIP";
+			put("NOCLIP");
 			break;
 		case element_bfc::invertnext:
-			m_stream << "INVERTNEXT";
+			put("INVERTNEXT");
 			break;
 	}
 
-	m_stream << std::endl;
+	end_line();
 }
 
 void writer::serialize_matrix(const matrix &m)
 {
-	m_stream << m.value(0, 3) << " " << m.value(1, 3) << " " << m.value(2, 3) <<
-		" " << m.value(0, 0) << " " << m.value(0, 1) << " " << m.value(0, 2) <<
-		" " << m.value(1, 0) << " " << m.value(1, 1) << " " << m.value(1, 2) <<
-		" " << m.value(2, 0) << " " << m.value(2, 1) << " " << m.value(2, 2);
+	static const int order[][2] = {
+		{ 0, 3 }, { 1, 3 }, { 2, 3 },
+		{ 0, 0 }, { 0, 1 }, { 0, 2 },
+		{ 1, 0 }, { 1, 1 }, { 1, 2 },
+		{ 2, 0 }, { 2, 1 }, { 2, 2 }
+	};
+
+	for (int i = 0; i < 12; ++i) {
+		if (i)
+			put(' ');
+		put_float(m.value(order[i][0], order[i][1]));
+	}
 }
 
 void writer::serialize_vector(const vector &v)
 {
-	m_stream << v.x() << " " << v.y() << " " << v.z();
+	put_float(v.x());
+	put(' ');
+	put_float(v.y());
+	put(' ');
+	put_float(v.z());
 }
 
 }
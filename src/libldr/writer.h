@@ -17,6 +17,7 @@ namespace ldraw
 
 class model;
 class model_multipart;
+class geometry_columns;
 class element_base;
 class element_comment;
 class element_state;
@@ -30,17 +31,26 @@ class element_bfc;
 class matrix;
 class vector;
 
+// Output is collected in a buffer and handed to the stream or file
+// descriptor in large blocks, and at the latest when the outermost write()
+// returns. Only the serialize_*() functions, when called directly, need a
+// flush() afterwards.
 class LIBLDR_EXPORT writer
 {
   public:
 	writer(const std::string &filename);
 	writer(std::ostream &stream);
+	// Writes to an open file descriptor, which is left open
+	writer(int fd);
 	virtual ~writer();
 
 	void write(const model *model);
 	void write(const model_multipart *mpmodel);
 	void write(const element_base *elem);
 
+	// Writes the elements of the source model from its columnar copy
+	void write_columns(const geometry_columns *columns);
+
 	void serialize_comment(const element_comment *e);
 	void serialize_state(const element_state *e);
 	void serialize_print(const element_print *e);
@@ -52,10 +62,45 @@ class LIBLDR_EXPORT writer
 	void serialize_bfc(const element_bfc *e);
 	void serialize_matrix(const matrix &m);
 	void serialize_vector(const vector &v);
+
+	void flush();
+
+	// Shortest decimal representation that strtof(), and so either reader,
+	// rounds back to the same float.
+	// Writes at most 24 characters to out and returns the length.
+	static int format_float(float v, char *out);
 	
   private:
+	// Held by every write(). Leaving the outermost one with done() flushes
+	// the buffer; the depth is restored however it is left, so a write()
+	// that threw does not keep later ones from flushing.
+	class scope
+	{
+	  public:
+		scope(writer *w) : m_writer(w) { ++w->m_depth; }
+		~scope() { --m_writer->m_depth; }
+
+		void done() { if (m_writer->m_depth == 1) m_writer->flush(); }
+
+	  private:
+		scope(const scope &);
+		scope& operator=(const scope &);
+
+		writer *m_writer;
+	};
+
+	void put(char c) { m_buffer.push_back(c); }
+	void put(const char *s);
+	void put(const std::string &s) { m_buffer.append(s); }
+	void put_uint(unsigned long v);
+	void put_float(float v);
+	void end_line();
+
 	std::ofstream *m_filestream;
-	std::ostream &m_stream;
+	std::ostream *m_stream;
+	int m_fd;
+	int m_depth;
+	std::string m_buffer;
 };
 
 }
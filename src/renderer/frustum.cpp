@@ -0,0 +1,146 @@
+/* LDRrenderer: LDraw model rendering library which based on libLDR                  *
+ * To obtain more information about LDraw, visit http://www.ldraw.org                *
+ * Distributed in terms of the General Public License v2                             *
+ *                                                                                   *
+ * Author: (c)2006-2010 Park "segfault" J. K. <mastermind_at_planetmono_dot_org>     */
+
+#include <cmath>
+
+#include <libldr/elements.h>
+#include <libldr/metrics.h>
+#include <libldr/model.h>
+
+#include "opengl.h"
+
+#include "frustum.h"
+
+namespace ldraw_renderer
+{
+
+frustum::frustum()
+	: m_levels(1), m_depth(0)
+{
+}
+
+void frustum::begin(bool enabled)
+{
+	m_depth = 0;
+
+	for (std::vector<level>::iterator it = m_levels.begin(); it != m_levels.end(); ++it)
+		(*it).queried = 0L;
+
+	level &root = m_levels[0];
+	root.vis = enabled ? intersecting : inside;
+
+	if (!enabled)
+		return;
+
+	float p[16], mv[16];
+
+	glGetFloatv(GL_PROJECTION_MATRIX, p);
+	glGetFloatv(GL_MODELVIEW_MATRIX, mv);
+
+	root.clip = ldraw::matrix(p).transpose() * ldraw::matrix(mv).transpose();
+}
+
+void frustum::push(const ldraw::element_ref *r, visibility v)
+{
+	const level &parent = m_levels[m_depth];
+
+	if (++m_depth == (int) m_levels.size())
+		m_levels.push_back(level());
+
+	level &l = m_levels[m_depth];
+	l.vis = v;
+	l.queried = 0L;
+
+	/* no test below this one needs the transform */
+	if (v != inside)
+		l.clip = parent.clip * r->get_matrix();
+}
+
+void frustum::pop()
+{
+	--m_depth;
+}
+
+frustum::visibility frustum::classify(const ldraw::model *m, const ldraw::element_ref *r)
+{
+	level &l = m_levels[m_depth];
+	ldraw::model *rm = r->get_model();
+
+	if (l.vis == inside || !rm)
+		return inside;
+
+	if (l.queried != m) {
+		const ldraw::bvh *b = m->custom_data<ldraw::bvh>();
+
+		l.queried = m;
+		l.indexed = b != 0L;
+		l.candidates.clear();
+
+		if (b) {
+			ldraw::bvh::plane planes[6];
+
+			get_planes(l.clip, planes);
+			m_found.clear();
+			b->query_frustum(planes, 6, m_found);
+			l.candidates.insert(m_found.begin(), m_found.end());
+		}
+	}
+
+	if (l.indexed && !l.candidates.count(r))
+		return outside;
+
+	const ldraw::metrics *mm = rm->shared_custom_data<ldraw::metrics>();
+
+	return classify_box(l.clip * r->get_matrix(), mm->min_(), mm->max_());
+}
+
+/* Rows of the clip matrix: -w <= x, y, z <= w */
+void frustum::get_planes(const ldraw::matrix &clip, ldraw::bvh::plane *planes)
+{
+	for (int i = 0; i < 6; ++i) {
+		float s = i & 1 ? -1.0f : 1.0f;
+		int axis = i >> 1;
+
+		planes[i].normal = ldraw::vector(clip.value(3, 0) + s * clip.value(axis, 0),
+		                                 clip.value(3, 1) + s * clip.value(axis, 1),
+		                                 clip.value(3, 2) + s * clip.value(axis, 2));
+		planes[i].distance = clip.value(3, 3) + s * clip.value(axis, 3);
+	}
+}
+
+/* Center and half extent of the box against each plane */
+frustum::visibility frustum::classify_box(const ldraw::matrix &clip, const ldraw::vector &min, const ldraw::vector &max)
+{
+	ldraw::bvh::plane planes[6];
+	float center[3], extent[3];
+	bool contained = true;
+
+	get_planes(clip, planes);
+
+	for (int j = 0; j < 3; ++j) {
+		center[j] = (min[j] + max[j]) * 0.5f;
+		extent[j] = (max[j] - min[j]) * 0.5f;
+	}
+
+	for (int i = 0; i < 6; ++i) {
+		const ldraw::vector &n = planes[i].normal;
+		float d = planes[i].distance, r = 0.0f;
+
+		for (int j = 0; j < 3; ++j) {
+			d += n[j] * center[j];
+			r += std::fabs(n[j]) * extent[j];
+		}
+
+		if (d + r < 0.0f)
+			return outside;
+		if (d - r < 0.0f)
+			contained = false;
+	}
+
+	return contained ? inside : intersecting;
+}
+
+}
@@ -0,0 +1,70 @@
+/* LDRrenderer: LDraw model rendering library which based on libLDR                  *
+ * To obtain more information about LDraw, visit http://www.ldraw.org                *
+ * Distributed in terms of the General Public License v2                             *
+ *                                                                                   *
+ * Author: (c)2006-2010 Park "segfault" J. K. <mastermind_at_planetmono_dot_org>     */
+
+#ifndef _RENDERER_FRUSTUM_H_
+#define _RENDERER_FRUSTUM_H_
+
+#include <unordered_set>
+#include <vector>
+
+#include <libldr/bvh.h>
+#include <libldr/math.h>
+
+namespace ldraw
+{
+	class element_base;
+	class element_ref;
+	class model;
+}
+
+namespace ldraw_renderer
+{
+
+/* View-frustum culling of references, for the renderers. A frame starts with
+ * begin(), which takes the current OpenGL matrices; the renderer then follows
+ * the references it descends into with push() and pop(). The box of the
+ * model of a reference, from its cached ldraw::metrics, is tested as
+ * transformed into clip space. Below a reference found inside, nothing is
+ * tested again. In a model with an ldraw::bvh, the hierarchy is queried once
+ * per visit and references it leaves out are culled without a test. */
+class LIBLDRAWRENDERER_EXPORT frustum
+{
+  public:
+	enum visibility { outside, intersecting, inside };
+
+	frustum();
+
+	void begin(bool enabled);
+
+	/* r being the reference descended into, as classified */
+	void push(const ldraw::element_ref *r, visibility v);
+	void pop();
+
+	/* Visibility of the reference r of the model m being drawn */
+	visibility classify(const ldraw::model *m, const ldraw::element_ref *r);
+
+	/* The planes of the clip volume, in the coordinates clip maps from */
+	static void get_planes(const ldraw::matrix &clip, ldraw::bvh::plane *planes);
+	static visibility classify_box(const ldraw::matrix &clip, const ldraw::vector &min, const ldraw::vector &max);
+
+  private:
+	struct level
+	{
+		ldraw::matrix clip;
+		visibility vis;
+		const ldraw::model *queried;
+		bool indexed;
+		std::unordered_set<const ldraw::element_base *> candidates;
+	};
+
+	std::vector<level> m_levels;
+	int m_depth;
+	std::vector<const ldraw::element_base *> m_found;
+};
+
+}
+
+#endif
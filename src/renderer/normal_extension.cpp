@@ -4,14 +4,122 @@
  *                                                                                   *
  * Author: (c)2006-2008 Park "segfault" J. K. <mastermind_at_planetmono_dot_org>     */
 
+#include <algorithm>
+#include <cmath>
+#include <thread>
+
 #include <libldr/elements.h>
 #include <libldr/model.h>
+#include <libldr/visitor.h>
 
 #include "normal_extension.h"
 
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define RENDERER_NORMAL_SSE
+#include <xmmintrin.h>
+#endif
+
 namespace ldraw_renderer
 {
 
+/* Faces per thread below which splitting the work does not pay off */
+static const std::size_t parallel_grain = 16384;
+
+/* Same operations in the same order as vector::cross_product() and
+ * vector::normalize(), so that both paths give identical results */
+static inline void calculate_normal(const float *v, float *out)
+{
+	float d1x = v[3] - v[0], d1y = v[4] - v[1], d1z = v[5] - v[2];
+	float d2x = v[6] - v[3], d2y = v[7] - v[4], d2z = v[8] - v[5];
+
+	float x = d1y*d2z - d1z*d2y;
+	float y = d1z*d2x - d1x*d2z;
+	float z = d1x*d2y - d1y*d2x;
+	float r = std::sqrt(x*x + y*y + z*z);
+
+	if (r != 0.0f) {
+		out[0] = x / r;
+		out[1] = y / r;
+		out[2] = z / r;
+	} else {
+		out[0] = out[1] = out[2] = 0.0f;
+	}
+}
+
+void normal_extension::calculate_normals(const float *positions, int stride, std::size_t count, float *out)
+{
+	std::size_t i = 0;
+
+#ifdef RENDERER_NORMAL_SSE
+	/* Four faces at a time, one coordinate per register */
+	for (; i + 4 <= count; i += 4) {
+		const float *p0 = positions + i * stride, *p1 = p0 + stride, *p2 = p1 + stride, *p3 = p2 + stride;
+		__m128 c[9];
+
+		for (int k = 0; k < 9; ++k)
+			c[k] = _mm_set_ps(p3[k], p2[k], p1[k], p0[k]);
+
+		__m128 d1x = _mm_sub_ps(c[3], c[0]), d1y = _mm_sub_ps(c[4], c[1]), d1z = _mm_sub_ps(c[5], c[2]);
+		__m128 d2x = _mm_sub_ps(c[6], c[3]), d2y = _mm_sub_ps(c[7], c[4]), d2z = _mm_sub_ps(c[8], c[5]);
+
+		__m128 x = _mm_sub_ps(_mm_mul_ps(d1y, d2z), _mm_mul_ps(d1z, d2y));
+		__m128 y = _mm_sub_ps(_mm_mul_ps(d1z, d2x), _mm_mul_ps(d1x, d2z));
+		__m128 z = _mm_sub_ps(_mm_mul_ps(d1x, d2y), _mm_mul_ps(d1y, d2x));
+		__m128 r = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y)), _mm_mul_ps(z, z)));
+		__m128 nonzero = _mm_cmpneq_ps(r, _mm_setzero_ps());
+
+		float nx[4], ny[4], nz[4];
+		_mm_storeu_ps(nx, _mm_and_ps(_mm_div_ps(x, r), nonzero));
+		_mm_storeu_ps(ny, _mm_and_ps(_mm_div_ps(y, r), nonzero));
+		_mm_storeu_ps(nz, _mm_and_ps(_mm_div_ps(z, r), nonzero));
+
+		for (int j = 0; j < 4; ++j) {
+			out[(i + j) * 3] = nx[j];
+			out[(i + j) * 3 + 1] = ny[j];
+			out[(i + j) * 3 + 2] = nz[j];
+		}
+	}
+#endif
+
+	for (; i < count; ++i)
+		calculate_normal(positions + i * stride, out + i * 3);
+}
+
+/* Normals of packed faces, scattered to the elements they belong to */
+static void calculate_range(const float *positions, int stride, const unsigned int *elements, std::size_t first, std::size_t last, float *normals)
+{
+	float buffer[256 * 3];
+
+	for (std::size_t i = first; i < last; i += 256) {
+		std::size_t n = std::min<std::size_t>(256, last - i);
+
+		normal_extension::calculate_normals(positions + i * stride, stride, n, buffer);
+		for (std::size_t j = 0; j < n; ++j)
+			std::copy(buffer + j * 3, buffer + j * 3 + 3, normals + elements[i + j] * 3);
+	}
+}
+
+static void calculate_all(const float *positions, int stride, const unsigned int *elements, std::size_t count, float *normals)
+{
+	std::size_t threads = std::min<std::size_t>(std::max(1u, std::thread::hardware_concurrency()), count / parallel_grain);
+
+	if (threads <= 1) {
+		calculate_range(positions, stride, elements, 0, count, normals);
+		return;
+	}
+
+	/* Every face writes its own element's normal only */
+	std::vector<std::thread> pool;
+	std::size_t chunk = (count + threads - 1) / threads;
+	for (std::size_t first = chunk; first < count; first += chunk)
+		pool.push_back(std::thread(calculate_range, positions, stride, elements, first, std::min(first + chunk, count), normals));
+
+	calculate_range(positions, stride, elements, 0, chunk, normals);
+
+	for (std::vector<std::thread>::iterator it = pool.begin(); it != pool.end(); ++it)
+		(*it).join();
+}
+
 normal_extension::normal_extension(ldraw::model *m, void *arg)
 	: extension(m, arg)
 {
@@ -23,67 +131,69 @@ normal_extension::~normal_extension()
 
 }
 
+/* The first three vertices of every face dispatched to it, packed, and the
+ * index of the face in its model */
+class face_packer : public ldraw::element_visitor<face_packer>
+{
+  public:
+	face_packer() : index(0) {}
+
+	void visit_triangle(const ldraw::element_triangle *t) { add(t->pos1(), t->pos2(), t->pos3()); }
+	void visit_quadrilateral(const ldraw::element_quadrilateral *q) { add(q->pos1(), q->pos2(), q->pos3()); }
+
+	unsigned int index;
+	std::vector<float> positions;
+	std::vector<unsigned int> faces;
+
+  private:
+	void add(const ldraw::vector &v1, const ldraw::vector &v2, const ldraw::vector &v3)
+	{
+		positions.insert(positions.end(), v1.get_pointer(), v1.get_pointer() + 3);
+		positions.insert(positions.end(), v2.get_pointer(), v2.get_pointer() + 3);
+		positions.insert(positions.end(), v3.get_pointer(), v3.get_pointer() + 3);
+		faces.push_back(index);
+	}
+};
+
 void normal_extension::update()
 {
-	int i = 0;
-
-	m_normals.clear();
-	
-	for (ldraw::model::const_iterator it = m_model->elements().begin(); it != m_model->elements().end(); ++it) {
-		ldraw::vector v1, v2, v3;
-		ldraw::vector nvec;
-
-		switch ((*it)->get_type()) {
-			case ldraw::type_triangle:
-			{
-				const ldraw::element_triangle *t = CAST_AS_CONST_TRIANGLE(*it);
-				nvec = calculate_normal(t->pos1(), t->pos2(), t->pos3());
-				break;
-			}
-			case ldraw::type_quadrilateral:
-			{
-				const ldraw::element_quadrilateral *t = CAST_AS_CONST_QUADRILATERAL(*it);
-				nvec = calculate_normal(t->pos1(), t->pos2(), t->pos3());
-				break;
-			}
-			default:
-				++i;
-				continue;
-		}
+	const std::vector<ldraw::element_base *> &elements = m_model->elements();
 
-		m_normals[i++] = nvec;
-	}
+	m_normals.assign(elements.size() * 3, 0.0f);
+
+	face_packer p;
+
+	p.positions.reserve(elements.size() * 9);
+	p.faces.reserve(elements.size());
+
+	for (std::vector<ldraw::element_base *>::const_iterator it = elements.begin(); it != elements.end(); ++it, ++p.index)
+		p.dispatch(*it);
+
+	if (!p.faces.empty())
+		calculate_all(&p.positions[0], 9, &p.faces[0], p.faces.size(), &m_normals[0]);
 }
 
 bool normal_extension::has_normal(int idx) const
 {
-	return m_normals.find(idx) != m_normals.end();
+	if (idx < 0 || (std::size_t) idx * 3 >= m_normals.size() || (std::size_t) idx >= m_model->elements().size())
+		return false;
+
+	ldraw::type t = m_model->elements()[idx]->get_type();
+
+	return t == ldraw::type_triangle || t == ldraw::type_quadrilateral;
 }
 
 ldraw::vector normal_extension::normal(int idx) const
 {
 	if (has_normal(idx))
-		return (*m_normals.find(idx)).second;
+		return ldraw::vector(m_normals[idx * 3], m_normals[idx * 3 + 1], m_normals[idx * 3 + 2]);
 	else
 		return ldraw::vector();
 }
 
-const std::map<int, ldraw::vector>& normal_extension::normals() const
-{
-	return m_normals;
-}
-
-// Calculates normal vector
-ldraw::vector normal_extension::calculate_normal(const ldraw::vector &v1, const ldraw::vector &v2, const ldraw::vector &v3)
+std::size_t normal_extension::memory_usage() const
 {
-	ldraw::vector d1, d2, out;
-	
-	d1 = v2 - v1;
-	d2 = v3 - v2;
-	
-	out = ldraw::vector::cross_product(d1, d2).normalize();
-	
-	return out;
+	return m_normals.capacity() * sizeof(float);
 }
 
 }
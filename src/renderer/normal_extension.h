@@ -7,7 +7,8 @@
 #ifndef _RENDERER_NORMAL_EXTENSION_H_
 #define _RENDERER_NORMAL_EXTENSION_H_
 
-#include <map>
+#include <cstddef>
+#include <vector>
 
 #include <libldr/extension.h>
 #include <libldr/math.h>
@@ -20,6 +21,9 @@ namespace ldraw
 namespace ldraw_renderer
 {
 
+/* Face normals of the triangles and quads of a model, three floats per
+ * element so that the normal of element i is at normals() + 3 * i. Other
+ * elements get a zero vector. */
 class LIBLDRAWRENDERER_EXPORT normal_extension : public ldraw::extension
 {
   public:
@@ -32,12 +36,16 @@ class LIBLDRAWRENDERER_EXPORT normal_extension : public ldraw::extension
 
 	bool has_normal(int idx) const;
 	ldraw::vector normal(int idx) const;
-	const std::map<int, ldraw::vector>& normals() const;
+	const float* normals() const { return m_normals.empty() ? 0L : &m_normals[0]; }
+
+	std::size_t memory_usage() const;
+
+	/* Normals of count faces given by their first three vertices, the
+	 * faces being stride floats apart; three floats per face into out */
+	static void calculate_normals(const float *positions, int stride, std::size_t count, float *out);
 
   private:
-	static ldraw::vector calculate_normal(const ldraw::vector &v1, const ldraw::vector &v2, const ldraw::vector &v3);
-	
-	std::map<int, ldraw::vector> m_normals;
+	std::vector<float> m_normals;
 };
 
 }
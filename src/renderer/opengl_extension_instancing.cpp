@@ -0,0 +1,43 @@
+/* LDRrenderer: LDraw model rendering library which based on libLDR                  *
+ * To obtain more information about LDraw, visit http://www.ldraw.org                *
+ * Distributed in terms of the General Public License v2                             *
+ *                                                                                   *
+ * Author: (c)2006-2010 Park "segfault" J. K. <mastermind_at_planetmono_dot_org>     */
+
+#include "opengl_extension_instancing.h"
+
+namespace ldraw_renderer
+{
+
+opengl_extension_instancing* opengl_extension_instancing::m_instance = 0L;
+
+opengl_extension_instancing* opengl_extension_instancing::self()
+{
+	if (!m_instance)
+		m_instance = new opengl_extension_instancing();
+
+	return m_instance;
+}
+
+opengl_extension_instancing::opengl_extension_instancing()
+	: opengl_extension("GL_ARB_instanced_arrays")
+{
+	if (m_supported) {
+		m_glvertexattribdivisor = (PFNGLVERTEXATTRIBDIVISORARBPROC) get_glext_proc("glVertexAttribDivisorARB");
+		m_gldrawelementsinstanced = (PFNGLDRAWELEMENTSINSTANCEDARBPROC) get_glext_proc("glDrawElementsInstancedARB");
+	}
+}
+
+void opengl_extension_instancing::glVertexAttribDivisor(GLuint index, GLuint divisor)
+{
+	if (m_supported)
+		m_glvertexattribdivisor(index, divisor);
+}
+
+void opengl_extension_instancing::glDrawElementsInstanced(GLenum mode, GLsizei count, GLenum type, const GLvoid *indices, GLsizei primcount)
+{
+	if (m_supported)
+		m_gldrawelementsinstanced(mode, count, type, indices, primcount);
+}
+
+}
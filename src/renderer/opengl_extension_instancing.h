@@ -0,0 +1,38 @@
+/* LDRrenderer: LDraw model rendering library which based on libLDR                  *
+ * To obtain more information about LDraw, visit http://www.ldraw.org                *
+ * Distributed in terms of the General Public License v2                             *
+ *                                                                                   *
+ * Author: (c)2006-2010 Park "segfault" J. K. <mastermind_at_planetmono_dot_org>     */
+
+#ifndef _RENDERER_OPENGL_EXTENSION_INSTANCING_H_
+#define _RENDERER_OPENGL_EXTENSION_INSTANCING_H_
+
+#include <libldr/common.h>
+
+#include "opengl.h"
+#include <renderer/opengl_extension.h>
+
+namespace ldraw_renderer
+{
+
+class LIBLDRAWRENDERER_EXPORT opengl_extension_instancing : public opengl_extension
+{
+ public:
+  static opengl_extension_instancing* self();
+  
+  opengl_extension_instancing();
+  
+  void glVertexAttribDivisor(GLuint index, GLuint divisor);
+  void glDrawElementsInstanced(GLenum mode, GLsizei count, GLenum type, const GLvoid *indices, GLsizei primcount);
+  
+ private:
+  static opengl_extension_instancing *m_instance;
+  
+  PFNGLVERTEXATTRIBDIVISORARBPROC m_glvertexattribdivisor;
+  PFNGLDRAWELEMENTSINSTANCEDARBPROC m_gldrawelementsinstanced;
+};
+
+}
+
+#endif
+
@@ -0,0 +1,50 @@
+/* LDRrenderer: LDraw model rendering library which based on libLDR                  *
+ * To obtain more information about LDraw, visit http://www.ldraw.org                *
+ * Distributed in terms of the General Public License v2                             *
+ *                                                                                   *
+ * Author: (c)2006-2010 Park "segfault" J. K. <mastermind_at_planetmono_dot_org>     */
+
+#include "opengl_extension_vao.h"
+
+namespace ldraw_renderer
+{
+
+opengl_extension_vao* opengl_extension_vao::m_instance = 0L;
+
+opengl_extension_vao* opengl_extension_vao::self()
+{
+	if (!m_instance)
+		m_instance = new opengl_extension_vao();
+
+	return m_instance;
+}
+
+opengl_extension_vao::opengl_extension_vao()
+	: opengl_extension("GL_ARB_vertex_array_object")
+{
+	if (m_supported) {
+		m_glgenvertexarrays = (PFNGLGENVERTEXARRAYSPROC) get_glext_proc("glGenVertexArrays");
+		m_gldeletevertexarrays = (PFNGLDELETEVERTEXARRAYSPROC) get_glext_proc("glDeleteVertexArrays");
+		m_glbindvertexarray = (PFNGLBINDVERTEXARRAYPROC) get_glext_proc("glBindVertexArray");
+	}
+}
+
+void opengl_extension_vao::glGenVertexArrays(GLsizei n, GLuint *arrays)
+{
+	if (m_supported)
+		m_glgenvertexarrays(n, arrays);
+}
+
+void opengl_extension_vao::glDeleteVertexArrays(GLsizei n, const GLuint *arrays)
+{
+	if (m_supported)
+		m_gldeletevertexarrays(n, arrays);
+}
+
+void opengl_extension_vao::glBindVertexArray(GLuint array)
+{
+	if (m_supported)
+		m_glbindvertexarray(array);
+}
+
+}
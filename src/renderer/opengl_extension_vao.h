@@ -0,0 +1,40 @@
+/* LDRrenderer: LDraw model rendering library which based on libLDR                  *
+ * To obtain more information about LDraw, visit http://www.ldraw.org                *
+ * Distributed in terms of the General Public License v2                             *
+ *                                                                                   *
+ * Author: (c)2006-2010 Park "segfault" J. K. <mastermind_at_planetmono_dot_org>     */
+
+#ifndef _RENDERER_OPENGL_EXTENSION_VAO_H_
+#define _RENDERER_OPENGL_EXTENSION_VAO_H_
+
+#include <libldr/common.h>
+
+#include "opengl.h"
+#include <renderer/opengl_extension.h>
+
+namespace ldraw_renderer
+{
+
+class LIBLDRAWRENDERER_EXPORT opengl_extension_vao : public opengl_extension
+{
+ public:
+  static opengl_extension_vao* self();
+  
+  opengl_extension_vao();
+  
+  void glGenVertexArrays(GLsizei n, GLuint *arrays);
+  void glDeleteVertexArrays(GLsizei n, const GLuint *arrays);
+  void glBindVertexArray(GLuint array);
+  
+ private:
+  static opengl_extension_vao *m_instance;
+  
+  PFNGLGENVERTEXARRAYSPROC m_glgenvertexarrays;
+  PFNGLDELETEVERTEXARRAYSPROC m_gldeletevertexarrays;
+  PFNGLBINDVERTEXARRAYPROC m_glbindvertexarray;
+};
+
+}
+
+#endif
+
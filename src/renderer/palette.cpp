@@ -0,0 +1,204 @@
+/* LDRrenderer: LDraw model rendering library which based on libLDR                  *
+ * To obtain more information about LDraw, visit http://www.ldraw.org                *
+ * Distributed in terms of the General Public License v2                             *
+ *                                                                                   *
+ * Author: (c)2006-2010 Park "segfault" J. K. <mastermind_at_planetmono_dot_org>     */
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <mutex>
+
+#include "palette.h"
+
+namespace ldraw_renderer
+{
+
+/* Colors beyond the chart, by LDraw color ID; their entities belong to
+ * ldraw::color objects, so the values are copied. Slots nobody holds queue
+ * up in idle, each at most once. */
+struct palette_table
+{
+	palette_table() : limit(palette::max_slots), size(ldraw::color::color_chart_count), serial(0) {}
+
+	std::mutex mutex;
+	std::map<unsigned int, int> slots;
+	std::vector<unsigned int> ids;
+	std::vector<int> refs;
+	std::vector<bool> queued;
+	std::deque<int> idle;
+	std::vector<unsigned char> rgba;
+	std::vector<unsigned char> complement;
+	int limit;
+	std::atomic<int> size;
+	std::atomic<unsigned int> serial;
+};
+
+const int palette::max_slots;
+
+static palette_table& get_table()
+{
+	static palette_table t;
+
+	return t;
+}
+
+static void make_idle(palette_table &t, int i)
+{
+	if (!t.queued[i]) {
+		t.queued[i] = true;
+		t.idle.push_back(i);
+	}
+}
+
+/* Closest color of the chart, by squared distance in RGB */
+static int closest_chart_slot(const ldraw::color_entity *ce)
+{
+	int best = 0, best_distance = -1;
+
+	for (int i = 0; i < ldraw::color::color_chart_count; ++i) {
+		int d = 0;
+
+		for (int j = 0; j < 3; ++j) {
+			int c = (int) ldraw::color::color_chart[i].rgba[j] - (int) ce->rgba[j];
+			d += c * c;
+		}
+
+		if (best_distance < 0 || d < best_distance) {
+			best = i;
+			best_distance = d;
+		}
+	}
+
+	return best;
+}
+
+/* The slot of a color beyond the chart, recycling one when the texture is
+ * full; -1 if every slot is held */
+static int assign(palette_table &t, const ldraw::color &c)
+{
+	const ldraw::color_entity *ce = c.get_entity();
+	const int chart = ldraw::color::color_chart_count;
+	int i;
+
+	if (chart + (int) t.ids.size() < t.limit) {
+		i = (int) t.ids.size();
+		t.ids.push_back(c.get_id());
+		t.refs.push_back(0);
+		t.queued.push_back(false);
+		t.rgba.insert(t.rgba.end(), ce->rgba, ce->rgba + 4);
+		t.complement.insert(t.complement.end(), ce->complement, ce->complement + 4);
+		t.size = chart + i + 1;
+	} else {
+		/* Those held again since they were queued are skipped */
+		do {
+			if (t.idle.empty())
+				return -1;
+
+			i = t.idle.front();
+			t.idle.pop_front();
+			t.queued[i] = false;
+		} while (t.refs[i] > 0);
+
+		t.slots.erase(t.ids[i]);
+		t.ids[i] = c.get_id();
+		std::memcpy(&t.rgba[i * 4], ce->rgba, 4);
+		std::memcpy(&t.complement[i * 4], ce->complement, 4);
+	}
+
+	t.slots[c.get_id()] = chart + i;
+	++t.serial;
+
+	return chart + i;
+}
+
+int palette::acquire(const ldraw::color &c)
+{
+	const ldraw::color_entity *ce = c.get_entity();
+	const int chart = ldraw::color::color_chart_count;
+
+	if (ce >= ldraw::color::color_chart && ce < ldraw::color::color_chart + chart)
+		return (int) (ce - ldraw::color::color_chart);
+
+	palette_table &t = get_table();
+	std::lock_guard<std::mutex> lock(t.mutex);
+
+	int s;
+	std::map<unsigned int, int>::const_iterator it = t.slots.find(c.get_id());
+
+	if (it != t.slots.end())
+		s = (*it).second;
+	else if ((s = assign(t, c)) < 0)
+		return closest_chart_slot(ce);
+
+	++t.refs[s - chart];
+
+	return s;
+}
+
+void palette::release(const std::vector<int> &slots)
+{
+	const int chart = ldraw::color::color_chart_count;
+	palette_table &t = get_table();
+	std::lock_guard<std::mutex> lock(t.mutex);
+
+	for (std::vector<int>::const_iterator it = slots.begin(); it != slots.end(); ++it) {
+		int i = *it - chart;
+
+		if (i >= 0 && --t.refs[i] == 0)
+			make_idle(t, i);
+	}
+}
+
+int palette::size()
+{
+	return get_table().size;
+}
+
+unsigned int palette::serial()
+{
+	return get_table().serial;
+}
+
+void palette::fit(int max_width)
+{
+	palette_table &t = get_table();
+	std::lock_guard<std::mutex> lock(t.mutex);
+
+	int width = 1;
+	while (width * 2 <= max_width)
+		width <<= 1;
+
+	t.limit = std::min(t.limit, width);
+}
+
+int palette::get_texture(std::vector<unsigned char> &texels, int &width)
+{
+	palette_table &t = get_table();
+	std::lock_guard<std::mutex> lock(t.mutex);
+
+	const int chart = ldraw::color::color_chart_count;
+	const int count = std::min((int) t.size, t.limit);
+
+	width = 1;
+	while (width < count)
+		width <<= 1;
+
+	texels.assign(width * 2 * 4, 0);
+
+	for (int i = 0; i < chart && i < count; ++i) {
+		std::memcpy(&texels[i * 4], ldraw::color::color_chart[i].rgba, 4);
+		std::memcpy(&texels[(width + i) * 4], ldraw::color::color_chart[i].complement, 4);
+	}
+
+	if (count > chart) {
+		std::memcpy(&texels[chart * 4], &t.rgba[0], (count - chart) * 4);
+		std::memcpy(&texels[(width + chart) * 4], &t.complement[0], (count - chart) * 4);
+	}
+
+	return count;
+}
+
+}
@@ -0,0 +1,57 @@
+/* LDRrenderer: LDraw model rendering library which based on libLDR                  *
+ * To obtain more information about LDraw, visit http://www.ldraw.org                *
+ * Distributed in terms of the General Public License v2                             *
+ *                                                                                   *
+ * Author: (c)2006-2010 Park "segfault" J. K. <mastermind_at_planetmono_dot_org>     */
+
+#ifndef _RENDERER_PALETTE_H_
+#define _RENDERER_PALETTE_H_
+
+#include <vector>
+
+#include <libldr/color.h>
+
+namespace ldraw_renderer
+{
+
+/* Colors the vertex buffers refer to by slot, to be resolved through a
+ * texture of two rows: the colors, then their edge colors. The colors of
+ * ldraw::color::color_chart take the first slots, in order; other colors
+ * get theirs the first time they are asked for, and hold it while anyone
+ * acquired it. Once the texture is as wide as it may get, slots nobody
+ * holds are given to new colors, least recently released first; with none
+ * left, a new color gets the slot of the closest color of the chart. */
+class LIBLDRAWRENDERER_EXPORT palette
+{
+  public:
+	enum row
+	{
+		row_color, row_edge
+	};
+
+	/* Slots a GLshort texture coordinate can address */
+	static const int max_slots = 32768;
+
+	/* The slot of c, held until released; the slots of the chart are
+	 * always held */
+	static int acquire(const ldraw::color &c);
+	static void release(const std::vector<int> &slots);
+
+	/* Number of slots handed out so far */
+	static int size();
+
+	/* Changes whenever a slot is given a color */
+	static unsigned int serial();
+
+	/* Keeps the texture within max_width texels (GL_MAX_TEXTURE_SIZE), for
+	 * each renderer to call before it draws */
+	static void fit(int max_width);
+
+	/* Texels of the palette texture, RGBA, width a power of two within the
+	 * limit; returns the number of slots they cover */
+	static int get_texture(std::vector<unsigned char> &texels, int &width);
+};
+
+}
+
+#endif
@@ -17,6 +17,7 @@ parameters::parameters()
 	m_shading = true;
 	m_debug = false;
 	m_culling = false; /* disabled for a while */
+	m_frustum_culling = true;
 	m_shader = true;
 }
 
@@ -28,6 +29,7 @@ parameters::parameters(const parameters &rhs)
 	m_shading = rhs.get_shading();
 	m_debug = rhs.get_debug();
 	m_culling = rhs.get_culling();
+	m_frustum_culling = rhs.get_frustum_culling();
 	m_shader = rhs.get_shader();
 }
 
@@ -29,6 +29,7 @@ class LIBLDRAWRENDERER_EXPORT parameters
 	bool get_shading() const { return m_shading; }
 	bool get_debug() const { return m_debug; }
 	bool get_culling() const { return m_culling; }
+	bool get_frustum_culling() const { return m_frustum_culling; }
 	bool get_shader() const { return m_shader; }
 
 	void set_stud_rendering_mode(stud_rendering_mode s) { m_stud_mode = s; }
@@ -37,6 +38,7 @@ class LIBLDRAWRENDERER_EXPORT parameters
 	void set_shading(bool b) { m_shading = b; }
 	void set_debug(bool b) { m_debug = b; }
 	void set_culling(bool b) { m_culling = b; }
+	void set_frustum_culling(bool b) { m_frustum_culling = b; }
 	void set_shader(bool b) { m_shader = b; }
 
   private:
@@ -46,6 +48,7 @@ class LIBLDRAWRENDERER_EXPORT parameters
 	bool m_shading;
 	bool m_debug;
 	bool m_culling;
+	bool m_frustum_culling;
 	bool m_shader;
 };
 
@@ -0,0 +1,345 @@
+/* LDRrenderer: LDraw model rendering library which based on libLDR                  *
+ * To obtain more information about LDraw, visit http://www.ldraw.org                *
+ * Distributed in terms of the General Public License v2                             *
+ *                                                                                   *
+ * Author: (c)2006-2010 Park "segfault" J. K. <mastermind_at_planetmono_dot_org>     */
+
+#include <algorithm>
+
+#include <libldr/bvh.h>
+#include <libldr/elements.h>
+#include <libldr/filter.h>
+#include <libldr/metrics.h>
+#include <libldr/model.h>
+
+#include "frustum.h"
+#include "picking.h"
+
+namespace ldraw_renderer
+{
+
+/* Distance of a clip space vertex to one of the six planes of the clip
+ * volume: -w <= x, y, z <= w */
+static inline float plane_distance(const float *v, int plane)
+{
+	return plane & 1 ? v[3] - v[plane >> 1] : v[3] + v[plane >> 1];
+}
+
+static inline void to_clip(const ldraw::matrix &clip, const ldraw::vector &p, float *out)
+{
+	for (int i = 0; i < 4; ++i)
+		out[i] = clip.value(i, 0) * p.x() + clip.value(i, 1) * p.y() + clip.value(i, 2) * p.z() + clip.value(i, 3);
+}
+
+/* -1 if the box lies entirely outside one plane, 1 if entirely inside all,
+ * 0 otherwise */
+static int classify_box(const ldraw::matrix &clip, const ldraw::vector &min, const ldraw::vector &max, float corners[8][4])
+{
+	for (int i = 0; i < 8; ++i)
+		to_clip(clip, ldraw::vector(i & 1 ? max.x() : min.x(), i & 2 ? max.y() : min.y(), i & 4 ? max.z() : min.z()), corners[i]);
+
+	bool inside = true;
+	for (int plane = 0; plane < 6; ++plane) {
+		int out = 0;
+		for (int i = 0; i < 8; ++i) {
+			if (plane_distance(corners[i], plane) < 0.0f)
+				++out;
+		}
+
+		if (out == 8)
+			return -1;
+		if (out)
+			inside = false;
+	}
+
+	return inside ? 1 : 0;
+}
+
+static unsigned int window_depth(float z)
+{
+	z = std::min(1.0f, std::max(0.0f, z * 0.5f + 0.5f));
+
+	return (unsigned int) (z * 4294967295.0);
+}
+
+picker::picker(const float *projection_matrix, const float *modelview_matrix, const int *viewport, int x, int y, int w, int h)
+{
+	float p[16], mv[16];
+
+	if (w == 0)
+		w = 1;
+	else if (w < 0)
+		x += w, w = -w;
+
+	if (h == 0)
+		h = 1;
+	else if (h < 0)
+		y += h, h = -h;
+
+	/* gluPickMatrix(x + w/2, viewport[3] - (y + h/2), w, h, viewport) */
+	float cx = x + w/2, cy = viewport[3] - (y + h/2);
+	ldraw::matrix pick((float) viewport[2] / w, 0.0f, 0.0f,
+	                   0.0f, (float) viewport[3] / h, 0.0f,
+	                   0.0f, 0.0f, 1.0f,
+	                   (viewport[2] - 2.0f * (cx - viewport[0])) / w, (viewport[3] - 2.0f * (cy - viewport[1])) / h, 0.0f);
+
+	std::copy(projection_matrix, projection_matrix + 16, p);
+	std::copy(modelview_matrix, modelview_matrix + 16, mv);
+
+	m_clip = pick * ldraw::matrix(p).transpose() * ldraw::matrix(mv).transpose();
+}
+
+bool picker::hit_test(ldraw::model *m, const ldraw::filter *hit_filter) const
+{
+	std::vector<int> list = candidates(m);
+
+	for (std::vector<int>::const_iterator it = list.begin(); it != list.end(); ++it) {
+		if (hit_filter && !hit_filter->query(m, *it, 0))
+			continue;
+
+		const ldraw::element_ref *r = ldraw::element_cast<ldraw::element_ref>(m->elements()[*it]);
+		float depth = 1.0f;
+
+		if (clip_box(m_clip * r->get_matrix(), *r->get_model()->custom_data<ldraw::metrics>(), &depth))
+			return true;
+	}
+
+	return false;
+}
+
+selection_list picker::select(ldraw::model *m, const ldraw::filter *skip_filter, renderer::selection type) const
+{
+	std::vector<int> list = candidates(m);
+	selection_list result;
+
+	for (std::vector<int>::const_iterator it = list.begin(); it != list.end(); ++it) {
+		if (skip_filter && skip_filter->query(m, *it, 0))
+			continue;
+
+		const ldraw::element_ref *r = ldraw::element_cast<ldraw::element_ref>(m->elements()[*it]);
+		const ldraw::metrics *rmm = r->get_model()->custom_data<ldraw::metrics>();
+		const ldraw::matrix &rmt = r->get_matrix();
+		float depth = 1.0f;
+		bool hit;
+
+		if (type == renderer::selection_points) {
+			ldraw::vector center = (rmt * rmm->min_() + rmt * rmm->max_()) * 0.5f;
+			hit = clip_primitive(m_clip, &center, 1, &depth);
+		} else if (type == renderer::selection_model_full) {
+			hit = clip_box(m_clip * rmt, *rmm, &depth);
+		} else {
+			hit = clip_model(m_clip * rmt, r->get_model(), &depth);
+		}
+
+		if (hit)
+			result.push_back(std::pair<int, unsigned int>(*it, window_depth(depth)));
+	}
+
+	return result;
+}
+
+/* Indices of the references whose boxes may be hit, in model order */
+std::vector<int> picker::candidates(ldraw::model *m) const
+{
+	if (!m->custom_data<ldraw::bvh>())
+		m->update_custom_data<ldraw::bvh>();
+
+	/* The clip volume in model coordinates */
+	ldraw::bvh::plane planes[6];
+	frustum::get_planes(m_clip, planes);
+
+	ldraw::bvh *b = m->custom_data<ldraw::bvh>();
+	std::vector<const ldraw::element_base *> found;
+	b->query_frustum(planes, 6, found);
+
+	std::vector<int> result;
+	const std::vector<ldraw::element_base *> &elements = m->elements();
+
+	/* The leaves know where their elements are */
+	result.reserve(found.size());
+	for (std::vector<const ldraw::element_base *>::const_iterator it = found.begin(); it != found.end(); ++it)
+		result.push_back(b->index(*it));
+	std::sort(result.begin(), result.end());
+
+	/* Only references take part, with their models' boxes at hand */
+	std::vector<int>::iterator out = result.begin();
+	for (std::vector<int>::const_iterator it = result.begin(); it != result.end(); ++it) {
+		ldraw::element_base *e = elements[*it];
+		if (e->get_type() != ldraw::type_ref)
+			continue;
+
+		ldraw::model *rm = ldraw::element_cast<ldraw::element_ref>(e)->get_model();
+		if (!rm)
+			continue;
+		rm->shared_custom_data<ldraw::metrics>();
+
+		*out++ = *it;
+	}
+	result.erase(out, result.end());
+
+	return result;
+}
+
+/* The six faces of the box, as drawn filled */
+bool picker::clip_box(const ldraw::matrix &clip, const ldraw::metrics &metrics, float *depth) const
+{
+	static const int faces[6][4] = {
+		{ 0, 1, 3, 2 }, { 4, 5, 7, 6 }, { 0, 1, 5, 4 }, { 2, 3, 7, 6 }, { 0, 2, 6, 4 }, { 1, 3, 7, 5 }
+	};
+
+	const ldraw::vector &min = metrics.min_();
+	const ldraw::vector &max = metrics.max_();
+	float corners[8][4];
+
+	int c = classify_box(clip, min, max, corners);
+	if (c < 0)
+		return false;
+
+	if (c > 0) {
+		for (int i = 0; i < 8; ++i)
+			*depth = std::min(*depth, corners[i][2] / corners[i][3]);
+		return true;
+	}
+
+	bool hit = false;
+	for (int i = 0; i < 6; ++i) {
+		ldraw::vector face[4];
+		for (int j = 0; j < 4; ++j) {
+			int k = faces[i][j];
+			face[j] = ldraw::vector(k & 1 ? max.x() : min.x(), k & 2 ? max.y() : min.y(), k & 4 ? max.z() : min.z());
+		}
+
+		if (clip_primitive(clip, face, 4, depth))
+			hit = true;
+	}
+
+	return hit;
+}
+
+/* The lines, triangles and quads the model is drawn with */
+bool picker::clip_model(const ldraw::matrix &clip, const ldraw::model *m, float *depth) const
+{
+	bool hit = false;
+
+	for (ldraw::model::const_iterator it = m->elements().begin(); it != m->elements().end(); ++it) {
+		switch ((*it)->get_type()) {
+			case ldraw::type_line: {
+				const ldraw::element_line *l = ldraw::element_cast<ldraw::element_line>(*it);
+				ldraw::vector p[2] = { l->pos1(), l->pos2() };
+				hit = clip_primitive(clip, p, 2, depth) || hit;
+				break;
+			}
+			case ldraw::type_triangle: {
+				const ldraw::element_triangle *l = ldraw::element_cast<ldraw::element_triangle>(*it);
+				ldraw::vector p[3] = { l->pos1(), l->pos2(), l->pos3() };
+				hit = clip_primitive(clip, p, 3, depth) || hit;
+				break;
+			}
+			case ldraw::type_quadrilateral: {
+				const ldraw::element_quadrilateral *l = ldraw::element_cast<ldraw::element_quadrilateral>(*it);
+				ldraw::vector p[4] = { l->pos1(), l->pos2(), l->pos3(), l->pos4() };
+				hit = clip_primitive(clip, p, 4, depth) || hit;
+				break;
+			}
+			case ldraw::type_ref: {
+				const ldraw::element_ref *r = ldraw::element_cast<ldraw::element_ref>(*it);
+				ldraw::model *rm = r->get_model();
+				if (!rm)
+					break;
+
+				ldraw::matrix child = clip * r->get_matrix();
+				const ldraw::metrics *rmm = rm->shared_custom_data<ldraw::metrics>();
+				float corners[8][4];
+
+				if (classify_box(child, rmm->min_(), rmm->max_(), corners) >= 0)
+					hit = clip_model(child, rm, depth) || hit;
+				break;
+			}
+			default:
+				break;
+		}
+	}
+
+	return hit;
+}
+
+/* Clips a point, a line or a polygon to the clip volume, keeping the
+ * smallest depth (z/w) of what remains */
+bool picker::clip_primitive(const ldraw::matrix &clip, const ldraw::vector *points, int count, float *depth)
+{
+	float buffer[2][12][4];
+	int n = count, cur = 0;
+
+	for (int i = 0; i < count; ++i)
+		to_clip(clip, points[i], buffer[0][i]);
+
+	if (count == 1) {
+		for (int plane = 0; plane < 6; ++plane) {
+			if (plane_distance(buffer[0][0], plane) < 0.0f)
+				return false;
+		}
+	} else if (count == 2) {
+		float t0 = 0.0f, t1 = 1.0f;
+
+		for (int plane = 0; plane < 6; ++plane) {
+			float d0 = plane_distance(buffer[0][0], plane), d1 = plane_distance(buffer[0][1], plane);
+
+			if (d0 < 0.0f && d1 < 0.0f)
+				return false;
+			if (d0 < 0.0f)
+				t0 = std::max(t0, d0 / (d0 - d1));
+			else if (d1 < 0.0f)
+				t1 = std::min(t1, d0 / (d0 - d1));
+			if (t0 > t1)
+				return false;
+		}
+
+		float a[4], b[4];
+		for (int j = 0; j < 4; ++j) {
+			a[j] = buffer[0][0][j] + t0 * (buffer[0][1][j] - buffer[0][0][j]);
+			b[j] = buffer[0][0][j] + t1 * (buffer[0][1][j] - buffer[0][0][j]);
+		}
+		for (int j = 0; j < 4; ++j) {
+			buffer[0][0][j] = a[j];
+			buffer[0][1][j] = b[j];
+		}
+	} else {
+		/* Sutherland-Hodgman; every plane adds one vertex at most */
+		for (int plane = 0; plane < 6 && n; ++plane) {
+			const float (*in)[4] = buffer[cur];
+			float (*out)[4] = buffer[cur ^ 1];
+			int m = 0;
+
+			for (int i = 0; i < n; ++i) {
+				const float *a = in[i], *b = in[(i + 1) % n];
+				float da = plane_distance(a, plane), db = plane_distance(b, plane);
+
+				if (da >= 0.0f) {
+					std::copy(a, a + 4, out[m++]);
+				}
+				if ((da >= 0.0f) != (db >= 0.0f)) {
+					float t = da / (da - db);
+					for (int j = 0; j < 4; ++j)
+						out[m][j] = a[j] + t * (b[j] - a[j]);
+					++m;
+				}
+			}
+
+			n = m;
+			cur ^= 1;
+		}
+
+		if (!n)
+			return false;
+	}
+
+	for (int i = 0; i < n; ++i) {
+		const float *v = buffer[cur][i];
+		if (v[3] > 0.0f)
+			*depth = std::min(*depth, v[2] / v[3]);
+	}
+
+	return true;
+}
+
+}
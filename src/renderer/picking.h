@@ -0,0 +1,59 @@
+/* LDRrenderer: LDraw model rendering library which based on libLDR                  *
+ * To obtain more information about LDraw, visit http://www.ldraw.org                *
+ * Distributed in terms of the General Public License v2                             *
+ *                                                                                   *
+ * Author: (c)2006-2010 Park "segfault" J. K. <mastermind_at_planetmono_dot_org>     */
+
+#ifndef _RENDERER_PICKING_H_
+#define _RENDERER_PICKING_H_
+
+#include <vector>
+
+#include <libldr/common.h>
+#include <libldr/math.h>
+
+#include <renderer/renderer.h>
+
+namespace ldraw
+{
+	class filter;
+	class metrics;
+	class model;
+}
+
+namespace ldraw_renderer
+{
+
+/* Picking on the CPU, with the results OpenGL selection mode would give:
+ * the region is turned into a pick matrix as by gluPickMatrix(), and the
+ * primitives that would have been drawn are clipped against it in clip
+ * space. The candidates come from the model's ldraw::bvh, which is set up
+ * on first use and then kept current by the model itself. */
+
+class LIBLDRAWRENDERER_EXPORT picker
+{
+  public:
+	/* projection_matrix and modelview_matrix are OpenGL (column-major)
+	 * matrices; x, y, w and h the region in window coordinates, from the
+	 * top left corner */
+	picker(const float *projection_matrix, const float *modelview_matrix, const int *viewport, int x, int y, int w, int h);
+
+	/* Whether the bounding box of any reference hit_filter accepts is hit */
+	bool hit_test(ldraw::model *m, const ldraw::filter *hit_filter) const;
+
+	/* References hit, by index and depth, in model order */
+	selection_list select(ldraw::model *m, const ldraw::filter *skip_filter, renderer::selection type) const;
+
+  private:
+	std::vector<int> candidates(ldraw::model *m) const;
+
+	bool clip_box(const ldraw::matrix &clip, const ldraw::metrics &metrics, float *depth) const;
+	bool clip_model(const ldraw::matrix &clip, const ldraw::model *m, float *depth) const;
+	static bool clip_primitive(const ldraw::matrix &clip, const ldraw::vector *points, int count, float *depth);
+
+	ldraw::matrix m_clip;
+};
+
+}
+
+#endif
@@ -4,6 +4,8 @@
  *                                                                                   *
  * Author: (c)2006-2010 Park "segfault" J. K. <mastermind_at_planetmono_dot_org>     */
 
+#include <cstring>
+
 #include <renderer/parameters.h>
 
 #include "renderer.h"
@@ -17,6 +19,8 @@ renderer::renderer(const parameters *rp)
 	
 	m_params = rp;
 	m_selection = selection_points;
+
+	std::memset(&m_stats, 0, sizeof(statistics));
 }
 
 renderer::~renderer()
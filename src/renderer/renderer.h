@@ -29,6 +29,18 @@ class parameters;
 
 typedef std::list<std::pair<int, unsigned int> > selection_list;
 
+/* Counters of the last frame; culled counts the references skipped as out
+ * of the view frustum, drawn those descended into */
+struct statistics
+{
+	int triangles;
+	int quads;
+	int faces;
+	int lines;
+	int culled;
+	int drawn;
+};
+
 class LIBLDRAWRENDERER_EXPORT render_filter
 {
   public:
@@ -48,6 +60,8 @@ class LIBLDRAWRENDERER_EXPORT renderer
 	void set_base_color(const ldraw::color &c);
 	void set_selection_type(selection s);
 
+	const statistics* get_stats() const { return &m_stats; }
+
 	virtual void render(ldraw::model *m, const ldraw::filter *filter = 0L) = 0;
 	virtual void render_bounding_box(const ldraw::metrics &metrics) = 0;
 	
@@ -59,6 +73,7 @@ class LIBLDRAWRENDERER_EXPORT renderer
   protected:
 	const parameters *m_params;
 	selection m_selection;
+	statistics m_stats;
 
 	/* helpers */
 	const unsigned char* get_color(const ldraw::color &c) const;
@@ -7,6 +7,7 @@
 #include "opengl.h"
 #include "opengl_extension_vbo.h"
 #include "parameters.h"
+#include "picking.h"
 #include "renderer_opengl_immediate.h"
 #include "renderer_opengl_retained.h"
 
@@ -99,6 +100,24 @@ void renderer_opengl::setup()
 	}
 }
 
+bool renderer_opengl::hit_test(float *projection_matrix, float *modelview_matrix, int x, int y, int w, int h, ldraw::model *m, const ldraw::filter *hit_filter)
+{
+	GLint viewport[4];
+
+	glGetIntegerv(GL_VIEWPORT, viewport);
+
+	return picker(projection_matrix, modelview_matrix, viewport, x, y, w, h).hit_test(m, hit_filter);
+}
+
+selection_list renderer_opengl::select(float *projection_matrix, float *modelview_matrix, int x, int y, int w, int h, ldraw::model *m, const ldraw::filter *skip_filter)
+{
+	GLint viewport[4];
+
+	glGetIntegerv(GL_VIEWPORT, viewport);
+
+	return picker(projection_matrix, modelview_matrix, viewport, x, y, w, h).select(m, skip_filter, m_selection);
+}
+
 renderer_opengl_factory::renderer_opengl_factory(const parameters *params, rendering_mode rm)
 {
 	m_params = params;
@@ -9,6 +9,7 @@
 
 #include <libldr/common.h>
 
+#include <renderer/frustum.h>
 #include <renderer/renderer.h>
 
 namespace ldraw_renderer
@@ -24,6 +25,13 @@ class LIBLDRAWRENDERER_EXPORT renderer_opengl : public renderer
 	virtual ~renderer_opengl();
 	
 	virtual void setup();
+
+	/* Picking runs on the CPU, see picker */
+	virtual bool hit_test(float *projection_matrix, float *modelview_matrix, int x, int y, int w, int h, ldraw::model *m, const ldraw::filter *hit_filter);
+	virtual selection_list select(float *projection_matrix, float *modelview_matrix, int x, int y, int w, int h, ldraw::model *m, const ldraw::filter *skip_filter);
+
+  protected:
+	frustum m_frustum;
 };
 
 class LIBLDRAWRENDERER_EXPORT renderer_opengl_factory
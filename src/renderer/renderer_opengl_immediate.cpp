@@ -13,6 +13,7 @@
 #include <libldr/math.h>
 #include <libldr/metrics.h>
 #include <libldr/utils.h>
+#include <libldr/visitor.h>
 
 #include "opengl.h"
 #include "normal_extension.h"
@@ -35,6 +36,7 @@ renderer_opengl_immediate::~renderer_opengl_immediate()
 void renderer_opengl_immediate::render(ldraw::model *m, const ldraw::filter *filter)
 {
 	std::memset(&m_stats, 0, sizeof(statistics));
+	m_frustum.begin(m_params->get_frustum_culling());
 	
 	switch (m_params->get_rendering_mode()) {
 		case parameters::model_full:
@@ -49,441 +51,361 @@ void renderer_opengl_immediate::render(ldraw::model *m, const ldraw::filter *fil
 	}
 }
 
-// rendering code
-void renderer_opengl_immediate::draw_model_full(const ldraw::model_multipart *base, ldraw::model *m, int depth, const ldraw::filter *filter)
+/* Element visitors (libldr/visitor.h), one for each rendering mode. Each
+ * draws the elements of one model and recurses into the references. */
+
+class renderer_opengl_immediate::full_drawer : public ldraw::element_visitor<renderer_opengl_immediate::full_drawer>
+{
+  public:
+	full_drawer(renderer_opengl_immediate *r, const ldraw::model_multipart *base, ldraw::model *m, int depth, const ldraw::filter *filter);
+
+	void visit_line(const ldraw::element_line *l)
+	{
+		unlit();
+		m_r->render_line(*l);
+	}
+
+	void visit_condline(const ldraw::element_condline *l)
+	{
+		unlit();
+		m_r->render_condline(*l, m_proj);
+	}
+
+	void visit_triangle(const ldraw::element_triangle *l)
+	{
+		face(l);
+		m_r->render_triangle(*l);
+	}
+
+	void visit_quadrilateral(const ldraw::element_quadrilateral *l)
+	{
+		face(l);
+		m_r->render_quadrilateral(*l);
+	}
+
+	void visit_ref(const ldraw::element_ref *l);
+	void visit_bfc(const ldraw::element_bfc *l);
+
+	/* Position of the element being visited in the model */
+	int index;
+
+	/* Set by a BFC INVERTNEXT for the element after it */
+	bool invertnext;
+
+  private:
+	void face(const ldraw::element_base *e);
+
+	void unlit()
+	{
+		if (m_r->m_params->get_shading())
+			glDisable(GL_LIGHTING);
+	}
+
+	renderer_opengl_immediate *m_r;
+	const ldraw::model_multipart *m_base;
+	const ldraw::model *m_model;
+	int m_depth;
+	const ldraw::filter *m_filter;
+	bool m_culling;
+	bool m_flipped;
+	ldraw::bfc_certification::winding m_winding;
+	ldraw::bfc_certification::winding m_localwinding;
+	ldraw::matrix m_proj;
+	normal_extension *m_ne;
+};
+
+renderer_opengl_immediate::full_drawer::full_drawer(renderer_opengl_immediate *r, const ldraw::model_multipart *base, ldraw::model *m, int depth, const ldraw::filter *filter)
+	: index(0), invertnext(false), m_r(r), m_base(base), m_model(m), m_depth(depth), m_filter(filter), m_culling(true),
+	  m_winding(ldraw::bfc_certification::ccw), m_localwinding(ldraw::bfc_certification::ccw)
 {
-	bool culling = true;
-	bool invertnext = false;
-	ldraw::bfc_certification::winding winding = ldraw::bfc_certification::ccw;
-	ldraw::bfc_certification::winding localwinding = ldraw::bfc_certification::ccw;
 	ldraw::bfc_certification::cert_status cert;
 	const ldraw::bfc_certification *cext = m->custom_data<ldraw::bfc_certification>();
-	bool cullenabled = false;
 
 	if (!cext)
 		cert = ldraw::bfc_certification::unknown;
 	else {
 		cert = cext->certification();
 		if (cert == ldraw::bfc_certification::certified) {
-			winding = localwinding = cext->orientation();
-			if (m_bfc_tracker.inverted())
-				winding = winding == ldraw::bfc_certification::ccw ? ldraw::bfc_certification::cw : ldraw::bfc_certification::ccw;
-			if (m_bfc_tracker.localinverted())
-				localwinding = localwinding == ldraw::bfc_certification::ccw ? ldraw::bfc_certification::cw : ldraw::bfc_certification::ccw;
+			m_winding = m_localwinding = cext->orientation();
+			if (r->m_bfc_tracker.inverted())
+				m_winding = m_winding == ldraw::bfc_certification::ccw ? ldraw::bfc_certification::cw : ldraw::bfc_certification::ccw;
+			if (r->m_bfc_tracker.localinverted())
+				m_localwinding = m_localwinding == ldraw::bfc_certification::ccw ? ldraw::bfc_certification::cw : ldraw::bfc_certification::ccw;
 		}
 	}
 
 	// Obtain current modelview matrix for conditional line calculation
-	ldraw::matrix proj;
-	glGetFloatv(GL_MODELVIEW_MATRIX, const_cast<float *>(proj.get_pointer()));
-	proj = proj.transpose();
+	glGetFloatv(GL_MODELVIEW_MATRIX, const_cast<float *>(m_proj.get_pointer()));
+	m_proj = m_proj.transpose();
 	
 	// enable shading if set
-	normal_extension *ne = 0L;
-	if (!m->custom_data<normal_extension>())
-		m->update_custom_data<normal_extension>();
-
-	ne = m->custom_data<normal_extension>();
+	m_ne = m->shared_custom_data<normal_extension>();
 
 	/* apply bfc policy */
-	if (cert == ldraw::bfc_certification::certified && culling && m_bfc_tracker.culling() && m_params->get_culling()) {
+	if (cert == ldraw::bfc_certification::certified && m_culling && r->m_bfc_tracker.culling() && r->m_params->get_culling())
 		glEnable(GL_CULL_FACE);
-		cullenabled = true;
-	} else {
+	else
 		glDisable(GL_CULL_FACE);
-		cullenabled = false;
-	}
-
-	bool flipped = ldraw::utils::det3(proj) < 0.0f;
-
-	// Iterate!
-	int i = 0;
-	for (ldraw::model::const_iterator it = m->elements().begin(); it != m->elements().end(); ++it) {
-		if (filter && filter->query(m, i, depth)) {
-			++i;
-			continue;
-		}
-		
-		ldraw::type elemtype = (*it)->get_type();
-
-		if (elemtype == ldraw::type_triangle || elemtype == ldraw::type_quadrilateral) {
-			GLenum mode;
-			
-			if (winding == ldraw::bfc_certification::ccw) {
-				if (flipped)
-					mode = GL_CW;
-				else
-					mode = GL_CCW;
-			} else {
-				if (flipped)
-					mode = GL_CCW;
-				else
-					mode = GL_CW;
-			}
-
-			if (m_params->get_culling())
-				glFrontFace(mode);
-			
-			/* shading */
-			if (m_params->get_shading())
-				glEnable(GL_LIGHTING);
-			
-			if (ne->has_normal(i)) {
-				ldraw::vector nv = ne->normal(i);
-				
-				if (winding == ldraw::bfc_certification::cw)
-					nv = -nv;
-				
-				if (m_params->get_debug())
-					render_normal_orientation(*it, nv, localwinding == ldraw::bfc_certification::ccw);
-				
-				if (m_params->get_shading())
-					glNormal3fv(nv.get_pointer());
-			}
-		} else if ((elemtype == ldraw::type_line || elemtype == ldraw::type_condline) && m_params->get_shading()) {
-			glDisable(GL_LIGHTING);
-		}
-
-		if (elemtype == ldraw::type_line) {
-			// Line
-			ldraw::element_line *l = CAST_AS_LINE(*it);
-			render_line(*l);
-		} else if (elemtype == ldraw::type_triangle) {
-			// Triangle
-			ldraw::element_triangle *l = CAST_AS_TRIANGLE(*it);
-			render_triangle(*l);
-		} else if (elemtype == ldraw::type_quadrilateral) {
-			// Quadrilateral
-			ldraw::element_quadrilateral *l = CAST_AS_QUADRILATERAL(*it);
-			render_quadrilateral(*l);
-		} else if (elemtype == ldraw::type_condline) {
-			// Conditional line
-			ldraw::element_condline *l = CAST_AS_CONDLINE(*it);
-			render_condline(*l, proj);
-		} else if (elemtype == ldraw::type_ref) {
-			// Reference
-			ldraw::element_ref *l = CAST_AS_REF(*it);
-			ldraw::model *lm = l->get_model();
-
-			if (lm) {
-				// flip plane check
-				bool reverse;
-
-				if (ldraw::utils::det3(proj * l->get_matrix()) < 0.0f) {
-					reverse = true;
-				} else
-					reverse = false;
-
-				// Push appropriate color into the color stack.
-				int id = l->get_color().get_id();
-				if (id == 16 || id == 24)
-					m_colorstack.push(m_colorstack.top());
-				else
-					m_colorstack.push(l->get_color());
-	
-				m_bfc_tracker.accumulate_culling(culling);
-				m_bfc_tracker.accumulate_invert(invertnext, reverse);
-
-				glPushAttrib(GL_ENABLE_BIT);
-	
-				// transform
-				glPushMatrix();
-				glMultMatrixf(l->get_matrix().transpose().get_pointer());
-			
-				if (ldraw::utils::is_stud(l))
-					render_stud(lm, false);
-				else
-					draw_model_full(base, lm, depth+1, filter); // Recurse
-					
-				glPopMatrix();
-
-				glPopAttrib();
-	
-				m_bfc_tracker.pop_culling();
-				m_bfc_tracker.pop_invert();
-				
-				m_colorstack.pop();
-			}
-		} else if (elemtype == ldraw::type_bfc) {
-			// Back Face Culling
-			const ldraw::element_bfc *l = CAST_AS_CONST_BFC(*it);
-
-			if (l->get_command() & ldraw::element_bfc::clip)
-				culling = true;
-			else if (l->get_command() == ldraw::element_bfc::noclip)
-				culling = false;
-
-			if (l->get_command() & ldraw::element_bfc::cw)
-				winding = localwinding = ldraw::bfc_certification::cw;
-			else if (l->get_command() & ldraw::element_bfc::ccw)
-				winding = localwinding = ldraw::bfc_certification::ccw;
-			
-			if (m_bfc_tracker.inverted())
-				winding = winding == ldraw::bfc_certification::cw ? ldraw::bfc_certification::ccw : ldraw::bfc_certification::cw;
-			if (m_bfc_tracker.localinverted())
-				localwinding = localwinding == ldraw::bfc_certification::cw ? ldraw::bfc_certification::ccw : ldraw::bfc_certification::cw;
-			
-			if (l->get_command() == ldraw::element_bfc::invertnext)
-				invertnext = true;
-		}
 
-		/* reset invertnext */
-		if (invertnext) {
-			if (elemtype != ldraw::type_bfc) {
-				invertnext = false;
-			} else {
-				const ldraw::element_bfc *l = CAST_AS_CONST_BFC(*it);
-				
-				if (l->get_command() != ldraw::element_bfc::invertnext)
-					invertnext = false;
-			}
-		}
-		
-		++i;
-	}
+	m_flipped = ldraw::utils::det3(m_proj) < 0.0f;
 }
 
-void renderer_opengl_immediate::draw_model_edges(const ldraw::model_multipart *base, const ldraw::model *m, int depth, const ldraw::filter *filter)
+void renderer_opengl_immediate::full_drawer::face(const ldraw::element_base *e)
 {
-	// Obtain current ldraw::modelview ldraw::matrix for conditional line calculation
-	float *tmp = new float[16];
-	glGetFloatv(GL_MODELVIEW_MATRIX, tmp);
-	ldraw::matrix proj = ldraw::matrix(tmp).transpose();
-	delete [] tmp;
+	GLenum mode;
 	
-	// Iterate!
-	int i = 0;
-	for (ldraw::model::const_iterator it = m->elements().begin(); it != m->elements().end(); ++it) {
-		if (filter && filter->query(m, i, depth)) {
-			++i;
-			continue;
-		}
+	if (m_winding == ldraw::bfc_certification::ccw) {
+		if (m_flipped)
+			mode = GL_CW;
+		else
+			mode = GL_CCW;
+	} else {
+		if (m_flipped)
+			mode = GL_CCW;
+		else
+			mode = GL_CW;
+	}
+
+	if (m_r->m_params->get_culling())
+		glFrontFace(mode);
+	
+	/* shading */
+	if (m_r->m_params->get_shading())
+		glEnable(GL_LIGHTING);
+	
+	if (m_ne->has_normal(index)) {
+		ldraw::vector nv = m_ne->normal(index);
 		
-		ldraw::type elemtype = (*it)->get_type();
+		if (m_winding == ldraw::bfc_certification::cw)
+			nv = -nv;
 		
-		if (elemtype == ldraw::type_line) {
-			// Line
-			ldraw::element_line *l = CAST_AS_LINE(*it);
-			render_line(*l);
-		} else if (elemtype == ldraw::type_condline) {
-			// Conditional line
-			ldraw::element_condline *l = CAST_AS_CONDLINE(*it);
-			render_condline(*l, proj);
-		} else if (elemtype == ldraw::type_ref) {
-			// Reference
-			ldraw::element_ref *l = CAST_AS_REF(*it);
-			
-			// Push appropriate color into the color stack.
-			int id = l->get_color().get_id();
-			if (id == 16 || id == 24)
-				m_colorstack.push(m_colorstack.top());
-			else
-				m_colorstack.push(l->get_color());
-				
-			// transform
-			glPushMatrix();
-			glMultMatrixf(l->get_matrix().transpose().get_pointer());
-			
-			if (ldraw::utils::is_stud(l))
-				render_stud(l->get_model(), true);
-			else if (l->get_model())
-				draw_model_edges(base, l->get_model(), depth+1, filter); // Recurse
-				
-			glPopMatrix();
-			m_colorstack.pop();
-		}
+		if (m_r->m_params->get_debug())
+			m_r->render_normal_orientation(e, nv, m_localwinding == ldraw::bfc_certification::ccw);
 		
-		++i;
+		if (m_r->m_params->get_shading())
+			glNormal3fv(nv.get_pointer());
 	}
 }
 
-/* Renders bounding box recursively */
-void renderer_opengl_immediate::draw_model_bounding_boxes(const ldraw::model_multipart *, const ldraw::model *m, int, const ldraw::filter *filter)
+void renderer_opengl_immediate::full_drawer::visit_ref(const ldraw::element_ref *l)
 {
-	// Iterate!
-	int i = 0;
-	for (ldraw::model::const_iterator it = m->elements().begin(); it != m->elements().end(); ++it) {
-		if (filter && filter->query(m, i, 0)) {
-			++i;
-			continue;
-		}
-		
-		ldraw::type elemtype = (*it)->get_type();
-			
-		if (elemtype == ldraw::type_ref) {
-			ldraw::element_ref *l = CAST_AS_REF(*it);
-			
-			if (l->get_model() && !l->get_model()->custom_data<ldraw::metrics>())
-				l->get_model()->update_custom_data<ldraw::metrics>();
-			
-			glPushMatrix();
-			glMultMatrixf(l->get_matrix().transpose().get_pointer());
-			
-			if (l->get_model()) {
-				const ldraw::metrics *metrics = l->get_model()->custom_data<ldraw::metrics>();
-				ldraw::vector center = (metrics->min_() + metrics->max_()) * 0.5f;
-				glColor4ub(0, 0, 0, 160);
-				glBegin(GL_POINTS);
-				glVertex3fv(center.get_pointer());
-				glEnd();
-				glColor3ub(0, 0, 0);
-				render_bounding_box(*metrics);
-				
-				//draw_model_bounding_boxes(base, l->get_model(), depth+1, std::set<int>());
-			}
-			
-			glPopMatrix();
-		}
-		
-		++i;
+	ldraw::model *lm = l->get_model();
+	frustum::visibility vis = frustum::outside;
+
+	if (lm) {
+		vis = m_r->m_frustum.classify(m_model, l);
+		if (vis == frustum::outside)
+			++m_r->m_stats.culled;
+		else
+			++m_r->m_stats.drawn;
 	}
+
+	if (vis == frustum::outside)
+		return;
+
+	// flip plane check
+	bool reverse;
+
+	if (ldraw::utils::det3(m_proj * l->get_matrix()) < 0.0f) {
+		reverse = true;
+	} else
+		reverse = false;
+
+	// Push appropriate color into the color stack.
+	int id = l->get_color().get_id();
+	if (id == 16 || id == 24)
+		m_r->m_colorstack.push(m_r->m_colorstack.top());
+	else
+		m_r->m_colorstack.push(l->get_color());
+
+	m_r->m_bfc_tracker.accumulate_culling(m_culling);
+	m_r->m_bfc_tracker.accumulate_invert(invertnext, reverse);
+
+	glPushAttrib(GL_ENABLE_BIT);
+
+	// transform
+	glPushMatrix();
+	glMultMatrixf(l->get_matrix().transpose().get_pointer());
+	m_r->m_frustum.push(l, vis);
+
+	if (ldraw::utils::is_stud(l))
+		m_r->render_stud(lm, false);
+	else
+		m_r->draw_model_full(m_base, lm, m_depth+1, m_filter); // Recurse
+		
+	m_r->m_frustum.pop();
+	glPopMatrix();
+
+	glPopAttrib();
+
+	m_r->m_bfc_tracker.pop_culling();
+	m_r->m_bfc_tracker.pop_invert();
+	
+	m_r->m_colorstack.pop();
 }
 
-bool renderer_opengl_immediate::hit_test(float *projection_matrix, float *modelview_matrix, int x, int y, int w, int h, ldraw::model *m, const ldraw::filter *skip_filter)
+// Back Face Culling
+void renderer_opengl_immediate::full_drawer::visit_bfc(const ldraw::element_bfc *l)
 {
-	GLint viewport[4];
-	GLuint selectionBuffer[4];
-	
-	if (w == 0)
-		w = 1;
-	else if (w < 0)
-		x += w, w = -w;
-
-	if (h == 0)
-		h = 1;
-	else if (h < 0)
-		y += h, h = -h;
-
-	glSelectBuffer(4, selectionBuffer);
-	glRenderMode(GL_SELECT);
-	
-	glGetIntegerv(GL_VIEWPORT, viewport);
-
-	glMatrixMode(GL_PROJECTION);
-	glLoadIdentity();
-	gluPickMatrix(x + w/2, viewport[3] - (y + h/2), w, h, viewport);
-	glMultMatrixf(projection_matrix);
-
-	glMatrixMode(GL_MODELVIEW);
-	glLoadMatrixf(modelview_matrix);
-	glInitNames();
-	glPushName(0);
-
-	glPointSize(7.0f);
-
-	int i = 0;
-	for (ldraw::model::const_iterator it = m->elements().begin(); it != m->elements().end(); ++it) {
-		ldraw::type elemtype = (*it)->get_type();
-
-		if (skip_filter->query(m, i, 0)) {
-			if (elemtype == ldraw::type_ref) {
-				ldraw::element_ref *l = CAST_AS_REF(*it);
-				
-				if (!l->get_model())
-					continue;
-				
-				if (!l->get_model()->custom_data<ldraw::metrics>())
-					l->get_model()->update_custom_data<ldraw::metrics>();
-				
-				glPushMatrix();
-				glMultMatrixf(l->get_matrix().transpose().get_pointer());
-				
-				render_filled_bounding_box(*l->get_model()->custom_data<ldraw::metrics>());
-				
-				glPopMatrix();
-			}
-		}
+	if (l->get_command() & ldraw::element_bfc::clip)
+		m_culling = true;
+	else if (l->get_command() == ldraw::element_bfc::noclip)
+		m_culling = false;
+
+	if (l->get_command() & ldraw::element_bfc::cw)
+		m_winding = m_localwinding = ldraw::bfc_certification::cw;
+	else if (l->get_command() & ldraw::element_bfc::ccw)
+		m_winding = m_localwinding = ldraw::bfc_certification::ccw;
+	
+	if (m_r->m_bfc_tracker.inverted())
+		m_winding = m_winding == ldraw::bfc_certification::cw ? ldraw::bfc_certification::ccw : ldraw::bfc_certification::cw;
+	if (m_r->m_bfc_tracker.localinverted())
+		m_localwinding = m_localwinding == ldraw::bfc_certification::cw ? ldraw::bfc_certification::ccw : ldraw::bfc_certification::cw;
+	
+	invertnext = l->get_command() == ldraw::element_bfc::invertnext;
+}
 
-		++i;
+class renderer_opengl_immediate::edge_drawer : public ldraw::element_visitor<renderer_opengl_immediate::edge_drawer>
+{
+  public:
+	edge_drawer(renderer_opengl_immediate *r, const ldraw::model_multipart *base, const ldraw::model *m, int depth, const ldraw::filter *filter)
+		: index(0), m_r(r), m_base(base), m_model(m), m_depth(depth), m_filter(filter)
+	{
+		// Obtain current modelview matrix for conditional line calculation
+		glGetFloatv(GL_MODELVIEW_MATRIX, const_cast<float *>(m_proj.get_pointer()));
+		m_proj = m_proj.transpose();
 	}
 
-	if (i == 0)
-		return false;
+	void visit_line(const ldraw::element_line *l) { m_r->render_line(*l); }
+	void visit_condline(const ldraw::element_condline *l) { m_r->render_condline(*l, m_proj); }
+	void visit_ref(const ldraw::element_ref *l);
 
-	if (glRenderMode(GL_RENDER))
-		return true;
+	int index;
+
+  private:
+	renderer_opengl_immediate *m_r;
+	const ldraw::model_multipart *m_base;
+	const ldraw::model *m_model;
+	int m_depth;
+	const ldraw::filter *m_filter;
+	ldraw::matrix m_proj;
+};
+
+void renderer_opengl_immediate::edge_drawer::visit_ref(const ldraw::element_ref *l)
+{
+	frustum::visibility vis = m_r->m_frustum.classify(m_model, l);
+	
+	if (vis == frustum::outside) {
+		++m_r->m_stats.culled;
+		return;
+	}
+	
+	++m_r->m_stats.drawn;
+	
+	// Push appropriate color into the color stack.
+	int id = l->get_color().get_id();
+	if (id == 16 || id == 24)
+		m_r->m_colorstack.push(m_r->m_colorstack.top());
 	else
-		return false;
+		m_r->m_colorstack.push(l->get_color());
+		
+	// transform
+	glPushMatrix();
+	glMultMatrixf(l->get_matrix().transpose().get_pointer());
+	m_r->m_frustum.push(l, vis);
+	
+	if (ldraw::utils::is_stud(l))
+		m_r->render_stud(l->get_model(), true);
+	else if (l->get_model())
+		m_r->draw_model_edges(m_base, l->get_model(), m_depth+1, m_filter); // Recurse
+		
+	m_r->m_frustum.pop();
+	glPopMatrix();
+	m_r->m_colorstack.pop();
 }
 
-// Get selection
-selection_list renderer_opengl_immediate::select(float *projection_matrix, float *modelview_matrix, int x, int y, int w, int h, ldraw::model *m, const ldraw::filter *skip_filter)
+class renderer_opengl_immediate::box_drawer : public ldraw::element_visitor<renderer_opengl_immediate::box_drawer>
 {
-	GLint hits, viewport[4];
-	GLuint selectionBuffer[1024];
+  public:
+	box_drawer(renderer_opengl_immediate *r, const ldraw::model *m) : index(0), m_r(r), m_model(m) {}
 
-	if (w == 0)
-		w = 1;
-	else if (w < 0)
-		x += w, w = -w;
+	void visit_ref(const ldraw::element_ref *l);
 
-	if (h == 0)
-		h = 1;
-	else if (h < 0)
-		y += h, h = -h;
-
-	glSelectBuffer(1024, selectionBuffer);
-	glRenderMode(GL_SELECT);
-	
-	glGetIntegerv(GL_VIEWPORT, viewport);
+	int index;
 
-	glMatrixMode(GL_PROJECTION);
-	glLoadIdentity();
-	gluPickMatrix(x + w/2, viewport[3] - (y + h/2), w, h, viewport);
-	glMultMatrixf(projection_matrix);
+  private:
+	renderer_opengl_immediate *m_r;
+	const ldraw::model *m_model;
+};
 
-	glMatrixMode(GL_MODELVIEW);
-	glLoadMatrixf(modelview_matrix);
-	glInitNames();
-	glPushName(0);
+void renderer_opengl_immediate::box_drawer::visit_ref(const ldraw::element_ref *l)
+{
+	if (l->get_model())
+		l->get_model()->shared_custom_data<ldraw::metrics>();
+	
+	if (m_r->m_frustum.classify(m_model, l) == frustum::outside) {
+		++m_r->m_stats.culled;
+		return;
+	}
+	
+	++m_r->m_stats.drawn;
+	
+	glPushMatrix();
+	glMultMatrixf(l->get_matrix().transpose().get_pointer());
+	
+	if (l->get_model()) {
+		const ldraw::metrics *metrics = l->get_model()->custom_data<ldraw::metrics>();
+		ldraw::vector center = (metrics->min_() + metrics->max_()) * 0.5f;
+		glColor4ub(0, 0, 0, 160);
+		glBegin(GL_POINTS);
+		glVertex3fv(center.get_pointer());
+		glEnd();
+		glColor3ub(0, 0, 0);
+		m_r->render_bounding_box(*metrics);
+	}
+	
+	glPopMatrix();
+}
 
-	glPointSize(7.0f);
+// rendering code
+void renderer_opengl_immediate::draw_model_full(const ldraw::model_multipart *base, ldraw::model *m, int depth, const ldraw::filter *filter)
+{
+	full_drawer d(this, base, m, depth, filter);
 
 	// Iterate!
-	int i = 0;
-	for (ldraw::model::const_iterator it = m->elements().begin(); it != m->elements().end(); ++it) {
- 		if (skip_filter->query(m, i, 0)) {
-			++i;
+	for (ldraw::model::const_iterator it = m->elements().begin(); it != m->elements().end(); ++it, ++d.index) {
+		if (filter && filter->query(m, d.index, depth))
 			continue;
-		}
 		
-		ldraw::type elemtype = (*it)->get_type();
-			
-		if (elemtype == ldraw::type_ref) {
-			ldraw::element_ref *l = CAST_AS_REF(*it);
+		d.dispatch(*it);
 
-			if (!l->get_model()) {
-				++i;
-				continue;
-			}
-			
-			if (!l->get_model()->custom_data<ldraw::metrics>())
-				l->get_model()->update_custom_data<ldraw::metrics>();
-			
-			glPushMatrix();
-			glMultMatrixf(l->get_matrix().transpose().get_pointer());
-			
-			glLoadName(i);
-			const ldraw::metrics *metrics = l->get_model()->custom_data<ldraw::metrics>();
-			ldraw::vector center = (metrics->min_() + metrics->max_()) * 0.5;
-			
-			glBegin(GL_POINTS);
-			glVertex3fv(center.get_pointer());
-			glEnd();
-			
-			glPopMatrix();
-		}
-		
-		++i;
+		/* reset invertnext */
+		if ((*it)->get_type() != ldraw::type_bfc)
+			d.invertnext = false;
 	}
+}
 
-	hits = glRenderMode(GL_RENDER);
-
-	std::list<std::pair<int, GLuint> > result;
-	for (int i = 0; i < hits; ++i)
-		result.push_back(std::pair<int, GLuint>(selectionBuffer[i * 4 + 3], selectionBuffer[i * 4 + 1]));
+void renderer_opengl_immediate::draw_model_edges(const ldraw::model_multipart *base, const ldraw::model *m, int depth, const ldraw::filter *filter)
+{
+	edge_drawer d(this, base, m, depth, filter);
+	
+	// Iterate!
+	for (ldraw::model::const_iterator it = m->elements().begin(); it != m->elements().end(); ++it, ++d.index) {
+		if (!filter || !filter->query(m, d.index, depth))
+			d.dispatch(*it);
+	}
+}
 
-	return result;
+/* Renders bounding box recursively */
+void renderer_opengl_immediate::draw_model_bounding_boxes(const ldraw::model_multipart *, const ldraw::model *m, int, const ldraw::filter *filter)
+{
+	box_drawer d(this, m);
+	
+	// Iterate!
+	for (ldraw::model::const_iterator it = m->elements().begin(); it != m->elements().end(); ++it, ++d.index) {
+		if (!filter || !filter->query(m, d.index, 0))
+			d.dispatch(*it);
+	}
 }
 
 // Draw a filled bounding box
@@ -710,13 +632,13 @@ void renderer_opengl_immediate::render_normal_orientation(const ldraw::element_b
 	ldraw::vector nv3 = nv * 3.0f;
 
 	if (el->get_type() == ldraw::type_triangle) {
-		const ldraw::element_triangle *t = CAST_AS_CONST_TRIANGLE(el);
+		const ldraw::element_triangle *t = ldraw::element_cast<ldraw::element_triangle>(el);
 
 		center.x() = (t->pos1().x() + t->pos2().x() + t->pos3().x()) / 3.0f;
 		center.y() = (t->pos1().y() + t->pos2().y() + t->pos3().y()) / 3.0f;
 		center.z() = (t->pos1().z() + t->pos2().z() + t->pos3().z()) / 3.0f;
 	} else {
-		const ldraw::element_quadrilateral *t = CAST_AS_CONST_QUADRILATERAL(el);
+		const ldraw::element_quadrilateral *t = ldraw::element_cast<ldraw::element_quadrilateral>(el);
 
 		center.x() = (t->pos1().x() + t->pos2().x() + t->pos3().x() + t->pos4().x()) / 4.0f;
 		center.y() = (t->pos1().y() + t->pos2().y() + t->pos3().y() + t->pos4().y()) / 4.0f;
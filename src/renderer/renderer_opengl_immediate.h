@@ -28,14 +28,6 @@ namespace ldraw
 namespace ldraw_renderer
 {
 
-struct statistics
-{
-	int triangles;
-	int quads;
-	int faces;
-	int lines;
-};
-
 class parameters;
 
 /* OpenGL immediate mode rendering path (now deprecated) */
@@ -44,15 +36,10 @@ class LIBLDRAWRENDERER_EXPORT renderer_opengl_immediate : public renderer_opengl
 {
   public:
 	~renderer_opengl_immediate();
-	
-	const statistics* get_stats() const { return &m_stats; }
 
 	void render(ldraw::model *m, const ldraw::filter *filter);
 	void render_bounding_box(const ldraw::metrics &metrics);
 	
-	bool hit_test(float *projection_matrix, float *modelview_matrix, int x, int y, int w, int h, ldraw::model *m, const ldraw::filter *filter);
-	selection_list select(float *projection_matrix, float *modelview_matrix, int x, int y, int w, int h, ldraw::model *m, const ldraw::filter *filter);
-	
   protected:
 	void draw_model_full(const ldraw::model_multipart *base, ldraw::model *m, int depth, const ldraw::filter *filter);
 	void draw_model_edges(const ldraw::model_multipart *base, const ldraw::model *m, int depth, const ldraw::filter *filter);
@@ -69,10 +56,15 @@ class LIBLDRAWRENDERER_EXPORT renderer_opengl_immediate : public renderer_opengl
   private:
 	friend class renderer_opengl_factory;
 	
+	/* Element visitors (libldr/visitor.h) drawing the elements of a model
+	 * in each rendering mode */
+	class full_drawer;
+	class edge_drawer;
+	class box_drawer;
+	
 	renderer_opengl_immediate(const parameters *rp);
 	
 	ldraw::bfc_state_tracker m_bfc_tracker;
-	statistics m_stats;
 };
 
 }
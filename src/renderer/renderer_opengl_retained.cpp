@@ -4,12 +4,19 @@
  *                                                                                   *
  * Author: (c)2006-2008 Park "segfault" J. K. <mastermind_at_planetmono_dot_org>     */
 
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+
 #include <libldr/filter.h>
 #include <libldr/model.h>
 
 #include "opengl.h"
+#include "opengl_extension_instancing.h"
 #include "opengl_extension_vbo.h"
 #include "opengl_extension_shader.h"
+#include "opengl_extension_vao.h"
+#include "palette.h"
 #include "vbuffer_extension.h"
 
 #include "renderer_opengl_retained.h"
@@ -91,10 +98,34 @@ const char renderer_opengl_retained::m_shader_color_modifier[] =
 #  include "renderer_opengl_retained_vshader.h"
     ;
 
+const char renderer_opengl_retained::m_shader_instance[] =
+#  include "renderer_opengl_retained_ishader.h"
+    ;
+
 renderer_opengl_retained::renderer_opengl_retained(const parameters *rp,
                                                    bool force_vbuffer, bool force_fixed)
     : renderer_opengl(rp)
 {
+  m_vao = opengl_extension_vao::self()->is_supported();
+  m_vao_bound = false;
+  m_frame = 0;
+  
+  glGenTextures(1, &m_palette_texture);
+  glBindTexture(GL_TEXTURE_2D, m_palette_texture);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP);
+  glBindTexture(GL_TEXTURE_2D, 0);
+  m_palette_size = 0;
+  m_palette_serial = 0;
+  m_palette_width = 1;
+  m_palette_slot = -1;
+  
+  GLint max_width;
+  glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_width);
+  palette::fit(std::min<int>(max_width, palette::max_slots));
+  
   if (force_vbuffer)
     m_vbo = false;
   else
@@ -104,10 +135,18 @@ renderer_opengl_retained::renderer_opengl_retained(const parameters *rp,
     m_shader = false;
   else
     init_shader();
+  
+  init_instancing();
 }
 
 renderer_opengl_retained::~renderer_opengl_retained()
 {
+  for (vao_list::iterator it = m_vaos.begin(); it != m_vaos.end(); ++it)
+    opengl_extension_vao::self()->glDeleteVertexArrays(4, (*it).second.names);
+  
+  glDeleteTextures(1, &m_palette_texture);
+  palette::release(m_frame_slots);
+  
   if (m_vbo) {
     opengl_extension_vbo *vbo = opengl_extension_vbo::self();
     
@@ -122,31 +161,70 @@ renderer_opengl_retained::~renderer_opengl_retained()
     shader->glDeleteShader(m_vs_color_shader);
     shader->glDeleteProgram(m_vs_color_program);
   }
+  
+  if (m_instancing) {
+    opengl_extension_shader *shader = opengl_extension_shader::self();
+    
+    if (m_vbo)
+      opengl_extension_vbo::self()->glDeleteBuffers(1, &m_vbo_instances);
+    
+    shader->glDetachShader(m_vs_instance_program, m_vs_instance_shader);
+    shader->glDeleteShader(m_vs_instance_shader);
+    shader->glDeleteProgram(m_vs_instance_program);
+  }
 }
 
 /* render filter works properly only with PARTS, PRIMITIVE mode. */
 void renderer_opengl_retained::render(ldraw::model *m, const ldraw::filter *filter)
 {
-  opengl_extension_shader *shader = opengl_extension_shader::self();
   opengl_extension_vbo *vbo = opengl_extension_vbo::self();
   
+  std::memset(&m_stats, 0, sizeof(statistics));
+  m_frustum.begin(m_params->get_frustum_culling());
+  
+  palette::release(m_frame_slots);
+  m_frame_slots.clear();
+  
   glEnableClientState(GL_VERTEX_ARRAY);
   
   if (m_params->get_rendering_mode() == parameters::model_boundingboxes) {
     render_bounding_boxes(m, filter);
   } else {
-    glEnableClientState(GL_COLOR_ARRAY);
+    glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+    glEnable(GL_TEXTURE_2D);
+    glBindTexture(GL_TEXTURE_2D, m_palette_texture);
+    glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE);
+    glColor4f(1.0f, 1.0f, 1.0f, 1.0f);
     
-    if (m_shader)
-      shader->glEnableVertexAttribArray(m_vs_color_location_verttype);
+    glMatrixMode(GL_TEXTURE);
+    glPushMatrix();
+    glMatrixMode(GL_MODELVIEW);
+    m_palette_slot = -1;
     
-    render_recursive(m, filter, 0);
+    if (m_instancing) {
+      m_transform = ldraw::matrix();
+      render_recursive(m, filter, 0);
+      render_instances();
+    } else {
+      render_recursive(m, filter, 0);
+    }
     
-    if (m_shader)
-      shader->glDisableVertexAttribArray(m_vs_color_location_verttype);
-    if (m_vbo)
+    release_arrays();
+    if (m_vao && (++m_frame & 255) == 0)
+      purge_arrays();
+    
+    if (m_vbo) {
       vbo->glBindBuffer(GL_ARRAY_BUFFER_ARB, 0);
-    glDisableClientState(GL_COLOR_ARRAY);
+      vbo->glBindBuffer(GL_ELEMENT_ARRAY_BUFFER_ARB, 0);
+    }
+    
+    glMatrixMode(GL_TEXTURE);
+    glPopMatrix();
+    glMatrixMode(GL_MODELVIEW);
+    
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glDisable(GL_TEXTURE_2D);
+    glDisableClientState(GL_TEXTURE_COORD_ARRAY);
   }
   
   glDisableClientState(GL_VERTEX_ARRAY);
@@ -218,17 +296,24 @@ void renderer_opengl_retained::render_bounding_boxes(ldraw::model *m,
   int i = 0;
   for (ldraw::model::const_iterator it = m->elements().begin(); it != m->elements().end(); ++it) {
     if ((*it)->get_type() == ldraw::type_ref) {
-      ldraw::element_ref *r = CAST_AS_REF(*it);
+      ldraw::element_ref *r = ldraw::element_cast<ldraw::element_ref>(*it);
       ldraw::model *rm = r->get_model();
       
       if (rm) {
         if (!filter || (filter && !filter->query(rm, i, 0))) {
-          if (!rm->custom_data<ldraw::metrics>())
-            rm->init_custom_data<ldraw::metrics>();
+          const ldraw::metrics *rmm = rm->shared_custom_data<ldraw::metrics>();
+          
+          if (m_frustum.classify(m, r) == frustum::outside) {
+            ++m_stats.culled;
+            ++i;
+            continue;
+          }
+          
+          ++m_stats.drawn;
           
           glPushMatrix();
           glMultMatrixf(r->get_matrix().transpose().get_pointer());
-          render_bounding_box(*rm->custom_data<ldraw::metrics>());
+          render_bounding_box(*rmm);
           glPopMatrix();
         }
       }
@@ -237,194 +322,6 @@ void renderer_opengl_retained::render_bounding_boxes(ldraw::model *m,
   }
 }
 
-bool renderer_opengl_retained::hit_test(float *projection_matrix,
-                                        float *modelview_matrix,
-                                        int x, int y,
-                                        int w, int h,
-                                        ldraw::model *m,
-                                        const ldraw::filter *skip_filter)
-{
-  GLint viewport[4];
-  GLuint selectionBuffer[4];
-  
-  if (m_vbo)
-    opengl_extension_vbo::self()->glBindBuffer(GL_ARRAY_BUFFER_ARB, 0);
-  
-  if (w == 0)
-    w = 1;
-  else if (w < 0)
-    x += w, w = -w;
-  
-  if (h == 0)
-    h = 1;
-  else if (h < 0)
-    y += h, h = -h;
-  
-  glSelectBuffer(4, selectionBuffer);
-  glRenderMode(GL_SELECT);
-  
-  glGetIntegerv(GL_VIEWPORT, viewport);
-  
-  glMatrixMode(GL_PROJECTION);
-  glLoadIdentity();
-  gluPickMatrix(x + w/2, viewport[3] - (y + h/2), w, h, viewport);
-  glMultMatrixf(projection_matrix);
-  
-  glMatrixMode(GL_MODELVIEW);
-  glLoadMatrixf(modelview_matrix);
-  glInitNames();
-  glPushName(0);
-  
-  glPointSize(7.0f);
-  
-  int i = 0;
-  for (ldraw::model::const_iterator it = m->elements().begin(); it != m->elements().end(); ++it) {
-    ldraw::type elemtype = (*it)->get_type();
-    
-    if (skip_filter->query(m, i, 0)) {
-      if (elemtype == ldraw::type_ref) {
-        ldraw::element_ref *l = CAST_AS_REF(*it);
-	
-        if (!l->get_model())
-          continue;
-	
-        if (!l->get_model()->custom_data<ldraw::metrics>())
-          l->get_model()->update_custom_data<ldraw::metrics>();
-	
-        glPushMatrix();
-        glMultMatrixf(l->get_matrix().transpose().get_pointer());
-	
-        render_bounding_box_filled(*l->get_model()->custom_data<ldraw::metrics>());
-	
-        glPopMatrix();
-      }
-    }
-    
-    ++i;
-  }
-
-  glPopName();
-  
-  if (m_vbo)
-    opengl_extension_vbo::self()->glBindBuffer(GL_ARRAY_BUFFER_ARB, 0);
-  if (i == 0)
-    return false;
-  
-  if (glRenderMode(GL_RENDER))
-    return true;
-  else
-    return false;
-}
-
-selection_list renderer_opengl_retained::select(float *projection_matrix,
-                                                float *modelview_matrix,
-                                                int x, int y,
-                                                int w, int h,
-                                                ldraw::model *m,
-                                                const ldraw::filter *skip_filter)
-{
-  GLint hits, viewport[4];
-  GLuint selectionBuffer[1024 * 4];
-  
-  if (m_vbo)
-    opengl_extension_vbo::self()->glBindBuffer(GL_ARRAY_BUFFER_ARB, 0);
-  if (w == 0)
-    w = 1;
-  else if (w < 0)
-    x += w, w = -w;
-  
-  if (h == 0)
-    h = 1;
-  else if (h < 0)
-    y += h, h = -h;
-  
-  glSelectBuffer(1024, selectionBuffer);
-  glRenderMode(GL_SELECT);
-  
-  glGetIntegerv(GL_VIEWPORT, viewport);
-  
-  glMatrixMode(GL_PROJECTION);
-  glLoadIdentity();
-  gluPickMatrix(x + w/2, viewport[3] - (y + h/2), w, h, viewport);
-  glMultMatrixf(projection_matrix);
-  
-  glMatrixMode(GL_MODELVIEW);
-  glLoadMatrixf(modelview_matrix);
-  glInitNames();
-  glPushName(0);
-  
-  glPointSize(7.0f);
-  
-  if (m_selection == selection_model_full) {
-    glPushAttrib(GL_ENABLE_BIT);
-    glEnable(GL_DEPTH_TEST);
-  }
-  
-  // Iterate!
-  int i = 0;
-  for (ldraw::model::const_iterator it = m->elements().begin(); it != m->elements().end(); ++it) {
-    if (skip_filter && skip_filter->query(m, i, 0)) {
-      ++i;
-      continue;
-    }
-    
-    ldraw::type elemtype = (*it)->get_type();
-    
-    if (elemtype == ldraw::type_ref) {
-      ldraw::element_ref *l = CAST_AS_REF(*it);
-      
-      if (!l->get_model()) {
-        ++i;
-        continue;
-      }
-      
-      ldraw::model *rm = l->get_model();
-      
-      if (!rm->custom_data<ldraw::metrics>())
-        rm->init_custom_data<ldraw::metrics>();
-      
-      glLoadName(i);
-      
-      const ldraw::metrics *rmm = rm->custom_data<ldraw::metrics>();
-      const ldraw::matrix &rmt = l->get_matrix();
-      
-      if (m_selection == selection_points) {
-        ldraw::vector center = (rmt * rmm->min_() + rmt * rmm->max_()) * 0.5f;
-	
-        glBegin(GL_POINTS);
-        glVertex3fv(center.get_pointer());
-        glEnd();
-      } else {
-        glPushMatrix();
-        glMultMatrixf(l->get_matrix().transpose().get_pointer());
-        
-        if (m_selection == selection_model_full)
-          render_bounding_box_filled(*rmm);
-        else
-          render(rm, 0L);
-
-        glPopMatrix();
-      }
-    }
-    
-    ++i;
-  }
-
-  glPopName();
-  
-  hits = glRenderMode(GL_RENDER);
-  
-  if (m_selection == selection_model_full) {
-    glPopAttrib();
-  }
-  
-  std::list<std::pair<int, GLuint> > result;
-  for (int i = 0; i < hits; ++i)
-    result.push_back(std::pair<int, GLuint>(selectionBuffer[i * 4 + 3], selectionBuffer[i * 4 + 1]));
-  
-  return result;
-}
-
 #if 0
 void printInfo(GLenum e)
 {
@@ -465,10 +362,6 @@ void renderer_opengl_retained::init_shader()
     printInfo(m_vs_color_shader);
     printInfo(m_vs_color_program);
 #endif
-    
-    m_vs_color_location_rgba = shader->glGetUniformLocation(m_vs_color_program, "rgba");
-    m_vs_color_location_complement = shader->glGetUniformLocation(m_vs_color_program, "complement");
-    m_vs_color_location_verttype = shader->glGetAttribLocation(m_vs_color_program, "verttype");
   } else {
     m_shader = false;
   }
@@ -496,175 +389,191 @@ void renderer_opengl_retained::init_vbuffer()
   }
 }
 
-void renderer_opengl_retained::render_recursive(ldraw::model *m, const ldraw::filter *filter, int depth)
+void renderer_opengl_retained::init_instancing()
 {
-  if (!m)
+  opengl_extension_shader *shader = opengl_extension_shader::self();
+  
+  m_instancing = false;
+  if (!m_shader || !opengl_extension_instancing::self()->is_supported())
     return;
   
-  bool edgesonly = m_params->get_rendering_mode() == parameters::model_edges;
+  m_vs_instance_program = shader->glCreateProgram();
   
-  bool collapse = false;
-  parameters::vbuffer_criteria vc = m_params->get_vbuffer_criteria();
+  const char *str = m_shader_instance;
+  m_vs_instance_shader = shader->glCreateShader(GL_VERTEX_SHADER_ARB);
+  shader->glShaderSource(m_vs_instance_shader, 1, &str, 0L);
+  shader->glCompileShader(m_vs_instance_shader);
+  shader->glAttachShader(m_vs_instance_program, m_vs_instance_shader);
+  shader->glLinkProgram(m_vs_instance_program);
+  
+  m_vs_instance_location_rows[0] = shader->glGetAttribLocation(m_vs_instance_program, "row0");
+  m_vs_instance_location_rows[1] = shader->glGetAttribLocation(m_vs_instance_program, "row1");
+  m_vs_instance_location_rows[2] = shader->glGetAttribLocation(m_vs_instance_program, "row2");
+  m_vs_instance_location_slot = shader->glGetAttribLocation(m_vs_instance_program, "slot");
+  
+  m_instancing = true;
+  for (int i = 0; i < 3; ++i) {
+    if (m_vs_instance_location_rows[i] < 0)
+      m_instancing = false;
+  }
+  if (m_vs_instance_location_slot < 0)
+    m_instancing = false;
+  
+  /* program failed to build */
+  if (!m_instancing) {
+    shader->glDetachShader(m_vs_instance_program, m_vs_instance_shader);
+    shader->glDeleteShader(m_vs_instance_shader);
+    shader->glDeleteProgram(m_vs_instance_program);
+    
+    return;
+  }
+  
+  if (m_vbo)
+    opengl_extension_vbo::self()->glGenBuffers(1, &m_vbo_instances);
+}
 
+bool renderer_opengl_retained::is_collapsed(const ldraw::model *m, int depth) const
+{
+  parameters::vbuffer_criteria vc = m_params->get_vbuffer_criteria();
+  
   if (vc == parameters::vbuffer_everything && depth == 0)
-    collapse = true;
+    return true;
   else if (vc == parameters::vbuffer_submodels && m->modeltype() <= ldraw::model::submodel)
-    collapse = true;
+    return true;
   else if (vc == parameters::vbuffer_parts && m->modeltype() <= ldraw::model::part)
-    collapse = true;
+    return true;
   else
-    collapse = false;
-  
+    return false;
+}
+
+vbuffer_extension* renderer_opengl_retained::get_vbuffer(ldraw::model *m, bool collapse) const
+{
   vbuffer_extension *ve = m->custom_data<vbuffer_extension>();
   if (!ve) {
     vbuffer_extension::vbuffer_params p;
+    p.force_fixed = !m_shader;
     p.force_vbuffer = !m_vbo;
     p.collapse_subfiles = collapse;
     p.params = m_params;
     
-    ve = m->init_custom_data<vbuffer_extension>(&p);
-    ve->update();
-  } else {
-    if (ve->is_update_required(collapse))
-      ve->update(collapse);
+    ve = m->shared_custom_data<vbuffer_extension>(&p);
   }
   
+  if (ve->is_update_required(collapse))
+    ve->update(collapse);
+  
+  return ve;
+}
+
+void renderer_opengl_retained::render_recursive(ldraw::model *m, const ldraw::filter *filter, int depth)
+{
+  if (!m)
+    return;
+  
+  bool edgesonly = m_params->get_rendering_mode() == parameters::model_edges;
+  bool collapse = is_collapsed(m, depth);
+  
+  vbuffer_extension *ve = get_vbuffer(m, collapse);
+  
   if (!ve->is_null()) {
-    const float *color;
-    GLuint vbo_color;
     bool shading = m_params->get_shading();
-    opengl_extension_vbo *vbo = opengl_extension_vbo::self();
     opengl_extension_shader *shader = opengl_extension_shader::self();
     
-    if (m_shader) {
+    ldraw::color c(0);
+    if (m_colorstack.size() > 0)
+      c = m_colorstack.top();
+    
+    set_palette_slot(hold_palette_slot(c));
+    
+    if (m_shader)
       shader->glUseProgram(m_vs_color_program);
-      ldraw::color c(0);
-      if (m_colorstack.size() > 0)
-        c = m_colorstack.top();
-      
-      const unsigned char *cptr;
-      
-      cptr = c.get_entity()->rgba;
-      shader->glUniform4f(m_vs_color_location_rgba, cptr[0] / 255.0f, cptr[1] / 255.0f, cptr[2] / 255.0f, cptr[3] / 255.0f);
-      cptr = c.get_entity()->complement;
-      shader->glUniform4f(m_vs_color_location_complement, cptr[0] / 255.0f, cptr[1] / 255.0f, cptr[2] / 255.0f, cptr[3] / 255.0f);
-    }
     
     glDisable(GL_LIGHTING);
     
     /* lines */
     if (ve->count(vbuffer_extension::type_lines) > 0) {
-      if (m_vbo)
-        vbo->glBindBuffer(GL_ARRAY_BUFFER_ARB, ve->get_vbo_vertices(vbuffer_extension::type_lines));
-      glVertexPointer(3, GL_FLOAT, 0, ve->get_vertex_array(vbuffer_extension::type_lines));
-      if (m_vbo) {
-        if (m_shader)
-          vbo_color = ve->get_vbo_colors(vbuffer_extension::type_lines);
-        else
-          vbo_color = ve->get_vbo_precolored(vbuffer_extension::type_lines, m_colorstack.top());
-        vbo->glBindBuffer(GL_ARRAY_BUFFER_ARB, vbo_color);
-      }
-      if (m_shader)
-        color = ve->get_color_array(vbuffer_extension::type_lines);
-      else
-        color = ve->get_precolored_array(vbuffer_extension::type_lines, m_colorstack.top());
-      glColorPointer(4, GL_FLOAT, 0, color);
-      glDrawArrays(GL_LINES, 0, ve->count(vbuffer_extension::type_lines));
+      set_arrays(ve, vbuffer_extension::type_lines);
+      glDrawElements(GL_LINES, ve->count(vbuffer_extension::type_lines), GL_UNSIGNED_INT, ve->get_index_array(vbuffer_extension::type_lines));
     }
     
     /* conditional lines */
     if (ve->count(vbuffer_extension::type_condlines) > 0) {
 #if 0
-      if (m_vbo)
-        vbo->glBindBuffer(GL_ARRAY_BUFFER_ARB, ve->get_vbo_vertices(vbuffer_extension::type_condlines));
-      glVertexPointer(3, GL_FLOAT, 0, ve->get_vertex_array(vbuffer_extension::type_condlines));
-      if (m_vbo)
-        vbo->glBindBuffer(GL_ARRAY_BUFFER_ARB, ve->get_vbo_colors(vbuffer_extension::type_condlines));
-      glColorPointer(4, GL_FLOAT, 0, ve->get_color_array(vbuffer_extension::type_condlines));
-      glDrawArrays(GL_LINES, 0, ve->count(vbuffer_extension::type_condlines));
+      set_arrays(ve, vbuffer_extension::type_condlines);
+      glDrawElements(GL_LINES, ve->count(vbuffer_extension::type_condlines), GL_UNSIGNED_INT, ve->get_index_array(vbuffer_extension::type_condlines));
 #endif
     }
     
     if (!edgesonly) {
       if (shading) {
         glEnable(GL_LIGHTING);
+        release_arrays();
         glEnableClientState(GL_NORMAL_ARRAY);
       }
       
       /* triangles */
       if (ve->count(vbuffer_extension::type_triangles) > 0) {
-        if (m_vbo)
-          vbo->glBindBuffer(GL_ARRAY_BUFFER_ARB, ve->get_vbo_vertices(vbuffer_extension::type_triangles));
-        glVertexPointer(3, GL_FLOAT, 0, ve->get_vertex_array(vbuffer_extension::type_triangles));
-        if (shading) {
-          if (m_vbo)
-            vbo->glBindBuffer(GL_ARRAY_BUFFER_ARB, ve->get_vbo_normals(vbuffer_extension::type_triangles));
-          glNormalPointer(GL_FLOAT, 0, ve->get_normal_array(vbuffer_extension::type_triangles));
-        }
-	
-        if (m_vbo) {
-          if (m_shader)
-            vbo_color = ve->get_vbo_colors(vbuffer_extension::type_triangles);
-          else
-            vbo_color = ve->get_vbo_precolored(vbuffer_extension::type_triangles, m_colorstack.top());
-          vbo->glBindBuffer(GL_ARRAY_BUFFER_ARB, vbo_color);
-        }
-        if (m_shader)
-          color = ve->get_color_array(vbuffer_extension::type_triangles);
-        else
-          color = ve->get_precolored_array(vbuffer_extension::type_triangles, m_colorstack.top());
-        glColorPointer(4, GL_FLOAT, 0, color);
-        glDrawArrays(GL_TRIANGLES, 0, ve->count(vbuffer_extension::type_triangles));
+        set_arrays(ve, vbuffer_extension::type_triangles);
+        glDrawElements(GL_TRIANGLES, ve->count(vbuffer_extension::type_triangles), GL_UNSIGNED_INT, ve->get_index_array(vbuffer_extension::type_triangles));
       }
       
       /* quads */
       if (ve->count(vbuffer_extension::type_quads) > 0) {
-        if (m_vbo)
-          vbo->glBindBuffer(GL_ARRAY_BUFFER_ARB, ve->get_vbo_vertices(vbuffer_extension::type_quads));
-        glVertexPointer(3, GL_FLOAT, 0, ve->get_vertex_array(vbuffer_extension::type_quads));
-        if (shading) {
-          if (m_vbo)
-            vbo->glBindBuffer(GL_ARRAY_BUFFER_ARB, ve->get_vbo_normals(vbuffer_extension::type_quads));
-          glNormalPointer(GL_FLOAT, 0, ve->get_normal_array(vbuffer_extension::type_quads));
-        }
-        if (m_vbo) {
-          if (m_shader)
-            vbo_color = ve->get_vbo_colors(vbuffer_extension::type_quads);
-          else
-            vbo_color = ve->get_vbo_precolored(vbuffer_extension::type_quads, m_colorstack.top());
-          vbo->glBindBuffer(GL_ARRAY_BUFFER_ARB, vbo_color);
-        }
-        if (m_shader)
-          color = ve->get_color_array(vbuffer_extension::type_quads);
-        else
-          color = ve->get_precolored_array(vbuffer_extension::type_quads, m_colorstack.top());
-        glColorPointer(4, GL_FLOAT, 0, color);
-        glDrawArrays(GL_QUADS, 0, ve->count(vbuffer_extension::type_quads));
+        set_arrays(ve, vbuffer_extension::type_quads);
+        glDrawElements(GL_TRIANGLES, ve->count(vbuffer_extension::type_quads), GL_UNSIGNED_INT, ve->get_index_array(vbuffer_extension::type_quads));
       }
       
       if (m_shader)
         shader->glUseProgram(0);
       
-      if (shading)
+      if (shading) {
+        release_arrays();
         glDisableClientState(GL_NORMAL_ARRAY);
+      }
     }
+    
+    /* uploading the buffers of the references below rebinds the element
+     * array buffer, which belongs to the bound vertex array object */
+    release_arrays();
   }
   
   if (!collapse) {
     int i  = 0;
     for (ldraw::model::const_iterator it = m->elements().begin(); it != m->elements().end(); ++it) {
       if ((*it)->get_type() == ldraw::type_ref) {
-        ldraw::element_ref *r = CAST_AS_REF(*it);
+        ldraw::element_ref *r = ldraw::element_cast<ldraw::element_ref>(*it);
         
         if (!filter || (filter && !filter->query(m, i, depth))) {
-          m_colorstack.push(r->get_color());
+          ldraw::model *rm = r->get_model();
+          frustum::visibility vis = m_frustum.classify(m, r);
           
-          glPushMatrix();
-          glMultMatrixf(r->get_matrix().transpose().get_pointer());
-          render_recursive(r->get_model(), filter, depth + 1);
-          glPopMatrix();
+          if (vis == frustum::outside) {
+            ++m_stats.culled;
+            ++i;
+            continue;
+          }
           
-          m_colorstack.pop();
+          ++m_stats.drawn;
+          
+          if (m_instancing && rm && is_collapsed(rm, depth + 1)) {
+            queue_instance(rm, m_transform * r->get_matrix(), r->get_color());
+          } else {
+            ldraw::matrix transform = m_transform;
+            
+            m_colorstack.push(r->get_color());
+            if (m_instancing)
+              m_transform = m_transform * r->get_matrix();
+            
+            glPushMatrix();
+            glMultMatrixf(r->get_matrix().transpose().get_pointer());
+            m_frustum.push(r, vis);
+            render_recursive(rm, filter, depth + 1);
+            m_frustum.pop();
+            glPopMatrix();
+            
+            m_transform = transform;
+            m_colorstack.pop();
+          }
         }
       }
       ++i;
@@ -672,4 +581,225 @@ void renderer_opengl_retained::render_recursive(ldraw::model *m, const ldraw::fi
   }
 }
 
+void renderer_opengl_retained::queue_instance(ldraw::model *m, const ldraw::matrix &transform, const ldraw::color &c)
+{
+  vbuffer_extension *ve = get_vbuffer(m, true);
+  if (ve->is_null())
+    return;
+  
+  std::unordered_map<const vbuffer_extension *, int>::const_iterator it = m_instance_lookup.find(ve);
+  int group;
+  
+  if (it == m_instance_lookup.end()) {
+    group = (int) m_instance_models.size();
+    m_instance_lookup[ve] = group;
+    m_instance_models.push_back(ve);
+  } else {
+    group = (*it).second;
+  }
+  
+  instance in;
+  std::memcpy(in.matrix, transform.get_pointer(), sizeof(in.matrix));
+  in.slot = (float) hold_palette_slot(c);
+  
+  m_instances.push_back(in);
+  m_instance_groups.push_back(group);
+}
+
+/* Draws the references queued by render_recursive(), by model */
+void renderer_opengl_retained::render_instances()
+{
+  const int groups = (int) m_instance_models.size();
+  
+  if (groups > 0) {
+    opengl_extension_instancing *inst = opengl_extension_instancing::self();
+    opengl_extension_shader *shader = opengl_extension_shader::self();
+    opengl_extension_vbo *vbo = opengl_extension_vbo::self();
+    bool edgesonly = m_params->get_rendering_mode() == parameters::model_edges;
+    
+    /* lay out the instances of each group one after another */
+    std::vector<int> first(groups + 1, 0);
+    for (std::vector<int>::const_iterator it = m_instance_groups.begin(); it != m_instance_groups.end(); ++it)
+      ++first[*it + 1];
+    for (int i = 0; i < groups; ++i)
+      first[i + 1] += first[i];
+    
+    std::vector<int> next(first.begin(), first.end() - 1);
+    m_instance_buffer.resize(m_instances.size());
+    for (std::size_t i = 0; i < m_instances.size(); ++i)
+      m_instance_buffer[next[m_instance_groups[i]]++] = m_instances[i];
+    
+    const char *base = reinterpret_cast<const char *>(&m_instance_buffer[0]);
+    if (m_vbo) {
+      vbo->glBindBuffer(GL_ARRAY_BUFFER_ARB, m_vbo_instances);
+      vbo->glBufferData(GL_ARRAY_BUFFER_ARB, m_instance_buffer.size() * sizeof(instance), base, GL_STREAM_DRAW_ARB);
+      base = 0L;
+    }
+    
+    const GLuint attribs[] = {
+      (GLuint) m_vs_instance_location_rows[0], (GLuint) m_vs_instance_location_rows[1],
+      (GLuint) m_vs_instance_location_rows[2], (GLuint) m_vs_instance_location_slot
+    };
+    
+    /* the shader adds the slot of each instance */
+    set_palette_slot(0);
+    
+    shader->glUseProgram(m_vs_instance_program);
+    for (int i = 0; i < 4; ++i) {
+      shader->glEnableVertexAttribArray(attribs[i]);
+      inst->glVertexAttribDivisor(attribs[i], 1);
+    }
+    
+    glDisable(GL_LIGHTING);
+    
+    static const vbuffer_extension::buffer_type types[] = { vbuffer_extension::type_lines, vbuffer_extension::type_triangles, vbuffer_extension::type_quads };
+    static const GLenum modes[] = { GL_LINES, GL_TRIANGLES, GL_TRIANGLES };
+    
+    release_arrays();
+    
+    for (int g = 0; g < groups; ++g) {
+      vbuffer_extension *ve = m_instance_models[g];
+      const char *ptr = base + first[g] * sizeof(instance);
+      
+      if (m_vbo)
+        vbo->glBindBuffer(GL_ARRAY_BUFFER_ARB, m_vbo_instances);
+      for (int i = 0; i < 3; ++i)
+        shader->glVertexAttribPointer(attribs[i], 4, GL_FLOAT, GL_FALSE, sizeof(instance), ptr + i * 4 * sizeof(float));
+      shader->glVertexAttribPointer(attribs[3], 1, GL_FLOAT, GL_FALSE, sizeof(instance), ptr + offsetof(instance, slot));
+      
+      for (int i = 0; i < (edgesonly ? 1 : 3); ++i) {
+        vbuffer_extension::buffer_type type = types[i];
+        
+        if (ve->count(type) == 0)
+          continue;
+        
+        ve->set_arrays(type);
+        inst->glDrawElementsInstanced(modes[i], ve->count(type), GL_UNSIGNED_INT, ve->get_index_array(type), first[g + 1] - first[g]);
+      }
+    }
+    
+    for (int i = 0; i < 4; ++i) {
+      inst->glVertexAttribDivisor(attribs[i], 0);
+      shader->glDisableVertexAttribArray(attribs[i]);
+    }
+    shader->glUseProgram(0);
+    
+    if (!edgesonly && m_params->get_shading())
+      glEnable(GL_LIGHTING);
+  }
+  
+  m_instances.clear();
+  m_instance_groups.clear();
+  m_instance_models.clear();
+  m_instance_lookup.clear();
+}
+
+/* Uploads the palette again once slots were given colors */
+void renderer_opengl_retained::update_palette()
+{
+  if (m_palette_size && palette::serial() == m_palette_serial)
+    return;
+  
+  std::vector<unsigned char> texels;
+  int width;
+  
+  m_palette_serial = palette::serial();
+  m_palette_size = palette::get_texture(texels, width);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, 2, 0, GL_RGBA, GL_UNSIGNED_BYTE, &texels[0]);
+  
+  if (width != m_palette_width) {
+    m_palette_width = width;
+    m_palette_slot = -1;
+  }
+}
+
+/* Slot of a reference's color, held until the next frame so that it is not
+ * given to another color while the frame is drawn */
+int renderer_opengl_retained::hold_palette_slot(const ldraw::color &c)
+{
+  int slot = palette::acquire(c);
+  
+  if (slot >= ldraw::color::color_chart_count)
+    m_frame_slots.push_back(slot);
+  
+  return slot;
+}
+
+/* Sets up the texture matrix to take the texture coordinates of the
+ * vertices, (slot, inherited, row), to the texel of their color, adding
+ * slot to the slot of inherited ones */
+void renderer_opengl_retained::set_palette_slot(int slot)
+{
+  update_palette();
+  
+  if (slot == m_palette_slot)
+    return;
+  
+  const float w = 1.0f / m_palette_width;
+  const GLfloat m[16] = {
+    w,        0.0f,  0.0f, 0.0f,
+    slot * w, 0.0f,  0.0f, 0.0f,
+    0.0f,     0.5f,  0.0f, 0.0f,
+    0.5f * w, 0.25f, 0.0f, 1.0f
+  };
+  
+  glMatrixMode(GL_TEXTURE);
+  glLoadMatrixf(m);
+  glMatrixMode(GL_MODELVIEW);
+  
+  m_palette_slot = slot;
+}
+
+/* Points the arrays at the buffers of type, through a vertex array object
+ * of this renderer where possible; they are not shared between contexts */
+void renderer_opengl_retained::set_arrays(vbuffer_extension *ve, vbuffer_extension::buffer_type type)
+{
+  if (!m_vao || !ve->is_vbo()) {
+    release_arrays();
+    ve->set_arrays(type);
+    return;
+  }
+  
+  opengl_extension_vao *vao = opengl_extension_vao::self();
+  vao_set &vs = m_vaos[ve];
+  
+  vs.frame = m_frame;
+  if (!vs.names[type])
+    vao->glGenVertexArrays(1, &vs.names[type]);
+  
+  vao->glBindVertexArray(vs.names[type]);
+  m_vao_bound = true;
+  
+  if (vs.serials[type] != ve->serial()) {
+    glEnableClientState(GL_VERTEX_ARRAY);
+    glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+    if (type == vbuffer_extension::type_triangles || type == vbuffer_extension::type_quads)
+      glEnableClientState(GL_NORMAL_ARRAY);
+    
+    ve->set_arrays(type);
+    vs.serials[type] = ve->serial();
+  }
+}
+
+void renderer_opengl_retained::release_arrays()
+{
+  if (m_vao_bound) {
+    opengl_extension_vao::self()->glBindVertexArray(0);
+    m_vao_bound = false;
+  }
+}
+
+/* Drops the vertex array objects of buffers not drawn for a while */
+void renderer_opengl_retained::purge_arrays()
+{
+  for (vao_list::iterator it = m_vaos.begin(); it != m_vaos.end(); ) {
+    if (m_frame - (*it).second.frame > 256) {
+      opengl_extension_vao::self()->glDeleteVertexArrays(4, (*it).second.names);
+      it = m_vaos.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
 }
@@ -7,14 +7,24 @@
 #ifndef _RENDERER_RENDERER_OPENGL_RETAINED_H_
 #define _RENDERER_RENDERER_OPENGL_RETAINED_H_
 
+#include <unordered_map>
+#include <vector>
+
 #include <renderer/renderer_opengl.h>
+#include <renderer/vbuffer_extension.h>
 
 namespace ldraw_renderer
 {
 
 class parameters;
 
-/* OpenGL retained rendering path */
+/* OpenGL retained rendering path. Vertex colors are entries of the palette,
+ * looked up in a texture of this renderer; the texture matrix adds the slot
+ * of the color of the reference to those taking theirs from it. When
+ * instanced arrays are available along with the vertex shader, references
+ * to collapsed models are not drawn as they are visited; they are grouped by
+ * model and drawn after the traversal, one instanced draw per group, with
+ * the matrix and color slot of every reference in a vertex buffer. */
 
 class LIBLDRAWRENDERER_EXPORT renderer_opengl_retained : public renderer_opengl
 {
@@ -27,37 +37,99 @@ class LIBLDRAWRENDERER_EXPORT renderer_opengl_retained : public renderer_opengl
   
   void render_bounding_boxes(ldraw::model *m, const ldraw::filter *filter);
   
-  bool hit_test(float *projection_matrix, float *modelview_matrix, int x, int y, int w, int h, ldraw::model *m, const ldraw::filter *filter);
-  selection_list select(float *projection_matrix, float *modelview_matrix, int x, int y, int w, int h, ldraw::model *m, const ldraw::filter *filter);
-  
  private:
   friend class renderer_opengl_factory;
   
   renderer_opengl_retained(const parameters *rp, bool force_vbuffer, bool force_fixed);
   
+  /* Per-instance attributes; rows of the transform, then the color slot */
+  struct instance
+  {
+    float matrix[12];
+    float slot;
+  };
+  
+  /* Vertex array objects for the buffer types of a vbuffer_extension, and
+   * the buffers they were set up for */
+  struct vao_set
+  {
+    GLuint names[4];
+    unsigned int serials[4];
+    unsigned int frame;
+  };
+  
+  typedef std::unordered_map<const vbuffer_extension *, vao_set> vao_list;
+  
   void init_shader();
   void init_vbuffer();
+  void init_instancing();
+  
+  void update_palette();
+  int hold_palette_slot(const ldraw::color &c);
+  void set_palette_slot(int slot);
+  
+  void set_arrays(vbuffer_extension *ve, vbuffer_extension::buffer_type type);
+  void release_arrays();
+  void purge_arrays();
+  
+  bool is_collapsed(const ldraw::model *m, int depth) const;
+  vbuffer_extension* get_vbuffer(ldraw::model *m, bool collapse) const;
   
   void render_recursive(ldraw::model *m, const ldraw::filter *filter, int depth = 0);
+  void queue_instance(ldraw::model *m, const ldraw::matrix &transform, const ldraw::color &c);
+  void render_instances();
   
   static const float m_bbox_lines[];
   static const float m_bbox_filled[];
   
   static const char m_shader_color_modifier[];
+  static const char m_shader_instance[];
   
   bool m_vbo;
   bool m_shader;
+  bool m_instancing;
+  bool m_vao;
   
   /* VBO */
   GLuint m_vbo_bbox_lines;
   GLuint m_vbo_bbox_filled;
+  GLuint m_vbo_instances;
   
   /* Vertex shader */
-  GLint m_vs_color_location_rgba;
-  GLint m_vs_color_location_complement;
-  GLint m_vs_color_location_verttype;
   GLuint m_vs_color_program;
   GLuint m_vs_color_shader;
+  
+  /* Instancing */
+  GLint m_vs_instance_location_rows[3];
+  GLint m_vs_instance_location_slot;
+  GLuint m_vs_instance_program;
+  GLuint m_vs_instance_shader;
+  
+  /* Palette texture, the slots it covers as of which palette::serial(),
+   * and the slot of the color the texture matrix is set up for */
+  GLuint m_palette_texture;
+  int m_palette_size;
+  unsigned int m_palette_serial;
+  int m_palette_width;
+  int m_palette_slot;
+  
+  /* Palette slots held for the references of the last frame */
+  std::vector<int> m_frame_slots;
+  
+  /* Transform from the model being rendered, while instancing */
+  ldraw::matrix m_transform;
+  
+  /* References queued during the traversal, and the group of each */
+  std::vector<instance> m_instances;
+  std::vector<int> m_instance_groups;
+  std::vector<vbuffer_extension *> m_instance_models;
+  std::unordered_map<const vbuffer_extension *, int> m_instance_lookup;
+  std::vector<instance> m_instance_buffer;
+  
+  /* Vertex array objects */
+  vao_list m_vaos;
+  bool m_vao_bound;
+  unsigned int m_frame;
 };
 
 }
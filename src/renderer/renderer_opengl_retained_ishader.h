@@ -0,0 +1,23 @@
+"\x61\x74\x74\x72\x69\x62\x75\x74\x65\x20\x76\x65\x63\x34\x20\x72\x6f\x77\x30"
+"\x3b\x0a\x61\x74\x74\x72\x69\x62\x75\x74\x65\x20\x76\x65\x63\x34\x20\x72\x6f"
+"\x77\x31\x3b\x0a\x61\x74\x74\x72\x69\x62\x75\x74\x65\x20\x76\x65\x63\x34\x20"
+"\x72\x6f\x77\x32\x3b\x0a\x61\x74\x74\x72\x69\x62\x75\x74\x65\x20\x66\x6c\x6f"
+"\x61\x74\x20\x73\x6c\x6f\x74\x3b\x0a\x0a\x76\x6f\x69\x64\x20\x6d\x61\x69\x6e"
+"\x28\x76\x6f\x69\x64\x29\x0a\x7b\x0a\x20\x20\x20\x20\x76\x65\x63\x34\x20\x76"
+"\x65\x72\x74\x65\x78\x20\x3d\x20\x76\x65\x63\x34\x28\x64\x6f\x74\x28\x72\x6f"
+"\x77\x30\x2c\x20\x67\x6c\x5f\x56\x65\x72\x74\x65\x78\x29\x2c\x20\x64\x6f\x74"
+"\x28\x72\x6f\x77\x31\x2c\x20\x67\x6c\x5f\x56\x65\x72\x74\x65\x78\x29\x2c\x20"
+"\x64\x6f\x74\x28\x72\x6f\x77\x32\x2c\x20\x67\x6c\x5f\x56\x65\x72\x74\x65\x78"
+"\x29\x2c\x20\x31\x2e\x30\x29\x3b\x0a\x20\x20\x20\x20\x76\x65\x63\x34\x20\x65"
+"\x6e\x74\x72\x79\x20\x3d\x20\x67\x6c\x5f\x4d\x75\x6c\x74\x69\x54\x65\x78\x43"
+"\x6f\x6f\x72\x64\x30\x3b\x0a\x0a\x20\x20\x20\x20\x65\x6e\x74\x72\x79\x2e\x78"
+"\x20\x2b\x3d\x20\x73\x6c\x6f\x74\x20\x2a\x20\x65\x6e\x74\x72\x79\x2e\x79\x3b"
+"\x0a\x20\x20\x20\x20\x65\x6e\x74\x72\x79\x2e\x79\x20\x3d\x20\x30\x2e\x30\x3b"
+"\x0a\x0a\x20\x20\x20\x20\x67\x6c\x5f\x46\x72\x6f\x6e\x74\x43\x6f\x6c\x6f\x72"
+"\x20\x3d\x20\x76\x65\x63\x34\x28\x31\x2e\x30\x29\x3b\x0a\x20\x20\x20\x20\x67"
+"\x6c\x5f\x54\x65\x78\x43\x6f\x6f\x72\x64\x5b\x30\x5d\x20\x3d\x20\x67\x6c\x5f"
+"\x54\x65\x78\x74\x75\x72\x65\x4d\x61\x74\x72\x69\x78\x5b\x30\x5d\x20\x2a\x20"
+"\x65\x6e\x74\x72\x79\x3b\x0a\x0a\x20\x20\x20\x20\x67\x6c\x5f\x50\x6f\x73\x69"
+"\x74\x69\x6f\x6e\x20\x3d\x20\x67\x6c\x5f\x4d\x6f\x64\x65\x6c\x56\x69\x65\x77"
+"\x50\x72\x6f\x6a\x65\x63\x74\x69\x6f\x6e\x4d\x61\x74\x72\x69\x78\x20\x2a\x20"
+"\x76\x65\x72\x74\x65\x78\x3b\x0a\x7d\x0a"
@@ -1,16 +1,10 @@
-"\x75\x6e\x69\x66\x6f\x72\x6d\x20\x76\x65\x63\x34\x20\x72\x67\x62\x61\x3b\x0a"
-"\x75\x6e\x69\x66\x6f\x72\x6d\x20\x76\x65\x63\x34\x20\x63\x6f\x6d\x70\x6c\x65"
-"\x6d\x65\x6e\x74\x3b\x0a\x0a\x76\x6f\x69\x64\x20\x6d\x61\x69\x6e\x28\x76\x6f"
-"\x69\x64\x29\x0a\x7b\x0a\x20\x20\x20\x20\x67\x6c\x5f\x46\x72\x6f\x6e\x74\x43"
-"\x6f\x6c\x6f\x72\x20\x3d\x20\x67\x6c\x5f\x43\x6f\x6c\x6f\x72\x3b\x0a\x0a\x20"
-"\x20\x20\x20\x69\x66\x20\x28\x67\x6c\x5f\x46\x72\x6f\x6e\x74\x43\x6f\x6c\x6f"
-"\x72\x2e\x78\x20\x3c\x20\x2d\x31\x2e\x30\x29\x0a\x20\x20\x20\x20\x20\x20\x20"
-"\x20\x67\x6c\x5f\x46\x72\x6f\x6e\x74\x43\x6f\x6c\x6f\x72\x20\x3d\x20\x63\x6f"
-"\x6d\x70\x6c\x65\x6d\x65\x6e\x74\x3b\x0a\x20\x20\x20\x20\x65\x6c\x73\x65\x20"
-"\x69\x66\x20\x28\x67\x6c\x5f\x46\x72\x6f\x6e\x74\x43\x6f\x6c\x6f\x72\x2e\x78"
-"\x20\x3c\x20\x30\x2e\x30\x29\x0a\x20\x20\x20\x20\x20\x20\x20\x20\x67\x6c\x5f"
-"\x46\x72\x6f\x6e\x74\x43\x6f\x6c\x6f\x72\x20\x3d\x20\x72\x67\x62\x61\x3b\x0a"
-"\x0a\x20\x20\x20\x20\x67\x6c\x5f\x50\x6f\x73\x69\x74\x69\x6f\x6e\x20\x3d\x20"
-"\x67\x6c\x5f\x4d\x6f\x64\x65\x6c\x56\x69\x65\x77\x50\x72\x6f\x6a\x65\x63\x74"
-"\x69\x6f\x6e\x4d\x61\x74\x72\x69\x78\x20\x2a\x20\x67\x6c\x5f\x56\x65\x72\x74"
-"\x65\x78\x3b\x0a\x7d\x0a"
+"\x76\x6f\x69\x64\x20\x6d\x61\x69\x6e\x28\x76\x6f\x69\x64\x29\x0a\x7b\x0a\x20"
+"\x20\x20\x20\x67\x6c\x5f\x46\x72\x6f\x6e\x74\x43\x6f\x6c\x6f\x72\x20\x3d\x20"
+"\x76\x65\x63\x34\x28\x31\x2e\x30\x29\x3b\x0a\x20\x20\x20\x20\x67\x6c\x5f\x54"
+"\x65\x78\x43\x6f\x6f\x72\x64\x5b\x30\x5d\x20\x3d\x20\x67\x6c\x5f\x54\x65\x78"
+"\x74\x75\x72\x65\x4d\x61\x74\x72\x69\x78\x5b\x30\x5d\x20\x2a\x20\x67\x6c\x5f"
+"\x4d\x75\x6c\x74\x69\x54\x65\x78\x43\x6f\x6f\x72\x64\x30\x3b\x0a\x0a\x20\x20"
+"\x20\x20\x67\x6c\x5f\x50\x6f\x73\x69\x74\x69\x6f\x6e\x20\x3d\x20\x67\x6c\x5f"
+"\x4d\x6f\x64\x65\x6c\x56\x69\x65\x77\x50\x72\x6f\x6a\x65\x63\x74\x69\x6f\x6e"
+"\x4d\x61\x74\x72\x69\x78\x20\x2a\x20\x67\x6c\x5f\x56\x65\x72\x74\x65\x78\x3b"
+"\x0a\x7d\x0a"
@@ -4,14 +4,22 @@
  *                                                                                   *
  * Author: (c)2006-2010 Park "segfault" J. K. <mastermind_at_planetmono_dot_org>     */
 
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+#include <vector>
+
 #include <libldr/elements.h>
 #include <libldr/model.h>
+#include <libldr/traits.h>
 #include <libldr/utils.h>
+#include <libldr/visitor.h>
 
 #include "opengl.h"
 #include "normal_extension.h"
-#include "opengl_extension_shader.h"
 #include "opengl_extension_vbo.h"
+#include "palette.h"
 #include "parameters.h"
 
 #include "vbuffer_extension.h"
@@ -28,20 +36,22 @@ vbuffer_extension::vbuffer_extension(ldraw::model *m, void *arg)
 	m_isnull = true;
 
 	for (int i = 0; i < 4; ++i) {
+		m_vbo_indices[i] = 0;
 		m_vbo_vertices[i] = 0;
-		m_vbo_colors[i] = 0;
 
 		m_elemcnt[i] = 0;
+		m_vertcnt[i] = 0;
 
 		m_vertptr[i] = 0;
 		m_colorptr[i] = 0;
 
+		m_indices[i] = 0L;
+		m_packed[i] = 0L;
 		m_vertices[i] = 0L;
 		m_colors[i] = 0L;
 	}
 
 	for (int i = 0; i < 2; ++i) {
-		m_vbo_normals[i] = 0;
 		m_normptr[i] = 0;
 		m_normals[i] = 0L;
 	}
@@ -50,7 +60,7 @@ vbuffer_extension::vbuffer_extension(ldraw::model *m, void *arg)
 	m_condparams = 0L;
 	m_condparamptr = 0;
 
-	m_colorfixed = false;
+	m_serial = 0;
 }
 
 vbuffer_extension::~vbuffer_extension()
@@ -59,7 +69,8 @@ vbuffer_extension::~vbuffer_extension()
 	delete m_params;
 }
 
-int vbuffer_extension::s_memory_usage = 0;
+std::atomic<int> vbuffer_extension::s_memory_usage(0);
+std::atomic<unsigned int> vbuffer_extension::s_serial(0);
 
 int vbuffer_extension::get_total_memory_usage()
 {
@@ -74,54 +85,42 @@ void vbuffer_extension::reset_total_memory_usage()
 void vbuffer_extension::clear()
 {
 	if (!m_isnull) {
-		if (m_vertices[0] != 0L) {
-			for (int i = 0; i < 4; ++i) {
-				delete m_vertices[i];
-				delete m_colors[i];
-			}
-			
-			for (int i = 0; i < 2; ++i)
-				delete m_normals[i];
+		for (int i = 0; i < 4; ++i) {
+			delete[] m_indices[i];
+			delete[] m_packed[i];
 
-			delete m_condparams;
+			m_indices[i] = 0L;
+			m_packed[i] = 0L;
 		}
+
+		delete[] m_condparams;
+		m_condparams = 0L;
 		
 		opengl_extension_vbo *vboext = opengl_extension_vbo::self();
 		if (!m_params->force_vbuffer && vboext->is_supported()) {
+			vboext->glDeleteBuffers(4, m_vbo_indices);
 			vboext->glDeleteBuffers(4, m_vbo_vertices);
-			vboext->glDeleteBuffers(2, m_vbo_normals);
-			vboext->glDeleteBuffers(4, m_vbo_colors);
 			vboext->glDeleteBuffers(1, &m_vbo_condparams);
 		}
 
-		for (int i = 0; i < 4; ++i)
+		for (int i = 0; i < 4; ++i) {
 			m_elemcnt[i] = 0;
-
-		for (std::map<ldraw::color, float **>::iterator it = m_precolored_buf.begin(); it != m_precolored_buf.end(); ++it) {
-			for (int i = 0; i < 4; ++i)
-				delete (*it).second[i];
+			m_vertcnt[i] = 0;
 		}
 
-		for (std::map<ldraw::color, GLuint *>::iterator it = m_vbo_precolored.begin(); it != m_vbo_precolored.end(); ++it)
-			vboext->glDeleteBuffers(4, (*it).second);
-		
-		m_colorfixed = false;
-		
 		m_isnull = true;
 	}
+
+	palette::release(m_slots);
+	m_slots.clear();
 }
 
 void vbuffer_extension::update()
 {
 	clear();
-	
-	opengl_extension_shader *shader = opengl_extension_shader::self();
-	bool is_shader = shader->is_supported() && !m_params->force_fixed;
-
-	m_colorfixed = !is_color_ambiguous();
 
 	int nbytes[4];
-	int ncolorbytes[4];
+	int nindexbytes[4];
 
 	count_elements();
 
@@ -131,67 +130,62 @@ void vbuffer_extension::update()
 		return;
 
 	m_isnull = false;
+	m_serial = ++s_serial;
 
+	// Filled one vertex per corner first, then welded and packed
 	for (int i = 0; i < 4; ++i) {
-		nbytes[i] = 3 * m_elemcnt[i];
-		ncolorbytes[i] = 4 * m_elemcnt[i];
+		m_vertices[i] = new float[3 * m_elemcnt[i]];
+		m_colors[i] = new float[3 * m_elemcnt[i]];
+	}
 
-		m_vertices[i] = new float[nbytes[i]];
-		m_colors[i] = new float[ncolorbytes[i]];
+	m_normals[0] = new float[3 * m_elemcnt[1]];
+	m_normals[1] = new float[3 * m_elemcnt[2]];
 
-		s_memory_usage += nbytes[i] * sizeof(float);
-		s_memory_usage += ncolorbytes[i] * sizeof(float);
-	}
+	fill_elements();
+
+	for (int i = 0; i < 4; ++i) {
+		index_elements((buffer_type) i);
 
-	m_normals[0] = new float[nbytes[1]];
-	m_normals[1] = new float[nbytes[2]];
+		nbytes[i] = m_vertcnt[i] * sizeof(vertex);
+		nindexbytes[i] = m_elemcnt[i] * sizeof(unsigned int);
 
-	m_condparams = new float[nbytes[3]];
+		s_memory_usage += nbytes[i];
+		s_memory_usage += nindexbytes[i];
+	}
 
-	s_memory_usage += nbytes[1] * sizeof(float) + nbytes[2] * sizeof(float) + nbytes[3] * sizeof(float);
+	m_condparams = new float[3 * m_vertcnt[3]]();
 
-	fill_elements();
+	s_memory_usage += 3 * m_vertcnt[3] * sizeof(float);
 
 	opengl_extension_vbo *vbo = opengl_extension_vbo::self();
 	if (!m_params->force_vbuffer && vbo->is_supported()) {
 		m_isvbo = true;
 
 		// Create VBO and upload static data to VRAM if needed
+		vbo->glGenBuffers(4, m_vbo_indices);
 		vbo->glGenBuffers(4, m_vbo_vertices);
-		vbo->glGenBuffers(2, m_vbo_normals);
-		vbo->glGenBuffers(4, m_vbo_colors);
 		vbo->glGenBuffers(1, &m_vbo_condparams);
 
 		for (int i = 0; i < 4; ++i) {
-			vbo->glBindBuffer(GL_ARRAY_BUFFER_ARB, m_vbo_vertices[i]);
-			vbo->glBufferData(GL_ARRAY_BUFFER_ARB, nbytes[i] * sizeof(float), m_vertices[i], GL_STATIC_DRAW_ARB);
+			vbo->glBindBuffer(GL_ELEMENT_ARRAY_BUFFER_ARB, m_vbo_indices[i]);
+			vbo->glBufferData(GL_ELEMENT_ARRAY_BUFFER_ARB, nindexbytes[i], m_indices[i], GL_STATIC_DRAW_ARB);
 
-			if (is_shader || m_colorfixed) {
-				vbo->glBindBuffer(GL_ARRAY_BUFFER_ARB, m_vbo_colors[i]);
-				vbo->glBufferData(GL_ARRAY_BUFFER_ARB, ncolorbytes[i] * sizeof(float), m_colors[i], GL_STATIC_DRAW_ARB);
-			}
-			
-			delete m_vertices[i];
-			m_vertices[i] = 0L;
-
-			if (is_shader && m_colorfixed) {
-				delete m_colors[i];
-				m_colors[i] = 0L;
-			}
-		}
+			vbo->glBindBuffer(GL_ARRAY_BUFFER_ARB, m_vbo_vertices[i]);
+			vbo->glBufferData(GL_ARRAY_BUFFER_ARB, nbytes[i], m_packed[i], GL_STATIC_DRAW_ARB);
 
-		for (int i = 0; i < 2; ++i) {
-			vbo->glBindBuffer(GL_ARRAY_BUFFER_ARB, m_vbo_normals[i]);
-			vbo->glBufferData(GL_ARRAY_BUFFER_ARB, nbytes[i + 1] * sizeof(float), m_normals[i], GL_STATIC_DRAW_ARB);
-			
-			delete m_normals[i];
-			m_normals[i] = 0L;
+			delete[] m_indices[i];
+			delete[] m_packed[i];
+			m_indices[i] = 0L;
+			m_packed[i] = 0L;
 		}
 
 		vbo->glBindBuffer(GL_ARRAY_BUFFER_ARB, m_vbo_condparams);
-		vbo->glBufferData(GL_ARRAY_BUFFER_ARB, nbytes[3] * sizeof(float), m_condparams, GL_STATIC_DRAW_ARB);
+		vbo->glBufferData(GL_ARRAY_BUFFER_ARB, 3 * m_vertcnt[3] * sizeof(float), m_condparams, GL_STATIC_DRAW_ARB);
+
+		vbo->glBindBuffer(GL_ARRAY_BUFFER_ARB, 0);
+		vbo->glBindBuffer(GL_ELEMENT_ARRAY_BUFFER_ARB, 0);
 
-		delete m_condparams;
+		delete[] m_condparams;
 		m_condparams = 0L;
 	} else {
 		m_isvbo = false;
@@ -215,6 +209,11 @@ bool vbuffer_extension::is_null() const
 	return m_isnull;
 }
 
+unsigned int vbuffer_extension::serial() const
+{
+	return m_serial;
+}
+
 bool vbuffer_extension::is_update_required(bool collapse) const
 {
 	if (m_params->collapse_subfiles != collapse || m_stud != m_params->params->get_stud_rendering_mode())
@@ -228,33 +227,25 @@ int vbuffer_extension::count(buffer_type type) const
 	return m_elemcnt[type];
 }
 
-GLuint vbuffer_extension::get_vbo_vertices(buffer_type type) const
+int vbuffer_extension::vertex_count(buffer_type type) const
 {
-	if (!m_isvbo || m_isnull)
-		return 0;
-
-	return m_vbo_vertices[type];
+	return m_vertcnt[type];
 }
 
-GLuint vbuffer_extension::get_vbo_normals(buffer_type type) const
+GLuint vbuffer_extension::get_vbo_indices(buffer_type type) const
 {
 	if (!m_isvbo || m_isnull)
 		return 0;
 
-	if (type == type_triangles)
-		return m_vbo_normals[0];
-	else if (type == type_quads)
-		return m_vbo_normals[1];
-
-	return 0;
+	return m_vbo_indices[type];
 }
 
-GLuint vbuffer_extension::get_vbo_colors(buffer_type type) const
+GLuint vbuffer_extension::get_vbo_vertices(buffer_type type) const
 {
 	if (!m_isvbo || m_isnull)
 		return 0;
 
-	return m_vbo_colors[type];
+	return m_vbo_vertices[type];
 }
 
 GLuint vbuffer_extension::get_vbo_condline_directions() const
@@ -265,47 +256,20 @@ GLuint vbuffer_extension::get_vbo_condline_directions() const
 	return m_vbo_condparams;
 }
 
-GLuint vbuffer_extension::get_vbo_precolored(buffer_type type, const ldraw::color &c)
-{
-	if (!m_isvbo || m_isnull)
-		return 0;
-
-	if (m_colorfixed)
-		return get_vbo_colors(type);
-
-	if (m_vbo_precolored.find(c) == m_vbo_precolored.end())
-		fork_color(c);
-
-	return m_vbo_precolored[c][type];
-}
-
-const float* vbuffer_extension::get_vertex_array(buffer_type type) const
+const unsigned int* vbuffer_extension::get_index_array(buffer_type type) const
 {
 	if (m_isvbo || m_isnull)
 		return 0L;
 
-	return m_vertices[type];
+	return m_indices[type];
 }
 
-const float* vbuffer_extension::get_normal_array(buffer_type type) const
+const vbuffer_extension::vertex* vbuffer_extension::get_vertex_array(buffer_type type) const
 {
 	if (m_isvbo || m_isnull)
 		return 0L;
 
-	if (type == type_triangles)
-		return m_normals[0];
-	else if (type == type_quads)
-		return m_normals[1];
-
-	return 0L;
-}
-
-const float* vbuffer_extension::get_color_array(buffer_type type) const
-{
-	if (m_isvbo || m_isnull)
-		return 0L;
-
-	return m_colors[type];
+	return m_packed[type];
 }
 
 const float* vbuffer_extension::get_condline_direction_array() const
@@ -316,145 +280,54 @@ const float* vbuffer_extension::get_condline_direction_array() const
 	return m_condparams;
 }
 
-const float* vbuffer_extension::get_precolored_array(buffer_type type, const ldraw::color &c)
-{
-	if (m_isvbo || m_isnull)
-		return 0L;
-	
-	if (m_colorfixed)
-		return get_color_array(type);
-
-	if (m_precolored_buf.find(c) == m_precolored_buf.end())
-		fork_color(c);
-
-	return m_precolored_buf[c][type];
-}
-
-bool vbuffer_extension::is_color_ambiguous() const
-{
-	return is_color_ambiguous_recursive(m_model);
-}
-
-bool vbuffer_extension::is_color_ambiguous_recursive(const ldraw::model *m) const
+void vbuffer_extension::set_arrays(buffer_type type) const
 {
-	bool found;
-	
-	for (ldraw::model::const_iterator it = m->elements().begin(); it != m->elements().end(); ++it) {
-		ldraw::type t = (*it)->get_type();
-		ldraw::color c;
+	opengl_extension_vbo *vbo = opengl_extension_vbo::self();
 
-		found = false;
+	if (m_isnull)
+		return;
 
-		switch (t) {
-			case ldraw::type_line:
-				c = CAST_AS_CONST_LINE(*it)->get_color();
-				found = true;
-				break;
-			case ldraw::type_triangle:
-				c = CAST_AS_CONST_TRIANGLE(*it)->get_color();
-				found = true;
-				break;
-			case ldraw::type_quadrilateral:
-				c = CAST_AS_CONST_QUADRILATERAL(*it)->get_color();
-				found = true;
-				break;
-			case ldraw::type_condline:
-				c = CAST_AS_CONST_CONDLINE(*it)->get_color();
-				found = true;
-				break;
-			case ldraw::type_ref:
-				if (m_params->collapse_subfiles) {
-					const ldraw::model *mm = CAST_AS_CONST_REF(*it)->get_model();
-
-					if (mm) {
-						if (is_color_ambiguous_recursive(mm))
-							return true;
-					}
-				}
-				break;
-			default:
-				break;
-		}
+	const char *base = 0L;
+	if (m_isvbo)
+		vbo->glBindBuffer(GL_ARRAY_BUFFER_ARB, m_vbo_vertices[type]);
+	else
+		base = reinterpret_cast<const char *>(m_packed[type]);
 
-		if (found) {
-			if (c.get_id() == 16 || c.get_id() == 24)
-				return true;
-		}
-	}
+	glVertexPointer(3, GL_FLOAT, sizeof(vertex), base + offsetof(vertex, position));
+	if (type == type_triangles || type == type_quads)
+		glNormalPointer(GL_SHORT, sizeof(vertex), base + offsetof(vertex, normal));
+	glTexCoordPointer(3, GL_SHORT, sizeof(vertex), base + offsetof(vertex, color));
 
-	return false;
+	if (m_isvbo)
+		vbo->glBindBuffer(GL_ELEMENT_ARRAY_BUFFER_ARB, m_vbo_indices[type]);
 }
 
-void vbuffer_extension::fork_color(const ldraw::color &c)
+class vbuffer_extension::counter : public ldraw::element_visitor<vbuffer_extension::counter>
 {
-	const ldraw::color_entity *ce = c.get_entity();
-	opengl_extension_vbo *vbo = opengl_extension_vbo::self();
+  public:
+	counter(vbuffer_extension *ext) : m_ext(ext) {}
 
-	float **colors = new float *[4];
+	void visit_line(const ldraw::element_line *) { m_ext->m_elemcnt[0] += 2; }
+	void visit_triangle(const ldraw::element_triangle *) { m_ext->m_elemcnt[1] += 3; }
+	void visit_quadrilateral(const ldraw::element_quadrilateral *) { m_ext->m_elemcnt[2] += 4; }
+	void visit_condline(const ldraw::element_condline *) { m_ext->m_elemcnt[3] += 2; }
 
-	for (int i = 0; i < 4; ++i) {
-		float *ctemp = m_colors[i];
-
-		if (ctemp && m_elemcnt[i] > 0) {
-			colors[i] = new float[4 * m_elemcnt[i]];
-			float *cval = colors[i];
-
-			s_memory_usage += 4 * m_elemcnt[i] * sizeof(float);
-
-			for (int j = 0; j < m_elemcnt[i]; ++j) {
-				if (*ctemp < -1.0f) {
-					*(cval++) = ce->complement[0] / 255.0f;
-					*(cval++) = ce->complement[1] / 255.0f;
-					*(cval++) = ce->complement[2] / 255.0f;
-					*(cval++) = ce->complement[3] / 255.0f;
-					ctemp += 4;
-				} else if (*ctemp < 0.0f) {
-					*(cval++) = ce->rgba[0] / 255.0f;
-					*(cval++) = ce->rgba[1] / 255.0f;
-					*(cval++) = ce->rgba[2] / 255.0f;
-					*(cval++) = ce->rgba[3] / 255.0f;
-					ctemp += 4;
-				} else {
-					*(cval++) = *(ctemp++);
-					*(cval++) = *(ctemp++);
-					*(cval++) = *(ctemp++);
-					*(cval++) = *(ctemp++);
-				}
-			}
-		} else {
-			colors[i] = 0L;
-		}
-	}
-	if (m_isvbo) {
-		GLuint *vbobuf = new GLuint[4];
-		vbo->glGenBuffers(4, vbobuf);
-		
-		for (int i = 0; i < 4; ++i) {
-			if (colors[i]) {
-				vbo->glBindBuffer(GL_ARRAY_BUFFER_ARB, vbobuf[i]);
-				vbo->glBufferData(GL_ARRAY_BUFFER_ARB, 4 * m_elemcnt[i] * sizeof(float), colors[i], GL_STATIC_DRAW_ARB);
-				delete colors[i];
-			}
-		}
-		delete colors;
+	void visit_ref(const ldraw::element_ref *l)
+	{
+		const ldraw::model *m = l->get_model();
 
-		if (m_vbo_precolored.find(c) != m_vbo_precolored.end()) {
-			GLuint *b = m_vbo_precolored[c];
-			vbo->glDeleteBuffers(4, b);
-			delete b;
-		}
-		m_vbo_precolored[c] = vbobuf;
-	} else {
-		if (m_precolored_buf.find(c) != m_precolored_buf.end()) {
-			float **b = m_precolored_buf[c];
+		if (!m || !m_ext->m_params->collapse_subfiles)
+			return;
 
-			for (int i = 0; i < 4; ++i)
-				delete b[i];
-			delete b;
-		}
-		m_precolored_buf[c] = colors;
+		if (ldraw::utils::is_stud(m))
+			m_ext->count_elements_stud(m);
+		else
+			m_ext->count_elements_recursive(m);
 	}
-}
+
+  private:
+	vbuffer_extension *m_ext;
+};
 
 void vbuffer_extension::count_elements_stud(const ldraw::model *m)
 {
@@ -468,29 +341,29 @@ void vbuffer_extension::count_elements_stud(const ldraw::model *m)
 
 void vbuffer_extension::count_elements_recursive(const ldraw::model *m)
 {
-	for (ldraw::model::const_iterator it = m->elements().begin(); it != m->elements().end(); ++it) {
-		ldraw::type t = (*it)->get_type();
-		
-		if (t == ldraw::type_line) {
-			m_elemcnt[0] += 2;
-		} else if (t == ldraw::type_triangle) {
-			m_elemcnt[1] += 3;
-		} else if (t == ldraw::type_quadrilateral) {
-			m_elemcnt[2] += 4;
-		} else if (t == ldraw::type_condline) {
-			m_elemcnt[3] += 2;
-		} else if (t == ldraw::type_ref && m_params->collapse_subfiles) {
-			const ldraw::model *mm = CAST_AS_CONST_REF(*it)->get_model();
-
-			if (!mm)
-				continue;
+	const ldraw::traits *tr = m->custom_data<ldraw::traits>();
+
+	if (tr && m_params->collapse_subfiles) {
+		m_elemcnt[0] += 2 * tr->total(ldraw::traits::lines);
+		m_elemcnt[1] += 3 * tr->total(ldraw::traits::triangles);
+		m_elemcnt[2] += 4 * tr->total(ldraw::traits::quads);
+		m_elemcnt[3] += 2 * tr->total(ldraw::traits::condlines);
 
-			if (ldraw::utils::is_stud(mm))
-				count_elements_stud(mm);
-			else
-				count_elements_recursive(mm);
+		if (m_params->params->get_stud_rendering_mode() == parameters::stud_square) {
+			m_elemcnt[0] += 8 * tr->studs();
+		} else if (m_params->params->get_stud_rendering_mode() == parameters::stud_line) {
+			m_elemcnt[0] += 2 * tr->studs();
+		} else {
+			m_elemcnt[0] += 2 * tr->stud_total(ldraw::traits::lines);
+			m_elemcnt[1] += 3 * tr->stud_total(ldraw::traits::triangles);
+			m_elemcnt[2] += 4 * tr->stud_total(ldraw::traits::quads);
+			m_elemcnt[3] += 2 * tr->stud_total(ldraw::traits::condlines);
 		}
+
+		return;
 	}
+
+	counter(this).visit_elements(m);
 }
 
 void vbuffer_extension::count_elements()
@@ -511,144 +384,155 @@ void vbuffer_extension::fill_element_atomic(const ldraw::vector &v, float *data,
 		data[(*iterator)++] = v.w();
 }
 
-void vbuffer_extension::fill_element_atomic(const unsigned char *color, float *data, int *iterator)
+// Palette slot of c, held as long as the buffers are
+int vbuffer_extension::hold(const ldraw::color &c)
 {
-	data[(*iterator)++] = color[0] / 255.0f;
-	data[(*iterator)++] = color[1] / 255.0f;
-	data[(*iterator)++] = color[2] / 255.0f;
-	data[(*iterator)++] = color[3] / 255.0f;
-}
+	int s = palette::acquire(c);
 
-void vbuffer_extension::fill_element_atomic(const float *cflag, float *data, int *iterator)
-{
-	data[(*iterator)++] = cflag[0];
-	data[(*iterator)++] = cflag[1];
+	if (s >= ldraw::color::color_chart_count)
+		m_slots.push_back(s);
+
+	return s;
 }
 
+// Colors are written as palette entries, three floats each: the slot, 1 if
+// the slot of the reference is to be added to it and the row
 void vbuffer_extension::fill_color(const std::stack<ldraw::color> &colorstack, const ldraw::color &color, int count, buffer_type type)
 {
-	const float null[] = { -1.0f, -1.0f, -1.0f, -1.0f };
-	const float null_complement[] = { -2.0f, -2.0f, -2.0f, -2.0f };
+	float entry[3] = { 0.0f, 0.0f, (float) palette::row_color };
+	const ldraw::color &top = colorstack.top();
 
-	int flag = 0;
-	const unsigned char *ce;
-	
 	if (color.get_id() == 16) {
-		if (colorstack.top().get_id() == 16) {
-			ce = 0L;
-			flag = 1;
-		} else {
-			ce = colorstack.top().get_entity()->rgba;
-		}
+		if (top.get_id() == 16)
+			entry[1] = 1.0f;
+		else
+			entry[0] = (float) hold(top);
 	} else if (color.get_id() == 24) {
-		if (colorstack.top().get_id() == 16 || colorstack.top().get_id() == 24) {
-			ce = 0L;
-			flag = -1;
-		} else {
-			ce = colorstack.top().get_entity()->complement;
-		}
+		entry[2] = (float) palette::row_edge;
+
+		if (top.get_id() == 16 || top.get_id() == 24)
+			entry[1] = 1.0f;
+		else
+			entry[0] = (float) hold(top);
 	} else {
-		ce = color.get_entity()->rgba;
+		entry[0] = (float) hold(color);
 	}
 
-	for (int i = 0; i < count; ++i) {
-		if (ce) {
-			fill_element_atomic(ce, m_colors[type], &m_colorptr[type]);
-		} else {
-			const float *cf;
-
-			if (flag == 1)
-				cf = null;
-			else
-				cf = null_complement;
-			
-			fill_element_atomic(ldraw::vector(cf[0], cf[1], cf[2], cf[3]), m_colors[type], &m_colorptr[type], true);
-		}
-	}
+	float *out = m_colors[type] + m_colorptr[type];
+
+	for (int i = 0; i < count; ++i, out += 3)
+		std::copy(entry, entry + 3, out);
+	m_colorptr[type] += 3 * count;
 }
 
+/* index is that of the element dispatched in its model, for its normal */
+class vbuffer_extension::filler : public ldraw::element_visitor<vbuffer_extension::filler>
+{
+  public:
+	filler(vbuffer_extension *ext, std::stack<ldraw::color> &colorstack, const float *norms, const ldraw::matrix &transform)
+		: index(0), m_ext(ext), m_colorstack(colorstack), m_norms(norms), m_transform(transform), m_transform_wo_position(transform)
+	{
+		m_transform_wo_position.set_translation_vector(ldraw::vector());
+	}
+
+	void visit_line(const ldraw::element_line *l)
+	{
+		position(l->pos1(), 0);
+		position(l->pos2(), 0);
+
+		m_ext->fill_color(m_colorstack, l->get_color(), 2, type_lines);
+	}
+
+	void visit_triangle(const ldraw::element_triangle *l)
+	{
+		position(l->pos1(), 1);
+		position(l->pos2(), 1);
+		position(l->pos3(), 1);
+
+		normal(0, 3);
+
+		m_ext->fill_color(m_colorstack, l->get_color(), 3, type_triangles);
+	}
+
+	void visit_quadrilateral(const ldraw::element_quadrilateral *l)
+	{
+		position(l->pos1(), 2);
+		position(l->pos2(), 2);
+		position(l->pos3(), 2);
+		position(l->pos4(), 2);
+
+		normal(1, 4);
+
+		m_ext->fill_color(m_colorstack, l->get_color(), 4, type_quads);
+	}
+
+	void visit_condline(const ldraw::element_condline *l)
+	{
+		position(l->pos1(), 3);
+		position(l->pos2(), 3);
+
+		m_ext->fill_color(m_colorstack, l->get_color(), 2, type_condlines);
+	}
+
+	void visit_ref(const ldraw::element_ref *l)
+	{
+		if (m_ext->m_params->collapse_subfiles)
+			m_ext->fill_elements_ref(m_colorstack, l, m_transform);
+	}
+
+	int index;
+
+  private:
+	void position(const ldraw::vector &v, int buffer)
+	{
+		m_ext->fill_element_atomic(m_transform * v, m_ext->m_vertices[buffer], &m_ext->m_vertptr[buffer]);
+	}
+
+	/* The normal of the element, once per vertex */
+	void normal(int buffer, int count)
+	{
+		ldraw::vector n = m_transform_wo_position * ldraw::vector(m_norms[index * 3], m_norms[index * 3 + 1], m_norms[index * 3 + 2]);
+
+		for (int i = 0; i < count; ++i)
+			m_ext->fill_element_atomic(n, m_ext->m_normals[buffer], &m_ext->m_normptr[buffer]);
+	}
+
+	vbuffer_extension *m_ext;
+	std::stack<ldraw::color> &m_colorstack;
+	const float *m_norms;
+	const ldraw::matrix &m_transform;
+	ldraw::matrix m_transform_wo_position;
+};
+
 void vbuffer_extension::fill_elements_recursive(std::stack<ldraw::color> &colorstack, ldraw::model *m, const ldraw::matrix &transform)
 {
-	if (!m->custom_data<normal_extension>())
-		m->update_custom_data<normal_extension>();
+	const float *norms = m->shared_custom_data<normal_extension>()->normals();
+	filler f(this, colorstack, norms, transform);
 
-	ldraw::matrix transform_wo_position = transform;
-	transform_wo_position.set_translation_vector(ldraw::vector());
+	for (ldraw::model::const_iterator it = m->elements().begin(); it != m->elements().end(); ++it, ++f.index)
+		f.dispatch(*it);
+}
 
-	const std::map<int, ldraw::vector> &norms = m->custom_data<normal_extension>()->normals();
+void vbuffer_extension::fill_elements_ref(std::stack<ldraw::color> &colorstack, const ldraw::element_ref *l, const ldraw::matrix &transform)
+{
+	ldraw::model *m = l->get_model();
+
+	if (!m)
+		return;
+
+	const ldraw::color &c = l->get_color();
 	
-	int i = 0;
+	if (c.get_id() == 16 || c.get_id() == 24)
+		colorstack.push(colorstack.top());
+	else
+		colorstack.push(c);
 	
-	for (ldraw::model::const_iterator it = m->elements().begin(); it != m->elements().end(); ++it) {
-		ldraw::type t = (*it)->get_type();
-		
-		if (t == ldraw::type_line) {
-			const ldraw::element_line *l = CAST_AS_CONST_LINE(*it);
-
-			fill_element_atomic(transform * l->pos1(), m_vertices[0], &m_vertptr[0]);
-			fill_element_atomic(transform * l->pos2(), m_vertices[0], &m_vertptr[0]);
-
-			fill_color(colorstack, l->get_color(), 2, type_lines);
-		} else if (t == ldraw::type_triangle) {
-			const ldraw::element_triangle *l = CAST_AS_CONST_TRIANGLE(*it);
-
-			fill_element_atomic(transform * l->pos1(), m_vertices[1], &m_vertptr[1]);
-			fill_element_atomic(transform * l->pos2(), m_vertices[1], &m_vertptr[1]);
-			fill_element_atomic(transform * l->pos3(), m_vertices[1], &m_vertptr[1]);
-
-			ldraw::vector n = transform_wo_position * (*norms.find(i)).second;
-			
-			fill_element_atomic(n, m_normals[0], &m_normptr[0]);
-			fill_element_atomic(n, m_normals[0], &m_normptr[0]);
-			fill_element_atomic(n, m_normals[0], &m_normptr[0]);
-
-			fill_color(colorstack, l->get_color(), 3, type_triangles);
-		} else if (t == ldraw::type_quadrilateral) {
-			const ldraw::element_quadrilateral *l = CAST_AS_CONST_QUADRILATERAL(*it);
-
-			fill_element_atomic(transform * l->pos1(), m_vertices[2], &m_vertptr[2]);
-			fill_element_atomic(transform * l->pos2(), m_vertices[2], &m_vertptr[2]);
-			fill_element_atomic(transform * l->pos3(), m_vertices[2], &m_vertptr[2]);
-			fill_element_atomic(transform * l->pos4(), m_vertices[2], &m_vertptr[2]);
-			
-			ldraw::vector n = transform_wo_position * (*norms.find(i)).second;
-			
-			fill_element_atomic(n, m_normals[1], &m_normptr[1]);
-			fill_element_atomic(n, m_normals[1], &m_normptr[1]);
-			fill_element_atomic(n, m_normals[1], &m_normptr[1]);
-			fill_element_atomic(n, m_normals[1], &m_normptr[1]);
-
-			fill_color(colorstack, l->get_color(), 4, type_quads);
-		} else if (t == ldraw::type_condline) {
-			const ldraw::element_condline *l = CAST_AS_CONST_CONDLINE(*it);
-
-			fill_element_atomic(transform * l->pos1(), m_vertices[3], &m_vertptr[3]);
-			fill_element_atomic(transform * l->pos2(), m_vertices[3], &m_vertptr[3]);
-
-			fill_color(colorstack, l->get_color(), 2, type_condlines);			
-		} else if (t == ldraw::type_ref && m_params->collapse_subfiles) {
-			ldraw::element_ref *l = CAST_AS_REF(*it);
-			ldraw::model *m = l->get_model();
-
-			if (m) {
-				const ldraw::color &c = l->get_color();
-				
-				if (c.get_id() == 16 || c.get_id() == 24)
-					colorstack.push(colorstack.top());
-				else
-					colorstack.push(c);
-				
-				if (ldraw::utils::is_stud(m))
-					fill_elements_stud(colorstack, m, transform * l->get_matrix());
-				else
-					fill_elements_recursive(colorstack, m, transform * l->get_matrix());
-				
-				colorstack.pop();
-			}
-		}
-
-		++i;
-	}
+	if (ldraw::utils::is_stud(m))
+		fill_elements_stud(colorstack, m, transform * l->get_matrix());
+	else
+		fill_elements_recursive(colorstack, m, transform * l->get_matrix());
+	
+	colorstack.pop();
 }
 
 void vbuffer_extension::fill_elements_stud(std::stack<ldraw::color> &colorstack, ldraw::model *m, const ldraw::matrix &transform)
@@ -708,7 +592,281 @@ void vbuffer_extension::fill_elements()
 	fill_elements_recursive(colorstack, m_model, transform);
 }
 
+/* Corners are merged when their positions and normals fall into the same
+ * cell of a grid this fine and their colors match exactly. Two corners
+ * closer than a cell may still straddle a cell boundary; they then stay
+ * apart, which only costs a vertex. */
+static const float weld_grid = 0.001f;
+
+/* Beyond this many cells from the origin the cell does not fit an int */
+static const float weld_grid_range = 2.0e9f;
+
+/* The grid cell of f; false, with f's bits as the key, where there is no
+ * cell for it, so that such corners are only merged when equal */
+static inline bool snap_to_grid(float f, int *key)
+{
+	f *= 1.0f / weld_grid;
+
+	if (!(std::fabs(f) < weld_grid_range)) {
+		f *= weld_grid;
+		std::memcpy(key, &f, sizeof(int));
+		return false;
+	}
+
+	*key = (int) (f < 0.0f ? f - 0.5f : f + 0.5f);
+
+	return true;
+}
+
+/* Position and normal on the welding grid, the palette entry, and a mask of
+ * the components that were off the grid */
+static inline void weld_key(const float *vert, const float *norm, const float *color, int *key)
+{
+	key[9] = 0;
+
+	for (int j = 0; j < 3; ++j) {
+		if (!snap_to_grid(vert[j], &key[j]))
+			key[9] |= 1 << j;
+		key[3 + j] = 0;
+		if (norm && !snap_to_grid(norm[j], &key[3 + j]))
+			key[9] |= 8 << j;
+	}
+	std::memcpy(&key[6], color, sizeof(float) * 3);
+}
+
+static inline std::size_t weld_hash(const int *key)
+{
+	std::size_t h = 2166136261U;
+
+	for (int i = 0; i < 10; ++i)
+		h = (h ^ (unsigned int) key[i]) * 16777619U;
+
+	return h;
+}
+
+/* Normals are unit length; GL_NORMALIZE takes care of the rounding */
+static inline GLshort pack_normal(float f)
+{
+	f = std::min(1.0f, std::max(-1.0f, f)) * 32767.0f;
+
+	return (GLshort) (f < 0.0f ? f - 0.5f : f + 0.5f);
+}
+
+static inline void pack_vertex(const float *vert, const float *norm, const float *color, vbuffer_extension::vertex *out)
+{
+	std::copy(vert, vert + 3, out->position);
+
+	if (norm) {
+		ldraw::vector n = ldraw::vector(norm[0], norm[1], norm[2]).normalize();
+
+		out->normal[0] = pack_normal(n.x());
+		out->normal[1] = pack_normal(n.y());
+		out->normal[2] = pack_normal(n.z());
+	} else {
+		out->normal[0] = out->normal[1] = out->normal[2] = 0;
+	}
+
+	for (int j = 0; j < 3; ++j)
+		out->color[j] = (GLshort) color[j];
+}
+
+// Welds the corners written by fill_elements() into distinct vertices, with
+// an index per corner. Primitives are then reordered for the post-transform
+// vertex cache, and the vertices packed in the order they are first used;
+// the float arrays of the type are released.
+void vbuffer_extension::index_elements(buffer_type type)
+{
+	static const int primsizes[] = { 2, 3, 3, 2 };
+
+	const int n = m_elemcnt[type];
+	const int normal = type == type_triangles ? 0 : (type == type_quads ? 1 : -1);
+	float *verts = m_vertices[type];
+	float *colors = m_colors[type];
+	float *norms = normal >= 0 ? m_normals[normal] : 0L;
+
+	unsigned int *indices = new unsigned int[n];
+	int unique = 0;
+
+	// Open addressing over the vertices welded so far, at most half full
+	std::size_t mask = 1;
+	while (mask < (std::size_t) n * 2)
+		mask <<= 1;
+	std::vector<int> table(mask, -1);
+	std::vector<int> keys;
+	--mask;
+
+	for (int i = 0; i < n; ++i) {
+		int key[10];
+		std::size_t slot;
+
+		weld_key(verts + i * 3, norms ? norms + i * 3 : 0L, colors + i * 3, key);
+
+		for (slot = weld_hash(key) & mask; table[slot] >= 0; slot = (slot + 1) & mask) {
+			if (!std::memcmp(key, &keys[table[slot] * 10], sizeof(key)))
+				break;
+		}
+
+		// First of its kind; moved down in place, as unique <= i
+		if (table[slot] < 0) {
+			keys.insert(keys.end(), key, key + 10);
+			std::copy(verts + i * 3, verts + i * 3 + 3, verts + unique * 3);
+			std::copy(colors + i * 3, colors + i * 3 + 3, colors + unique * 3);
+			if (norms)
+				std::copy(norms + i * 3, norms + i * 3 + 3, norms + unique * 3);
+			table[slot] = unique++;
+		}
+
+		indices[i] = table[slot];
+	}
+
+	int count = n;
+
+	// Quads are drawn as pairs of triangles, split as for GL_QUADS
+	if (type == type_quads) {
+		unsigned int *tris = new unsigned int[n / 4 * 6];
+
+		for (int i = 0; i < n / 4; ++i) {
+			const unsigned int *q = indices + i * 4;
+			unsigned int *t = tris + i * 6;
+
+			t[0] = q[0]; t[1] = q[1]; t[2] = q[2];
+			t[3] = q[2]; t[4] = q[3]; t[5] = q[0];
+		}
+
+		delete[] indices;
+		indices = tris;
+		count = n / 4 * 6;
+	}
+
+	optimize_vertex_cache(indices, count, primsizes[type], unique);
+
+	std::vector<int> order(unique, -1);
+	int next = 0;
+
+	for (int i = 0; i < count; ++i) {
+		if (order[indices[i]] < 0)
+			order[indices[i]] = next++;
+		indices[i] = order[indices[i]];
+	}
+
+	vertex *packed = new vertex[unique];
+
+	for (int i = 0; i < unique; ++i)
+		pack_vertex(verts + i * 3, norms ? norms + i * 3 : 0L, colors + i * 3, &packed[order[i]]);
+
+	delete[] verts;
+	delete[] colors;
+	delete[] norms;
+
+	m_indices[type] = indices;
+	m_packed[type] = packed;
+	m_vertices[type] = 0L;
+	m_colors[type] = 0L;
+	if (norms)
+		m_normals[normal] = 0L;
+
+	m_elemcnt[type] = count;
+	m_vertcnt[type] = unique;
+}
+
+// Tipsify (Sander, Nehab and Barczak, "Fast Triangle Reordering for Vertex
+// Locality and Reduced Overdraw"), for primitives of primsize vertices: the
+// primitives around one vertex are drawn as a fan, and the next vertex to fan
+// around is picked among those just drawn, preferring one still in a modelled
+// FIFO cache once its remaining primitives are drawn. Runs in linear time.
+void vbuffer_extension::optimize_vertex_cache(unsigned int *indices, int count, int primsize, int vertices)
+{
+	const int cache_size = 16;
+	const int prims = count / primsize;
+
+	if (prims < 3)
+		return;
+
+	// Primitives using each vertex, and how many of those are left
+	std::vector<int> live(vertices, 0);
+	std::vector<int> offset(vertices + 1, 0);
+	std::vector<int> adjacency(count);
+
+	for (int i = 0; i < count; ++i)
+		++live[indices[i]];
+	for (int i = 0; i < vertices; ++i)
+		offset[i + 1] = offset[i] + live[i];
+
+	std::vector<int> fill(offset.begin(), offset.end() - 1);
+	for (int i = 0; i < count; ++i)
+		adjacency[fill[indices[i]]++] = i / primsize;
+
+	std::vector<int> stamp(vertices, 0);
+	std::vector<bool> drawn(prims, false);
+	std::vector<int> deadend;
+	std::vector<int> candidates;
+	std::vector<unsigned int> out;
+	out.reserve(count);
+
+	int fan = 0, time = cache_size + 1, cursor = 1;
+
+	while (fan >= 0) {
+		candidates.clear();
+
+		for (int k = offset[fan]; k < offset[fan + 1]; ++k) {
+			int q = adjacency[k];
+
+			if (drawn[q])
+				continue;
+			drawn[q] = true;
+
+			for (int j = 0; j < primsize; ++j) {
+				unsigned int v = indices[q * primsize + j];
+
+				out.push_back(v);
+				deadend.push_back(v);
+				candidates.push_back(v);
+				--live[v];
+
+				if (time - stamp[v] > cache_size)
+					stamp[v] = time++;
+			}
+		}
 
+		// The candidate that stays in the cache longest, if any does
+		int best = -1, priority = -1;
+
+		for (std::vector<int>::const_iterator it = candidates.begin(); it != candidates.end(); ++it) {
+			if (live[*it] > 0) {
+				int p = 0;
+
+				if (time - stamp[*it] + (primsize - 1) * live[*it] <= cache_size)
+					p = time - stamp[*it];
+				if (p > priority) {
+					best = *it;
+					priority = p;
+				}
+			}
+		}
+
+		// Otherwise a recently used vertex with primitives left, or the next one
+		if (best < 0) {
+			while (!deadend.empty()) {
+				int v = deadend.back();
+
+				deadend.pop_back();
+				if (live[v] > 0) {
+					best = v;
+					break;
+				}
+			}
+		}
+		while (best < 0 && cursor < vertices) {
+			if (live[cursor] > 0)
+				best = cursor;
+			++cursor;
+		}
+
+		fan = best;
+	}
+
+	std::copy(out.begin(), out.end(), indices);
+}
 }
 
 
@@ -7,8 +7,9 @@
 #ifndef _RENDERER_VBUFFER_EXTENSION_H_
 #define _RENDERER_VBUFFER_EXTENSION_H_
 
-#include <map>
+#include <atomic>
 #include <stack>
+#include <vector>
 
 #include <libldr/color.h>
 #include <libldr/extension.h>
@@ -18,6 +19,7 @@
 
 namespace ldraw
 {
+	class element_ref;
 	class model;
 }
 
@@ -31,7 +33,18 @@ class LIBLDRAWRENDERER_EXPORT vbuffer_extension : public ldraw::extension
 	{
 		type_lines, type_triangles, type_quads, type_condlines
 	};
-	
+
+	/* Interleaved vertex. The color is looked up in the palette texture
+	 * by color[]: a slot, whether the slot of the color of the reference
+	 * drawing the buffer is added to it, and a palette::row. Lines and
+	 * condlines have no normals. */
+	struct vertex
+	{
+		GLfloat position[3];
+		GLshort normal[3];
+		GLshort color[3];
+	};
+
 	struct vbuffer_params
 	{
 		bool force_fixed;
@@ -56,69 +69,82 @@ class LIBLDRAWRENDERER_EXPORT vbuffer_extension : public ldraw::extension
 	bool is_null() const;
 	bool is_update_required(bool collapse) const;
 
+	/* Changes whenever the buffers are built again */
+	unsigned int serial() const;
+
+	/* Number of indices; quads are drawn as two triangles each */
 	int count(buffer_type type) const;
+	/* Distinct vertices stored after welding */
+	int vertex_count(buffer_type type) const;
 
+	GLuint get_vbo_indices(buffer_type type) const;
 	GLuint get_vbo_vertices(buffer_type type) const;
-	GLuint get_vbo_normals(buffer_type type) const;
-	GLuint get_vbo_colors(buffer_type type) const;
 	GLuint get_vbo_condline_directions() const;
-	GLuint get_vbo_precolored(buffer_type type, const ldraw::color &c);
 
-	const float* get_vertex_array(buffer_type type) const;
-	const float* get_normal_array(buffer_type type) const;
-	const float* get_color_array(buffer_type type) const;
+	const unsigned int* get_index_array(buffer_type type) const;
+	const vertex* get_vertex_array(buffer_type type) const;
 	const float* get_condline_direction_array() const;
-	const float* get_precolored_array(buffer_type type, const ldraw::color &c);
+
+	/* Points the vertex, normal and texture coordinate arrays and the
+	 * element array at the buffers of type */
+	void set_arrays(buffer_type type) const;
 
   private:
-	bool is_color_ambiguous() const;
-	bool is_color_ambiguous_recursive(const ldraw::model *m) const;
-	void fork_color(const ldraw::color &c);
-	
+	/* Element visitors (libldr/visitor.h) counting the vertices of a
+	 * model and writing them into the buffers */
+	class counter;
+	class filler;
+
 	void count_elements_stud(const ldraw::model *m);
 	void count_elements_recursive(const ldraw::model *m);
 	void count_elements();
 
 	void fill_element_atomic(const ldraw::vector &v, float *data, int *iterator, bool quadruple = false);
-	void fill_element_atomic(const unsigned char *color, float *data, int *iterator);
-	void fill_element_atomic(const float *cflag, float *data, int *iterator);
 
+	int hold(const ldraw::color &c);
 	void fill_color(const std::stack<ldraw::color> &colorstack, const ldraw::color &color, int count, buffer_type type);
 	void fill_elements_recursive(std::stack<ldraw::color> &colorstack, ldraw::model *m, const ldraw::matrix &transform);
+	void fill_elements_ref(std::stack<ldraw::color> &colorstack, const ldraw::element_ref *l, const ldraw::matrix &transform);
 	void fill_elements_stud(std::stack<ldraw::color> &colorstack, ldraw::model *m, const ldraw::matrix &transform);
 	void fill_elements();
 
+	void index_elements(buffer_type type);
+	static void optimize_vertex_cache(unsigned int *indices, int count, int primsize, int vertices);
+
   private:
-	static int s_memory_usage;
+	static std::atomic<int> s_memory_usage;
+	static std::atomic<unsigned int> s_serial;
 	
 	vbuffer_params *m_params;
 
 	bool m_isnull;
 	bool m_isvbo;
-	bool m_colorfixed;
 	parameters::stud_rendering_mode m_stud;
+	unsigned int m_serial;
 	
+	GLuint m_vbo_indices[4];
 	GLuint m_vbo_vertices[4];
-	GLuint m_vbo_normals[2];
-	GLuint m_vbo_colors[4];
 	GLuint m_vbo_condparams;
 	
 	int m_elemcnt[4];
+	int m_vertcnt[4];
 	
+	unsigned int *m_indices[4];
+	vertex *m_packed[4];
+	float *m_condparams;
+
+	/* Filled by fill_elements() and welded, then packed */
 	float *m_vertices[4];
 	float *m_normals[2];
 	float *m_colors[4];
-	float *m_condparams;
 
 	int m_vertptr[4];
 	int m_normptr[2];
 	int m_colorptr[4];
 	int m_condparamptr;
 
-	std::map<ldraw::color, float **> m_precolored_buf;
-	std::map<ldraw::color, GLuint *> m_vbo_precolored;
-	std::map<ldraw::color, GLuint> m_display_lists;
-	GLuint m_display_list;
+	std::vector<int> m_slots;  // palette slots the colors refer to
+
 };	
 
 }
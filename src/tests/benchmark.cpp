@@ -0,0 +1,2236 @@
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <vector>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+#include <libldr/atom.h>
+#include <libldr/bvh.h>
+#include <libldr/color.h>
+#include <libldr/elements.h>
+#include <libldr/geometry_columns.h>
+#include <libldr/metrics.h>
+#include <libldr/model.h>
+#include <libldr/part_cache.h>
+#include <libldr/part_library.h>
+#include <libldr/reader.h>
+#include <libldr/traits.h>
+#include <libldr/utils.h>
+#include <libldr/visitor.h>
+#include <libldr/writer.h>
+
+#include <renderer/frustum.h>
+#include <renderer/normal_extension.h>
+#include <renderer/opengl.h>
+#include <renderer/parameters.h>
+#include <renderer/picking.h>
+#include <renderer/vbuffer_extension.h>
+
+/* libLDR micro benchmarks.
+ *
+ * usage: benchmark <test> [file] [iterations]
+ *
+ * When no file (or an empty name) is given a synthetic multipart model is
+ * generated. The link, budget, shared, cache, library, names, traits and
+ * mesh tests use the part library found through LDRAWDIR. Without a file,
+ * link loads a model referencing 500 parts of the library and cache reads
+ * every part and primitive. budget and shared take a number of parts, graph a
+ * number of submodels and metrics, bvh, picking and frustum a number of
+ * references instead of iterations.
+ *
+ * Only the timings are of interest here; a test fails if the variants it
+ * times disagree. The behaviour of the library is checked by the unit
+ * tests (test_*.cpp), which ctest runs. */
+
+static double now()
+{
+	struct timeval tv;
+	gettimeofday(&tv, 0L);
+
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static std::string generate_model(int submodels, int lines_per_submodel)
+{
+	std::ostringstream s;
+
+	s << "0 FILE main.ldr" << std::endl;
+	s << "0 Synthetic benchmark model" << std::endl;
+	s << "0 Name: main.ldr" << std::endl;
+	s << "0 Author: benchmark" << std::endl;
+	for (int i = 0; i < submodels; ++i)
+		s << "1 " << i % 16 << " " << i * 20 << " 0 " << -i * 8.5f << " 1 0 0 0 1 0 0 0 1 sub" << i << ".ldr" << std::endl;
+
+	for (int i = 0; i < submodels; ++i) {
+		s << "0 FILE sub" << i << ".ldr" << std::endl;
+		s << "0 Submodel " << i << std::endl;
+		s << "0 Name: sub" << i << ".ldr" << std::endl;
+		for (int j = 0; j < lines_per_submodel; ++j) {
+			float f = j * 0.25f;
+			switch (j % 4) {
+				case 0:
+					s << "2 24 " << f << " -4 " << -f << " " << f + 1.5f << " 0 6.25" << std::endl;
+					break;
+				case 1:
+					s << "3 16 " << f << " 0 0 -" << f << " 1.000 0.5 0 " << f << " -3.75" << std::endl;
+					break;
+				case 2:
+					s << "4 16 -10 -24 " << f << " 10 -24 " << f << " 10 0 " << -f << " -10 0 -" << f << std::endl;
+					break;
+				default:
+					s << "5 24 " << f << " 0 1 -" << f << " 0 1 0.3827 0 0.9239 -0.3827 0 0.9239" << std::endl;
+			}
+		}
+		s << "0 STEP" << std::endl;
+	}
+
+	return s.str();
+}
+
+static int count_lines(const std::string &path)
+{
+	std::ifstream file(path.c_str());
+	std::string line;
+	int n = 0;
+
+	while (getline(file, line))
+		++n;
+
+	return n;
+}
+
+static std::string serialize(const ldraw::model_multipart *m)
+{
+	std::ostringstream s;
+	ldraw::writer w(s);
+	w.write(m);
+
+	return s.str();
+}
+
+/* Both paths share the line tokenizer, so the ratio is that of mapping
+ * the file over reading it through std::ifstream */
+static int bench_reader(const std::string &path, int iterations)
+{
+	ldraw::reader r;
+	int lines = count_lines(path);
+	double t, stream_time, mapped_time;
+	std::string stream_result, mapped_result;
+
+	t = now();
+	for (int i = 0; i < iterations; ++i) {
+		std::ifstream file(path.c_str());
+		ldraw::model_multipart *m = ldraw::reader::load_from_stream(file, path);
+		if (i == 0)
+			stream_result = serialize(m);
+		delete m;
+	}
+	stream_time = now() - t;
+
+	r.set_memory_mapped(true);
+	t = now();
+	for (int i = 0; i < iterations; ++i) {
+		ldraw::model_multipart *m = r.load_from_file(path);
+		if (i == 0)
+			mapped_result = serialize(m);
+		delete m;
+	}
+	mapped_time = now() - t;
+
+	std::printf("reader: %d lines x %d iterations\n", lines, iterations);
+	std::printf("  stream: %8.3f s  %12.0f lines/s\n", stream_time, lines * (double) iterations / stream_time);
+	std::printf("  mapped: %8.3f s  %12.0f lines/s  (%.2fx)\n", mapped_time, lines * (double) iterations / mapped_time, stream_time / mapped_time);
+
+	if (stream_result != mapped_result) {
+		std::printf("  MISMATCH between stream and mapped results\n");
+		return 1;
+	}
+
+	return 0;
+}
+
+static double time_link(const std::string &path, const std::string &buffer, int threads, int iterations, int *parts)
+{
+	double t = now();
+
+	for (int i = 0; i < iterations; ++i) {
+		ldraw::part_library lib;
+		ldraw::reader r;
+		ldraw::model_multipart *m;
+
+		if (path.empty())
+			m = ldraw::reader::load_from_buffer(buffer.data(), buffer.size(), "main.ldr");
+		else
+			m = r.load_from_file(path);
+
+		lib.set_loader_threads(threads);
+		lib.link(m);
+		*parts = lib.size();
+		delete m;
+	}
+
+	return now() - t;
+}
+
+static int bench_link(const std::string &path, int iterations)
+{
+	std::string buffer;
+	int serial_parts, parallel_parts;
+
+	if (path.empty()) {
+		ldraw::part_library lib;
+		std::ostringstream s;
+		int n = 0;
+
+		for (ldraw::part_library::file_list::const_iterator it = lib.part_list().begin(); it != lib.part_list().end() && n < 500; ++it, ++n)
+			s << "1 16 " << n * 40 << " 0 0 1 0 0 0 1 0 0 0 1 " << (*it).second << std::endl;
+		buffer = s.str();
+	}
+
+	double serial_time = time_link(path, buffer, 1, iterations, &serial_parts);
+	double parallel_time = time_link(path, buffer, 0, iterations, &parallel_parts);
+
+	std::printf("link: %d library files x %d iterations\n", serial_parts, iterations);
+	std::printf("  serial:   %8.3f s\n", serial_time);
+	std::printf("  parallel: %8.3f s  (%.2fx)\n", parallel_time, serial_time / parallel_time);
+
+	if (serial_parts != parallel_parts) {
+		std::printf("  MISMATCH between serial and parallel results\n");
+		return 1;
+	}
+
+	return 0;
+}
+
+/* Links and frees one part at a time, as the DB updater does, keeping
+ * primitives (unlink policy "parts") without and with a memory budget. */
+static double run_updater(ldraw::part_library &lib, int count, std::size_t *peak)
+{
+	std::vector<std::string> names;
+	double t;
+
+	for (ldraw::part_library::file_list::const_iterator it = lib.part_list().begin(); it != lib.part_list().end() && (int) names.size() < count; ++it)
+		names.push_back("1 16 0 0 0 1 0 0 0 1 0 0 0 1 " + (*it).second);
+
+	*peak = 0;
+	t = now();
+	for (std::vector<std::string>::const_iterator it = names.begin(); it != names.end(); ++it) {
+		ldraw::model_multipart *m = ldraw::reader::load_from_buffer((*it).data(), (*it).size(), "main.ldr");
+		lib.link(m);
+		*peak = std::max(*peak, lib.stats().memory_usage);
+		delete m;
+	}
+
+	return now() - t;
+}
+
+static int bench_budget(int count)
+{
+	ldraw::part_library unbounded, bounded, freeing;
+	std::size_t unbounded_peak, bounded_peak, freeing_peak;
+
+	unbounded.set_unlink_policy(ldraw::part_library::parts);
+	double unbounded_time = run_updater(unbounded, count, &unbounded_peak);
+
+	std::size_t budget = unbounded_peak / 4;
+	bounded.set_unlink_policy(ldraw::part_library::parts);
+	bounded.set_memory_budget(budget);
+	double bounded_time = run_updater(bounded, count, &bounded_peak);
+
+	run_updater(freeing, count, &freeing_peak);
+
+	ldraw::part_library::statistics u = unbounded.stats(), b = bounded.stats();
+
+	std::printf("budget: %d parts, budget %ld kB\n", count, (long) budget / 1024);
+	std::printf("  unbounded: %8.3f s  peak %8ld kB, end %8ld kB, %lu hits, %lu misses\n", unbounded_time,
+	            (long) unbounded_peak / 1024, (long) u.memory_usage / 1024, u.hits, u.misses);
+	std::printf("  budget:    %8.3f s  peak %8ld kB, end %8ld kB, %lu hits, %lu misses, %lu evictions\n", bounded_time,
+	            (long) bounded_peak / 1024, (long) b.memory_usage / 1024, b.hits, b.misses, b.evictions);
+
+	if (b.memory_usage > budget || freeing.stats().memory_usage != 0) {
+		std::printf("  MISMATCH in memory accounting\n");
+		return 1;
+	}
+
+	return 0;
+}
+
+/* Several threads link and free documents sharing one library, as
+ * documents, exporters and the thumbnail renderer do. Thread t links the
+ * parts from the t-th on, so the threads overlap on almost all of them. */
+static void run_documents(ldraw::part_library *lib, const std::vector<std::string> *names, int first, int rounds, int *linked)
+{
+	*linked = 0;
+
+	for (int i = 0; i < rounds; ++i) {
+		for (std::size_t j = first; j < names->size(); ++j) {
+			const std::string &line = (*names)[j];
+			ldraw::model_multipart *m = ldraw::reader::load_from_buffer(line.data(), line.size(), "main.ldr");
+
+			lib->link(m);
+			if (m->main_model()->at(0)->get_type() == ldraw::type_ref && CAST_AS_REF(m->main_model()->at(0))->get_model())
+				++*linked;
+			delete m;
+		}
+	}
+}
+
+static double run_shared(ldraw::part_library &lib, const std::vector<std::string> &names, int threads, int rounds, int *linked)
+{
+	std::vector<std::thread> pool;
+	std::vector<int> counts(threads);
+	double t = now();
+
+	for (int i = 0; i < threads; ++i)
+		pool.push_back(std::thread(run_documents, &lib, &names, i, rounds, &counts[i]));
+	for (std::vector<std::thread>::iterator it = pool.begin(); it != pool.end(); ++it)
+		(*it).join();
+
+	*linked = 0;
+	for (int i = 0; i < threads; ++i)
+		*linked += counts[i];
+
+	return now() - t;
+}
+
+static int bench_shared(int count)
+{
+	const int threads = 4, rounds = 2;
+	std::vector<std::string> names;
+	int serial_linked, shared_linked, bounded_linked;
+
+	{
+		ldraw::part_library lib;
+		for (ldraw::part_library::file_list::const_iterator it = lib.part_list().begin(); it != lib.part_list().end() && (int) names.size() < count; ++it)
+			names.push_back("1 16 0 0 0 1 0 0 0 1 0 0 0 1 " + (*it).second);
+	}
+
+	// The same documents, one after another, for reference
+	ldraw::part_library serial, shared, bounded;
+	double serial_time = 0.0;
+	serial_linked = 0;
+	for (int i = 0; i < threads; ++i) {
+		int n;
+		std::vector<std::string> tail(names.begin() + std::min(i, (int) names.size()), names.end());
+		serial_time += run_shared(serial, tail, 1, rounds, &n);
+		serial_linked += n;
+	}
+
+	double shared_time = run_shared(shared, names, threads, rounds, &shared_linked);
+
+	bounded.set_memory_budget(1024 * 1024);
+	bounded.set_unlink_policy(0);
+	double bounded_time = run_shared(bounded, names, threads, rounds, &bounded_linked);
+
+	ldraw::part_library::statistics b = bounded.stats();
+
+	std::printf("shared: %d parts, %d threads x %d rounds\n", (int) names.size(), threads, rounds);
+	std::printf("  serial:   %8.3f s\n", serial_time);
+	std::printf("  shared:   %8.3f s  (%.2fx)\n", shared_time, serial_time / shared_time);
+	std::printf("  budget:   %8.3f s  end %ld kB, %lu hits, %lu misses, %lu evictions\n", bounded_time,
+	            (long) b.memory_usage / 1024, b.hits, b.misses, b.evictions);
+
+	if (serial_linked != shared_linked || serial_linked != bounded_linked ||
+	    shared.size() != 0 || shared.stats().memory_usage != 0 || b.memory_usage > bounded.memory_budget()) {
+		std::printf("  MISMATCH between serial and shared results\n");
+		return 1;
+	}
+
+	return 0;
+}
+
+static int bench_cache(const std::string &path, int iterations)
+{
+	ldraw::part_library lib;
+	ldraw::part_cache cache("benchmark_cache");
+	std::vector<std::string> files;
+	double t, text_time, cache_time;
+	int mismatches = 0;
+
+	if (!path.empty()) {
+		files.push_back(path);
+	} else {
+		for (ldraw::part_library::file_list::const_iterator it = lib.prim_list().begin(); it != lib.prim_list().end(); ++it)
+			files.push_back(lib.ldrawpath((*it).second, ldraw::part_library::ldraw_primitives_path));
+		for (ldraw::part_library::file_list::const_iterator it = lib.part_list().begin(); it != lib.part_list().end(); ++it)
+			files.push_back(lib.ldrawpath((*it).second, ldraw::part_library::ldraw_parts_path));
+	}
+
+	mkdir(cache.path().c_str(), 0755);
+
+	ldraw::reader r;
+	t = now();
+	for (int i = 0; i < iterations; ++i) {
+		for (std::vector<std::string>::const_iterator it = files.begin(); it != files.end(); ++it) {
+			ldraw::part_cache::stamp s;
+			bool stamped = i == 0 && ldraw::part_cache::source_stamp(*it, &s);
+			ldraw::model_multipart *m = r.load_from_file(*it);
+			if (stamped)
+				cache.store(*it, m, s);
+			delete m;
+		}
+	}
+	text_time = now() - t;
+
+	t = now();
+	for (int i = 0; i < iterations; ++i) {
+		for (std::vector<std::string>::const_iterator it = files.begin(); it != files.end(); ++it) {
+			ldraw::model_multipart *m = cache.load(*it);
+			if (!m) {
+				++mismatches;
+				continue;
+			}
+			delete m;
+		}
+	}
+	cache_time = now() - t;
+
+	for (std::vector<std::string>::const_iterator it = files.begin(); it != files.end(); ++it)
+		std::remove(cache.filename(*it).c_str());
+	rmdir(cache.path().c_str());
+
+	std::printf("cache: %d files x %d iterations\n", (int) files.size(), iterations);
+	std::printf("  text:  %8.3f s\n", text_time);
+	std::printf("  cache: %8.3f s  (%.2fx)\n", cache_time, text_time / cache_time);
+
+	if (mismatches) {
+		std::printf("  MISMATCH in %d cache entries\n", mismatches);
+		return 1;
+	}
+
+	return 0;
+}
+
+/* Sums a few coordinates of every element, once with the CAST_AS_* macros
+ * (dynamic_cast), once with element_cast and once through a visitor. */
+static float traverse_dynamic(const ldraw::model *m)
+{
+	float sum = 0.0f;
+
+	for (ldraw::model::const_iterator it = m->elements().begin(); it != m->elements().end(); ++it) {
+		switch ((*it)->get_type()) {
+			case ldraw::type_line:
+				sum += CAST_AS_CONST_LINE(*it)->pos1().x() + CAST_AS_CONST_LINE(*it)->pos2().x();
+				break;
+			case ldraw::type_triangle:
+				sum += CAST_AS_CONST_TRIANGLE(*it)->pos1().y() + CAST_AS_CONST_TRIANGLE(*it)->pos3().y();
+				break;
+			case ldraw::type_quadrilateral:
+				sum += CAST_AS_CONST_QUADRILATERAL(*it)->pos2().z() + CAST_AS_CONST_QUADRILATERAL(*it)->pos4().z();
+				break;
+			case ldraw::type_condline:
+				sum += CAST_AS_CONST_CONDLINE(*it)->pos3().x();
+				break;
+			case ldraw::type_ref:
+				sum += CAST_AS_CONST_REF(*it)->get_matrix().value(0, 3);
+				break;
+			default:
+				break;
+		}
+	}
+
+	return sum;
+}
+
+static float traverse(const ldraw::model *m)
+{
+	float sum = 0.0f;
+
+	for (ldraw::model::const_iterator it = m->elements().begin(); it != m->elements().end(); ++it) {
+		switch ((*it)->get_type()) {
+			case ldraw::type_line:
+				sum += ldraw::element_cast<ldraw::element_line>(*it)->pos1().x() + ldraw::element_cast<ldraw::element_line>(*it)->pos2().x();
+				break;
+			case ldraw::type_triangle:
+				sum += ldraw::element_cast<ldraw::element_triangle>(*it)->pos1().y() + ldraw::element_cast<ldraw::element_triangle>(*it)->pos3().y();
+				break;
+			case ldraw::type_quadrilateral:
+				sum += ldraw::element_cast<ldraw::element_quadrilateral>(*it)->pos2().z() + ldraw::element_cast<ldraw::element_quadrilateral>(*it)->pos4().z();
+				break;
+			case ldraw::type_condline:
+				sum += ldraw::element_cast<ldraw::element_condline>(*it)->pos3().x();
+				break;
+			case ldraw::type_ref:
+				sum += ldraw::element_cast<ldraw::element_ref>(*it)->get_matrix().value(0, 3);
+				break;
+			default:
+				break;
+		}
+	}
+
+	return sum;
+}
+
+class sum_visitor : public ldraw::element_visitor<sum_visitor>
+{
+  public:
+	sum_visitor() : sum(0.0f) {}
+
+	void visit_line(const ldraw::element_line *l) { sum += l->pos1().x() + l->pos2().x(); }
+	void visit_triangle(const ldraw::element_triangle *l) { sum += l->pos1().y() + l->pos3().y(); }
+	void visit_quadrilateral(const ldraw::element_quadrilateral *l) { sum += l->pos2().z() + l->pos4().z(); }
+	void visit_condline(const ldraw::element_condline *l) { sum += l->pos3().x(); }
+	void visit_ref(const ldraw::element_ref *l) { sum += l->get_matrix().value(0, 3); }
+
+	float sum;
+};
+
+static int bench_traverse(const std::string &path, int iterations)
+{
+	ldraw::reader r;
+	ldraw::model_multipart *m = r.load_from_file(path);
+	std::vector<const ldraw::model *> models;
+	double t, dynamic_time, static_time, visitor_time;
+	float dynamic_sum = 0.0f, static_sum = 0.0f, visitor_sum = 0.0f;
+	long elements = 0;
+
+	models.push_back(m->main_model());
+	for (ldraw::model_multipart::submodel_const_iterator it = m->submodel_list().begin(); it != m->submodel_list().end(); ++it)
+		models.push_back((*it).second);
+	for (std::vector<const ldraw::model *>::const_iterator it = models.begin(); it != models.end(); ++it)
+		elements += (*it)->size();
+
+	t = now();
+	for (int i = 0; i < iterations; ++i)
+		for (std::vector<const ldraw::model *>::const_iterator it = models.begin(); it != models.end(); ++it)
+			dynamic_sum += traverse_dynamic(*it);
+	dynamic_time = now() - t;
+
+	t = now();
+	for (int i = 0; i < iterations; ++i)
+		for (std::vector<const ldraw::model *>::const_iterator it = models.begin(); it != models.end(); ++it)
+			static_sum += traverse(*it);
+	static_time = now() - t;
+
+	t = now();
+	for (int i = 0; i < iterations; ++i) {
+		for (std::vector<const ldraw::model *>::const_iterator it = models.begin(); it != models.end(); ++it) {
+			sum_visitor v;
+			v.visit_elements(*it);
+			visitor_sum += v.sum;
+		}
+	}
+	visitor_time = now() - t;
+
+	delete m;
+
+	std::printf("traverse: %ld elements x %d iterations\n", elements, iterations);
+	std::printf("  dynamic_cast:  %8.3f s  %12.0f elements/s\n", dynamic_time, elements * (double) iterations / dynamic_time);
+	std::printf("  element_cast:  %8.3f s  %12.0f elements/s  (%.2fx)\n", static_time, elements * (double) iterations / static_time, dynamic_time / static_time);
+	std::printf("  visitor:       %8.3f s  %12.0f elements/s  (%.2fx)\n", visitor_time, elements * (double) iterations / visitor_time, dynamic_time / visitor_time);
+
+	if (dynamic_sum != static_sum || dynamic_sum != visitor_sum) {
+		std::printf("  MISMATCH between traversal results\n");
+		return 1;
+	}
+
+	return 0;
+}
+
+/* Builds the part and primitive index of the library by scanning its
+ * directories, then from the manifest written by the first scan. */
+/* A chain of submodels, each referencing the next, with the main model
+ * referencing the first. Cycle tests on it used to walk the rest of the
+ * chain once per submodel. */
+static std::string generate_chain(int submodels)
+{
+	std::ostringstream s;
+
+	s << "0 FILE main.ldr" << std::endl;
+	s << "1 16 0 0 0 1 0 0 0 1 0 0 0 1 sub0.ldr" << std::endl;
+	for (int i = 0; i < submodels; ++i) {
+		s << "0 FILE sub" << i << ".ldr" << std::endl;
+		s << "2 24 0 0 0 " << i << " 0 0" << std::endl;
+		if (i + 1 < submodels)
+			s << "1 16 0 0 0 1 0 0 0 1 0 0 0 1 sub" << i + 1 << ".ldr" << std::endl;
+	}
+
+	return s.str();
+}
+
+static bool walk_cycles(const ldraw::model_multipart *m)
+{
+	if (ldraw::utils::cyclic_reference_test(m->main_model()))
+		return true;
+	for (ldraw::model_multipart::submodel_const_iterator it = m->submodel_list().begin(); it != m->submodel_list().end(); ++it) {
+		if (ldraw::utils::cyclic_reference_test((*it).second))
+			return true;
+	}
+
+	return false;
+}
+
+/* affected_models() as it was: every model searched for references to the
+ * target, recursing into the submodels it references */
+static bool walk_affected(const ldraw::model *target, const ldraw::model *m)
+{
+	for (ldraw::model::const_iterator it = m->elements().begin(); it != m->elements().end(); ++it) {
+		if ((*it)->get_type() != ldraw::type_ref || !CAST_AS_CONST_REF(*it)->get_model())
+			continue;
+
+		const ldraw::model *cm = CAST_AS_CONST_REF(*it)->get_model();
+		if (cm == target || (cm->parent() == m->parent() && walk_affected(target, cm)))
+			return true;
+	}
+
+	return false;
+}
+
+static int bench_graph(int submodels)
+{
+	std::string buffer = generate_chain(submodels);
+	ldraw::model_multipart *m = ldraw::reader::load_from_buffer(buffer.data(), buffer.size(), "main.ldr");
+	std::vector<ldraw::model *> models;
+	double t, walk_time, graph_time, walk_edit_time, graph_edit_time, walk_affected_time, index_affected_time;
+	int mismatches = 0, cycles = 0;
+	const int edits = 2000;
+
+	for (int i = 0; i < submodels; ++i)
+		models.push_back(m->find_submodel("sub" + std::to_string(i) + ".ldr"));
+
+	// Load time check, as the reader used to do it and as it does now
+	t = now();
+	bool walked = walk_cycles(m);
+	walk_time = now() - t;
+
+	t = now();
+	bool graphed = m->is_cyclic();
+	graph_time = now() - t;
+
+	if (walked || graphed)
+		++mismatches;
+
+	// Editor: test a reference from one submodel to another before adding
+	// it, then remove it again
+	unsigned int seed = 4711;
+	std::vector<std::pair<int, int> > pairs;
+	for (int i = 0; i < edits; ++i) {
+		seed = seed * 1103515245u + 12345u;
+		int a = (seed >> 8) % submodels;
+		seed = seed * 1103515245u + 12345u;
+		pairs.push_back(std::make_pair(a, (seed >> 8) % submodels));
+	}
+
+	std::vector<bool> walk_result;
+	t = now();
+	for (std::vector<std::pair<int, int> >::const_iterator it = pairs.begin(); it != pairs.end(); ++it)
+		walk_result.push_back(ldraw::utils::cyclic_reference_test(models[(*it).first], models[(*it).second]));
+	walk_edit_time = now() - t;
+
+	t = now();
+	for (size_t i = 0; i < pairs.size(); ++i) {
+		ldraw::model *from = models[pairs[i].first], *to = models[pairs[i].second];
+		bool cyclic = m->creates_cycle(from, to);
+
+		if (cyclic != walk_result[i])
+			++mismatches;
+
+		if (cyclic) {
+			++cycles;
+			continue;
+		}
+
+		from->insert_element(new ldraw::element_ref(ldraw::color(16), ldraw::matrix(), to->name()));
+		if (m->is_cyclic())
+			++mismatches;
+		from->delete_element();
+	}
+	graph_edit_time = now() - t;
+
+	// Models affected by a change to a submodel
+	std::vector<int> walked_count, indexed_count;
+	t = now();
+	for (int i = 0; i < submodels; i += 10) {
+		int n = walk_affected(models[i], m->main_model()) ? 1 : 0;
+		for (int j = 0; j < submodels; ++j)
+			n += walk_affected(models[i], models[j]) ? 1 : 0;
+		walked_count.push_back(n);
+	}
+	walk_affected_time = now() - t;
+
+	t = now();
+	for (int i = 0; i < submodels; i += 10)
+		indexed_count.push_back(ldraw::utils::affected_models(m, models[i]).size());
+	index_affected_time = now() - t;
+
+	if (walked_count != indexed_count)
+		++mismatches;
+
+	delete m;
+
+	std::printf("graph: %d submodels, %d edits (%d would close a cycle)\n", submodels, edits, cycles);
+	std::printf("  load walk:  %8.3f s\n", walk_time);
+	std::printf("  load graph: %8.3f s  (%.2fx)\n", graph_time, walk_time / graph_time);
+	std::printf("  edit walk:  %8.3f s\n", walk_edit_time);
+	std::printf("  edit graph: %8.3f s  (%.2fx)\n", graph_edit_time, walk_edit_time / graph_edit_time);
+	std::printf("  affected walk:  %8.3f s\n", walk_affected_time);
+	std::printf("  affected index: %8.3f s  (%.2fx)\n", index_affected_time, walk_affected_time / index_affected_time);
+
+	if (mismatches) {
+		std::printf("  MISMATCH between walk and graph results (%d)\n", mismatches);
+		return 1;
+	}
+
+	return 0;
+}
+
+/* Bounding box of a freshly computed metrics against the tracked one */
+static bool same_bounds(ldraw::model *m)
+{
+	ldraw::metrics full(m);
+	full.update();
+
+	const ldraw::metrics *tracked = m->custom_data<ldraw::metrics>();
+	for (int i = 0; i < 3; ++i) {
+		if (full.min_()[i] != tracked->min_()[i] || full.max_()[i] != tracked->max_()[i])
+			return false;
+	}
+
+	return true;
+}
+
+static int bench_metrics(int refs)
+{
+	std::string buffer = generate_model(refs, 8);
+	ldraw::model_multipart *m = ldraw::reader::load_from_buffer(buffer.data(), buffer.size(), "main.ldr");
+	ldraw::model *main = m->main_model();
+	std::vector<ldraw::element_ref *> list;
+	std::vector<ldraw::matrix> original;
+	double t, full_time, tracked_time;
+	int mismatches = 0;
+	const int edits = 2000;
+
+	for (ldraw::model::const_iterator it = main->elements().begin(); it != main->elements().end(); ++it) {
+		if ((*it)->get_type() == ldraw::type_ref) {
+			list.push_back(CAST_AS_REF(*it));
+			original.push_back(list.back()->get_matrix());
+		}
+	}
+
+	unsigned int seed = 4711;
+	std::vector<std::pair<int, ldraw::matrix> > moves;
+	for (int i = 0; i < edits; ++i) {
+		seed = seed * 1103515245u + 12345u;
+		int n = (seed >> 8) % list.size();
+		seed = seed * 1103515245u + 12345u;
+		ldraw::matrix mat = list[n]->get_matrix();
+		mat.set_translation_vector(ldraw::vector((float) ((seed >> 8) % 20000) - 10000.0f, 0.0f, (float) i));
+		moves.push_back(std::make_pair(n, mat));
+	}
+
+	// Every edit followed by a full update, as the editor used to
+	main->init_custom_data<ldraw::metrics>();
+	t = now();
+	for (std::vector<std::pair<int, ldraw::matrix> >::const_iterator it = moves.begin(); it != moves.end(); ++it) {
+		list[(*it).first]->set_matrix((*it).second);
+		main->update_custom_data<ldraw::metrics>();
+	}
+	full_time = now() - t;
+
+	for (size_t i = 0; i < list.size(); ++i)
+		list[i]->set_matrix(original[i]);
+
+	// The same edits on a tracked box
+	main->init_custom_data<ldraw::metrics>()->track();
+	const ldraw::metrics *tracked = main->custom_data<ldraw::metrics>();
+	t = now();
+	for (std::vector<std::pair<int, ldraw::matrix> >::const_iterator it = moves.begin(); it != moves.end(); ++it) {
+		list[(*it).first]->set_matrix((*it).second);
+		main->element_changed(list[(*it).first]);
+		tracked->min_();
+	}
+	tracked_time = now() - t;
+
+	if (!same_bounds(main))
+		++mismatches;
+
+	delete m;
+
+	std::printf("metrics: %d references, %d edits\n", refs, edits);
+	std::printf("  full update: %8.3f s\n", full_time);
+	std::printf("  tracked:     %8.3f s  (%.2fx)\n", tracked_time, full_time / tracked_time);
+
+	if (mismatches) {
+		std::printf("  MISMATCH between tracked and full bounds (%d)\n", mismatches);
+		return 1;
+	}
+
+	return 0;
+}
+
+/* matrix and vector products as they were before the SSE kernels, kept out
+ * of line as they were in the library */
+__attribute__((noinline)) static ldraw::matrix multiply_scalar(const ldraw::matrix &a, const ldraw::matrix &b)
+{
+	ldraw::matrix n;
+
+	for (int i = 0; i < 4; i++) {
+		for (int j = 0; j < 4; j++) {
+			n.value(i, j) = 0.0f;
+			for (int k = 0; k < 4; k++)
+				n.value(i, j) += a.value(i, k) * b.value(k, j);
+		}
+	}
+
+	return n;
+}
+
+__attribute__((noinline)) static ldraw::vector transform_scalar(const ldraw::matrix &m, const ldraw::vector &v)
+{
+	return ldraw::vector(
+		m.value(0, 0)*v.x() + m.value(0, 1)*v.y() + m.value(0, 2)*v.z() + m.value(0, 3)*v.w(),
+		m.value(1, 0)*v.x() + m.value(1, 1)*v.y() + m.value(1, 2)*v.z() + m.value(1, 3)*v.w(),
+		m.value(2, 0)*v.x() + m.value(2, 1)*v.y() + m.value(2, 2)*v.z() + m.value(2, 3)*v.w());
+}
+
+__attribute__((noinline)) static float distance_pow(const ldraw::vector &a, const ldraw::vector &b)
+{
+	return std::sqrt(std::pow(a.x() - b.x(), 2.0f) + std::pow(a.y() - b.y(), 2.0f) + std::pow(a.z() - b.z(), 2.0f));
+}
+
+static int bench_math(int iterations)
+{
+	const int count = 1 << 16;
+	std::vector<ldraw::matrix> matrices;
+	std::vector<float> points(count * 3), out(count * 3);
+	double t, times[8];
+	int mismatches = 0;
+	float sum[8] = { 0.0f };
+
+	unsigned int seed = 4711;
+	for (int i = 0; i < count * 3; ++i) {
+		seed = seed * 1103515245u + 12345u;
+		points[i] = (float) ((seed >> 8) % 20000) / 16.0f - 625.0f;
+	}
+	for (int i = 0; i < 64; ++i) {
+		float a = i * 0.1f;
+		matrices.push_back(ldraw::matrix(std::cos(a), 0.0f, std::sin(a), 0.0f, 1.0f, 0.0f, -std::sin(a), 0.0f, std::cos(a), points[i], points[i + 1], points[i + 2]));
+	}
+
+	// matrix products, as for nested references
+	t = now();
+	for (int n = 0; n < iterations * 100; ++n) {
+		ldraw::matrix m;
+		for (std::vector<ldraw::matrix>::const_iterator it = matrices.begin(); it != matrices.end(); ++it)
+			m = multiply_scalar(m, *it);
+		sum[0] += m.value(0, 3);
+	}
+	times[0] = now() - t;
+
+	t = now();
+	for (int n = 0; n < iterations * 100; ++n) {
+		ldraw::matrix m;
+		for (std::vector<ldraw::matrix>::const_iterator it = matrices.begin(); it != matrices.end(); ++it)
+			m = m * *it;
+		sum[1] += m.value(0, 3);
+	}
+	times[1] = now() - t;
+
+	// single points
+	t = now();
+	for (int n = 0; n < iterations; ++n) {
+		const ldraw::matrix &m = matrices[n % matrices.size()];
+		for (int i = 0; i < count; ++i)
+			sum[2] += transform_scalar(m, ldraw::vector(points[i * 3], points[i * 3 + 1], points[i * 3 + 2])).y();
+	}
+	times[2] = now() - t;
+
+	t = now();
+	for (int n = 0; n < iterations; ++n) {
+		const ldraw::matrix &m = matrices[n % matrices.size()];
+		for (int i = 0; i < count; ++i)
+			sum[3] += (m * ldraw::vector(points[i * 3], points[i * 3 + 1], points[i * 3 + 2])).y();
+	}
+	times[3] = now() - t;
+
+	// packed points, as in the vertex buffers
+	t = now();
+	for (int n = 0; n < iterations; ++n) {
+		const ldraw::matrix &m = matrices[n % matrices.size()];
+		m.transform(&points[0], &out[0], count);
+		sum[4] += out[n % count * 3 + 1];
+	}
+	times[4] = now() - t;
+
+	// distances
+	t = now();
+	for (int n = 0; n < iterations; ++n) {
+		for (int i = 0; i + 1 < count; ++i)
+			sum[5] += distance_pow(ldraw::vector(points[i * 3], points[i * 3 + 1], points[i * 3 + 2]), ldraw::vector(points[i * 3 + 3], points[i * 3 + 4], points[i * 3 + 5]));
+	}
+	times[5] = now() - t;
+
+	t = now();
+	for (int n = 0; n < iterations; ++n) {
+		for (int i = 0; i + 1 < count; ++i)
+			sum[6] += ldraw::vector::distance(ldraw::vector(points[i * 3], points[i * 3 + 1], points[i * 3 + 2]), ldraw::vector(points[i * 3 + 3], points[i * 3 + 4], points[i * 3 + 5]));
+	}
+	times[6] = now() - t;
+
+	// The kernels must agree with the scalar code to the bit
+	for (size_t j = 0; j < matrices.size(); ++j) {
+		const ldraw::matrix &m = matrices[j];
+		ldraw::matrix a = multiply_scalar(m, matrices[(j + 1) % matrices.size()]), b = m * matrices[(j + 1) % matrices.size()];
+		if (std::memcmp(a.get_pointer(), b.get_pointer(), sizeof(float) * 16))
+			++mismatches;
+
+		m.transform(&points[0], &out[0], 1024);
+		for (int i = 0; i < 1024; ++i) {
+			ldraw::vector v(points[i * 3], points[i * 3 + 1], points[i * 3 + 2]);
+			ldraw::vector s = transform_scalar(m, v), k = m * v;
+			if (s.x() != k.x() || s.y() != k.y() || s.z() != k.z() || s.x() != out[i * 3] || s.y() != out[i * 3 + 1] || s.z() != out[i * 3 + 2])
+				++mismatches;
+		}
+	}
+
+	// In place
+	std::vector<float> copy(points.begin(), points.begin() + 300);
+	matrices[3].transform(&copy[0], &copy[0], 100);
+	matrices[3].transform(&points[0], &out[0], 100);
+	if (!std::equal(copy.begin(), copy.end(), out.begin()))
+		++mismatches;
+
+	std::printf("math: %d points x %d iterations (checksum %g %g %g %g)\n", count, iterations, sum[0] - sum[1], sum[2] - sum[3], sum[4], sum[5] - sum[6]);
+	std::printf("  matrix * matrix scalar: %8.3f s\n", times[0]);
+	std::printf("  matrix * matrix:        %8.3f s  (%.2fx)\n", times[1], times[0] / times[1]);
+	std::printf("  matrix * vector scalar: %8.3f s  %12.0f points/s\n", times[2], count * (double) iterations / times[2]);
+	std::printf("  matrix * vector:        %8.3f s  %12.0f points/s  (%.2fx)\n", times[3], count * (double) iterations / times[3], times[2] / times[3]);
+	std::printf("  transform (packed):     %8.3f s  %12.0f points/s  (%.2fx)\n", times[4], count * (double) iterations / times[4], times[2] / times[4]);
+	std::printf("  distance pow:           %8.3f s\n", times[5]);
+	std::printf("  distance:               %8.3f s  (%.2fx)\n", times[6], times[5] / times[6]);
+
+	if (mismatches) {
+		std::printf("  MISMATCH between scalar and vector results (%d)\n", mismatches);
+		return 1;
+	}
+
+	return 0;
+}
+
+/* A layout of bricks of four sizes on a plate, turned in steps of 90
+ * degrees */
+static std::string generate_layout(int refs)
+{
+	static const char *rotations[] = { "1 0 0 0 1 0 0 0 1", "0 0 1 0 1 0 -1 0 0", "-1 0 0 0 1 0 0 0 -1", "0 0 -1 0 1 0 1 0 0" };
+	std::ostringstream s;
+	unsigned int seed = 4711;
+	int side = (int) std::sqrt((float) refs) + 1;
+
+	s << "0 FILE main.ldr" << std::endl;
+	for (int i = 0; i < refs; ++i) {
+		seed = seed * 1103515245u + 12345u;
+		s << "1 " << i % 16 << " " << (i % side) * 40 << " " << -(int) ((seed >> 8) % 8) * 24 << " " << (i / side) * 40 << " "
+		  << rotations[(seed >> 12) % 4] << " brick" << (seed >> 16) % 4 << ".ldr" << std::endl;
+	}
+
+	for (int i = 0; i < 4; ++i) {
+		int w = 10 * (i + 1);
+		s << "0 FILE brick" << i << ".ldr" << std::endl;
+		s << "4 16 " << -w << " 0 -10 " << w << " 0 -10 " << w << " 0 10 " << -w << " 0 10" << std::endl;
+		s << "4 16 " << -w << " -24 -10 " << w << " -24 -10 " << w << " -24 10 " << -w << " -24 10" << std::endl;
+	}
+
+	return s.str();
+}
+
+static void sort_unique(std::vector<const ldraw::element_base *> &v)
+{
+	std::sort(v.begin(), v.end());
+	v.erase(std::unique(v.begin(), v.end()), v.end());
+}
+
+static int bench_bvh(int refs)
+{
+	std::string buffer = generate_layout(refs);
+	ldraw::model_multipart *m = ldraw::reader::load_from_buffer(buffer.data(), buffer.size(), "main.ldr");
+	ldraw::model *main = m->main_model();
+	const int queries = 1000, edits = 2000;
+	double t, build_time, linear_time = 0.0, tree_time = 0.0, edit_time;
+	int mismatches = 0, found = 0;
+
+	t = now();
+	main->update_custom_data<ldraw::bvh>();
+	build_time = now() - t;
+	ldraw::bvh *tree = main->custom_data<ldraw::bvh>();
+
+	if (tree->size() != refs)
+		++mismatches;
+
+	unsigned int seed = 1234;
+	float extent = (std::sqrt((float) refs) + 1) * 40.0f;
+	std::vector<ldraw::element_ref *> list;
+	for (ldraw::model::const_iterator it = main->elements().begin(); it != main->elements().end(); ++it)
+		list.push_back(CAST_AS_REF(*it));
+
+	for (int round = 0; round < 2; ++round) {
+		// The boxes a linear scan would test, as the tree holds them
+		std::vector<std::pair<ldraw::vector, ldraw::vector> > boxes(list.size());
+		for (size_t i = 0; i < list.size(); ++i)
+			tree->bounds(list[i], boxes[i].first, boxes[i].second);
+
+		for (int q = 0; q < queries; ++q) {
+			seed = seed * 1103515245u + 12345u;
+			float x = (seed >> 8) % (int) extent, z = (seed >> 4) % (int) extent, w = 20.0f + (seed >> 20) % 200;
+			ldraw::vector min(x, -500.0f, z), max(x + w, 500.0f, z + w);
+			ldraw::vector origin(x, -1000.0f, z), direction(0.01f, 1.0f, -0.02f);
+
+			// Region and frustum: the box as planes
+			ldraw::bvh::plane planes[4] = {
+				{ ldraw::vector(1.0f, 0.0f, 0.0f), -x }, { ldraw::vector(-1.0f, 0.0f, 0.0f), x + w },
+				{ ldraw::vector(0.0f, 0.0f, 1.0f), -z }, { ldraw::vector(0.0f, 0.0f, -1.0f), z + w } };
+
+			std::vector<const ldraw::element_base *> linear_box, tree_box, tree_frustum, linear_ray, tree_ray;
+			std::vector<ldraw::bvh::hit> hits;
+
+			double t0 = now();
+			for (size_t i = 0; i < boxes.size(); ++i) {
+				const ldraw::vector &bmin = boxes[i].first, &bmax = boxes[i].second;
+				if (bmax.x() >= min.x() && bmin.x() <= max.x() && bmax.y() >= min.y() && bmin.y() <= max.y() && bmax.z() >= min.z() && bmin.z() <= max.z())
+					linear_box.push_back(list[i]);
+
+				float tmin = 0.0f, tmax = HUGE_VALF;
+				for (int j = 0; j < 3; ++j) {
+					float t1 = (bmin[j] - origin[j]) / direction[j], t2 = (bmax[j] - origin[j]) / direction[j];
+					tmin = std::max(tmin, std::min(t1, t2));
+					tmax = std::min(tmax, std::max(t1, t2));
+				}
+				if (tmin <= tmax)
+					linear_ray.push_back(list[i]);
+			}
+			double t1 = now();
+			tree->query_box(min, max, tree_box);
+			tree->query_frustum(planes, 4, tree_frustum);
+			tree->query_ray(origin, direction, hits);
+			double t2 = now();
+
+			linear_time += t1 - t0;
+			tree_time += t2 - t1;
+
+			for (size_t i = 0; i < hits.size(); ++i) {
+				tree_ray.push_back(hits[i].second);
+				if (i && hits[i].first < hits[i - 1].first)
+					++mismatches;
+			}
+
+			sort_unique(linear_box);
+			sort_unique(tree_box);
+			sort_unique(tree_frustum);
+			sort_unique(linear_ray);
+			sort_unique(tree_ray);
+
+			// The frustum planes leave y open, so it finds at least as much
+			if (linear_box != tree_box || linear_ray != tree_ray || !std::includes(tree_frustum.begin(), tree_frustum.end(), tree_box.begin(), tree_box.end()))
+				++mismatches;
+
+			found += tree_box.size();
+		}
+
+		if (round)
+			break;
+
+		// Move parts around; the tree follows
+		t = now();
+		for (int i = 0; i < edits; ++i) {
+			seed = seed * 1103515245u + 12345u;
+			ldraw::element_ref *r = list[(seed >> 8) % list.size()];
+			ldraw::matrix mat = r->get_matrix();
+			if (i % 4)
+				mat.set_translation_vector(mat.get_translation_vector() + ldraw::vector(20.0f, 0.0f, 0.0f));
+			else
+				mat.set_translation_vector(ldraw::vector((seed >> 4) % (int) extent, 0.0f, (seed >> 12) % (int) extent));
+			r->set_matrix(mat);
+			main->element_changed(r);
+		}
+		edit_time = now() - t;
+	}
+
+	// A row of parts added one by one must not degenerate the tree
+	int height = tree->height();
+	for (int i = 0; i < refs; ++i) {
+		ldraw::matrix mat;
+		mat.set_translation_vector(ldraw::vector(extent + i * 40.0f, 0.0f, 0.0f));
+		main->insert_element(new ldraw::element_ref(ldraw::color(16), mat, "brick0.ldr"));
+	}
+	int grown = tree->height();
+	if (tree->size() != refs * 2 || grown > 4 * std::log2((float) refs * 2) + 2)
+		++mismatches;
+
+	for (int i = 0; i < refs; ++i)
+		main->delete_element();
+	if (tree->size() != refs)
+		++mismatches;
+
+	delete m;
+
+	std::printf("bvh: %d references, %d queries (%d found), %d edits\n", refs, queries * 2, found, edits);
+	std::printf("  build:   %8.3f s  height %d, %d after adding a row\n", build_time, height, grown);
+	std::printf("  edits:   %8.3f s  %12.0f edits/s\n", edit_time, edits / edit_time);
+	std::printf("  linear:  %8.3f s\n", linear_time);
+	std::printf("  tree:    %8.3f s  (%.2fx)\n", tree_time, linear_time / tree_time);
+
+	if (mismatches) {
+		std::printf("  MISMATCH between linear and tree results (%d)\n", mismatches);
+		return 1;
+	}
+
+	return 0;
+}
+
+/* gluPerspective(45, 4/3, near, far) */
+static ldraw::matrix perspective(float near, float far)
+{
+	float f = 1.0f / std::tan(22.5f * M_PI / 180.0f);
+	ldraw::matrix projection;
+
+	projection.value(0, 0) = f * 3.0f / 4.0f;
+	projection.value(1, 1) = f;
+	projection.value(2, 2) = (far + near) / (near - far);
+	projection.value(2, 3) = 2.0f * far * near / (near - far);
+	projection.value(3, 2) = -1.0f;
+	projection.value(3, 3) = 0.0f;
+
+	return projection;
+}
+
+/* gluLookAt(), with -y up as LDraw has it */
+static ldraw::matrix look_at(const ldraw::vector &eye, const ldraw::vector &center)
+{
+	ldraw::vector fw = (center - eye).normalize(), up(0.0f, -1.0f, 0.0f);
+	ldraw::vector s = ldraw::vector(fw.y() * up.z() - fw.z() * up.y(), fw.z() * up.x() - fw.x() * up.z(), fw.x() * up.y() - fw.y() * up.x()).normalize();
+	ldraw::vector u(s.y() * fw.z() - s.z() * fw.y(), s.z() * fw.x() - s.x() * fw.z(), s.x() * fw.y() - s.y() * fw.x());
+
+	return ldraw::matrix(s.x(), s.y(), s.z(), u.x(), u.y(), u.z(), -fw.x(), -fw.y(), -fw.z(),
+	                     -(s.x() * eye.x() + s.y() * eye.y() + s.z() * eye.z()),
+	                     -(u.x() * eye.x() + u.y() * eye.y() + u.z() * eye.z()),
+	                     fw.x() * eye.x() + fw.y() * eye.y() + fw.z() * eye.z());
+}
+
+/* Window coordinates of a point as OpenGL would compute them; false if it
+ * is behind the eye */
+static bool project(const ldraw::matrix &clip, const int *viewport, const ldraw::vector &p, float *out)
+{
+	float v[4];
+	for (int i = 0; i < 4; ++i)
+		v[i] = clip.value(i, 0) * p.x() + clip.value(i, 1) * p.y() + clip.value(i, 2) * p.z() + clip.value(i, 3);
+	if (v[3] <= 0.0f)
+		return false;
+
+	out[0] = viewport[0] + (v[0] / v[3] + 1.0f) * viewport[2] * 0.5f;
+	out[1] = viewport[1] + (v[1] / v[3] + 1.0f) * viewport[3] * 0.5f;
+	out[2] = v[2] / v[3] * 0.5f + 0.5f;
+
+	return true;
+}
+
+/* A camera looking down on a generated layout, with selection checked
+ * against projecting the parts directly */
+static int bench_picking(int refs)
+{
+	std::string buffer = generate_layout(refs);
+	ldraw::model_multipart *m = ldraw::reader::load_from_buffer(buffer.data(), buffer.size(), "main.ldr");
+	ldraw::model *main = m->main_model();
+	const int viewport[4] = { 0, 0, 800, 600 };
+	const int clicks = 1000, bands = 100;
+	double t, first, click_time[3] = { 0.0, 0.0, 0.0 }, band_time = 0.0, linear_time = 0.0;
+	int mismatches = 0, found = 0, largest = 0;
+	std::vector<double> latencies;
+
+	float extent = (std::sqrt((float) refs) + 1) * 40.0f;
+	ldraw::matrix projection = perspective(10.0f, 100000.0f);
+	ldraw::matrix modelview = look_at(ldraw::vector(extent * 0.5f, -extent * 0.8f, -extent * 0.4f), ldraw::vector(extent * 0.5f, 0.0f, extent * 0.5f));
+
+	ldraw::matrix clip = projection * modelview;
+	ldraw::matrix gl_projection = projection.transpose(), gl_modelview = modelview.transpose();
+
+	std::vector<ldraw::element_ref *> list;
+	for (ldraw::model::const_iterator it = main->elements().begin(); it != main->elements().end(); ++it)
+		list.push_back(CAST_AS_REF(*it));
+
+	t = now();
+	ldraw_renderer::picker(gl_projection.get_pointer(), gl_modelview.get_pointer(), viewport, 400, 300, 5, 5).select(main, 0L, ldraw_renderer::renderer::selection_points);
+	first = now() - t;
+
+	unsigned int seed = 99;
+	for (int q = 0; q < clicks + bands; ++q) {
+		seed = seed * 1103515245u + 12345u;
+		int x = (seed >> 8) % viewport[2], y = (seed >> 4) % viewport[3], w = 5, h = 5;
+		if (q >= clicks) {
+			seed = seed * 1103515245u + 12345u;
+			w = (int) ((seed >> 8) % 400) - 200;
+			h = (int) ((seed >> 16) % 300) - 150;
+		}
+
+		ldraw_renderer::picker p(gl_projection.get_pointer(), gl_modelview.get_pointer(), viewport, x, y, w, h);
+		ldraw_renderer::selection_list sel[3];
+		for (int type = 0; type < 3; ++type) {
+			double t0 = now();
+			sel[type] = p.select(main, 0L, (ldraw_renderer::renderer::selection) type);
+			double t1 = now();
+
+			if (q < clicks) {
+				click_time[type] += t1 - t0;
+				latencies.push_back(t1 - t0);
+			} else if (type == ldraw_renderer::renderer::selection_points) {
+				band_time += t1 - t0;
+			}
+		}
+
+		if (p.hit_test(main, 0L) != !sel[ldraw_renderer::renderer::selection_model_full].empty())
+			++mismatches;
+
+		/* The region as the pick matrix sees it */
+		if (w < 0)
+			x += w, w = -w;
+		if (h < 0)
+			y += h, h = -h;
+		float cx = x + w/2, cy = viewport[3] - (y + h/2);
+		float left = cx - w * 0.5f, right = cx + w * 0.5f, bottom = cy - h * 0.5f, top = cy + h * 0.5f;
+		const float margin = 0.01f;
+
+		std::vector<int> inside, outside;
+		std::vector<unsigned int> depth(list.size());
+		double t0 = now();
+		for (size_t i = 0; i < list.size(); ++i) {
+			const ldraw::metrics *rmm = list[i]->get_model()->custom_data<ldraw::metrics>();
+			const ldraw::matrix &rmt = list[i]->get_matrix();
+			float win[3];
+
+			if (!project(clip, viewport, (rmt * rmm->min_() + rmt * rmm->max_()) * 0.5f, win) || win[2] < 0.0f || win[2] > 1.0f)
+				outside.push_back(i);
+			else if (win[0] > left + margin && win[0] < right - margin && win[1] > bottom + margin && win[1] < top - margin)
+				inside.push_back(i), depth[i] = (unsigned int) (win[2] * 4294967295.0);
+			else if (win[0] < left - margin || win[0] > right + margin || win[1] < bottom - margin || win[1] > top + margin)
+				outside.push_back(i);
+		}
+		linear_time += now() - t0;
+
+		/* Everything clearly inside is selected at its depth, nothing
+		 * clearly outside */
+		std::vector<int> selected;
+		std::unordered_map<int, unsigned int> depths;
+		for (ldraw_renderer::selection_list::const_iterator it = sel[0].begin(); it != sel[0].end(); ++it) {
+			selected.push_back(it->first);
+			depths[it->first] = it->second;
+		}
+
+		for (size_t i = 0; i < inside.size(); ++i) {
+			if (!depths.count(inside[i]) || std::abs((double) depths[inside[i]] - depth[inside[i]]) > 4294967295.0 * 1e-5)
+				++mismatches;
+		}
+		for (size_t i = 0; i < outside.size(); ++i) {
+			if (depths.count(outside[i]))
+				++mismatches;
+		}
+		if (!std::is_sorted(selected.begin(), selected.end()))
+			++mismatches;
+
+		/* A box whose center is hit is hit as well, and so is the model in
+		 * it unless the center falls into a gap */
+		for (size_t i = 0; i < inside.size(); ++i) {
+			bool hit = false;
+			for (ldraw_renderer::selection_list::const_iterator it = sel[2].begin(); it != sel[2].end(); ++it)
+				hit = hit || it->first == inside[i];
+			if (!hit)
+				++mismatches;
+		}
+		if (sel[1].size() > sel[2].size())
+			++mismatches;
+
+		found += sel[0].size();
+		largest = std::max(largest, (int) sel[2].size());
+	}
+
+	/* The whole view, well over what a selection buffer held */
+	ldraw_renderer::picker all(gl_projection.get_pointer(), gl_modelview.get_pointer(), viewport, 0, 0, viewport[2], viewport[3]);
+	t = now();
+	ldraw_renderer::selection_list everything = all.select(main, 0L, ldraw_renderer::renderer::selection_points);
+	double all_time = now() - t;
+
+	/* Every other part moved behind the eye is no longer found */
+	for (size_t i = 0; i < list.size(); i += 2) {
+		ldraw::matrix mat = list[i]->get_matrix();
+		mat.set_translation_vector(mat.get_translation_vector() + ldraw::vector(0.0f, 0.0f, -extent * 10.0f));
+		list[i]->set_matrix(mat);
+		main->element_changed(list[i]);
+	}
+
+	ldraw_renderer::selection_list remaining = all.select(main, 0L, ldraw_renderer::renderer::selection_points);
+	std::vector<int> expected;
+	for (ldraw_renderer::selection_list::const_iterator it = everything.begin(); it != everything.end(); ++it) {
+		if (it->first % 2)
+			expected.push_back(it->first);
+	}
+	std::vector<int> after;
+	for (ldraw_renderer::selection_list::const_iterator it = remaining.begin(); it != remaining.end(); ++it)
+		after.push_back(it->first);
+	if (after != expected)
+		++mismatches;
+
+	delete m;
+
+	std::printf("picking: %d references, %d clicks (%d found), %d rubber bands\n", refs, clicks, found, bands);
+	std::printf("  first:   %8.3f ms (building the tree)\n", first * 1000.0);
+	std::printf("  points:  %8.3f ms per click\n", click_time[0] * 1000.0 / clicks);
+	std::printf("  model:   %8.3f ms per click\n", click_time[1] * 1000.0 / clicks);
+	std::printf("  boxes:   %8.3f ms per click\n", click_time[2] * 1000.0 / clicks);
+	std::sort(latencies.begin(), latencies.end());
+	std::printf("  99%%:     %8.3f ms, %d parts in the largest selection\n", latencies[latencies.size() * 99 / 100] * 1000.0, largest);
+	std::printf("  bands:   %8.3f ms per rubber band\n", band_time * 1000.0 / bands);
+	std::printf("  linear:  %8.3f ms per projection of every part\n", linear_time * 1000.0 / (clicks + bands));
+	std::printf("  view:    %8.3f ms for %d parts, %d after moving half away\n", all_time * 1000.0, (int) everything.size(), (int) remaining.size());
+
+	if (mismatches) {
+		std::printf("  MISMATCH between picking and projection (%d)\n", mismatches);
+		return 1;
+	}
+
+	return 0;
+}
+
+/* Cameras circling low over a generated layout, each reference classified
+ * against the view frustum by its box alone and with the tree of the model
+ * first, checked against projecting the parts directly */
+static int bench_frustum(int refs)
+{
+	std::string buffer = generate_layout(refs);
+	ldraw::model_multipart *m = ldraw::reader::load_from_buffer(buffer.data(), buffer.size(), "main.ldr");
+	ldraw::model *main = m->main_model();
+	const int viewport[4] = { 0, 0, 800, 600 };
+	const int views = 200;
+	double t, linear_time = 0.0, tree_time = 0.0;
+	int mismatches = 0, culled = 0, inside = 0;
+
+	main->update_custom_data<ldraw::bvh>();
+	const ldraw::bvh *tree = main->custom_data<ldraw::bvh>();
+
+	std::vector<ldraw::element_ref *> list;
+	for (ldraw::model::const_iterator it = main->elements().begin(); it != main->elements().end(); ++it)
+		list.push_back(CAST_AS_REF(*it));
+
+	float extent = (std::sqrt((float) refs) + 1) * 40.0f;
+	ldraw::matrix projection = perspective(10.0f, 100000.0f);
+
+	for (int v = 0; v < views; ++v) {
+		float a = 2.0f * M_PI * v / views;
+		ldraw::vector center(extent * (0.5f + 0.3f * std::cos(a)), 0.0f, extent * (0.5f + 0.3f * std::sin(a)));
+		ldraw::vector eye = center + ldraw::vector(extent * 0.1f * std::cos(a * 3.0f), -extent * 0.05f, extent * 0.1f * std::sin(a * 3.0f));
+		ldraw::matrix clip = projection * look_at(eye, center);
+
+		std::vector<ldraw_renderer::frustum::visibility> linear(list.size());
+		t = now();
+		for (size_t i = 0; i < list.size(); ++i) {
+			const ldraw::metrics *rmm = list[i]->get_model()->custom_data<ldraw::metrics>();
+			linear[i] = ldraw_renderer::frustum::classify_box(clip * list[i]->get_matrix(), rmm->min_(), rmm->max_());
+		}
+		linear_time += now() - t;
+
+		/* What the tree leaves out is outside without a test */
+		std::vector<ldraw_renderer::frustum::visibility> hierarchy(list.size(), ldraw_renderer::frustum::outside);
+		std::vector<const ldraw::element_base *> found;
+		ldraw::bvh::plane planes[6];
+		t = now();
+		ldraw_renderer::frustum::get_planes(clip, planes);
+		tree->query_frustum(planes, 6, found);
+		std::unordered_map<const ldraw::element_base *, int> index;
+		for (size_t i = 0; i < found.size(); ++i)
+			index[found[i]] = 0;
+		for (size_t i = 0; i < list.size(); ++i) {
+			if (index.count(list[i])) {
+				const ldraw::metrics *rmm = list[i]->get_model()->custom_data<ldraw::metrics>();
+				hierarchy[i] = ldraw_renderer::frustum::classify_box(clip * list[i]->get_matrix(), rmm->min_(), rmm->max_());
+			}
+		}
+		tree_time += now() - t;
+
+		for (size_t i = 0; i < list.size(); ++i) {
+			const ldraw::metrics *rmm = list[i]->get_model()->custom_data<ldraw::metrics>();
+			const ldraw::matrix &rmt = list[i]->get_matrix();
+			float win[3];
+
+			if (linear[i] != hierarchy[i])
+				++mismatches;
+
+			/* A part whose center is in view is never culled */
+			if (project(clip, viewport, (rmt * rmm->min_() + rmt * rmm->max_()) * 0.5f, win) && win[2] >= 0.0f && win[2] <= 1.0f &&
+			    win[0] >= 0.0f && win[0] <= viewport[2] && win[1] >= 0.0f && win[1] <= viewport[3] && linear[i] == ldraw_renderer::frustum::outside)
+				++mismatches;
+
+			/* Nor is one whose corners are all in view found anything but inside */
+			bool contained = true;
+			for (int c = 0; c < 8 && contained; ++c) {
+				ldraw::vector corner(c & 1 ? rmm->max_().x() : rmm->min_().x(), c & 2 ? rmm->max_().y() : rmm->min_().y(), c & 4 ? rmm->max_().z() : rmm->min_().z());
+				contained = project(clip, viewport, rmt * corner, win) && win[2] > 0.0f && win[2] < 1.0f &&
+				            win[0] > 0.5f && win[0] < viewport[2] - 0.5f && win[1] > 0.5f && win[1] < viewport[3] - 0.5f;
+			}
+			if (contained && linear[i] != ldraw_renderer::frustum::inside)
+				++mismatches;
+
+			if (linear[i] == ldraw_renderer::frustum::outside)
+				++culled;
+			else if (linear[i] == ldraw_renderer::frustum::inside)
+				++inside;
+		}
+	}
+
+	delete m;
+
+	std::printf("frustum: %d references, %d views\n", refs, views);
+	std::printf("  culled:  %8.1f%% of the references, %.1f%% inside\n", 100.0 * culled / views / refs, 100.0 * inside / views / refs);
+	std::printf("  linear:  %8.3f ms per view, every box tested\n", linear_time * 1000.0 / views);
+	std::printf("  tree:    %8.3f ms per view, boxes the tree finds tested\n", tree_time * 1000.0 / views);
+
+	if (mismatches) {
+		std::printf("  MISMATCH between culling and projection (%d)\n", mismatches);
+		return 1;
+	}
+
+	return 0;
+}
+
+/* Traits of a model worked out by walking everything below it, as the
+ * renderers and exporters did before */
+struct walked_traits
+{
+	bool color_ambiguous;
+	bool renderable;
+	std::size_t total[4];
+	std::size_t stud_total[4];
+	std::size_t studs;
+};
+
+static void walk_traits(const ldraw::model *m, walked_traits &w)
+{
+	w.color_ambiguous = w.renderable = false;
+	w.studs = 0;
+	for (int i = 0; i < 4; ++i)
+		w.total[i] = w.stud_total[i] = 0;
+
+	for (ldraw::model::const_iterator it = m->elements().begin(); it != m->elements().end(); ++it) {
+		ldraw::type t = (*it)->get_type();
+
+		if (t == ldraw::type_ref) {
+			const ldraw::element_ref *r = CAST_AS_CONST_REF(*it);
+			if (!r->get_model())
+				continue;
+
+			walked_traits c;
+			walk_traits(r->get_model(), c);
+			bool stud = ldraw::utils::is_stud(r->get_model());
+
+			for (int i = 0; i < 4; ++i) {
+				if (stud)
+					w.stud_total[i] += c.total[i] + c.stud_total[i];
+				else
+					w.total[i] += c.total[i], w.stud_total[i] += c.stud_total[i];
+			}
+			w.studs += stud ? 1 : c.studs;
+			w.renderable = w.renderable || c.renderable;
+			if ((r->get_color().get_id() == 16 || r->get_color().get_id() == 24) && (c.color_ambiguous || stud))
+				w.color_ambiguous = true;
+		} else if (t == ldraw::type_line || t == ldraw::type_triangle || t == ldraw::type_quadrilateral || t == ldraw::type_condline) {
+			int id = static_cast<const ldraw::element_colored_base *>(*it)->get_color().get_id();
+
+			++w.total[t == ldraw::type_line ? 0 : t == ldraw::type_triangle ? 1 : t == ldraw::type_quadrilateral ? 2 : 3];
+			w.renderable = true;
+			if (id == 16 || id == 24)
+				w.color_ambiguous = true;
+		}
+	}
+}
+
+static int bench_traits(int iterations)
+{
+	ldraw::part_library lib;
+	std::ostringstream s;
+	int n = 0;
+
+	for (ldraw::part_library::file_list::const_iterator it = lib.part_list().begin(); it != lib.part_list().end() && n < 500; ++it, ++n)
+		s << "1 " << (n % 2 ? 16 : 4) << " " << n * 40 << " 0 0 1 0 0 0 1 0 0 0 1 " << (*it).second << std::endl;
+	std::string buffer = s.str();
+	ldraw::model_multipart *m = ldraw::reader::load_from_buffer(buffer.data(), buffer.size(), "main.ldr");
+
+	double t = now();
+	lib.link(m);
+	double link_time = now() - t;
+
+	std::vector<const ldraw::model *> parts;
+	for (ldraw::model::const_iterator it = m->main_model()->elements().begin(); it != m->main_model()->elements().end(); ++it) {
+		const ldraw::element_ref *r = CAST_AS_CONST_REF(*it);
+		if (r->get_model())
+			parts.push_back(r->get_model());
+	}
+
+	int mismatches = 0, ambiguous = 0;
+	std::size_t walked = 0, cached = 0;
+	double walk_time, traits_time;
+
+	t = now();
+	for (int i = 0; i < iterations; ++i) {
+		for (std::vector<const ldraw::model *>::const_iterator it = parts.begin(); it != parts.end(); ++it) {
+			walked_traits w;
+			walk_traits(*it, w);
+			walked += w.total[1] + w.studs + w.color_ambiguous;
+		}
+	}
+	walk_time = now() - t;
+
+	t = now();
+	for (int i = 0; i < iterations; ++i) {
+		for (std::vector<const ldraw::model *>::const_iterator it = parts.begin(); it != parts.end(); ++it) {
+			const ldraw::traits *tr = (*it)->custom_data<ldraw::traits>();
+			cached += tr->total(ldraw::traits::triangles) + tr->studs() + tr->is(ldraw::traits::color_ambiguous);
+		}
+	}
+	traits_time = now() - t;
+
+	if (walked != cached)
+		++mismatches;
+
+	for (std::vector<const ldraw::model *>::const_iterator it = parts.begin(); it != parts.end(); ++it) {
+		const ldraw::traits *tr = (*it)->custom_data<ldraw::traits>();
+		walked_traits w;
+		walk_traits(*it, w);
+
+		if (!tr || tr->is(ldraw::traits::color_ambiguous) != w.color_ambiguous || tr->is(ldraw::traits::renderable) != w.renderable || tr->studs() != w.studs)
+			++mismatches;
+		for (int i = 0; tr && i < 4; ++i) {
+			if (tr->total((ldraw::traits::primitive) i) != w.total[i] || tr->stud_total((ldraw::traits::primitive) i) != w.stud_total[i])
+				++mismatches;
+		}
+		ambiguous += w.color_ambiguous;
+	}
+
+	/* A document model is left alone until asked for */
+	if (m->main_model()->custom_data<ldraw::traits>())
+		++mismatches;
+	m->main_model()->update_custom_data<ldraw::traits>();
+	walked_traits w;
+	walk_traits(m->main_model(), w);
+	const ldraw::traits *tr = m->main_model()->custom_data<ldraw::traits>();
+	if (tr->is(ldraw::traits::color_ambiguous) != w.color_ambiguous || tr->total(ldraw::traits::quads) != w.total[2] || tr->studs() != w.studs)
+		++mismatches;
+
+	delete m;
+
+	std::printf("traits: %d parts (%d color ambiguous) x %d iterations\n", (int) parts.size(), ambiguous, iterations);
+	std::printf("  link:    %8.3f s\n", link_time);
+	std::printf("  walk:    %8.3f s\n", walk_time);
+	std::printf("  traits:  %8.3f s  (%.0fx)\n", traits_time, walk_time / traits_time);
+
+	if (mismatches) {
+		std::printf("  MISMATCH between walked and cached traits (%d)\n", mismatches);
+		return 1;
+	}
+
+	return 0;
+}
+
+/* normal_extension as it was: a map from element index to normal */
+static void map_normals(const ldraw::model *m, std::map<int, ldraw::vector> &normals)
+{
+	int i = 0;
+
+	normals.clear();
+	for (ldraw::model::const_iterator it = m->elements().begin(); it != m->elements().end(); ++it, ++i) {
+		if ((*it)->get_type() == ldraw::type_triangle) {
+			const ldraw::element_triangle *t = CAST_AS_CONST_TRIANGLE(*it);
+			normals[i] = ldraw::vector::cross_product(t->pos2() - t->pos1(), t->pos3() - t->pos2()).normalize();
+		} else if ((*it)->get_type() == ldraw::type_quadrilateral) {
+			const ldraw::element_quadrilateral *t = CAST_AS_CONST_QUADRILATERAL(*it);
+			normals[i] = ldraw::vector::cross_product(t->pos2() - t->pos1(), t->pos3() - t->pos2()).normalize();
+		}
+	}
+}
+
+static int bench_normals(const std::string &path, int iterations)
+{
+	ldraw::reader r;
+	ldraw::model_multipart *mp = r.load_from_file(path);
+	ldraw::model *m = mp->submodel_list().begin()->second;
+	int mismatches = 0, faces = 0;
+	double map_time = 0.0, dense_time = 0.0, map_read = 0.0, dense_read = 0.0;
+	float sum_map = 0.0f, sum_dense = 0.0f;
+	std::map<int, ldraw::vector> normals;
+
+	/* The largest submodel, as a collapsed vertex buffer would see it */
+	for (ldraw::model_multipart::submodel_const_iterator it = mp->submodel_list().begin(); it != mp->submodel_list().end(); ++it) {
+		if (it->second->size() > m->size())
+			m = it->second;
+	}
+
+	for (int i = 0; i < iterations; ++i) {
+		double t0 = now();
+		map_normals(m, normals);
+		double t1 = now();
+		m->update_custom_data<ldraw_renderer::normal_extension>();
+		double t2 = now();
+
+		map_time += t1 - t0;
+		dense_time += t2 - t1;
+
+		/* Every face looks its normal up once per fill */
+		const float *dense = m->custom_data<ldraw_renderer::normal_extension>()->normals();
+		int index = 0;
+		for (ldraw::model::const_iterator it = m->elements().begin(); it != m->elements().end(); ++it, ++index) {
+			ldraw::type t = (*it)->get_type();
+			if (t == ldraw::type_triangle || t == ldraw::type_quadrilateral)
+				sum_map += (*normals.find(index)).second.y();
+		}
+		double t3 = now();
+		index = 0;
+		for (ldraw::model::const_iterator it = m->elements().begin(); it != m->elements().end(); ++it, ++index) {
+			ldraw::type t = (*it)->get_type();
+			if (t == ldraw::type_triangle || t == ldraw::type_quadrilateral)
+				sum_dense += dense[index * 3 + 1];
+		}
+		double t4 = now();
+
+		map_read += t3 - t2;
+		dense_read += t4 - t3;
+	}
+
+	/* Identical to the bit */
+	const ldraw_renderer::normal_extension *ne = m->custom_data<ldraw_renderer::normal_extension>();
+	for (std::map<int, ldraw::vector>::const_iterator it = normals.begin(); it != normals.end(); ++it, ++faces) {
+		if (!ne->has_normal(it->first) || std::memcmp(ne->normals() + it->first * 3, it->second.get_pointer(), sizeof(float) * 3))
+			++mismatches;
+	}
+	if (ne->has_normal(0) != (normals.find(0) != normals.end()))
+		++mismatches;
+
+	if (sum_map != sum_dense)
+		++mismatches;
+
+	delete mp;
+
+	std::printf("normals: %d faces x %d iterations\n", faces, iterations);
+	std::printf("  map:     %8.3f s  compute, %8.3f s  look up\n", map_time, map_read);
+	std::printf("  dense:   %8.3f s  compute, %8.3f s  look up  (%.2fx, %.2fx)\n", dense_time, dense_read, map_time / dense_time, map_read / dense_read);
+
+	if (mismatches) {
+		std::printf("  MISMATCH between map and dense normals (%d)\n", mismatches);
+		return 1;
+	}
+
+	return 0;
+}
+
+static double corner_sum(const ldraw::vector &v)
+{
+	return (double) v.x() + v.y() + v.z();
+}
+
+/* Sum of the corners drawn for each buffer type, quads as the two
+ * triangles they are split into */
+static void walk_corners(const ldraw::model *m, const ldraw::matrix &transform, double *sums)
+{
+	for (ldraw::model::const_iterator it = m->elements().begin(); it != m->elements().end(); ++it) {
+		switch ((*it)->get_type()) {
+			case ldraw::type_line: {
+				const ldraw::element_line *l = CAST_AS_CONST_LINE(*it);
+				sums[0] += corner_sum(transform * l->pos1()) + corner_sum(transform * l->pos2());
+				break;
+			}
+			case ldraw::type_triangle: {
+				const ldraw::element_triangle *l = CAST_AS_CONST_TRIANGLE(*it);
+				sums[1] += corner_sum(transform * l->pos1()) + corner_sum(transform * l->pos2()) + corner_sum(transform * l->pos3());
+				break;
+			}
+			case ldraw::type_quadrilateral: {
+				const ldraw::element_quadrilateral *l = CAST_AS_CONST_QUADRILATERAL(*it);
+				sums[2] += 2.0 * corner_sum(transform * l->pos1()) + corner_sum(transform * l->pos2()) + 2.0 * corner_sum(transform * l->pos3()) + corner_sum(transform * l->pos4());
+				break;
+			}
+			case ldraw::type_condline: {
+				const ldraw::element_condline *l = CAST_AS_CONST_CONDLINE(*it);
+				sums[3] += corner_sum(transform * l->pos1()) + corner_sum(transform * l->pos2());
+				break;
+			}
+			case ldraw::type_ref: {
+				const ldraw::element_ref *r = CAST_AS_CONST_REF(*it);
+				if (r->get_model())
+					walk_corners(r->get_model(), transform * r->get_matrix(), sums);
+				break;
+			}
+			default:
+				break;
+		}
+	}
+}
+
+/* Vertices a 16 entry FIFO post-transform cache has to transform */
+static int transformed_vertices(const unsigned int *indices, int count)
+{
+	unsigned int fifo[16];
+	int size = 0, head = 0, misses = 0;
+
+	for (int i = 0; i < count; ++i) {
+		if (std::find(fifo, fifo + size, indices[i]) != fifo + size)
+			continue;
+
+		++misses;
+		fifo[head] = indices[i];
+		head = (head + 1) % 16;
+		size = std::min(size + 1, 16);
+	}
+
+	return misses;
+}
+
+/* Collapsed vertex buffers of library parts, as the retained renderer with
+ * vbuffer_parts builds them, in system memory: corners written one by one
+ * in separate float arrays as they used to be drawn, against welded and
+ * indexed vertices in the packed format. */
+static int bench_mesh(int iterations)
+{
+	static const char *names[] = { "lines", "triangles", "quads", "condlines" };
+
+	ldraw::part_library lib;
+	std::ostringstream s;
+	int n = 0;
+
+	for (ldraw::part_library::file_list::const_iterator it = lib.part_list().begin(); it != lib.part_list().end() && n < 500; ++it, ++n)
+		s << "1 16 " << n * 40 << " 0 0 1 0 0 0 1 0 0 0 1 " << (*it).second << std::endl;
+	std::string buffer = s.str();
+	ldraw::model_multipart *m = ldraw::reader::load_from_buffer(buffer.data(), buffer.size(), "main.ldr");
+	lib.link(m);
+
+	std::vector<ldraw::model *> parts;
+	for (ldraw::model::const_iterator it = m->main_model()->elements().begin(); it != m->main_model()->elements().end(); ++it) {
+		const ldraw::element_ref *r = CAST_AS_CONST_REF(*it);
+		if (r->get_model())
+			parts.push_back(r->get_model());
+	}
+
+	ldraw_renderer::parameters params;
+	params.set_stud_rendering_mode(ldraw_renderer::parameters::stud_regular);
+
+	ldraw_renderer::vbuffer_extension::vbuffer_params vp;
+	vp.force_fixed = true;
+	vp.force_vbuffer = true;
+	vp.collapse_subfiles = true;
+	vp.params = &params;
+
+	double t = now();
+	for (int i = 0; i < iterations; ++i) {
+		for (std::vector<ldraw::model *>::const_iterator it = parts.begin(); it != parts.end(); ++it)
+			(*it)->update_custom_data<ldraw_renderer::vbuffer_extension>(&vp);
+	}
+	double build_time = now() - t;
+
+	long corners[4] = { 0, 0, 0, 0 }, vertices[4] = { 0, 0, 0, 0 }, transformed[4] = { 0, 0, 0, 0 };
+	std::size_t unindexed_bytes = 0, indexed_bytes = 0;
+	int mismatches = 0;
+
+	for (std::vector<ldraw::model *>::const_iterator it = parts.begin(); it != parts.end(); ++it) {
+		const ldraw_renderer::vbuffer_extension *ve = (*it)->custom_data<ldraw_renderer::vbuffer_extension>();
+		double sums[4] = { 0.0, 0.0, 0.0, 0.0 };
+
+		walk_corners(*it, ldraw::matrix(), sums);
+
+		for (int i = 0; i < 4; ++i) {
+			ldraw_renderer::vbuffer_extension::buffer_type type = (ldraw_renderer::vbuffer_extension::buffer_type) i;
+			const int floats = (i == 1 || i == 2) ? 10 : 7;
+			const int count = ve->count(type);
+			const int drawn = i == 2 ? count / 6 * 4 : count;
+			const unsigned int *indices = ve->get_index_array(type);
+			const ldraw_renderer::vbuffer_extension::vertex *verts = ve->get_vertex_array(type);
+			double sum = 0.0, scale = 0.0;
+
+			for (int j = 0; j < count; ++j) {
+				if (indices[j] >= (unsigned int) ve->vertex_count(type)) {
+					++mismatches;
+					break;
+				}
+				const float *v = verts[indices[j]].position;
+				sum += (double) v[0] + v[1] + v[2];
+				scale += std::fabs(v[0]) + std::fabs(v[1]) + std::fabs(v[2]);
+			}
+			if (std::fabs(sum - sums[i]) > 1e-4 * (scale + 1.0))
+				++mismatches;
+
+			corners[i] += drawn;
+			vertices[i] += ve->vertex_count(type);
+			if (count)
+				transformed[i] += transformed_vertices(indices, count);
+
+			unindexed_bytes += drawn * floats * sizeof(float);
+			indexed_bytes += ve->vertex_count(type) * sizeof(ldraw_renderer::vbuffer_extension::vertex) + count * sizeof(unsigned int);
+		}
+	}
+
+	delete m;
+
+	std::printf("mesh: %d parts x %d iterations, %8.3f s to build\n", (int) parts.size(), iterations, build_time);
+	for (int i = 0; i < 4; ++i)
+		std::printf("  %-10s %9ld corners, %9ld vertices (%.2fx), %9ld transformed (%.2fx)\n", names[i], corners[i], vertices[i], vertices[i] ? (double) corners[i] / vertices[i] : 0.0, transformed[i], transformed[i] ? (double) corners[i] / transformed[i] : 0.0);
+	std::printf("  memory: %8.2f MB unindexed, %8.2f MB indexed (%.2fx)\n", unindexed_bytes / 1048576.0, indexed_bytes / 1048576.0, (double) unindexed_bytes / indexed_bytes);
+
+	if (mismatches) {
+		std::printf("  MISMATCH between model and indexed buffers (%d)\n", mismatches);
+		return 1;
+	}
+
+	return 0;
+}
+
+static int bench_library(int iterations)
+{
+	std::string cache = "benchmark_cache";
+	double t, scan_time, manifest_time;
+	int mismatches = 0;
+	size_t files = 0;
+
+	mkdir(cache.c_str(), 0755);
+
+	t = now();
+	for (int i = 0; i < iterations; ++i) {
+		ldraw::part_library lib;
+		files = lib.part_list().size() + lib.prim_list().size();
+	}
+	scan_time = now() - t;
+
+	ldraw::part_library scanned;
+	scanned.set_cache_path(cache);
+	scanned.part_list();
+
+	t = now();
+	for (int i = 0; i < iterations; ++i) {
+		ldraw::part_library lib;
+		lib.set_cache_path(cache);
+		if (lib.part_list() != scanned.part_list() || lib.prim_list() != scanned.prim_list())
+			++mismatches;
+	}
+	manifest_time = now() - t;
+
+	std::remove((cache + "/library.manifest").c_str());
+	rmdir(cache.c_str());
+
+	std::printf("library: %d files x %d iterations\n", (int) files, iterations);
+	std::printf("  scan:     %8.3f s\n", scan_time);
+	std::printf("  manifest: %8.3f s  (%.2fx)\n", manifest_time, scan_time / manifest_time);
+
+	if (mismatches) {
+		std::printf("  MISMATCH in %d manifest loads\n", mismatches);
+		return 1;
+	}
+
+	return 0;
+}
+
+/* Looks up every library file name, spelled as in a model file, once by
+ * folding it into a string map key, once by interning it and once through
+ * an atom computed beforehand, as element_ref keeps it. */
+static int bench_names(int iterations)
+{
+	ldraw::part_library lib;
+	std::map<std::string, int> by_string;
+	std::unordered_map<ldraw::atom, int> by_atom;
+	std::vector<std::string> names;
+	std::vector<ldraw::atom> atoms;
+	double t, string_time, intern_time, atom_time;
+	long string_hits = 0, intern_hits = 0, atom_hits = 0;
+	int n = 0;
+
+	for (ldraw::part_library::file_list::const_iterator it = lib.part_list().begin(); it != lib.part_list().end(); ++it, ++n) {
+		by_string[(*it).first] = n;
+		by_atom[ldraw::atom_table::intern((*it).first)] = n;
+
+		std::string name = (*it).second;
+		for (std::string::iterator c = name.begin(); c != name.end(); ++c) {
+			if (*c == '/')
+				*c = '\\';
+			else
+				*c = std::toupper(*c);
+		}
+		names.push_back(name);
+		atoms.push_back(ldraw::atom_table::intern(name));
+	}
+
+	t = now();
+	for (int i = 0; i < iterations; ++i)
+		for (std::vector<std::string>::const_iterator it = names.begin(); it != names.end(); ++it)
+			string_hits += by_string.count(ldraw::utils::translate_string(*it));
+	string_time = now() - t;
+
+	t = now();
+	for (int i = 0; i < iterations; ++i)
+		for (std::vector<std::string>::const_iterator it = names.begin(); it != names.end(); ++it)
+			intern_hits += by_atom.count(ldraw::atom_table::intern(*it));
+	intern_time = now() - t;
+
+	t = now();
+	for (int i = 0; i < iterations; ++i)
+		for (std::vector<ldraw::atom>::const_iterator it = atoms.begin(); it != atoms.end(); ++it)
+			atom_hits += by_atom.count(*it);
+	atom_time = now() - t;
+
+	std::printf("names: %d names x %d iterations, %d atoms\n", (int) names.size(), iterations, (int) ldraw::atom_table::size());
+	std::printf("  string: %8.3f s\n", string_time);
+	std::printf("  intern: %8.3f s  (%.2fx)\n", intern_time, string_time / intern_time);
+	std::printf("  atom:   %8.3f s  (%.2fx)\n", atom_time, string_time / atom_time);
+
+	if (string_hits != intern_hits || string_hits != atom_hits || string_hits != (long) names.size() * iterations) {
+		std::printf("  MISMATCH: %ld string hits, %ld intern hits, %ld atom hits\n", string_hits, intern_hits, atom_hits);
+		return 1;
+	}
+
+	return 0;
+}
+
+/* Sums every vertex coordinate, once through the elements and once through
+ * the geometry_columns copy, and checks that write_columns() reproduces the
+ * element serialization. */
+static float sum_elements(const ldraw::model *m)
+{
+	float sum = 0.0f;
+
+	for (ldraw::model::const_iterator it = m->elements().begin(); it != m->elements().end(); ++it) {
+		switch ((*it)->get_type()) {
+			case ldraw::type_line: {
+				const ldraw::element_line *l = ldraw::element_cast<ldraw::element_line>(*it);
+				sum += l->pos1().x() + l->pos1().y() + l->pos1().z() + l->pos2().x() + l->pos2().y() + l->pos2().z();
+				break;
+			}
+			case ldraw::type_triangle: {
+				const ldraw::element_triangle *l = ldraw::element_cast<ldraw::element_triangle>(*it);
+				sum += l->pos1().x() + l->pos1().y() + l->pos1().z() + l->pos2().x() + l->pos2().y() + l->pos2().z();
+				sum += l->pos3().x() + l->pos3().y() + l->pos3().z();
+				break;
+			}
+			case ldraw::type_quadrilateral: {
+				const ldraw::element_quadrilateral *l = ldraw::element_cast<ldraw::element_quadrilateral>(*it);
+				sum += l->pos1().x() + l->pos1().y() + l->pos1().z() + l->pos2().x() + l->pos2().y() + l->pos2().z();
+				sum += l->pos3().x() + l->pos3().y() + l->pos3().z() + l->pos4().x() + l->pos4().y() + l->pos4().z();
+				break;
+			}
+			case ldraw::type_condline: {
+				const ldraw::element_condline *l = ldraw::element_cast<ldraw::element_condline>(*it);
+				sum += l->pos1().x() + l->pos1().y() + l->pos1().z() + l->pos2().x() + l->pos2().y() + l->pos2().z();
+				sum += l->pos3().x() + l->pos3().y() + l->pos3().z() + l->pos4().x() + l->pos4().y() + l->pos4().z();
+				break;
+			}
+			default:
+				break;
+		}
+	}
+
+	return sum;
+}
+
+static float sum_columns(const ldraw::geometry_columns *c)
+{
+	float sum = 0.0f;
+
+	for (int i = 0; i < 4; ++i) {
+		const std::vector<float> &p = c->get((ldraw::geometry_columns::column_type) i).positions;
+		for (std::size_t j = 0; j < p.size(); j += 3)
+			sum += p[j] + p[j + 1] + p[j + 2];
+	}
+
+	return sum;
+}
+
+static int bench_columns(const std::string &path, int iterations)
+{
+	ldraw::reader r;
+	ldraw::model_multipart *m = r.load_from_file(path);
+	std::vector<ldraw::model *> models;
+	double t, elements_time, columns_time, build_time;
+	float elements_sum = 0.0f, columns_sum = 0.0f;
+	std::size_t bytes = 0;
+	long elements = 0;
+	int mismatches = 0;
+
+	models.push_back(m->main_model());
+	for (ldraw::model_multipart::submodel_const_iterator it = m->submodel_list().begin(); it != m->submodel_list().end(); ++it)
+		models.push_back((*it).second);
+
+	t = now();
+	for (std::vector<ldraw::model *>::const_iterator it = models.begin(); it != models.end(); ++it)
+		(*it)->update_custom_data<ldraw::geometry_columns>();
+	build_time = now() - t;
+
+	for (std::vector<ldraw::model *>::const_iterator it = models.begin(); it != models.end(); ++it) {
+		const ldraw::geometry_columns *c = (*it)->custom_data<ldraw::geometry_columns>();
+		std::ostringstream a, b;
+		ldraw::writer wa(a), wb(b);
+
+		for (ldraw::model::const_iterator eit = (*it)->elements().begin(); eit != (*it)->elements().end(); ++eit)
+			wa.write(*eit);
+		wb.write_columns(c);
+
+		if (a.str() != b.str())
+			++mismatches;
+
+		bytes += c->memory_usage();
+		elements += (*it)->size();
+	}
+
+	t = now();
+	for (int i = 0; i < iterations; ++i)
+		for (std::vector<ldraw::model *>::const_iterator it = models.begin(); it != models.end(); ++it)
+			elements_sum += sum_elements(*it);
+	elements_time = now() - t;
+
+	t = now();
+	for (int i = 0; i < iterations; ++i)
+		for (std::vector<ldraw::model *>::const_iterator it = models.begin(); it != models.end(); ++it)
+			columns_sum += sum_columns((*it)->custom_data<ldraw::geometry_columns>());
+	columns_time = now() - t;
+
+	delete m;
+
+	std::printf("columns: %ld elements x %d iterations, %ld kB of columns built in %.3f s\n", elements, iterations, (long) bytes / 1024, build_time);
+	std::printf("  elements: %8.3f s  %12.0f elements/s\n", elements_time, elements * (double) iterations / elements_time);
+	std::printf("  columns:  %8.3f s  %12.0f elements/s  (%.2fx)\n", columns_time, elements * (double) iterations / columns_time, elements_time / columns_time);
+
+	if (mismatches) {
+		std::printf("  MISMATCH in %d written models\n", mismatches);
+		return 1;
+	}
+
+	if (std::abs(elements_sum - columns_sum) > 1e-3f * std::abs(elements_sum)) {
+		std::printf("  MISMATCH between traversal results\n");
+		return 1;
+	}
+
+	return 0;
+}
+
+/* Keeps every loaded copy alive so that peak RSS reflects the element
+ * storage, as it does for a part library. */
+/* The writer as it was: every value through operator<< and a flush per
+ * line. Geometry only, which is what large models consist of. */
+static void write_ostream(std::ostream &s, const ldraw::model *m)
+{
+	for (ldraw::model::const_iterator it = m->elements().begin(); it != m->elements().end(); ++it) {
+		const ldraw::element_base *e = *it;
+
+		switch (e->get_type()) {
+			case ldraw::type_ref: {
+				const ldraw::element_ref *r = CAST_AS_CONST_REF(e);
+				const ldraw::matrix &x = r->get_matrix();
+				s << "1 " << r->get_color().get_id() << " " << x.value(0, 3) << " " << x.value(1, 3) << " " << x.value(2, 3);
+				for (int i = 0; i < 9; ++i)
+					s << " " << x.value(i / 3, i % 3);
+				s << " " << r->filename() << std::endl;
+				break;
+			}
+			case ldraw::type_line:
+			case ldraw::type_triangle:
+			case ldraw::type_quadrilateral:
+			case ldraw::type_condline: {
+				const ldraw::element_colored_base *c = static_cast<const ldraw::element_colored_base *>(e);
+				const ldraw::vector *v[4];
+				int n;
+				if (e->get_type() == ldraw::type_line) {
+					const ldraw::element_line *l = CAST_AS_CONST_LINE(e);
+					v[0] = &l->pos1(), v[1] = &l->pos2(), n = 2;
+				} else if (e->get_type() == ldraw::type_triangle) {
+					const ldraw::element_triangle *l = CAST_AS_CONST_TRIANGLE(e);
+					v[0] = &l->pos1(), v[1] = &l->pos2(), v[2] = &l->pos3(), n = 3;
+				} else if (e->get_type() == ldraw::type_quadrilateral) {
+					const ldraw::element_quadrilateral *l = CAST_AS_CONST_QUADRILATERAL(e);
+					v[0] = &l->pos1(), v[1] = &l->pos2(), v[2] = &l->pos3(), v[3] = &l->pos4(), n = 4;
+				} else {
+					const ldraw::element_condline *l = CAST_AS_CONST_CONDLINE(e);
+					v[0] = &l->pos1(), v[1] = &l->pos2(), v[2] = &l->pos3(), v[3] = &l->pos4(), n = 4;
+				}
+				s << (int) e->get_type() << " " << c->get_color().get_id();
+				for (int i = 0; i < n; ++i)
+					s << " " << v[i]->x() << " " << v[i]->y() << " " << v[i]->z();
+				s << std::endl;
+				break;
+			}
+			default:
+				s << "0" << std::endl;
+		}
+	}
+}
+
+static int bench_writer(const std::string &path, int iterations)
+{
+	ldraw::reader r;
+	ldraw::model_multipart *m = r.load_from_file(path);
+	std::vector<const ldraw::model *> models;
+	double t, ostream_time, buffered_time, fd_time;
+	std::size_t bytes = 0;
+
+	models.push_back(m->main_model());
+	for (ldraw::model_multipart::submodel_const_iterator it = m->submodel_list().begin(); it != m->submodel_list().end(); ++it)
+		models.push_back((*it).second);
+
+	t = now();
+	for (int i = 0; i < iterations; ++i) {
+		std::ostringstream s;
+		for (std::vector<const ldraw::model *>::const_iterator it = models.begin(); it != models.end(); ++it)
+			write_ostream(s, *it);
+	}
+	ostream_time = now() - t;
+
+	std::string written;
+	t = now();
+	for (int i = 0; i < iterations; ++i) {
+		std::ostringstream s;
+		ldraw::writer w(s);
+		w.write(m);
+		if (i == 0)
+			written = s.str();
+	}
+	buffered_time = now() - t;
+	bytes = written.size();
+
+	int fd = open("/dev/null", O_WRONLY);
+	t = now();
+	for (int i = 0; i < iterations; ++i) {
+		ldraw::writer w(fd);
+		w.write(m);
+	}
+	fd_time = now() - t;
+	close(fd);
+
+	delete m;
+
+	double mb = bytes * (double) iterations / (1024.0 * 1024.0);
+
+	std::printf("writer: %ld bytes x %d iterations\n", (long) bytes, iterations);
+	std::printf("  ostream:  %8.3f s  %8.1f MB/s\n", ostream_time, mb / ostream_time);
+	std::printf("  buffered: %8.3f s  %8.1f MB/s  (%.2fx)\n", buffered_time, mb / buffered_time, ostream_time / buffered_time);
+	std::printf("  fd:       %8.3f s  %8.1f MB/s  (%.2fx)\n", fd_time, mb / fd_time, ostream_time / fd_time);
+
+	return 0;
+}
+
+static int bench_model(const std::string &path, int iterations)
+{
+	ldraw::reader r;
+	std::vector<ldraw::model_multipart *> models;
+	int lines = count_lines(path);
+	double t, load_time, traverse_time, free_time;
+	float sum = 0.0f;
+
+	t = now();
+	for (int i = 0; i < iterations; ++i)
+		models.push_back(r.load_from_file(path));
+	load_time = now() - t;
+
+	t = now();
+	for (int pass = 0; pass < 10; ++pass) {
+		for (std::vector<ldraw::model_multipart *>::const_iterator it = models.begin(); it != models.end(); ++it) {
+			sum += traverse((*it)->main_model());
+			for (ldraw::model_multipart::submodel_const_iterator sit = (*it)->submodel_list().begin(); sit != (*it)->submodel_list().end(); ++sit)
+				sum += traverse((*sit).second);
+		}
+	}
+	traverse_time = now() - t;
+
+	struct rusage ru;
+	getrusage(RUSAGE_SELF, &ru);
+
+	t = now();
+	for (std::vector<ldraw::model_multipart *>::iterator it = models.begin(); it != models.end(); ++it)
+		delete *it;
+	free_time = now() - t;
+
+	std::printf("model: %d lines x %d copies (checksum %g)\n", lines, iterations, sum);
+	std::printf("  load:     %8.3f s  %12.0f lines/s\n", load_time, lines * (double) iterations / load_time);
+	std::printf("  traverse: %8.3f s  %12.0f elements/s\n", traverse_time, lines * (double) iterations * 10 / traverse_time);
+	std::printf("  free:     %8.3f s\n", free_time);
+	std::printf("  peak RSS: %8ld kB\n", (long) ru.ru_maxrss);
+
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc < 2) {
+		std::cerr << "usage: " << argv[0] << " reader|writer|model|traverse|columns|link|budget|shared|cache|library|names|graph|metrics|math|bvh|picking|frustum|traits|normals|mesh [file] [iterations]" << std::endl;
+		return 1;
+	}
+
+	ldraw::color::init();
+
+	std::string test = argv[1];
+	std::string path;
+	int iterations = argc > 3 ? std::atoi(argv[3]) : 5;
+	bool generated = false;
+
+	if (argc > 2 && *argv[2]) {
+		path = argv[2];
+	} else if (test == "reader" || test == "writer" || test == "model" || test == "traverse" || test == "columns" || test == "normals") {
+		path = "benchmark_model.mpd";
+		std::ofstream out(path.c_str());
+		// normals wants one large submodel, as a collapsed buffer
+		out << (test == "normals" ? generate_model(2, 400000) : generate_model(100, 500));
+		generated = true;
+	}
+
+	int result = 1;
+	try {
+		if (test == "reader")
+			result = bench_reader(path, iterations);
+		else if (test == "writer")
+			result = bench_writer(path, iterations);
+		else if (test == "model")
+			result = bench_model(path, iterations);
+		else if (test == "traverse")
+			result = bench_traverse(path, iterations);
+		else if (test == "columns")
+			result = bench_columns(path, iterations);
+		else if (test == "link")
+			result = bench_link(path, iterations);
+		else if (test == "budget")
+			result = bench_budget(argc > 3 ? iterations : 500);
+		else if (test == "shared")
+			result = bench_shared(argc > 3 ? iterations : 200);
+		else if (test == "cache")
+			result = bench_cache(path, iterations);
+		else if (test == "library")
+			result = bench_library(iterations);
+		else if (test == "names")
+			result = bench_names(iterations);
+		else if (test == "graph")
+			result = bench_graph(argc > 3 ? iterations : 1000);
+		else if (test == "metrics")
+			result = bench_metrics(argc > 3 ? iterations : 5000);
+		else if (test == "math")
+			result = bench_math(argc > 3 ? iterations : 200);
+		else if (test == "bvh")
+			result = bench_bvh(argc > 3 ? iterations : 50000);
+		else if (test == "picking")
+			result = bench_picking(argc > 3 ? iterations : 50000);
+		else if (test == "frustum")
+			result = bench_frustum(argc > 3 ? iterations : 50000);
+		else if (test == "traits")
+			result = bench_traits(iterations);
+		else if (test == "normals")
+			result = bench_normals(path, iterations);
+		else if (test == "mesh")
+			result = bench_mesh(iterations);
+		else
+			std::cerr << "unknown test: " << test << std::endl;
+	} catch (const ldraw::exception &e) {
+		std::cerr << e.details() << std::endl;
+	}
+
+	if (generated)
+		std::remove(path.c_str());
+
+	return result;
+}
@@ -0,0 +1,234 @@
+#include <sys/time.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <libldr/bvh.h>
+#include <libldr/color.h>
+#include <libldr/elements.h>
+#include <libldr/model.h>
+
+#include "unit.h"
+
+static double now()
+{
+	timeval tv;
+	gettimeofday(&tv, 0L);
+
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+/* A grid of references to a brick, then a comment and a line */
+static std::string generate_grid(int side)
+{
+	std::ostringstream s;
+
+	s << "0 FILE main.ldr" << std::endl;
+	s << "0 Grid" << std::endl;
+	for (int i = 0; i < side * side; ++i)
+		s << "1 16 " << (i % side) * 40 << " 0 " << (i / side) * 40 << " 1 0 0 0 1 0 0 0 1 brick.ldr" << std::endl;
+	s << "0 a comment has no box" << std::endl;
+	s << "2 24 -100 0 -100 -90 0 -90" << std::endl;
+	s << "0 FILE brick.ldr" << std::endl;
+	s << "4 16 -10 0 -10 10 0 -10 10 0 10 -10 0 10" << std::endl;
+	s << "4 16 -10 -24 -10 10 -24 -10 10 -24 10 -10 -24 10" << std::endl;
+
+	return s.str();
+}
+
+static bool overlaps(const ldraw::vector &amin, const ldraw::vector &amax, const ldraw::vector &bmin, const ldraw::vector &bmax)
+{
+	for (int i = 0; i < 3; ++i) {
+		if (amax[i] < bmin[i] || amin[i] > bmax[i])
+			return false;
+	}
+
+	return true;
+}
+
+/* query_box() against a test of every element */
+static bool same_as_linear(ldraw::model *m, const ldraw::vector &min, const ldraw::vector &max)
+{
+	const ldraw::bvh *tree = m->custom_data<ldraw::bvh>();
+	std::vector<const ldraw::element_base *> linear, found;
+
+	for (ldraw::model::const_iterator it = m->elements().begin(); it != m->elements().end(); ++it) {
+		ldraw::vector bmin, bmax;
+		if (tree->bounds(*it, bmin, bmax) && overlaps(bmin, bmax, min, max))
+			linear.push_back(*it);
+	}
+
+	tree->query_box(min, max, found);
+	std::sort(linear.begin(), linear.end());
+	std::sort(found.begin(), found.end());
+
+	return linear == found;
+}
+
+/* index() of every element against its position */
+static bool indexed(ldraw::model *m)
+{
+	ldraw::bvh *tree = m->custom_data<ldraw::bvh>();
+
+	for (int i = 0; i < (int) m->elements().size(); ++i) {
+		ldraw::vector min, max;
+		int expected = tree->bounds(m->elements()[i], min, max) ? i : -1;
+
+		if (tree->index(m->elements()[i]) != expected)
+			return false;
+	}
+
+	return true;
+}
+
+static void test_queries()
+{
+	const int side = 10;
+	std::string text = generate_grid(side);
+	ldraw::model_multipart *mp = unit_load(text);
+	ldraw::model *main = mp->main_model();
+
+	main->update_custom_data<ldraw::bvh>();
+	ldraw::bvh *tree = main->custom_data<ldraw::bvh>();
+
+	/* References and the line, not the comment */
+	CHECK(tree->size() == side * side + 1);
+	CHECK(tree->height() <= 2 * (int) std::ceil(std::log2((float) tree->size())) + 1);
+
+	ldraw::vector min, max;
+	CHECK(!tree->bounds(main->elements()[side * side], min, max));
+	CHECK(tree->bounds(main->elements()[0], min, max));
+	CHECK(min.x() == -10.0f && max.x() == 10.0f && min.y() == -24.0f && max.y() == 0.0f);
+
+	CHECK(same_as_linear(main, ldraw::vector(50.0f, -5.0f, 50.0f), ldraw::vector(130.0f, 5.0f, 90.0f)));
+	CHECK(same_as_linear(main, ldraw::vector(-1000.0f, -1000.0f, -1000.0f), ldraw::vector(1000.0f, 1000.0f, 1000.0f)));
+	CHECK(same_as_linear(main, ldraw::vector(1000.0f, 0.0f, 0.0f), ldraw::vector(2000.0f, 0.0f, 0.0f)));
+
+	/* Down the column at x = 40: one brick per row, nearest first */
+	std::vector<ldraw::bvh::hit> hits;
+	tree->query_ray(ldraw::vector(40.0f, -12.0f, -1000.0f), ldraw::vector(0.0f, 0.0f, 1.0f), hits);
+	CHECK((int) hits.size() == side);
+	for (size_t i = 1; i < hits.size(); ++i)
+		CHECK(hits[i - 1].first <= hits[i].first);
+	if (!hits.empty())
+		CHECK(hits.front().second == main->elements()[1]);
+
+	/* The half-space x >= 0 leaves out the line only */
+	ldraw::bvh::plane plane = { ldraw::vector(1.0f, 0.0f, 0.0f), 0.0f };
+	std::vector<const ldraw::element_base *> found;
+	tree->query_frustum(&plane, 1, found);
+	CHECK((int) found.size() == side * side);
+	CHECK(std::find(found.begin(), found.end(), main->elements().back()) == found.end());
+
+	delete mp;
+}
+
+static void test_edits()
+{
+	const int side = 8;
+	std::string text = generate_grid(side);
+	ldraw::model_multipart *mp = unit_load(text);
+	ldraw::model *main = mp->main_model();
+
+	main->update_custom_data<ldraw::bvh>();
+	ldraw::bvh *tree = main->custom_data<ldraw::bvh>();
+	CHECK(indexed(main));
+
+	/* Moved a little, and far away */
+	for (int i = 0; i < side * side; i += 3) {
+		ldraw::element_ref *r = CAST_AS_REF(main->elements()[i]);
+		ldraw::matrix mat = r->get_matrix();
+		mat.set_translation_vector(mat.get_translation_vector() + ldraw::vector(i % 2 ? 5.0f : 5000.0f, 0.0f, 0.0f));
+		r->set_matrix(mat);
+		main->element_changed(r);
+
+		ldraw::vector min, max;
+		CHECK(tree->bounds(r, min, max));
+		CHECK(min.x() == mat.get_translation_vector().x() - 10.0f);
+	}
+	CHECK(same_as_linear(main, ldraw::vector(0.0f, -5.0f, 0.0f), ldraw::vector(200.0f, 5.0f, 200.0f)));
+	CHECK(same_as_linear(main, ldraw::vector(4000.0f, -5.0f, 0.0f), ldraw::vector(6000.0f, 5.0f, 400.0f)));
+
+	/* Insertions and deletions shift the indices */
+	main->insert_element(new ldraw::element_ref(ldraw::color(16), ldraw::matrix(), "brick.ldr"), 1);
+	CHECK(tree->size() == side * side + 2);
+	CHECK(indexed(main));
+
+	main->delete_element(5);
+	main->delete_element(5);
+	CHECK(tree->size() == side * side);
+	CHECK(indexed(main));
+
+	/* A row added one by one does not degenerate the tree */
+	for (int i = 0; i < 200; ++i) {
+		ldraw::matrix mat;
+		mat.set_translation_vector(ldraw::vector(1000.0f + i * 40.0f, 0.0f, 0.0f));
+		main->insert_element(new ldraw::element_ref(ldraw::color(16), mat, "brick.ldr"));
+	}
+	CHECK(tree->height() <= 2 * (int) std::ceil(std::log2((float) tree->size())) + 1);
+	CHECK(indexed(main));
+	CHECK(same_as_linear(main, ldraw::vector(2000.0f, -5.0f, -5.0f), ldraw::vector(3000.0f, 5.0f, 5.0f)));
+
+	main->clear();
+	CHECK(tree->size() == 0);
+
+	delete mp;
+}
+
+/* Adds count references along a row to the main model of text */
+static double insert_row(const std::string &text, int count, bool with_tree)
+{
+	ldraw::model_multipart *mp = unit_load(text);
+	ldraw::model *main = mp->main_model();
+
+	if (with_tree)
+		main->update_custom_data<ldraw::bvh>();
+
+	double t = now();
+	for (int i = 0; i < count; ++i) {
+		ldraw::matrix mat;
+		mat.set_translation_vector(ldraw::vector(i * 40.0f, 0.0f, 1000.0f));
+		main->insert_element(new ldraw::element_ref(ldraw::color(16), mat, "brick.ldr"));
+	}
+	t = now() - t;
+
+	if (with_tree) {
+		ldraw::bvh *tree = main->custom_data<ldraw::bvh>();
+		CHECK(tree->size() == count + 1 + 16);
+		CHECK(tree->height() <= 2 * (int) std::ceil(std::log2((float) tree->size())) + 1);
+		CHECK(same_as_linear(main, ldraw::vector(4000.0f, -5.0f, 990.0f), ldraw::vector(4400.0f, 5.0f, 1010.0f)));
+	}
+
+	delete mp;
+
+	return t;
+}
+
+/* Parts added one by one along a row, as when pasting, cost the tree about
+ * as much as the same parts added in random order: no rebuilds */
+static void test_row_insertion()
+{
+	const int count = 12000;
+	std::string text = generate_grid(4);
+
+	double without = insert_row(text, count, false);
+	double with = insert_row(text, count, true);
+	std::printf("row of %d references: %.3f s, %.3f s without a tree\n", count, with, without);
+
+	CHECK(with < 20.0 * without + 0.05);
+}
+
+int main()
+{
+	ldraw::color::init();
+
+	test_queries();
+	test_edits();
+	test_row_insertion();
+
+	return unit_result();
+}
@@ -0,0 +1,162 @@
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include <libldr/math.h>
+
+#include "unit.h"
+
+/* The products as the scalar code computes them */
+static ldraw::matrix multiply_scalar(const ldraw::matrix &a, const ldraw::matrix &b)
+{
+	ldraw::matrix n;
+
+	for (int i = 0; i < 4; i++) {
+		for (int j = 0; j < 4; j++) {
+			n.value(i, j) = 0.0f;
+			for (int k = 0; k < 4; k++)
+				n.value(i, j) += a.value(i, k) * b.value(k, j);
+		}
+	}
+
+	return n;
+}
+
+static ldraw::vector transform_scalar(const ldraw::matrix &m, const ldraw::vector &v)
+{
+	return ldraw::vector(
+		m.value(0, 0)*v.x() + m.value(0, 1)*v.y() + m.value(0, 2)*v.z() + m.value(0, 3)*v.w(),
+		m.value(1, 0)*v.x() + m.value(1, 1)*v.y() + m.value(1, 2)*v.z() + m.value(1, 3)*v.w(),
+		m.value(2, 0)*v.x() + m.value(2, 1)*v.y() + m.value(2, 2)*v.z() + m.value(2, 3)*v.w());
+}
+
+static float random_float(unsigned int &seed)
+{
+	seed = seed * 1103515245u + 12345u;
+
+	return (float) ((seed >> 8) % 20000) / 16.0f - 625.0f;
+}
+
+/* Rotations about y with a translation, as in references, and matrices
+ * with a last row of their own */
+static std::vector<ldraw::matrix> sample_matrices()
+{
+	std::vector<ldraw::matrix> result;
+	unsigned int seed = 4711;
+
+	for (int i = 0; i < 32; ++i) {
+		float a = i * 0.2f;
+		result.push_back(ldraw::matrix(std::cos(a), 0.0f, std::sin(a), 0.0f, 1.0f, 0.0f, -std::sin(a), 0.0f, std::cos(a), random_float(seed), random_float(seed), random_float(seed)));
+	}
+
+	for (int i = 0; i < 32; ++i) {
+		ldraw::matrix m;
+		for (int j = 0; j < 16; ++j)
+			m.value(j / 4, j % 4) = random_float(seed) / 625.0f;
+		result.push_back(m);
+	}
+
+	return result;
+}
+
+static bool same(const ldraw::matrix &a, const ldraw::matrix &b)
+{
+	for (int i = 0; i < 16; ++i) {
+		if (a.value(i / 4, i % 4) != b.value(i / 4, i % 4))
+			return false;
+	}
+
+	return true;
+}
+
+static bool same(const ldraw::vector &a, const ldraw::vector &b)
+{
+	return a.x() == b.x() && a.y() == b.y() && a.z() == b.z();
+}
+
+static void test_products()
+{
+	std::vector<ldraw::matrix> matrices = sample_matrices();
+
+	CHECK(matrices.front().is_affine());
+	CHECK(!matrices.back().is_affine());
+	CHECK(ldraw::vector().w() == 1.0f);
+
+	/* Affine by affine keeps the last row */
+	ldraw::matrix p = matrices[0] * matrices[1];
+	CHECK(p.is_affine());
+
+	for (size_t i = 0; i < matrices.size(); ++i) {
+		for (size_t j = 0; j < matrices.size(); j += 7)
+			CHECK(same(matrices[i] * matrices[j], multiply_scalar(matrices[i], matrices[j])));
+	}
+
+	/* Points and, for the projective matrices, vectors with w != 1 */
+	unsigned int seed = 1234;
+	for (size_t i = 0; i < matrices.size(); ++i) {
+		for (int j = 0; j < 64; ++j) {
+			float w = j % 2 ? 1.0f : random_float(seed) / 625.0f;
+			ldraw::vector v(random_float(seed), random_float(seed), random_float(seed), w);
+			CHECK(same(matrices[i] * v, transform_scalar(matrices[i], v)));
+		}
+	}
+}
+
+static void test_transform()
+{
+	std::vector<ldraw::matrix> matrices = sample_matrices();
+	const int count = 257;
+	std::vector<float> points(count * 3), out(count * 3);
+	unsigned int seed = 99;
+
+	for (int i = 0; i < count * 3; ++i)
+		points[i] = random_float(seed);
+
+	for (size_t i = 0; i < matrices.size(); ++i) {
+		if (!matrices[i].is_affine())
+			continue;
+
+		matrices[i].transform(&points[0], &out[0], count);
+
+		int mismatches = 0;
+		for (int j = 0; j < count; ++j) {
+			ldraw::vector v(points[j * 3], points[j * 3 + 1], points[j * 3 + 2]);
+			if (!same(ldraw::vector(out[j * 3], out[j * 3 + 1], out[j * 3 + 2]), transform_scalar(matrices[i], v)))
+				++mismatches;
+		}
+		CHECK(mismatches == 0);
+
+		/* In place, and nothing past the last point is written */
+		std::vector<float> copy(points);
+		copy.push_back(42.0f);
+		matrices[i].transform(&copy[0], &copy[0], count);
+		CHECK(std::equal(out.begin(), out.end(), copy.begin()));
+		CHECK(copy.back() == 42.0f);
+	}
+
+	/* No points */
+	matrices[0].transform(&points[0], &out[0], 0);
+}
+
+static void test_distance()
+{
+	unsigned int seed = 7;
+
+	for (int i = 0; i < 1000; ++i) {
+		ldraw::vector a(random_float(seed), random_float(seed), random_float(seed));
+		ldraw::vector b(random_float(seed), random_float(seed), random_float(seed));
+		double dx = a.x() - b.x(), dy = a.y() - b.y(), dz = a.z() - b.z();
+		double expected = std::sqrt(dx*dx + dy*dy + dz*dz);
+
+		CHECK(std::fabs(ldraw::vector::distance(a, b) - expected) <= expected * 1e-6);
+	}
+}
+
+int main()
+{
+	test_products();
+	test_transform();
+	test_distance();
+
+	return unit_result();
+}
@@ -0,0 +1,155 @@
+#include <sstream>
+#include <string>
+
+#include <libldr/color.h>
+#include <libldr/elements.h>
+#include <libldr/metrics.h>
+#include <libldr/model.h>
+
+#include "unit.h"
+
+/* A row of references to a brick, and the brick */
+static std::string generate_row(int refs)
+{
+	std::ostringstream s;
+
+	s << "0 FILE main.ldr" << std::endl;
+	for (int i = 0; i < refs; ++i)
+		s << "1 16 " << i * 40 << " 0 " << (i % 3) * 20 << " 1 0 0 0 1 0 0 0 1 brick.ldr" << std::endl;
+	s << "0 FILE brick.ldr" << std::endl;
+	s << "4 16 -20 0 -10 20 0 -10 20 0 10 -20 0 10" << std::endl;
+	s << "4 16 -20 -24 -10 20 -24 -10 20 -24 10 -20 -24 10" << std::endl;
+
+	return s.str();
+}
+
+/* The tracked box of m against one computed from scratch */
+static bool same_bounds(ldraw::model *m)
+{
+	ldraw::metrics full(m);
+	full.update();
+
+	const ldraw::metrics *tracked = m->custom_data<ldraw::metrics>();
+	for (int i = 0; i < 3; ++i) {
+		if (full.min_()[i] != tracked->min_()[i] || full.max_()[i] != tracked->max_()[i])
+			return false;
+	}
+
+	return true;
+}
+
+/* The element whose box reaches the maximum x of the model */
+static int extreme(ldraw::model *m)
+{
+	const ldraw::metrics *tracked = m->custom_data<ldraw::metrics>();
+	int result = -1;
+
+	for (int i = 0; i < (int) m->elements().size(); ++i) {
+		ldraw::vector min, max;
+		if (tracked->element_bounds(m->elements()[i], min, max) && max.x() == tracked->max_().x())
+			result = i;
+	}
+
+	return result;
+}
+
+static void test_edits()
+{
+	std::string text = generate_row(20);
+	ldraw::model_multipart *mp = unit_load(text);
+	ldraw::model *main = mp->main_model();
+
+	main->init_custom_data<ldraw::metrics>()->track();
+	CHECK(same_bounds(main));
+
+	/* Moved */
+	ldraw::element_ref *r = CAST_AS_REF(main->elements()[5]);
+	ldraw::matrix mat = r->get_matrix();
+	mat.set_translation_vector(ldraw::vector(-500.0f, 100.0f, 0.0f));
+	r->set_matrix(mat);
+	main->element_changed(r);
+	CHECK(same_bounds(main));
+	CHECK(main->custom_data<ldraw::metrics>()->min_().x() == -520.0f);
+
+	/* The element on the boundary removed, then put back */
+	for (int i = 0; i < 6; ++i) {
+		int e = extreme(main);
+		CHECK(e >= 0);
+		if (e < 0)
+			break;
+
+		std::string filename = CAST_AS_REF(main->elements()[e])->filename();
+		mat = CAST_AS_REF(main->elements()[e])->get_matrix();
+		main->delete_element(e);
+		CHECK(same_bounds(main));
+
+		if (i % 2) {
+			main->insert_element(new ldraw::element_ref(ldraw::color(16), mat, filename), e);
+			CHECK(same_bounds(main));
+		}
+	}
+
+	/* Elements without an extent have no bounds */
+	main->insert_element(new ldraw::element_comment("comment"));
+	ldraw::vector min, max;
+	CHECK(!main->custom_data<ldraw::metrics>()->element_bounds(main->elements().back(), min, max));
+	CHECK(same_bounds(main));
+
+	delete mp;
+}
+
+static void test_propagation()
+{
+	std::string text = generate_row(10);
+	ldraw::model_multipart *mp = unit_load(text);
+	ldraw::model *main = mp->main_model();
+	ldraw::model *brick = mp->find_submodel("brick.ldr");
+
+	main->init_custom_data<ldraw::metrics>()->track();
+	brick->init_custom_data<ldraw::metrics>()->track();
+	const ldraw::metrics *tracked = main->custom_data<ldraw::metrics>();
+
+	/* An edit of the submodel reaches the box of the main model */
+	float top = tracked->max_().y();
+	ldraw::vector far(0.0f, top + 1000.0f, 0.0f);
+	brick->insert_element(new ldraw::element_line(ldraw::color(24), far, far));
+	CHECK(same_bounds(brick));
+	CHECK(same_bounds(main));
+	CHECK(tracked->max_().y() == top + 1000.0f);
+
+	brick->delete_element();
+	CHECK(same_bounds(brick));
+	CHECK(same_bounds(main));
+	CHECK(tracked->max_().y() == top);
+
+	/* Within a batch the main model is told once, as it ends */
+	{
+		ldraw::model_multipart::batch b(mp);
+		CHECK(mp->is_batching());
+
+		brick->insert_element(new ldraw::element_line(ldraw::color(24), far, far));
+		brick->delete_element(0);
+		brick->delete_element(0);
+	}
+	CHECK(!mp->is_batching());
+	CHECK(same_bounds(brick));
+	CHECK(same_bounds(main));
+	CHECK(tracked->max_().y() == top + 1000.0f);
+
+	/* Emptied */
+	brick->clear();
+	CHECK(same_bounds(brick));
+	CHECK(same_bounds(main));
+
+	delete mp;
+}
+
+int main()
+{
+	ldraw::color::init();
+
+	test_edits();
+	test_propagation();
+
+	return unit_result();
+}
@@ -0,0 +1,165 @@
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+#include <libldr/color.h>
+#include <libldr/model.h>
+#include <libldr/part_cache.h>
+#include <libldr/reader.h>
+#include <libldr/writer.h>
+
+#include "unit.h"
+
+/* Every kind of line, headers and a submodel */
+static const char *text =
+	"0 FILE main.ldr\n"
+	"0 Cached model\n"
+	"0 Name: main.ldr\n"
+	"0 Author: test\n"
+	"0 BFC CERTIFY CCW\n"
+	"0 STEP\n"
+	"1 4 10 -24 0.5 1 0 0 0 1 0 0 0 1 sub.ldr\n"
+	"2 24 0 0 0 1.25 -2 3\n"
+	"3 16 0 0 0 1 0 0 0 0 1\n"
+	"4 1 0 0 0 1 0 0 1 1 0 0 1 0\n"
+	"5 24 0 0 0 0 -4 0 1 0 0 -1 0 0\n"
+	"0 FILE sub.ldr\n"
+	"0 Name: sub.ldr\n"
+	"0 BFC INVERTNEXT\n"
+	"3 16 0.1 0.2 0.3 1 0 0 0 0 1\n";
+
+static std::string serialize(const ldraw::model_multipart *m)
+{
+	std::ostringstream s;
+	ldraw::writer w(s);
+	w.write(m);
+
+	return s.str();
+}
+
+static void write_file(const std::string &path, const std::string &content)
+{
+	std::ofstream out(path.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+	out << content;
+}
+
+static void set_mtime(const std::string &path, time_t sec, long nsec)
+{
+	timespec times[2];
+	times[0].tv_sec = times[1].tv_sec = sec;
+	times[0].tv_nsec = times[1].tv_nsec = nsec;
+
+	utimensat(AT_FDCWD, path.c_str(), times, 0);
+}
+
+/* Stamps, parses and stores source, as part_library does */
+static bool parse_and_store(const ldraw::part_cache &cache, const std::string &source, ldraw::model_multipart **m)
+{
+	ldraw::part_cache::stamp s;
+	ldraw::reader r;
+
+	if (!ldraw::part_cache::source_stamp(source, &s))
+		return false;
+
+	*m = r.load_from_file(source);
+
+	return cache.store(source, *m, s);
+}
+
+int main()
+{
+	ldraw::color::init();
+
+	char dir[] = "/tmp/part_cache_XXXXXX";
+	CHECK(mkdtemp(dir) != 0L);
+
+	std::string source = std::string(dir) + "/main.mpd";
+	write_file(source, text);
+
+	ldraw::part_cache cache(std::string(dir) + "/cache");
+	mkdir(cache.path().c_str(), 0755);
+
+	time_t past = std::time(0L) - 10;
+
+	/* No entry yet */
+	CHECK(cache.load(source) == 0L);
+
+	/* Nothing is stored for a source modified just now */
+	ldraw::model_multipart *m;
+	CHECK(!parse_and_store(cache, source, &m));
+	CHECK(cache.load(source) == 0L);
+	delete m;
+
+	set_mtime(source, past, 500);
+	CHECK(parse_and_store(cache, source, &m));
+	CHECK(m != 0L);
+
+	/* What is read back is written exactly as the parsed text */
+	ldraw::model_multipart *c = cache.load(source);
+	CHECK(c != 0L);
+	if (c) {
+		CHECK(serialize(c) == serialize(m));
+		CHECK(c->count() == 1);
+		CHECK(c->main_model()->desc() == m->main_model()->desc());
+		CHECK(c->main_model()->author() == m->main_model()->author());
+
+		const ldraw::model *sub = c->find_submodel("sub.ldr");
+		CHECK(sub != 0L);
+		CHECK(c->referrers(sub).size() == 1);
+	}
+	delete c;
+
+	/* A rewrite within the same second at the same size makes the entry
+	 * out of date */
+	set_mtime(source, past, 600);
+	CHECK(cache.load(source) == 0L);
+	set_mtime(source, past, 500);
+	CHECK((c = cache.load(source)) != 0L);
+	delete c;
+
+	/* As does a changed source */
+	write_file(source, std::string(text) + "2 24 0 0 0 1 1 1\n");
+	set_mtime(source, past, 500);
+	CHECK(cache.load(source) == 0L);
+
+	/* An edit while the source is parsed leaves the entry out of date */
+	ldraw::part_cache::stamp before;
+	CHECK(ldraw::part_cache::source_stamp(source, &before));
+	ldraw::reader r;
+	ldraw::model_multipart *changed = r.load_from_file(source);
+	set_mtime(source, past + 5, 0);
+	CHECK(cache.store(source, changed, before));
+	CHECK(cache.load(source) == 0L);
+
+	/* As does a truncated cache file */
+	ldraw::part_cache::stamp after;
+	CHECK(ldraw::part_cache::source_stamp(source, &after));
+	CHECK(cache.store(source, changed, after));
+	CHECK((c = cache.load(source)) != 0L);
+	delete c;
+	CHECK(truncate(cache.filename(source).c_str(), 40) == 0);
+	CHECK(cache.load(source) == 0L);
+
+	/* A disabled cache keeps nothing */
+	ldraw::part_cache disabled;
+	CHECK(!disabled.is_enabled());
+	CHECK(!disabled.store(source, changed, after));
+	CHECK(disabled.load(source) == 0L);
+
+	delete changed;
+	delete m;
+
+	std::remove(cache.filename(source).c_str());
+	rmdir(cache.path().c_str());
+	std::remove(source.c_str());
+	rmdir(dir);
+
+	return unit_result();
+}
@@ -0,0 +1,120 @@
+#include <algorithm>
+#include <list>
+#include <unordered_set>
+
+#include <libldr/color.h>
+#include <libldr/elements.h>
+#include <libldr/model.h>
+
+#include "unit.h"
+
+/* main -> a twice, main -> b, a -> b */
+static const char *text =
+	"0 FILE main.ldr\n"
+	"1 16 0 0 0 1 0 0 0 1 0 0 0 1 a.ldr\n"
+	"1 4 40 0 0 1 0 0 0 1 0 0 0 1 a.ldr\n"
+	"1 16 0 0 0 1 0 0 0 1 0 0 0 1 b.ldr\n"
+	"0 FILE a.ldr\n"
+	"1 16 0 -24 0 1 0 0 0 1 0 0 0 1 b.ldr\n"
+	"2 24 0 0 0 1 0 0\n"
+	"0 FILE b.ldr\n"
+	"2 24 0 0 0 1 0 0\n";
+
+/* The references to m, found by searching every model */
+static std::unordered_set<ldraw::element_ref *> search(ldraw::model_multipart *mp, const ldraw::model *m)
+{
+	std::unordered_set<ldraw::element_ref *> result;
+	std::list<ldraw::model *> models(1, mp->main_model());
+
+	for (ldraw::model_multipart::submodel_iterator it = mp->submodel_list().begin(); it != mp->submodel_list().end(); ++it)
+		models.push_back((*it).second);
+
+	for (std::list<ldraw::model *>::const_iterator it = models.begin(); it != models.end(); ++it) {
+		for (ldraw::model::const_iterator eit = (*it)->elements().begin(); eit != (*it)->elements().end(); ++eit) {
+			if ((*eit)->get_type() == ldraw::type_ref && CAST_AS_REF(*eit)->get_model() == m)
+				result.insert(CAST_AS_REF(*eit));
+		}
+	}
+
+	return result;
+}
+
+static bool indexed(ldraw::model_multipart *mp, const ldraw::model *m)
+{
+	return mp->referrers(m) == search(mp, m);
+}
+
+static void test_links()
+{
+	ldraw::model_multipart *mp = unit_load(text);
+	ldraw::model *main = mp->main_model();
+	ldraw::model *a = mp->find_submodel("a.ldr"), *b = mp->find_submodel("b.ldr");
+
+	CHECK(mp->referrers(a).size() == 2);
+	CHECK(mp->referrers(b).size() == 2);
+	CHECK(mp->referrers(main).empty());
+	CHECK(indexed(mp, a) && indexed(mp, b));
+
+	std::list<ldraw::model *> models = mp->referencing_models(b);
+	CHECK(models.size() == 2);
+	CHECK(std::find(models.begin(), models.end(), a) != models.end());
+	CHECK(std::find(models.begin(), models.end(), main) != models.end());
+
+	/* Edits */
+	main->delete_element(0);
+	CHECK(mp->referrers(a).size() == 1);
+	CHECK(indexed(mp, a));
+
+	a->insert_element(new ldraw::element_ref(ldraw::color(16), ldraw::matrix(), "b.ldr"));
+	CHECK(mp->referrers(b).size() == 3);
+	CHECK(indexed(mp, b));
+
+	CAST_AS_REF(main->elements()[0])->set_filename("b.ldr");
+	CHECK(mp->referrers(a).empty());
+	CHECK(mp->referrers(b).size() == 4);
+	CHECK(indexed(mp, a) && indexed(mp, b));
+
+	/* A reference to nothing is in no index */
+	CAST_AS_REF(main->elements()[0])->set_filename("missing.ldr");
+	CHECK(CAST_AS_REF(main->elements()[0])->get_model() == 0L);
+	CHECK(indexed(mp, b));
+
+	a->clear();
+	CHECK(mp->referrers(b).size() == 1);
+	CHECK(indexed(mp, b));
+
+	delete mp;
+}
+
+static void test_rename()
+{
+	ldraw::model_multipart *mp = unit_load(text);
+	ldraw::model *a = mp->find_submodel("a.ldr"), *b = mp->find_submodel("b.ldr");
+
+	CHECK(mp->rename_submodel("b.ldr", "renamed.ldr"));
+	CHECK(mp->find_submodel("renamed.ldr") == b);
+	CHECK(mp->find_submodel("b.ldr") == 0L);
+	CHECK(b->name() == "renamed.ldr");
+	CHECK(indexed(mp, b));
+
+	const std::unordered_set<ldraw::element_ref *> &refs = mp->referrers(b);
+	CHECK(refs.size() == 2);
+	for (std::unordered_set<ldraw::element_ref *>::const_iterator it = refs.begin(); it != refs.end(); ++it)
+		CHECK((*it)->filename() == "renamed.ldr");
+
+	/* The other submodel is untouched */
+	CHECK(mp->referrers(a).size() == 2);
+	CHECK(indexed(mp, a));
+
+	delete mp;
+}
+
+int main()
+{
+	ldraw::color::init();
+
+	test_links();
+	test_rename();
+
+	return unit_result();
+}
@@ -0,0 +1,100 @@
+#include <set>
+#include <vector>
+
+#include <libldr/color.h>
+#include <libldr/elements.h>
+#include <libldr/model.h>
+#include <libldr/slab.h>
+
+#include "unit.h"
+
+static const char *text =
+	"0 FILE main.ldr\n"
+	"0 Main\n"
+	"1 16 0 0 0 1 0 0 0 1 0 0 0 1 a.ldr\n"
+	"0 // comment\n"
+	"2 24 0 0 0 1 0 0\n"
+	"3 16 0 0 0 1 0 0 0 1 0\n"
+	"0 FILE a.ldr\n"
+	"4 16 0 0 0 1 0 0 1 1 0 0 1 0\n"
+	"5 24 0 0 0 1 0 0 0 1 0 0 -1 0\n";
+
+static void test_slots()
+{
+	ldraw::slab s(sizeof(ldraw::element_triangle));
+	std::vector<void *> slots;
+
+	for (int i = 0; i < 1000; ++i)
+		slots.push_back(s.allocate());
+
+	/* Distinct and each owned */
+	CHECK(std::set<void *>(slots.begin(), slots.end()).size() == slots.size());
+	for (int i = 0; i < 1000; ++i)
+		CHECK(s.owns(slots[i]));
+
+	int outside;
+	CHECK(!s.owns(&outside));
+	CHECK(s.reserved() >= 1000 * sizeof(ldraw::element_triangle));
+
+	/* Freed slots are handed out again */
+	s.free(slots[10]);
+	s.free(slots[500]);
+	void *a = s.allocate(), *b = s.allocate();
+	CHECK((a == slots[10] && b == slots[500]) || (a == slots[500] && b == slots[10]));
+
+	s.release();
+	CHECK(s.reserved() == 0);
+	CHECK(!s.owns(slots[0]));
+}
+
+static void test_model()
+{
+	ldraw::model_multipart *mp = unit_load(text);
+	ldraw::model *main = mp->main_model();
+	ldraw::model *a = mp->find_submodel("a.ldr");
+
+	CHECK(a && main->size() == 4 && a->size() == 2);
+	CHECK(ldraw::element_cast<ldraw::element_ref>(main->at(0))->get_model() == a);
+
+	/* Made by a model and on the heap, side by side */
+	main->insert_element(main->new_element<ldraw::element_line>(ldraw::color(4), ldraw::vector(), ldraw::vector(0.0f, 1.0f, 0.0f)));
+	main->insert_element(new ldraw::element_line(ldraw::color(4), ldraw::vector(), ldraw::vector(0.0f, 0.0f, 1.0f)));
+	main->insert_element(main->new_element<ldraw::element_comment>("heap"));
+	CHECK(main->size() == 7);
+
+	CHECK(main->delete_element(5));
+	CHECK(main->delete_element(1));
+	CHECK(main->size() == 5);
+
+	/* A freed slot is reused */
+	ldraw::element_quadrilateral *q = a->new_element<ldraw::element_quadrilateral>(ldraw::color(1), ldraw::vector(), ldraw::vector(), ldraw::vector(), ldraw::vector());
+	a->insert_element(q);
+	a->delete_element();
+	CHECK(a->new_element<ldraw::element_quadrilateral>(ldraw::color(1), ldraw::vector(), ldraw::vector(), ldraw::vector(), ldraw::vector()) == q);
+	a->insert_element(q);
+
+	/* Removing a submodel frees its elements into the slabs */
+	CHECK(main->delete_element(0));
+	CHECK(mp->remove_submodel("a.ldr"));
+
+	/* clear() gives the slabs back at once */
+	mp->clear();
+	CHECK(main->size() == 0);
+	delete mp;
+
+	/* A model without a parent makes them on the heap */
+	ldraw::model *m = new ldraw::model();
+	m->insert_element(m->new_element<ldraw::element_triangle>(ldraw::color(16), ldraw::vector(), ldraw::vector(), ldraw::vector()));
+	CHECK(m->size() == 1);
+	delete m;
+}
+
+int main()
+{
+	ldraw::color::init();
+
+	test_slots();
+	test_model();
+
+	return unit_result();
+}
@@ -0,0 +1,140 @@
+#include <algorithm>
+#include <list>
+#include <vector>
+
+#include <libldr/color.h>
+#include <libldr/elements.h>
+#include <libldr/model.h>
+#include <libldr/utils.h>
+
+#include "unit.h"
+
+/* main -> a -> b -> c, and main -> c */
+static const char *chain =
+	"0 FILE main.ldr\n"
+	"1 16 0 0 0 1 0 0 0 1 0 0 0 1 a.ldr\n"
+	"1 16 0 0 0 1 0 0 0 1 0 0 0 1 c.ldr\n"
+	"0 FILE a.ldr\n"
+	"1 16 0 0 0 1 0 0 0 1 0 0 0 1 b.ldr\n"
+	"0 FILE b.ldr\n"
+	"1 16 0 0 0 1 0 0 0 1 0 0 0 1 c.ldr\n"
+	"0 FILE c.ldr\n"
+	"2 24 0 0 0 1 0 0\n";
+
+static int position(const std::vector<const ldraw::model *> &order, const ldraw::model *m)
+{
+	std::vector<const ldraw::model *>::const_iterator it = std::find(order.begin(), order.end(), m);
+
+	return it == order.end() ? -1 : it - order.begin();
+}
+
+/* Every model ahead of the ones it references */
+static bool is_ordered(const ldraw::model_multipart *mp)
+{
+	std::vector<const ldraw::model *> order = mp->dependency_order();
+
+	if ((int) order.size() != mp->count() + 1)
+		return false;
+
+	for (std::vector<const ldraw::model *>::const_iterator it = order.begin(); it != order.end(); ++it) {
+		for (ldraw::model::const_iterator eit = (*it)->elements().begin(); eit != (*it)->elements().end(); ++eit) {
+			if ((*eit)->get_type() != ldraw::type_ref)
+				continue;
+
+			const ldraw::model *target = CAST_AS_CONST_REF(*eit)->get_model();
+			if (target && position(order, target) <= position(order, *it))
+				return false;
+		}
+	}
+
+	return true;
+}
+
+static void test_order()
+{
+	ldraw::model_multipart *mp = unit_load(chain);
+	ldraw::model *c = mp->find_submodel("c.ldr");
+
+	CHECK(!mp->is_cyclic());
+	CHECK(is_ordered(mp));
+	CHECK(position(mp->dependency_order(), mp->main_model()) == 0);
+
+	/* A new submodel referenced from the end of the chain */
+	ldraw::model *d = new ldraw::model("d", "d.ldr", "", mp);
+	d->insert_element(new ldraw::element_line(ldraw::color(24), ldraw::vector(), ldraw::vector(1.0f, 0.0f, 0.0f)));
+	CHECK(mp->insert_submodel(d));
+	c->insert_element(new ldraw::element_ref(ldraw::color(16), ldraw::matrix(), "d.ldr"));
+	CHECK(is_ordered(mp));
+	CHECK(position(mp->dependency_order(), d) > position(mp->dependency_order(), c));
+
+	/* Referenced models cannot be removed, unreferenced ones can */
+	CHECK(!mp->remove_submodel(d));
+	c->delete_element();
+	CHECK(mp->remove_submodel(d));
+	CHECK(is_ordered(mp));
+
+	delete mp;
+}
+
+static void test_cycles()
+{
+	ldraw::model_multipart *mp = unit_load(chain);
+	ldraw::model *main = mp->main_model();
+	ldraw::model *a = mp->find_submodel("a.ldr"), *b = mp->find_submodel("b.ldr"), *c = mp->find_submodel("c.ldr");
+
+	CHECK(mp->creates_cycle(c, a));
+	CHECK(mp->creates_cycle(c, main));
+	CHECK(mp->creates_cycle(b, b));
+	CHECK(!mp->creates_cycle(a, c));
+	CHECK(!mp->creates_cycle(main, b));
+
+	/* The graph agrees with a walk of the references */
+	CHECK(mp->creates_cycle(c, a) == ldraw::utils::cyclic_reference_test(c, a));
+	CHECK(mp->creates_cycle(a, c) == ldraw::utils::cyclic_reference_test(a, c));
+
+	/* Closing the chain, then opening it again */
+	c->insert_element(new ldraw::element_ref(ldraw::color(16), ldraw::matrix(), "a.ldr"));
+	CHECK(mp->is_cyclic());
+	CHECK(mp->dependency_order().empty());
+
+	c->delete_element();
+	CHECK(!mp->is_cyclic());
+	CHECK(is_ordered(mp));
+
+	/* Relinking a reference moves its edge */
+	ldraw::element_ref *r = CAST_AS_REF(b->elements().front());
+	r->set_filename("a.ldr");
+	CHECK(mp->is_cyclic());
+	r->set_filename("c.ldr");
+	CHECK(!mp->is_cyclic());
+
+	delete mp;
+}
+
+static void test_affected()
+{
+	ldraw::model_multipart *mp = unit_load(chain);
+	ldraw::model *a = mp->find_submodel("a.ldr"), *b = mp->find_submodel("b.ldr"), *c = mp->find_submodel("c.ldr");
+
+	std::list<ldraw::model *> affected = ldraw::utils::affected_models(mp, c);
+	CHECK(affected.size() == 3);
+	CHECK(std::find(affected.begin(), affected.end(), a) != affected.end());
+	CHECK(std::find(affected.begin(), affected.end(), b) != affected.end());
+	CHECK(std::find(affected.begin(), affected.end(), mp->main_model()) != affected.end());
+
+	affected = ldraw::utils::affected_models(mp, a);
+	CHECK(affected.size() == 1 && affected.front() == mp->main_model());
+
+	delete mp;
+}
+
+int main()
+{
+	ldraw::color::init();
+
+	test_order();
+	test_cycles();
+	test_affected();
+
+	return unit_result();
+}
@@ -0,0 +1,179 @@
+#include <unistd.h>
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <libldr/color.h>
+#include <libldr/elements.h>
+#include <libldr/model.h>
+#include <libldr/reader.h>
+#include <libldr/writer.h>
+
+#include "unit.h"
+
+static std::string serialize(const ldraw::model_multipart *m)
+{
+	std::ostringstream s;
+	ldraw::writer w(s);
+	w.write(m);
+
+	return s.str();
+}
+
+/* LDraw-like values and arbitrary bit patterns within the range the
+ * writer prints without an exponent */
+static std::vector<float> sample_floats(int count)
+{
+	std::vector<float> result;
+	unsigned int seed = 12345;
+
+	while ((int) result.size() < count) {
+		float f;
+		seed = seed * 1103515245u + 12345u;
+
+		if (result.size() % 2) {
+			unsigned int bits = seed ^ (seed >> 7);
+			std::memcpy(&f, &bits, sizeof(f));
+			if (!std::isfinite(f) || std::fabs(f) > 1e30f || (f != 0.0f && std::fabs(f) < 1e-30f))
+				continue;
+		} else {
+			f = (int) (seed % 2000001 - 1000000) / 10000.0f;
+		}
+
+		result.push_back(f);
+	}
+
+	return result;
+}
+
+/* format_float() reads back through strtof() */
+static void test_format()
+{
+	std::vector<float> values = sample_floats(100000);
+	int failures = 0;
+
+	values.push_back(0.0f);
+	values.push_back(-0.0f);
+	values.push_back(1.0f / 3.0f);
+	values.push_back(16777217.0f);
+	values.push_back(1e-7f);
+
+	for (std::vector<float>::const_iterator it = values.begin(); it != values.end(); ++it) {
+		char buf[32];
+		int len = ldraw::writer::format_float(*it, buf);
+		buf[len] = '\0';
+
+		if (std::strtof(buf, 0L) != *it && ++failures <= 5)
+			std::printf("%.9g written as %s\n", *it, buf);
+	}
+
+	CHECK(failures == 0);
+
+	char buf[32];
+	buf[ldraw::writer::format_float(1.5f, buf)] = '\0';
+	CHECK(std::string(buf) == "1.5");
+	buf[ldraw::writer::format_float(-24.0f, buf)] = '\0';
+	CHECK(std::string(buf) == "-24");
+}
+
+/* A model of lines through the sample values, written and read back by
+ * both readers to the same floats */
+static void test_round_trip()
+{
+	std::vector<float> values = sample_floats(6000);
+	ldraw::model_multipart mp;
+	ldraw::model *m = mp.main_model();
+
+	m->set_name("main.ldr");
+	m->set_desc("Round trip");
+	m->set_author("test");
+
+	for (size_t i = 0; i + 6 <= values.size(); i += 6) {
+		ldraw::vector a(values[i], values[i + 1], values[i + 2]), b(values[i + 3], values[i + 4], values[i + 5]);
+		m->insert_element(new ldraw::element_line(ldraw::color(24), a, b));
+	}
+
+	ldraw::matrix mat;
+	mat.set_translation_vector(ldraw::vector(0.1f, -0.2f, 1234.5678f));
+	mat.value(0, 0) = 0.7071068f;
+	m->insert_element(new ldraw::element_ref(ldraw::color(4), mat, "sub.ldr"));
+
+	std::string written = serialize(&mp);
+
+	std::istringstream stream(written);
+	ldraw::model_multipart *streamed = ldraw::reader::load_from_stream(stream, "main.ldr");
+	ldraw::model_multipart *buffered = ldraw::reader::load_from_buffer(written.data(), written.size(), "main.ldr");
+	ldraw::model_multipart *read[] = { streamed, buffered };
+
+	for (int r = 0; r < 2; ++r) {
+		const ldraw::model *n = read[r]->main_model();
+
+		CHECK(serialize(read[r]) == written);
+		CHECK(n->desc() == m->desc());
+		CHECK(n->elements().size() == m->elements().size());
+		if (n->elements().size() != m->elements().size())
+			continue;
+
+		int mismatches = 0;
+		for (size_t i = 0; i + 1 < m->elements().size(); ++i) {
+			const ldraw::element_line *a = CAST_AS_CONST_LINE(m->elements()[i]), *b = CAST_AS_CONST_LINE(n->elements()[i]);
+
+			for (int j = 0; j < 3; ++j) {
+				if (a->pos1()[j] != b->pos1()[j] || a->pos2()[j] != b->pos2()[j])
+					++mismatches;
+			}
+		}
+		CHECK(mismatches == 0);
+
+		const ldraw::element_ref *ref = CAST_AS_CONST_REF(n->elements().back());
+		CHECK(ref->filename() == "sub.ldr");
+		CHECK(ref->get_color().get_id() == 4);
+		for (int j = 0; j < 16; ++j)
+			CHECK(ref->get_matrix().value(j / 4, j % 4) == mat.value(j / 4, j % 4));
+	}
+
+	delete streamed;
+	delete buffered;
+}
+
+/* Writing to a descriptor, the output of nested writes comes out whole */
+static void test_flush()
+{
+	char name[] = "/tmp/writer_XXXXXX";
+	int fd = mkstemp(name);
+	CHECK(fd >= 0);
+
+	ldraw::model_multipart mp;
+	mp.main_model()->insert_element(new ldraw::element_line(ldraw::color(24), ldraw::vector(), ldraw::vector(1.0f, 2.0f, 3.0f)));
+
+	{
+		ldraw::writer w(fd);
+		w.write(&mp);
+		w.write(mp.main_model()->elements().front());
+	}
+	close(fd);
+
+	std::ifstream in(name);
+	std::string content((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+	CHECK(content == serialize(&mp) + "2 24 0 0 0 1 2 3\n");
+
+	std::remove(name);
+}
+
+int main()
+{
+	ldraw::color::init();
+
+	test_format();
+	test_round_trip();
+	test_flush();
+
+	return unit_result();
+}
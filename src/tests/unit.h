@@ -0,0 +1,38 @@
+#ifndef _TESTS_UNIT_H_
+#define _TESTS_UNIT_H_
+
+#include <cstdio>
+#include <string>
+
+#include <libldr/model.h>
+#include <libldr/reader.h>
+
+/* Checks shared by the unit tests, which ctest runs. A failed CHECK() is
+ * reported with its line and counted; main() returns unit_result(). */
+
+static int unit_failures = 0;
+
+#define CHECK(cond) \
+	do { \
+		if (!(cond)) { \
+			std::printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+			++unit_failures; \
+		} \
+	} while (0)
+
+static inline int unit_result()
+{
+	if (unit_failures)
+		std::printf("%d checks failed\n", unit_failures);
+
+	return unit_failures ? 1 : 0;
+}
+
+/* A multipart model from LDraw text; every reference must be to one of
+ * its submodels, as there is no part library */
+static inline ldraw::model_multipart* unit_load(const std::string &text)
+{
+	return ldraw::reader::load_from_buffer(text.data(), text.size(), "main.ldr");
+}
+
+#endif